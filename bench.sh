@@ -0,0 +1,271 @@
+#!/bin/sh
+#
+# CDDL HEADER START
+#
+# The contents of this file are subject to the terms of the
+# Common Development and Distribution License (the "License").
+# You may not use this file except in compliance with the License.
+#
+# You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+# or http://www.opensolaris.org/os/licensing.
+# See the License for the specific language governing permissions
+# and limitations under the License.
+#
+# When distributing Covered Code, include this CDDL HEADER in each
+# file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+# If applicable, add the following below this CDDL HEADER, with the
+# fields enclosed by brackets "[]" replaced with your own identifying
+# information: Portions Copyright [yyyy] [name of copyright owner]
+#
+# CDDL HEADER END
+#
+# Installer for Schillix
+# (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+#
+# End to end timing of an install on Linux.  The installer is built
+# against the stand-in libraries in stub/, a fake livecd is made up and
+# installed onto sparse disk images, and the per-phase durations the
+# installer reports are printed along with the total and how much the
+# page cache grew.  -c starts from a cold page cache (needs root); try
+# it with "-- -C keep" and "-- -C drop" to see what dropping saves.
+# -u pct goes on to time an upgrade of the installed pool to a point
+# release of the livecd with pct percent of its files changed, and -r
+# times resetting the pool to its @installed snapshots afterwards.
+# -m dvd, usb2 or nvme reads the livecd as though it were on that media
+# (see stub/slowio.c); SLOWIO_* in the environment fine tune it.
+# -i installs from a Rock Ridge image of the livecd made with $MKISOFS
+# (mkisofs by default) instead of the directory.  The installer maps
+# the image, which -m can't slow down, so with -m it's given -I to read
+# the files out of it with pread instead.  Directory records are still
+# read through the mapping at full speed.
+#
+
+usage ()
+{
+	echo "usage: bench.sh [-c] [-d disks] [-s disk size] [-n files] [-k KB per file] [-w workdir] [-u pct] [-r] [-m media] [-i] [-- installer opts]" >&2
+	exit 1
+}
+
+ndisks=1
+size=4G
+nfiles=2000
+kbytes=64
+work=
+cold=
+upgrade=
+reset=
+media=
+image=
+
+while getopts cd:s:n:k:w:u:rm:i opt; do
+	case $opt in
+	c) cold=1 ;;
+	d) ndisks=$OPTARG ;;
+	s) size=$OPTARG ;;
+	n) nfiles=$OPTARG ;;
+	k) kbytes=$OPTARG ;;
+	w) work=$OPTARG ;;
+	u) upgrade=$OPTARG ;;
+	r) reset=1 ;;
+	m) media=$OPTARG ;;
+	i) image=1 ;;
+	*) usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+top=$(cd "$(dirname "$0")" && pwd)
+make=${MAKE:-make}
+
+if ! $make -C "$top" -s BACKEND=stub; then
+	echo "Error: Unable to build the stub backend (try \"$make clean\" first)" >&2
+	exit 1
+fi
+
+if [ -z "$work" ]; then
+	work=$(mktemp -d /tmp/schillix-bench.XXXXXX) || exit 1
+fi
+
+livecd=$work/livecd
+rm -rf "$work"/mnt* "$work/dsk" "$work/livecd2" "$work/zfs.state"
+mkdir -p "$work/dsk" || exit 1
+
+#
+# Lets an upgrade find the pool the install left
+#
+STUB_ZFS_STATE=$work/zfs.state
+export STUB_ZFS_STATE
+
+if [ -n "$upgrade" ] || [ -n "$reset" ]; then
+	set -- -u "$@"
+fi
+
+if [ -n "$image" ] && [ -n "$media" ]; then
+	set -- -I "$@"
+fi
+
+#
+# The livecd is only made once per workdir, as it takes a while
+#
+if [ ! -f "$livecd/.done" ]; then
+	echo "Creating livecd with $nfiles files of ${kbytes}K in $livecd"
+	rm -rf "$livecd"
+	mkdir -p "$livecd/boot/grub" "$livecd/boot/solaris" "$livecd/etc" \
+	    "$livecd/kernel/amd64" "$livecd/platform/i86pc/amd64" || exit 1
+
+	head -c 512 /dev/zero > "$livecd/boot/grub/stage1"
+	head -c 65536 /dev/zero > "$livecd/boot/grub/stage2"
+	echo "xVM" > "$livecd/boot/grub/capability"
+	echo | gzip > "$livecd/boot/grub/splash.xpm.gz"
+
+	printf '\177ELF\001' > "$livecd/kernel/unix"
+	printf '\177ELF\002' > "$livecd/kernel/amd64/unix"
+	echo "set noexec_user_stack=1" > "$livecd/etc/system"
+	printf 'etc/system\nkernel\n' > "$livecd/boot/solaris/filelist.ramdisk"
+	echo > "$livecd/platform/i86pc/boot_archive"
+	echo > "$livecd/platform/i86pc/amd64/boot_archive"
+
+	i=0
+	while [ $i -lt "$nfiles" ]; do
+		dir=$livecd/usr/share/bench/$((i / 100))
+		[ -d "$dir" ] || mkdir -p "$dir"
+		head -c $((kbytes * 1024)) /dev/urandom > "$dir/file$i"
+		i=$((i + 1))
+	done
+
+	touch "$livecd/.done"
+fi
+
+src=$livecd
+if [ -n "$image" ]; then
+	src=$work/livecd.iso
+
+	if [ ! -f "$src" ] || [ "$livecd/.done" -nt "$src" ]; then
+		echo "Creating image of the livecd in $src"
+		${MKISOFS:-mkisofs} -quiet -R -o "$src" "$livecd" || exit 1
+	fi
+fi
+
+#
+# The installer adds p0 to each disk to get the whole disk
+#
+disks=
+i=0
+while [ $i -lt "$ndisks" ]; do
+	truncate -s "$size" "$work/dsk/disk${i}p0" || exit 1
+	disks="$disks $work/dsk/disk$i"
+	i=$((i + 1))
+done
+
+#
+# Page cache size in KB
+#
+cached ()
+{
+	awk '/^Cached:/ { print $2 }' /proc/meminfo
+}
+
+if [ -n "$cold" ]; then
+	sync
+	echo 1 > /proc/sys/vm/drop_caches || exit 1
+fi
+
+cached_start=$(cached)
+start=$(date +%s%N)
+#
+# Slow the livecd down for the installer only; the disk images are
+# written at full speed
+#
+slowio=
+if [ -n "$media" ]; then
+	slowio="LD_PRELOAD=$top/stub/slowio.so SLOWIO_MEDIA=$media SLOWIO_PATH=$src"
+fi
+
+echo y | env $slowio "$top/schillix-install" -c "$src" -m "$work/mnt" -r benchpool -T "$work/trace.json" "$@" $disks \
+    > "$work/install.log" 2>&1
+ret=$?
+end=$(date +%s%N)
+sync
+cached_end=$(cached)
+
+sed -n '/^Install phases:/,$p' "$work/install.log"
+grep '^Error' "$work/install.log"
+grep '^slowio:' "$work/install.log"
+
+echo
+echo "Page cache grew by $(((cached_end - cached_start) / 1024)) MB"
+echo "Total: $(awk "BEGIN { printf \"%.2f\", ($end - $start) / 1e9 }")s, exit status $ret"
+echo "Log in $work/install.log, trace in $work/trace.json"
+
+#
+# Reset the pool to how it was installed
+#
+reset ()
+{
+	echo
+	start=$(date +%s%N)
+	"$top/schillix-install" -R -r benchpool > "$work/reset.log" 2>&1
+	ret=$?
+	end=$(date +%s%N)
+
+	grep '^Reset\|^Error' "$work/reset.log"
+	echo "Reset total: $(awk "BEGIN { printf \"%.2f\", ($end - $start) / 1e9 }")s, exit status $ret"
+}
+
+if [ $ret -ne 0 ] || [ -z "$upgrade" ]; then
+	if [ $ret -eq 0 ] && [ -n "$reset" ]; then
+		reset
+	fi
+
+	exit $ret
+fi
+
+#
+# The point release shares the livecd's files apart from the changed
+# ones, which are replaced rather than rewritten; one in ten of those
+# is dropped instead and a new file added in its place
+#
+echo
+echo "Creating point release with $upgrade% of files changed in $work/livecd2"
+cp -al "$livecd" "$work/livecd2" || exit 1
+
+step=$((100 / upgrade))
+i=0
+while [ $i -lt "$nfiles" ]; do
+	file=$work/livecd2/usr/share/bench/$((i / 100))/file$i
+	rm -f "$file"
+
+	if [ $((i / step % 10)) -eq 9 ]; then
+		head -c $((kbytes * 1024)) /dev/urandom > "$file.new"
+	else
+		head -c $((kbytes * 1024)) /dev/urandom > "$file"
+	fi
+
+	i=$((i + step))
+done
+
+#
+# Stand in for the user's own changes, which the upgrade has to keep:
+# one to a file the point release leaves alone and one to a file it
+# changes
+#
+echo "* local" >> "$work/mnt/etc/system"
+echo "local" >> "$work/mnt/usr/share/bench/0/file0"
+
+start=$(date +%s%N)
+"$top/schillix-install" -U -c "$work/livecd2" -r benchpool -T "$work/upgrade.json" > "$work/upgrade.log" 2>&1
+ret=$?
+end=$(date +%s%N)
+
+sed -n '/^Copied/p; /^Kept/p; /^Removed/p; /^Upgrade phases:/,$p' "$work/upgrade.log"
+grep '^Error' "$work/upgrade.log"
+
+echo
+echo "Upgrade total: $(awk "BEGIN { printf \"%.2f\", ($end - $start) / 1e9 }")s, exit status $ret"
+echo "Log in $work/upgrade.log, trace in $work/upgrade.json"
+
+if [ $ret -eq 0 ] && [ -n "$reset" ]; then
+	reset
+fi
+
+exit $ret
@@ -0,0 +1,696 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <zlib.h>
+#include <sha1.h>
+#include <libnvpair.h>
+#include <sys/stat.h>
+
+#include "disk.h"
+#include "config.h"
+#include "copy.h"
+#include "exec.h"
+#include "bootarch.h"
+#include "bufpool.h"
+
+/*
+ * Build the boot archives while the rest of the files are being copied,
+ * rather than having bootadm walk the new root again afterwards.  The
+ * members are the files named by filelist.ramdisk, the same as bootadm
+ * uses.  The copy engine only says when each member has been written;
+ * once the last of them is, mkisofs reads them back from the new root
+ * and the image is compressed, one thread per archive.  bootadm's stat
+ * cache is then written for the members, as bootadm would, so the
+ * boot-archive service finds the archives up to date at first boot.
+ *
+ * Better still, if the installer doesn't change any of the members the
+ * livecd's own archives are simply copied along with everything else,
+ * and so is its stat cache, which still matches them.
+ */
+#define FILELIST_PATH		"boot/solaris/filelist.ramdisk"
+#define ETC_FILELIST_PATH	"etc/boot/solaris/filelist.ramdisk"
+#define FILESTAT_PATH		"boot/solaris/filestat.ramdisk"
+#define ARCHIVE_32		"platform/i86pc/boot_archive"
+#define ARCHIVE_64		"platform/i86pc/amd64/boot_archive"
+
+typedef struct member
+{
+	char *m_path;		/* relative to the root */
+	boolean_t m_copied;
+	int m_class;		/* ELF class, or ELFCLASSNONE */
+} member_t;
+
+#define ELFCLASSNONE	0
+#define ELFCLASS32	1
+#define ELFCLASS64	2
+
+typedef struct archive
+{
+	char *a_path;
+	int a_exclude;		/* ELF class not wanted */
+	boolean_t a_ret;
+	pthread_t a_tid;
+} archive_t;
+
+static archive_t archives[] =
+{
+	{ ARCHIVE_32, ELFCLASS64 },
+	{ ARCHIVE_64, ELFCLASS32 }
+};
+
+#define NUM_ARCHIVES	(sizeof (archives) / sizeof (archives[0]))
+
+static pthread_mutex_t bootarch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bootarch_cv = PTHREAD_COND_INITIALIZER;
+static boolean_t bootarch_enabled = B_FALSE;
+static boolean_t bootarch_done = B_FALSE;
+static boolean_t bootarch_reuse = B_FALSE;
+static boolean_t bootarch_waited = B_FALSE;
+static boolean_t bootarch_ret;
+static int bootarch_pending;
+static member_t *members;
+static int nmembers, maxmembers;
+static char bootarch_src[PATH_MAX];
+static char bootarch_mnt[PATH_MAX];
+static size_t bootarch_srclen;
+
+/*
+ * Put dir/rel in a PATH_MAX buffer, failing if it won't fit
+ */
+static boolean_t
+join_path (char *buf, const char *dir, const char *rel)
+{
+	return snprintf (buf, PATH_MAX, "%s/%s", dir, rel) < PATH_MAX ? B_TRUE : B_FALSE;
+}
+
+static int
+compare_members (const void *a, const void *b)
+{
+	return strcmp (((member_t *) a)->m_path, ((member_t *) b)->m_path);
+}
+
+static member_t *
+find_member (const char *path)
+{
+	member_t key;
+
+	key.m_path = (char *) path;
+
+	return bsearch (&key, members, nmembers, sizeof (member_t), compare_members);
+}
+
+static boolean_t
+add_member (const char *path)
+{
+	if (nmembers == maxmembers)
+	{
+		member_t *tmp;
+
+		maxmembers = maxmembers == 0 ? 1024 : maxmembers * 2;
+
+		if ((tmp = realloc (members, maxmembers * sizeof (member_t))) == NULL)
+			return B_FALSE;
+
+		members = tmp;
+	}
+
+	if ((members[nmembers].m_path = strdup (path)) == NULL)
+		return B_FALSE;
+
+	members[nmembers].m_copied = B_FALSE;
+	members[nmembers].m_class = ELFCLASSNONE;
+	nmembers++;
+
+	return B_TRUE;
+}
+
+/*
+ * Add every file under a directory named in the filelist
+ */
+static int
+add_member_tree (const char *path, const struct stat *statptr, int fileflag, struct FTW *pftw)
+{
+	if (fileflag != FTW_F)
+		return 0;
+
+	return add_member (path + bootarch_srclen + 1) == B_TRUE ? 0 : 1;
+}
+
+/*
+ * Expand a filelist.ramdisk against the source tree
+ */
+static boolean_t
+read_filelist (char *file)
+{
+	char *p, line[LINE_MAX], path[PATH_MAX];
+	struct stat st;
+	FILE *fp;
+
+	if (join_path (path, bootarch_src, file) == B_FALSE)
+	{
+		fprintf (stderr, "Error: Path too long: %s/%s\n", bootarch_src, file);
+		return B_FALSE;
+	}
+
+	if ((fp = fopen (path, "r")) == NULL)
+		return errno == ENOENT;
+
+	while (fgets (line, sizeof (line), fp) != NULL)
+	{
+		if ((p = strchr (line, '#')) != NULL)
+			*p = '\0';
+
+		if ((p = strtok (line, " \t\n")) == NULL)
+			continue;
+
+		while (*p == '/')
+			p++;
+
+		if (join_path (path, bootarch_src, p) == B_FALSE)
+		{
+			fprintf (stderr, "Error: Path too long: %s/%s\n", bootarch_src, p);
+			(void) fclose (fp);
+			return B_FALSE;
+		}
+
+		/*
+		 * Entries that don't exist on this platform are skipped
+		 */
+		if (lstat (path, &st) == -1)
+			continue;
+
+		if (S_ISDIR (st.st_mode))
+		{
+			if (nftw (path, add_member_tree, 16, FTW_PHYS) != 0)
+			{
+				(void) fclose (fp);
+				return B_FALSE;
+			}
+		}
+		else if (S_ISREG (st.st_mode))
+		{
+			if (add_member (p) == B_FALSE)
+			{
+				(void) fclose (fp);
+				return B_FALSE;
+			}
+		}
+	}
+
+	(void) fclose (fp);
+	return B_TRUE;
+}
+
+/*
+ * Find out whether a member is a 32 or 64 bit ELF object
+ */
+static int
+elf_class (char *path)
+{
+	int fd;
+	unsigned char ident[5];
+
+	if ((fd = open (path, O_RDONLY)) == -1)
+		return ELFCLASSNONE;
+
+	if (read (fd, ident, sizeof (ident)) != sizeof (ident)
+	    || ident[0] != 0x7f || ident[1] != 'E' || ident[2] != 'L' || ident[3] != 'F')
+	{
+		(void) close (fd);
+		return ELFCLASSNONE;
+	}
+
+	(void) close (fd);
+	return ident[4];
+}
+
+/*
+ * Compress the mkisofs image into the final archive
+ */
+static boolean_t
+compress_archive (char *src, char *dest)
+{
+	int fd;
+	ssize_t len;
+	char *buf;
+	gzFile gz;
+
+	if ((fd = open (src, O_RDONLY)) == -1)
+	{
+		fprintf (stderr, "Error: Unable to open %s: %s\n", src, strerror (errno));
+		return B_FALSE;
+	}
+
+	if ((gz = gzopen (dest, "wb6")) == NULL)
+	{
+		fprintf (stderr, "Error: Unable to create %s\n", dest);
+		(void) close (fd);
+		return B_FALSE;
+	}
+
+	buf = bufpool_get ();
+
+	while ((len = read (fd, buf, BUFPOOL_BUFSIZE)) > 0)
+	{
+		if (gzwrite (gz, buf, len) != len)
+		{
+			fprintf (stderr, "Error: Unable to write %s\n", dest);
+			bufpool_put (buf);
+			(void) gzclose (gz);
+			(void) close (fd);
+			return B_FALSE;
+		}
+	}
+
+	bufpool_put (buf);
+	(void) close (fd);
+
+	if (len == -1 || gzclose (gz) != 0)
+	{
+		fprintf (stderr, "Error: Unable to write %s\n", dest);
+		return B_FALSE;
+	}
+
+	return B_TRUE;
+}
+
+/*
+ * Build one archive once every member has been copied
+ */
+static void *
+archive_thread (void *arg)
+{
+	int i, pending;
+	char list[PATH_MAX], image[PATH_MAX], dest[PATH_MAX], tmp[PATH_MAX];
+	char *argv[] = { MKISOFS_PATH, "-quiet", "-graft-points", "-dlrDJN", "-relaxed-filenames",
+	    "-o", image, "-path-list", list, NULL };
+	archive_t *a = arg;
+	FILE *fp;
+
+	a->a_ret = B_FALSE;
+
+	(void) pthread_mutex_lock (&bootarch_lock);
+
+	while (bootarch_pending > 0 && bootarch_done == B_FALSE)
+		(void) pthread_cond_wait (&bootarch_cv, &bootarch_lock);
+
+	pending = bootarch_pending;
+	(void) pthread_mutex_unlock (&bootarch_lock);
+
+	/*
+	 * The copy finished without giving us everything
+	 */
+	if (pending > 0)
+		return NULL;
+
+	if (join_path (dest, bootarch_mnt, a->a_path) == B_FALSE ||
+	    snprintf (list, PATH_MAX, "%s.list", dest) >= PATH_MAX ||
+	    snprintf (image, PATH_MAX, "%s.iso", dest) >= PATH_MAX ||
+	    snprintf (tmp, PATH_MAX, "%s.new", dest) >= PATH_MAX)
+	{
+		fprintf (stderr, "Error: Path too long: %s/%s\n", bootarch_mnt, a->a_path);
+		return NULL;
+	}
+
+	if ((fp = fopen (list, "w")) == NULL)
+	{
+		fprintf (stderr, "Error: Unable to create %s: %s\n", list, strerror (errno));
+		return NULL;
+	}
+
+	for (i = 0; i < nmembers; i++)
+	{
+		if (members[i].m_class == a->a_exclude)
+			continue;
+
+		fprintf (fp, "%s=%s/%s\n", members[i].m_path, bootarch_mnt, members[i].m_path);
+	}
+
+	if (fclose (fp) == EOF)
+	{
+		fprintf (stderr, "Error: Unable to write %s\n", list);
+		(void) unlink (list);
+		return NULL;
+	}
+
+	if (exec_cmd (argv, NULL, NULL) == B_TRUE && compress_archive (image, tmp) == B_TRUE)
+	{
+		if (rename (tmp, dest) == 0)
+			a->a_ret = B_TRUE;
+		else
+			fprintf (stderr, "Error: Unable to rename %s: %s\n", tmp, strerror (errno));
+	}
+
+	(void) unlink (list);
+	(void) unlink (image);
+	(void) unlink (tmp);
+
+	return NULL;
+}
+
+/*
+ * Write bootadm's stat cache: an XDR packed nvlist holding the size and
+ * mtime of each member, named by its path relative to the root
+ */
+static boolean_t
+write_stat_cache (void)
+{
+	int i, fd = -1;
+	char path[PATH_MAX], tmp[PATH_MAX], *buf = NULL;
+	size_t len = 0;
+	uint64_t filestat[2];
+	struct stat st;
+	nvlist_t *nvl;
+	boolean_t ret = B_FALSE;
+
+	if (nvlist_alloc (&nvl, NV_UNIQUE_NAME, 0) != 0)
+	{
+		fprintf (stderr, "Error: Unable to allocate the boot archive stat cache\n");
+		return B_FALSE;
+	}
+
+	for (i = 0; i < nmembers; i++)
+	{
+		if (join_path (path, bootarch_mnt, members[i].m_path) == B_FALSE)
+		{
+			fprintf (stderr, "Error: Path too long: %s/%s\n", bootarch_mnt, members[i].m_path);
+			goto out;
+		}
+
+		if (lstat (path, &st) == -1)
+		{
+			fprintf (stderr, "Error: Unable to stat %s: %s\n", path, strerror (errno));
+			goto out;
+		}
+
+		filestat[0] = st.st_size;
+		filestat[1] = st.st_mtime;
+
+		if (nvlist_add_uint64_array (nvl, members[i].m_path, filestat, 2) != 0)
+		{
+			fprintf (stderr, "Error: Unable to add %s to the boot archive stat cache\n", path);
+			goto out;
+		}
+	}
+
+	if (nvlist_pack (nvl, &buf, &len, NV_ENCODE_XDR, 0) != 0)
+	{
+		fprintf (stderr, "Error: Unable to pack the boot archive stat cache\n");
+		goto out;
+	}
+
+	if (join_path (path, bootarch_mnt, FILESTAT_PATH) == B_FALSE ||
+	    snprintf (tmp, PATH_MAX, "%s.new", path) >= PATH_MAX)
+	{
+		fprintf (stderr, "Error: Path too long: %s/%s\n", bootarch_mnt, FILESTAT_PATH);
+		goto out;
+	}
+
+	if ((fd = open (tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) == -1 ||
+	    write (fd, buf, len) != len || close (fd) == -1 || rename (tmp, path) == -1)
+	{
+		fprintf (stderr, "Error: Unable to write %s: %s\n", path, strerror (errno));
+		(void) unlink (tmp);
+		goto out;
+	}
+
+	ret = B_TRUE;
+out:
+	free (buf);
+	nvlist_free (nvl);
+	return ret;
+}
+
+/*
+ * SHA1 the rest of a file
+ */
+static void
+hash_file (FILE *fp, unsigned char *digest)
+{
+	size_t len;
+	char buf[8192];
+	SHA1_CTX ctx;
+
+	SHA1Init (&ctx);
+
+	while ((len = fread (buf, 1, sizeof (buf), fp)) > 0)
+		SHA1Update (&ctx, buf, len);
+
+	SHA1Final (digest, &ctx);
+}
+
+/*
+ * Find out whether any of the files we generate is an archive member
+ * which differs from the livecd's copy
+ */
+static boolean_t
+members_unchanged (void)
+{
+	int i;
+	char *path, src[PATH_MAX];
+	unsigned char old[20], new[20];
+	FILE *fp;
+
+	for (i = 0; (path = overlay_path (i)) != NULL; i++)
+	{
+		while (*path == '/')
+			path++;
+
+		if (find_member (path) == NULL)
+			continue;
+
+		if (join_path (src, bootarch_src, path) == B_FALSE || (fp = fopen (src, "r")) == NULL)
+			return B_FALSE;
+
+		hash_file (fp, old);
+		(void) fclose (fp);
+
+		if ((fp = tmpfile ()) == NULL)
+			return B_FALSE;
+
+		overlay_write (i, fp);
+		rewind (fp);
+		hash_file (fp, new);
+		(void) fclose (fp);
+
+		if (memcmp (old, new, sizeof (old)) != 0)
+			return B_FALSE;
+	}
+
+	/*
+	 * And the livecd actually has archives to reuse
+	 */
+	for (i = 0; i < NUM_ARCHIVES; i++)
+	{
+		if (join_path (src, bootarch_src, archives[i].a_path) == B_FALSE || access (src, R_OK) == -1)
+			return B_FALSE;
+	}
+
+	return B_TRUE;
+}
+
+/*
+ * Work out what goes in the boot archives and start the threads which
+ * build them, unless the livecd's archives can be used as they are.
+ * If there's no filelist we leave it all to bootadm.  Setting force
+ * always rebuilds the archives.
+ */
+boolean_t
+bootarch_init (char *src, char *mnt, boolean_t force)
+{
+	int i, j;
+
+	if (realpath (src, bootarch_src) == NULL)
+		return B_FALSE;
+
+	(void) strcpy (bootarch_mnt, mnt);
+	bootarch_srclen = strlen (bootarch_src);
+
+	if (read_filelist (FILELIST_PATH) == B_FALSE || read_filelist (ETC_FILELIST_PATH) == B_FALSE)
+		return B_FALSE;
+
+	if (nmembers == 0)
+		return B_FALSE;
+
+	/*
+	 * Both filelists may name the same file
+	 */
+	qsort (members, nmembers, sizeof (member_t), compare_members);
+
+	for (i = 1, j = 0; i < nmembers; i++)
+	{
+		if (strcmp (members[i].m_path, members[j].m_path) == 0)
+			free (members[i].m_path);
+		else
+			members[++j] = members[i];
+	}
+
+	nmembers = j + 1;
+	bootarch_pending = nmembers;
+
+	if (force == B_FALSE && members_unchanged () == B_TRUE)
+	{
+		puts ("Boot archive members unchanged, using the livecd's boot archives");
+		bootarch_reuse = B_TRUE;
+		return B_TRUE;
+	}
+
+	for (i = 0; i < NUM_ARCHIVES; i++)
+	{
+		if (pthread_create (&archives[i].a_tid, NULL, archive_thread, &archives[i]) != 0)
+		{
+			/*
+			 * Let the ones we did start give up
+			 */
+			bootarch_copy_done ();
+
+			while (--i >= 0)
+				(void) pthread_join (archives[i].a_tid, NULL);
+
+			return B_FALSE;
+		}
+	}
+
+	bootarch_enabled = B_TRUE;
+	return B_TRUE;
+}
+
+/*
+ * The archives we build, and their stat cache, replace the ones on the
+ * livecd, so the copy engine mustn't overwrite them
+ */
+boolean_t
+bootarch_skip (const char *path)
+{
+	int i;
+
+	if (bootarch_enabled == B_FALSE)
+		return B_FALSE;
+
+	while (*path == '/')
+		path++;
+
+	for (i = 0; i < NUM_ARCHIVES; i++)
+		if (strcmp (path, archives[i].a_path) == 0)
+			return B_TRUE;
+
+	return strcmp (path, FILESTAT_PATH) == 0 ? B_TRUE : B_FALSE;
+}
+
+/*
+ * Called by the copy engine for every file once it's been written
+ */
+void
+bootarch_copied (const char *path)
+{
+	char src[PATH_MAX];
+	member_t *m;
+
+	if (bootarch_enabled == B_FALSE)
+		return;
+
+	while (*path == '/')
+		path++;
+
+	if ((m = find_member (path)) == NULL)
+		return;
+
+	m->m_class = join_path (src, bootarch_mnt, path) == B_TRUE ? elf_class (src) : ELFCLASSNONE;
+
+	(void) pthread_mutex_lock (&bootarch_lock);
+
+	if (m->m_copied == B_FALSE)
+	{
+		m->m_copied = B_TRUE;
+
+		if (--bootarch_pending == 0)
+			(void) pthread_cond_broadcast (&bootarch_cv);
+	}
+
+	(void) pthread_mutex_unlock (&bootarch_lock);
+}
+
+/*
+ * Called when the copy is over so anything still waiting gives up
+ */
+void
+bootarch_copy_done (void)
+{
+	(void) pthread_mutex_lock (&bootarch_lock);
+	bootarch_done = B_TRUE;
+	(void) pthread_cond_broadcast (&bootarch_cv);
+	(void) pthread_mutex_unlock (&bootarch_lock);
+}
+
+/*
+ * Wait for the archives, returns B_FALSE if bootadm still has to build
+ * them.  The builders stay enabled afterwards so that the copy still
+ * leaves what they wrote alone.
+ */
+boolean_t
+bootarch_wait (void)
+{
+	int i;
+
+	/*
+	 * The copy engine installed the livecd's archives
+	 */
+	if (bootarch_reuse == B_TRUE)
+		return B_TRUE;
+
+	if (bootarch_enabled == B_FALSE)
+		return B_FALSE;
+
+	if (bootarch_waited == B_FALSE)
+	{
+		bootarch_ret = B_TRUE;
+
+		for (i = 0; i < NUM_ARCHIVES; i++)
+		{
+			(void) pthread_join (archives[i].a_tid, NULL);
+
+			if (archives[i].a_ret == B_FALSE)
+				bootarch_ret = B_FALSE;
+		}
+
+		/*
+		 * Without a stat cache to match, bootadm has to do it all
+		 */
+		if (bootarch_ret == B_TRUE && write_stat_cache () == B_FALSE)
+			bootarch_ret = B_FALSE;
+
+		bootarch_waited = B_TRUE;
+	}
+
+	return bootarch_ret;
+}
@@ -0,0 +1,569 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <libzfs.h>
+
+#include "iso.h"
+#include "bootlist.h"
+
+/*
+ * What has to be on disk before the system can boot: the kernel and its
+ * modules, /etc, and the commands used while the system comes up.
+ * Everything below an entry is covered, and entries may be fnmatch
+ * patterns.  Whatever the list, bootlist_expand adds the contents of the
+ * boot archive and the libraries the listed commands need, so that only
+ * the commands themselves have to be named here.
+ */
+static char *default_bootlist[] =
+{
+	"/boot",
+	"/platform",
+	"/kernel",
+	"/usr/kernel",
+	"/etc",
+	"/lib",
+	"/sbin",
+	"/usr/sbin/init",
+	"/usr/sbin/devfsadm",
+	"/usr/sbin/bootadm",
+	"/usr/lib/devfsadm",
+	"/usr/lib/fs",
+	"/usr/bin/sh",
+	"/usr/bin/ksh93",
+	"/var/svc/manifest"
+};
+
+#define NUM_DEFAULT	(sizeof (default_bootlist) / sizeof (default_bootlist[0]))
+
+#define FILELIST_PATH		"/boot/solaris/filelist.ramdisk"
+#define ETC_FILELIST_PATH	"/etc/boot/solaris/filelist.ramdisk"
+#define BOOTLIST_MAXLINKS	16	/* symlinks followed resolving a path */
+
+/*
+ * ELF layout.  Only little endian objects are looked at, as those are
+ * all that can be on an x86 livecd.
+ */
+#define EI_CLASS	4
+#define EI_DATA		5
+#define ELFCLASS32	1
+#define ELFCLASS64	2
+#define ELFDATA2LSB	1
+#define SHT_DYNAMIC	6
+#define DT_NULL		0
+#define DT_NEEDED	1
+#define DT_RPATH	15
+#define DT_RUNPATH	29
+
+/*
+ * Where the runtime linker looks for a library with no runpath
+ */
+static char *default_libdirs[][2] =
+{
+	{ "/lib", "/usr/lib" },		/* ELFCLASS32 */
+	{ "/lib/64", "/usr/lib/64" }	/* ELFCLASS64 */
+};
+
+/*
+ * isaexec runs a command from one of these directories next to it
+ */
+static char *isa_dirs[] = { "i86", "amd64" };
+
+static char **bootlist_paths;
+static int bootlist_npaths, bootlist_max;
+static boolean_t bootlist_custom = B_FALSE;
+static const char *bootlist_base;
+static iso_t *bootlist_iso;
+
+/*
+ * Add a path to the list unless it's already there
+ */
+static boolean_t
+add_path (const char *path)
+{
+	char **tmp;
+	int i;
+
+	while (*path == '/')
+		path++;
+
+	for (i = 0; i < bootlist_npaths; i++)
+		if (strcmp (bootlist_paths[i] + 1, path) == 0)
+			return B_TRUE;
+
+	if (bootlist_npaths == bootlist_max)
+	{
+		bootlist_max = bootlist_max == 0 ? 64 : bootlist_max * 2;
+
+		if ((tmp = realloc (bootlist_paths, bootlist_max * sizeof (char *))) == NULL)
+		{
+			fprintf (stderr, "Error: Unable to allocate boot list\n");
+			return B_FALSE;
+		}
+
+		bootlist_paths = tmp;
+	}
+
+	if ((bootlist_paths[bootlist_npaths] = malloc (strlen (path) + 2)) == NULL)
+	{
+		fprintf (stderr, "Error: Unable to allocate boot list\n");
+		return B_FALSE;
+	}
+
+	(void) sprintf (bootlist_paths[bootlist_npaths++], "/%s", path);
+
+	return B_TRUE;
+}
+
+/*
+ * Replace the default boot list with one read from path, one path or
+ * pattern per line.  Blank lines and anything after a # are ignored.
+ */
+boolean_t
+bootlist_read (char *path)
+{
+	FILE *fp;
+	char line[LINE_MAX], *entry;
+
+	if ((fp = fopen (path, "r")) == NULL)
+	{
+		fprintf (stderr, "Error: Unable to open boot list %s: %s\n", path, strerror (errno));
+		return B_FALSE;
+	}
+
+	bootlist_custom = B_TRUE;
+
+	while (fgets (line, sizeof (line), fp) != NULL)
+	{
+		line[strcspn (line, "#")] = '\0';
+
+		if ((entry = strtok (line, " \t\n")) != NULL && add_path (entry) == B_FALSE)
+		{
+			(void) fclose (fp);
+			return B_FALSE;
+		}
+	}
+
+	(void) fclose (fp);
+
+	return B_TRUE;
+}
+
+/*
+ * lstat a path on the livecd, reading a symlink's target into link
+ */
+static boolean_t
+source_lstat (const char *rel, struct stat *statptr, char *link)
+{
+	char path[PATH_MAX];
+	ssize_t len;
+
+	if (bootlist_iso != NULL)
+	{
+		if (iso_lookup (bootlist_iso, rel, statptr) == B_FALSE)
+			return B_FALSE;
+
+		if (S_ISLNK (statptr->st_mode))
+			(void) strcpy (link, bootlist_iso->i_link);
+
+		return B_TRUE;
+	}
+
+	if (snprintf (path, sizeof (path), "%s%s", bootlist_base, rel) >= sizeof (path) ||
+	    lstat (path, statptr) == -1)
+		return B_FALSE;
+
+	if (S_ISLNK (statptr->st_mode))
+	{
+		if ((len = readlink (path, link, PATH_MAX - 1)) == -1)
+			return B_FALSE;
+
+		link[len] = '\0';
+	}
+
+	return B_TRUE;
+}
+
+/*
+ * Turn a path on the livecd into one with no symlinks, "." or ".." in
+ * it, treating absolute symlinks as relative to the livecd's root
+ */
+static boolean_t
+resolve (const char *rel, char *resolved, struct stat *statptr)
+{
+	char rest[PATH_MAX], link[PATH_MAX], tmp[PATH_MAX], *p, *slash;
+	size_t len, rlen = 0;
+	int nlinks = 0;
+
+	if (snprintf (rest, sizeof (rest), "%s", rel) >= sizeof (rest))
+		return B_FALSE;
+
+	resolved[0] = '\0';
+
+	for (p = rest; *p != '\0'; p += len)
+	{
+		while (*p == '/')
+			p++;
+
+		if ((len = strcspn (p, "/")) == 0)
+			break;
+
+		if (len == 1 && *p == '.')
+			continue;
+
+		if (len == 2 && p[0] == '.' && p[1] == '.')
+		{
+			if ((slash = strrchr (resolved, '/')) != NULL)
+				*slash = '\0';
+
+			rlen = strlen (resolved);
+			continue;
+		}
+
+		if (rlen + 1 + len >= PATH_MAX)
+			return B_FALSE;
+
+		resolved[rlen] = '/';
+		(void) memcpy (resolved + rlen + 1, p, len);
+		resolved[rlen += 1 + len] = '\0';
+
+		if (source_lstat (resolved, statptr, link) == B_FALSE)
+			return B_FALSE;
+
+		if (!S_ISLNK (statptr->st_mode))
+			continue;
+
+		/*
+		 * Carry on from the symlink's target
+		 */
+		if (++nlinks > BOOTLIST_MAXLINKS ||
+		    snprintf (tmp, sizeof (tmp), "%s/%s", link, p + len) >= sizeof (tmp))
+			return B_FALSE;
+
+		(void) strcpy (rest, tmp);
+		p = rest;
+		len = 0;
+
+		if (*link == '/')
+			resolved[0] = '\0';
+		else if ((slash = strrchr (resolved, '/')) != NULL)
+			*slash = '\0';
+
+		rlen = strlen (resolved);
+	}
+
+	return resolved[0] != '\0' && source_lstat (resolved, statptr, link) == B_TRUE ? B_TRUE : B_FALSE;
+}
+
+/*
+ * Map a regular file on the livecd
+ */
+static const unsigned char *
+source_map (const char *rel, const struct stat *statptr)
+{
+	char path[PATH_MAX];
+	void *data;
+	int fd;
+
+	if (bootlist_iso != NULL)
+		return iso_data (bootlist_iso, statptr);
+
+	if (statptr->st_size == 0 || snprintf (path, sizeof (path), "%s%s", bootlist_base, rel) >= sizeof (path) ||
+	    (fd = open (path, O_RDONLY)) == -1)
+		return NULL;
+
+	data = mmap (NULL, statptr->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	(void) close (fd);
+
+	return data == MAP_FAILED ? NULL : data;
+}
+
+static void
+source_unmap (const unsigned char *data, const struct stat *statptr)
+{
+	if (bootlist_iso == NULL)
+		(void) munmap ((void *) data, statptr->st_size);
+}
+
+/*
+ * Add the entries of a filelist.ramdisk, which name what bootadm puts
+ * in the boot archive
+ */
+static boolean_t
+add_filelist (const char *file)
+{
+	char resolved[PATH_MAX], line[LINE_MAX], *entry;
+	const unsigned char *data;
+	struct stat st;
+	off_t off, end;
+	boolean_t ret = B_TRUE;
+
+	if (resolve (file, resolved, &st) == B_FALSE || !S_ISREG (st.st_mode) ||
+	    (data = source_map (resolved, &st)) == NULL)
+		return B_TRUE;
+
+	for (off = 0; off < st.st_size && ret == B_TRUE; off = end + 1)
+	{
+		for (end = off; end < st.st_size && data[end] != '\n'; end++)
+			;
+
+		if (end - off >= sizeof (line))
+			continue;
+
+		(void) memcpy (line, data + off, end - off);
+		line[end - off] = '\0';
+		line[strcspn (line, "#")] = '\0';
+
+		if ((entry = strtok (line, " \t")) != NULL)
+			ret = add_path (entry);
+	}
+
+	source_unmap (data, &st);
+
+	return ret;
+}
+
+static uint64_t
+le (const unsigned char *p, int n)
+{
+	uint64_t v = 0;
+
+	while (n-- > 0)
+		v = v << 8 | p[n];
+
+	return v;
+}
+
+/*
+ * Find a library the way the runtime linker would, along the object's
+ * runpath and then the default directories for its class
+ */
+static boolean_t
+add_library (const char *name, const char *runpath, int class, char *resolved)
+{
+	char dirs[PATH_MAX], path[PATH_MAX], *dir, *last;
+	struct stat st;
+	int i;
+
+	if (strchr (name, '/') != NULL)
+		return B_TRUE;
+
+	if (runpath == NULL || snprintf (dirs, sizeof (dirs), "%s", runpath) >= sizeof (dirs))
+		dirs[0] = '\0';
+
+	for (dir = strtok_r (dirs, ":", &last); dir != NULL; dir = strtok_r (NULL, ":", &last))
+	{
+		/*
+		 * $ORIGIN and the like are left to the default directories
+		 */
+		if (strchr (dir, '$') != NULL)
+			continue;
+
+		if (snprintf (path, sizeof (path), "%s/%s", dir, name) < sizeof (path) &&
+		    resolve (path, resolved, &st) == B_TRUE && S_ISREG (st.st_mode))
+			return add_path (resolved);
+	}
+
+	for (i = 0; i < 2; i++)
+	{
+		if (snprintf (path, sizeof (path), "%s/%s", default_libdirs[class - 1][i], name) < sizeof (path) &&
+		    resolve (path, resolved, &st) == B_TRUE && S_ISREG (st.st_mode))
+			return add_path (resolved);
+	}
+
+	return B_TRUE;
+}
+
+/*
+ * Add the libraries a dynamic ELF object needs.  Anything else is left
+ * alone.
+ */
+static boolean_t
+add_needed (const char *rel, const struct stat *statptr)
+{
+	const unsigned char *data, *sh, *dyn, *str;
+	char resolved[PATH_MAX], *runpath = NULL;
+	uint64_t shoff, dynoff, dynsize, stroff, strsize, tag, val;
+	uint32_t shentsize, shnum, link, i, j;
+	int class, wide;
+	boolean_t ret = B_TRUE;
+
+	if (statptr->st_size < 64 || (data = source_map (rel, statptr)) == NULL)
+		return B_TRUE;
+
+	if (memcmp (data, "\177ELF", 4) != 0 || data[EI_DATA] != ELFDATA2LSB ||
+	    ((class = data[EI_CLASS]) != ELFCLASS32 && class != ELFCLASS64))
+	{
+		source_unmap (data, statptr);
+		return B_TRUE;
+	}
+
+	/*
+	 * Offsets and sizes are words in 32 bit objects and doublewords
+	 * in 64 bit ones
+	 */
+	wide = class == ELFCLASS64 ? 8 : 4;
+	shoff = le (data + (wide == 8 ? 40 : 32), wide);
+	shentsize = le (data + (wide == 8 ? 58 : 46), 2);
+	shnum = le (data + (wide == 8 ? 60 : 48), 2);
+
+	if (shentsize < (wide == 8 ? 64 : 40) || shoff > statptr->st_size ||
+	    (uint64_t) shnum * shentsize > statptr->st_size - shoff)
+		shnum = 0;
+
+	for (i = 0; i < shnum && ret == B_TRUE; i++)
+	{
+		sh = data + shoff + (uint64_t) i * shentsize;
+
+		if (le (sh + 4, 4) != SHT_DYNAMIC || (link = le (sh + (wide == 8 ? 40 : 24), 4)) >= shnum)
+			continue;
+
+		dynoff = le (sh + (wide == 8 ? 24 : 16), wide);
+		dynsize = le (sh + (wide == 8 ? 32 : 20), wide);
+		sh = data + shoff + (uint64_t) link * shentsize;
+		stroff = le (sh + (wide == 8 ? 24 : 16), wide);
+		strsize = le (sh + (wide == 8 ? 32 : 20), wide);
+
+		if (dynoff > statptr->st_size || dynsize > statptr->st_size - dynoff ||
+		    stroff > statptr->st_size || strsize > statptr->st_size - stroff ||
+		    strsize == 0 || data[stroff + strsize - 1] != '\0')
+			continue;
+
+		str = data + stroff;
+
+		/*
+		 * The runpath can come after the libraries
+		 */
+		for (j = 0; j + 2 * wide <= dynsize; j += 2 * wide)
+		{
+			dyn = data + dynoff + j;
+
+			if ((tag = le (dyn, wide)) == DT_NULL)
+				break;
+
+			if ((tag == DT_RUNPATH || (tag == DT_RPATH && runpath == NULL)) &&
+			    (val = le (dyn + wide, wide)) < strsize)
+				runpath = (char *) str + val;
+		}
+
+		for (j = 0; j + 2 * wide <= dynsize && ret == B_TRUE; j += 2 * wide)
+		{
+			dyn = data + dynoff + j;
+
+			if ((tag = le (dyn, wide)) == DT_NULL)
+				break;
+
+			if (tag == DT_NEEDED && (val = le (dyn + wide, wide)) < strsize)
+				ret = add_library ((char *) str + val, runpath, class, resolved);
+		}
+	}
+
+	source_unmap (data, statptr);
+
+	return ret;
+}
+
+/*
+ * Complete the boot list for the livecd at base, or the image iso.  The
+ * contents of the boot archive are added, and every command on the list
+ * brings the libraries it needs, and theirs, along with it.  isaexec'd
+ * commands bring the versions it would run too.
+ */
+boolean_t
+bootlist_expand (const char *base, iso_t *iso)
+{
+	char resolved[PATH_MAX], path[PATH_MAX], *name;
+	struct stat st;
+	int i, j;
+
+	bootlist_base = base;
+	bootlist_iso = iso;
+
+	for (i = 0; bootlist_custom == B_FALSE && i < NUM_DEFAULT; i++)
+		if (add_path (default_bootlist[i]) == B_FALSE)
+			return B_FALSE;
+
+	if (add_filelist (FILELIST_PATH) == B_FALSE || add_filelist (ETC_FILELIST_PATH) == B_FALSE)
+		return B_FALSE;
+
+	/*
+	 * The list grows as this goes through it
+	 */
+	for (i = 0; i < bootlist_npaths; i++)
+	{
+		if (strpbrk (bootlist_paths[i], "*?[") != NULL ||
+		    resolve (bootlist_paths[i], resolved, &st) == B_FALSE || !S_ISREG (st.st_mode))
+			continue;
+
+		if (add_path (resolved) == B_FALSE || add_needed (resolved, &st) == B_FALSE)
+			return B_FALSE;
+
+		name = strrchr (bootlist_paths[i], '/');
+
+		for (j = 0; j < sizeof (isa_dirs) / sizeof (isa_dirs[0]); j++)
+		{
+			if (snprintf (path, sizeof (path), "%.*s/%s%s", (int) (name - bootlist_paths[i]),
+			    bootlist_paths[i], isa_dirs[j], name) < sizeof (path) &&
+			    resolve (path, resolved, &st) == B_TRUE && S_ISREG (st.st_mode) && add_path (resolved) == B_FALSE)
+				return B_FALSE;
+		}
+	}
+
+	return B_TRUE;
+}
+
+/*
+ * Whether rel, or a directory it's in, is on the boot list
+ */
+boolean_t
+bootlist_match (const char *rel)
+{
+	int i;
+	char path[PATH_MAX], *p;
+
+	(void) snprintf (path, sizeof (path), "%s", rel);
+
+	for (;;)
+	{
+		for (i = 0; i < bootlist_npaths; i++)
+			if (fnmatch (bootlist_paths[i], path, FNM_PATHNAME) == 0)
+				return B_TRUE;
+
+		if ((p = strrchr (path, '/')) == NULL || p == path)
+			return B_FALSE;
+
+		*p = '\0';
+	}
+}
@@ -0,0 +1,212 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#ifndef __linux__
+#include <procfs.h>
+#endif
+#include <libzfs.h>
+
+#include "bufpool.h"
+
+/*
+ * How many buffers are handed out between samples of the RSS
+ */
+#define BUFPOOL_SAMPLE	64
+
+static char **bufpool_free;	/* stack of free buffers */
+static char *bufpool_base;
+static int bufpool_nbufs;
+static int bufpool_nfree;
+static uint64_t bufpool_gets;
+static uint64_t bufpool_waits;
+static uint64_t bufpool_peak;	/* KB */
+
+static pthread_mutex_t bufpool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bufpool_cv = PTHREAD_COND_INITIALIZER;
+
+/*
+ * Resident set size in KB.  Linux keeps the high water mark for us,
+ * illumos only reports the current size so the peak has to be sampled.
+ */
+static uint64_t
+read_rss (void)
+{
+	uint64_t rss = 0;
+#ifdef __linux__
+	char line[128];
+	FILE *fp;
+
+	if ((fp = fopen ("/proc/self/status", "r")) == NULL)
+		return 0;
+
+	while (fgets (line, sizeof (line), fp) != NULL)
+		if (sscanf (line, "VmHWM: %llu", (unsigned long long *) &rss) == 1)
+			break;
+
+	(void) fclose (fp);
+#else
+	int fd;
+	psinfo_t psinfo;
+
+	if ((fd = open ("/proc/self/psinfo", O_RDONLY)) == -1)
+		return 0;
+
+	if (read (fd, &psinfo, sizeof (psinfo)) == sizeof (psinfo))
+		rss = psinfo.pr_rssize;
+
+	(void) close (fd);
+#endif
+	return rss;
+}
+
+static void
+sample_rss (void)
+{
+	uint64_t rss = read_rss ();
+
+	(void) pthread_mutex_lock (&bufpool_lock);
+
+	if (rss > bufpool_peak)
+		bufpool_peak = rss;
+
+	(void) pthread_mutex_unlock (&bufpool_lock);
+}
+
+/*
+ * Carve the budget into buffers.  A budget of 0 takes a share of the
+ * memory that's free now, which on a live system is what's left over
+ * once the live image itself is in memory.
+ */
+boolean_t
+bufpool_init (uint64_t budget)
+{
+	int i;
+	long pagesize = sysconf (_SC_PAGESIZE);
+
+	if (budget == 0)
+	{
+		budget = (uint64_t) sysconf (_SC_AVPHYS_PAGES) * pagesize / BUFPOOL_SHARE;
+
+		if (budget > BUFPOOL_MAX)
+			budget = BUFPOOL_MAX;
+	}
+
+	if (budget < BUFPOOL_MIN)
+		budget = BUFPOOL_MIN;
+
+	bufpool_nbufs = budget / BUFPOOL_BUFSIZE;
+
+	/*
+	 * Page aligned so the buffers never share a page and suit direct I/O
+	 */
+	if (posix_memalign ((void **) &bufpool_base, pagesize, (size_t) bufpool_nbufs * BUFPOOL_BUFSIZE) != 0 ||
+	    (bufpool_free = malloc (bufpool_nbufs * sizeof (char *))) == NULL)
+	{
+		fprintf (stderr, "Error: Unable to allocate %d MB of buffers\n", bufpool_nbufs);
+		free (bufpool_base);
+		bufpool_base = NULL;
+		return B_FALSE;
+	}
+
+	for (i = 0; i < bufpool_nbufs; i++)
+		bufpool_free[i] = bufpool_base + (size_t) i * BUFPOOL_BUFSIZE;
+
+	bufpool_nfree = bufpool_nbufs;
+
+	printf ("Memory budget: %d x %d KB buffers\n", bufpool_nbufs, BUFPOOL_BUFSIZE / 1024);
+	return B_TRUE;
+}
+
+/*
+ * Take a buffer, waiting for one if they're all in use
+ */
+char *
+bufpool_get (void)
+{
+	char *buf;
+	boolean_t sample;
+
+	(void) pthread_mutex_lock (&bufpool_lock);
+
+	if (bufpool_nfree == 0)
+	{
+		bufpool_waits++;
+
+		while (bufpool_nfree == 0)
+			(void) pthread_cond_wait (&bufpool_cv, &bufpool_lock);
+	}
+
+	buf = bufpool_free[--bufpool_nfree];
+	sample = ++bufpool_gets % BUFPOOL_SAMPLE == 1;
+
+	(void) pthread_mutex_unlock (&bufpool_lock);
+
+	if (sample == B_TRUE)
+		sample_rss ();
+
+	return buf;
+}
+
+void
+bufpool_put (char *buf)
+{
+	(void) pthread_mutex_lock (&bufpool_lock);
+	bufpool_free[bufpool_nfree++] = buf;
+	(void) pthread_cond_signal (&bufpool_cv);
+	(void) pthread_mutex_unlock (&bufpool_lock);
+}
+
+/*
+ * Say how much memory the install took and how often the copy had to
+ * wait for a buffer
+ */
+void
+bufpool_report (void)
+{
+	sample_rss ();
+
+	printf ("Peak RSS: %.1f MB", bufpool_peak / 1024.0);
+
+	if (bufpool_gets > 0)
+		printf (", %llu of %llu buffer requests waited", (unsigned long long) bufpool_waits,
+		    (unsigned long long) bufpool_gets);
+
+	printf ("\n");
+}
+
+void
+bufpool_fini (void)
+{
+	free (bufpool_base);
+	free (bufpool_free);
+	bufpool_base = NULL;
+	bufpool_free = NULL;
+	bufpool_nbufs = bufpool_nfree = 0;
+}
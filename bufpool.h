@@ -0,0 +1,41 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+
+/*
+ * A fixed pool of aligned I/O buffers which is all the memory the copy
+ * may hold at once.  Taking a buffer when none are free waits for one
+ * to come back, so a slow writer holds up the reader rather than the
+ * installer growing.
+ */
+#define BUFPOOL_BUFSIZE	(1024 * 1024)
+#define BUFPOOL_MIN	(4 * BUFPOOL_BUFSIZE)
+#define BUFPOOL_MAX	(64 * BUFPOOL_BUFSIZE)
+#define BUFPOOL_SHARE	8	/* of free memory, if no budget is given */
+
+boolean_t bufpool_init (uint64_t budget);
+char *bufpool_get (void);
+void bufpool_put (char *buf);
+void bufpool_report (void);
+void bufpool_fini (void);
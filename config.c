@@ -25,76 +25,412 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <libzfs.h>
+
+#include "disk.h"
+#include "config.h"
+#include "copy.h"
+#include "exec.h"
+#include "bootarch.h"
 
 /*
- * Final steps required to create a bootable system
- * Usage of system(3c) makes me feel dirty - find
- * out how these utilities do what they do and copy it
+ * Where installgrub puts things.  stage1 goes in the MBR and the first
+ * sector of the partition, stage2 goes in the boot slice and stage1 is
+ * patched to find it.
  */
-boolean_t
-config_grub (char *mnt, char *disk)
+#define SECTOR_SIZE		512
+#define STAGE2_BLKOFF		50	/* from the start of the fdisk partition */
+#define BOOTSZ			446	/* boot code in the MBR, then the partition table */
+#define STAGE1_BPB_OFFSET	0x3
+#define STAGE1_BPB_SIZE		0x3b
+#define STAGE1_STAGE2_ADDRESS	0x42
+#define STAGE1_STAGE2_SECTOR	0x44
+#define STAGE1_STAGE2_SEGMENT	0x48
+#define STAGE2_MEMADDR		0x8000
+#define STAGE2_BLOCKLIST	(SECTOR_SIZE - 0x8)
+#define STAGE2_INSTALLPART	(SECTOR_SIZE + 0x8)
+#define STAGE2_FORCE_LBA	(SECTOR_SIZE + 0x11)
+
+static void
+put16 (unsigned char *p, uint16_t val)
+{
+	p[0] = val & 0xff;
+	p[1] = (val >> 8) & 0xff;
+}
+
+static void
+put32 (unsigned char *p, uint32_t val)
+{
+	put16 (p, val & 0xffff);
+	put16 (p + 2, val >> 16);
+}
+
+/*
+ * Read a whole stage file, padded to a whole number of sectors
+ */
+static unsigned char *
+read_stage (char *path, size_t *size)
+{
+	int fd;
+	ssize_t len, got = 0;
+	unsigned char *buf;
+	struct stat st;
+
+	if ((fd = open (path, O_RDONLY)) == -1 || fstat (fd, &st) == -1)
+	{
+		fprintf (stderr, "Error: Unable to open %s: %s\n", path, strerror (errno));
+		if (fd != -1)
+			(void) close (fd);
+		return NULL;
+	}
+
+	*size = (st.st_size + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+
+	if (*size == 0 || (buf = calloc (1, *size)) == NULL)
+	{
+		fprintf (stderr, "Error: Unable to read %s\n", path);
+		(void) close (fd);
+		return NULL;
+	}
+
+	while (got < st.st_size)
+	{
+		if ((len = pread (fd, buf + got, st.st_size - got, got)) <= 0)
+		{
+			fprintf (stderr, "Error: Unable to read %s\n", path);
+			free (buf);
+			(void) close (fd);
+			return NULL;
+		}
+
+		got += len;
+	}
+
+	(void) close (fd);
+	return buf;
+}
+
+/*
+ * Write a buffer to the disk and make sure it got there
+ */
+static boolean_t
+write_verify (int fd, unsigned char *buf, size_t size, uint64_t sector, char *what)
 {
-	char *cmd;
+	unsigned char *check;
+	off_t offset = sector * SECTOR_SIZE;
 
-	if (asprintf (&cmd, "/usr/sbin/installgrub -mf %s/boot/grub/stage1 "
-		"%s/boot/grub/stage2 %ss0", mnt, mnt, disk) == -1)
+	if (pwrite (fd, buf, size, offset) != size)
+	{
+		fprintf (stderr, "Error: Unable to write %s: %s\n", what, strerror (errno));
+		return B_FALSE;
+	}
+
+	if ((check = malloc (size)) == NULL)
 	{
 		fprintf (stderr, "Error: out of memory\n");
 		return B_FALSE;
 	}
 
-	if (system (cmd) != 0)
+	if (pread (fd, check, size, offset) != size || memcmp (buf, check, size) != 0)
 	{
-		fprintf (stderr, "Error: installgrub failed\n");
-		free (cmd);
+		fprintf (stderr, "Error: %s did not read back correctly\n", what);
+		free (check);
 		return B_FALSE;
 	}
 
-	free (cmd);
+	free (check);
 	return B_TRUE;
 }
 
+/*
+ * Install GRUB the way installgrub -mf does, but without the fork.  The
+ * stage files are read from root, which can be the livecd.
+ */
+boolean_t
+config_grub (char *root, char *disk, root_layout_t *layout)
+{
+	int fd;
+	char path[PATH_MAX];
+	unsigned char *stage1, *stage2, sector[SECTOR_SIZE];
+	size_t stage1_size, stage2_size;
+	uint64_t stage2_sector, boot_end;
+	boolean_t ret = B_FALSE;
+
+	(void) snprintf (path, PATH_MAX, "%s/boot/grub/stage1", root);
+
+	if ((stage1 = read_stage (path, &stage1_size)) == NULL)
+		return B_FALSE;
+
+	(void) snprintf (path, PATH_MAX, "%s/boot/grub/stage2", root);
+
+	if ((stage2 = read_stage (path, &stage2_size)) == NULL)
+	{
+		free (stage1);
+		return B_FALSE;
+	}
+
+	/*
+	 * stage2 has to fit in the boot slice, after the VTOC if there is one
+	 */
+	stage2_sector = layout->rl_part_start + layout->rl_boot_start;
+
+	if (layout->rl_efi == B_FALSE)
+		stage2_sector += STAGE2_BLKOFF;
+
+	boot_end = layout->rl_part_start + layout->rl_boot_start + layout->rl_boot_size;
+
+	if (layout->rl_lbsize != SECTOR_SIZE || stage1_size != SECTOR_SIZE
+	    || stage2_sector + stage2_size / SECTOR_SIZE > boot_end)
+	{
+		fprintf (stderr, "Error: GRUB doesn't fit this disk layout\n");
+		goto out;
+	}
+
+	/*
+	 * Tell stage1 where stage2 is and stage2 where the rest of itself
+	 * and the root slice are
+	 */
+	put16 (stage1 + STAGE1_STAGE2_ADDRESS, STAGE2_MEMADDR);
+	put32 (stage1 + STAGE1_STAGE2_SECTOR, stage2_sector);
+	put16 (stage1 + STAGE1_STAGE2_SEGMENT, STAGE2_MEMADDR >> 4);
+
+	put32 (stage2 + STAGE2_BLOCKLIST, stage2_sector + 1);
+	put16 (stage2 + STAGE2_BLOCKLIST + 4, stage2_size / SECTOR_SIZE - 1);
+	put16 (stage2 + STAGE2_BLOCKLIST + 6, (STAGE2_MEMADDR + SECTOR_SIZE) >> 4);
+
+	if (layout->rl_efi == B_TRUE)
+		put32 (stage2 + STAGE2_INSTALLPART, (ROOT_SLICE << 16) | 0xffff);
+	else
+		put32 (stage2 + STAGE2_INSTALLPART, (ROOT_SLICE << 8) | 0xff);
+
+	/*
+	 * As installgrub does, always use LBA to read the disk
+	 */
+	stage2[STAGE2_FORCE_LBA] = 1;
+
+#ifdef sparc
+	(void) sprintf (path, "%ss2", disk);
+#else
+	(void) sprintf (path, "%sp0", disk);
+#endif
+
+	if ((fd = open (path, O_RDWR)) == -1)
+	{
+		fprintf (stderr, "Error: Unable to open %s: %s\n", path, strerror (errno));
+		goto out;
+	}
+
+	if (write_verify (fd, stage2, stage2_size, stage2_sector, "stage2") == B_FALSE)
+		goto out_close;
+
+	/*
+	 * The partition boot sector keeps its BPB
+	 */
+	if (layout->rl_efi == B_FALSE)
+	{
+		(void) memcpy (sector, stage1, SECTOR_SIZE);
+
+		if (pread (fd, sector + STAGE1_BPB_OFFSET, STAGE1_BPB_SIZE,
+		    layout->rl_part_start * SECTOR_SIZE + STAGE1_BPB_OFFSET) != STAGE1_BPB_SIZE)
+		{
+			fprintf (stderr, "Error: Unable to read partition boot sector\n");
+			goto out_close;
+		}
+
+		if (write_verify (fd, sector, SECTOR_SIZE, layout->rl_part_start, "stage1") == B_FALSE)
+			goto out_close;
+	}
+
+	/*
+	 * The MBR keeps its partition table
+	 */
+	if (pread (fd, sector, SECTOR_SIZE, 0) != SECTOR_SIZE)
+	{
+		fprintf (stderr, "Error: Unable to read MBR\n");
+		goto out_close;
+	}
+
+	(void) memcpy (sector, stage1, BOOTSZ);
+
+	if (write_verify (fd, sector, SECTOR_SIZE, 0, "MBR") == B_FALSE)
+		goto out_close;
+
+	ret = B_TRUE;
+
+out_close:
+	(void) close (fd);
+out:
+	free (stage1);
+	free (stage2);
+	return ret;
+}
+
+/*
+ * sdev fills these /dev directories in itself as they're looked at, so
+ * there's nothing in them to copy
+ */
+#define DEV_PATH	"/dev"
+
+static char *devfs_dynamic[] = { "net", "ipnet", "pts", "vt", "zcons", "zvol", "lofi", "rlofi", NULL };
+
+/*
+ * Copy the links in one /dev directory and the directories below it,
+ * taking ownership of srcfd and destfd.  Other filesystems mounted
+ * under /dev are skipped.  Anything that isn't a link or a directory,
+ * apart from devfsadm's own dot files, sets fallback.
+ */
+static boolean_t
+copy_dev_dir (int srcfd, int destfd, const char *path, int level, dev_t dev, boolean_t *fallback)
+{
+	int i, subsrc, subdest;
+	char subpath[PATH_MAX];
+	DIR *dir;
+	struct dirent *dp;
+	struct stat st;
+	boolean_t ret = B_TRUE;
+
+	if ((dir = fdopendir (srcfd)) == NULL)
+	{
+		fprintf (stderr, "Error: Unable to read %s: %s\n", path, strerror (errno));
+		(void) close (srcfd);
+		(void) close (destfd);
+		return B_FALSE;
+	}
+
+	while (ret == B_TRUE && (dp = readdir (dir)) != NULL)
+	{
+		if (dp->d_name[0] == '.' || fstatat (srcfd, dp->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+			continue;
+
+		if (S_ISLNK (st.st_mode))
+		{
+			ret = copy_symlink (srcfd, dp->d_name, destfd, dp->d_name);
+			continue;
+		}
+
+		if (!S_ISDIR (st.st_mode))
+		{
+			*fallback = B_TRUE;
+			continue;
+		}
+
+		for (i = 0; level == 0 && devfs_dynamic[i] != NULL; i++)
+			if (strcmp (dp->d_name, devfs_dynamic[i]) == 0)
+				break;
+
+		if ((level == 0 && devfs_dynamic[i] != NULL) || st.st_dev != dev)
+			continue;
+
+		if (snprintf (subpath, PATH_MAX, "%s/%s", path, dp->d_name) >= PATH_MAX)
+		{
+			fprintf (stderr, "Error: Path too long: %s/%s\n", path, dp->d_name);
+			ret = B_FALSE;
+		}
+		else if (mkdirat (destfd, dp->d_name, st.st_mode & 07777) == -1 && errno != EEXIST)
+		{
+			fprintf (stderr, "Error: Unable to create %s: %s\n", subpath, strerror (errno));
+			ret = B_FALSE;
+		}
+		else if ((subsrc = openat (srcfd, dp->d_name, O_RDONLY | O_DIRECTORY)) == -1)
+		{
+			fprintf (stderr, "Error: Unable to open %s: %s\n", subpath, strerror (errno));
+			ret = B_FALSE;
+		}
+		else if ((subdest = openat (destfd, dp->d_name, O_RDONLY | O_DIRECTORY)) == -1)
+		{
+			fprintf (stderr, "Error: Unable to open %s on the new root: %s\n", subpath, strerror (errno));
+			(void) close (subsrc);
+			ret = B_FALSE;
+		}
+		else
+		{
+			ret = copy_dev_dir (subsrc, subdest, subpath, level + 1, dev, fallback);
+		}
+	}
+
+	(void) closedir (dir);
+	(void) close (destfd);
+	return ret;
+}
+
+/*
+ * Populate /dev on the new root by copying the live system's links,
+ * which point into /devices and are as valid on the new root.  The
+ * live system is running on the machine being installed, so it already
+ * has a link for every device there.  devfsadm, which is slow on
+ * machines with many disks and NICs, only runs if /dev holds something
+ * else or can't be read.
+ */
 boolean_t
 config_devfs (char *mnt)
 {
-	char *cmd;
+	int srcfd, destfd;
+	char path[PATH_MAX];
+	char *argv[] = { DEVFSADM_PATH, "-r", mnt, NULL };
+	boolean_t fallback = B_FALSE;
+	struct stat st;
 
-	if (asprintf (&cmd, "/usr/sbin/devfsadm -r %s", mnt) == -1)
+	if (snprintf (path, PATH_MAX, "%s" DEV_PATH, mnt) >= PATH_MAX)
+	{
+		fprintf (stderr, "Error: Path too long: %s" DEV_PATH "\n", mnt);
+		return B_FALSE;
+	}
+
+	if ((srcfd = open (DEV_PATH, O_RDONLY | O_DIRECTORY)) == -1 || fstat (srcfd, &st) == -1)
+	{
+		if (srcfd != -1)
+			(void) close (srcfd);
+
+		fallback = B_TRUE;
+	}
+	else if ((mkdir (path, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == -1 && errno != EEXIST) ||
+	    (destfd = open (path, O_RDONLY | O_DIRECTORY)) == -1)
+	{
+		fprintf (stderr, "Error: Unable to create %s: %s\n", path, strerror (errno));
+		(void) close (srcfd);
+		return B_FALSE;
+	}
+	else if (copy_dev_dir (srcfd, destfd, DEV_PATH, 0, st.st_dev, &fallback) == B_FALSE)
 	{
-		fprintf (stderr, "Error: out of memory\n");
 		return B_FALSE;
 	}
 
-	if (system (cmd) != 0)
+	if (fallback == B_FALSE)
+		return B_TRUE;
+
+	if (exec_cmd (argv, NULL, NULL) == B_FALSE)
 	{
 		fprintf (stderr, "Error: devfsadm failed\n");
-		free (cmd);
 		return B_FALSE;
 	}
 
-	free (cmd);
 	return B_TRUE;
 }
 
 boolean_t
 config_bootadm (char *mnt)
 {
-	char *cmd;
+	char *argv[] = { BOOTADM_PATH, "update-archive", "-R", mnt, NULL };
 
-	if (asprintf (&cmd, "/usr/sbin/bootadm update-archive -R %s\n", mnt) == -1)
-	{
-		fprintf (stderr, "Error: out of memory\n");
-		return B_FALSE;
-	}
+	/*
+	 * Nothing to do if the archives were built during the copy or the
+	 * livecd's were good enough
+	 */
+	if (bootarch_wait () == B_TRUE)
+		return B_TRUE;
 
-	if (system (cmd) != 0)
+	if (exec_cmd (argv, NULL, NULL) == B_FALSE)
 	{
 		fprintf (stderr, "Error: bootadm failed\n");
-		free (cmd);
 		return B_FALSE;
 	}
 
-	free (cmd);
 	return B_TRUE;
 }
-
@@ -26,6 +26,19 @@
 #define DEFAULT_MNT_POINT "/mnt"
 #define DEFAULT_CDROM_PATH "/.cdrom"
 
-boolean_t config_grub (char *mnt, char *disk);
+/*
+ * The Makefile can point these elsewhere
+ */
+#ifndef DEVFSADM_PATH
+#define DEVFSADM_PATH "/usr/sbin/devfsadm"
+#endif
+#ifndef BOOTADM_PATH
+#define BOOTADM_PATH "/usr/sbin/bootadm"
+#endif
+#ifndef MKISOFS_PATH
+#define MKISOFS_PATH "/usr/bin/mkisofs"
+#endif
+
+boolean_t config_grub (char *root, char *disk, root_layout_t *layout);
 boolean_t config_devfs (char *mnt);
 boolean_t config_bootadm (char *mnt);
@@ -30,20 +30,176 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <ftw.h>
+#include <time.h>
+#include <sha1.h>
+#include <sys/mman.h>
 #include <sys/sendfile.h>
 
-extern char temp_mount[PATH_MAX];
-extern char cdrom_path[PATH_MAX];
+#include "copy.h"
+#include "manifest.h"
+#include "bufpool.h"
+#include "iso.h"
+#include "bootlist.h"
+#include "streams.h"
+#include "bootarch.h"
+#include "fanout.h"
+#include "trace.h"
+#include "progress.h"
+
+static boolean_t copy_drop_cache = B_FALSE;
+static boolean_t copy_image_pread = B_FALSE;
 
 /*
- * Copy a file to a new destination
+ * Decide whether to drop copied pages.  Free memory is judged once, up
+ * front, when the live system is all that's using it.
+ *
+ * Only Linux can drop them.  illumos' posix_fadvise does nothing, and
+ * ZFS keeps file data in the ARC rather than the page cache, so there
+ * the pages are always kept instead of being synced for no gain.
+ */
+void
+copy_cache_mode (cache_mode_t mode)
+{
+#ifndef __linux__
+	if (mode == CACHE_DROP)
+		puts ("Copied files can't be dropped from the cache on this system, keeping them");
+
+	mode = CACHE_KEEP;
+#endif
+
+	if (mode == CACHE_AUTO)
+		mode = sysconf (_SC_AVPHYS_PAGES) < sysconf (_SC_PHYS_PAGES) / COPY_LOWMEM_SHARE ? CACHE_DROP : CACHE_KEEP;
+
+	if ((copy_drop_cache = mode == CACHE_DROP ? B_TRUE : B_FALSE) == B_TRUE)
+		puts ("Dropping copied files from the page cache");
+}
+
+/*
+ * Read files out of an ISO image with pread rather than through its
+ * mapping.  Slower, but reads can be seen and held up by stub/slowio.c
+ * where page faults can't.
+ */
+void
+copy_pread_image (boolean_t pread)
+{
+	copy_image_pread = pread;
+}
+
+/*
+ * Drop a copied range of a file from the page cache.  Dirty pages can't
+ * be dropped, so with wait set the range is written back first.
+ */
+void
+copy_drop (int fd, off_t offset, off_t len, boolean_t wait)
+{
+	if (copy_drop_cache == B_FALSE || len == 0)
+		return;
+
+	if (wait == B_TRUE)
+	{
+#ifdef SYNC_FILE_RANGE_WRITE
+		(void) sync_file_range (fd, offset, len,
+		    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#else
+		(void) fdatasync (fd);
+#endif
+	}
+
+	(void) posix_fadvise (fd, offset, len, POSIX_FADV_DONTNEED);
+}
+
+/*
+ * Whether a root is still being copied to.  Fanout writers and copy
+ * streams clear the flag while the walk reads it, so it's only touched
+ * with atomics until they've finished.
+ */
+boolean_t
+copy_root_ok (boolean_t *ok)
+{
+	return __sync_add_and_fetch (ok, 0);
+}
+
+void
+copy_root_failed (boolean_t *ok)
+{
+	(void) __sync_bool_compare_and_swap (ok, B_TRUE, B_FALSE);
+}
+
+/*
+ * Create a file, replacing any that's there, and give it the source's
+ * owner
+ */
+static int
+create_file (const char *dest, const struct stat *statptr)
+{
+	int fd;
+
+	if ((fd = creat (dest, statptr->st_mode)) == -1)
+	{
+		if (errno == EEXIST)
+		{
+			if (unlink (dest) == -1)
+			{
+				fprintf (stderr, "Unable to remove file %s: %s\n", dest, strerror (errno));
+				return -1;
+			}
+
+			if ((fd = creat (dest, statptr->st_mode)) == -1)
+			{
+				fprintf (stderr, "Unable to recreate file %s: %s\n", dest, strerror (errno));
+				return -1;
+			}
+		}
+		else
+		{
+			fprintf (stderr, "Unable to create file %s: %s\n", dest, strerror (errno));
+			return -1;
+		}
+	}
+
+	/*
+	 * Copy ownership
+	 */
+	if (fchown (fd, statptr->st_uid, statptr->st_gid) == -1)
+	{
+		fprintf (stderr, "Unable to chown file %s: %s\n", dest, strerror (errno));
+		(void) close (fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/*
+ * Keep the times so an upgrade can tell the file hasn't changed
  */
 static boolean_t
+copy_times (int fd, const char *dest, const struct stat *statptr)
+{
+	struct timespec times[2];
+
+	times[0] = statptr->st_atim;
+	times[1] = statptr->st_mtim;
+
+	if (futimens (fd, times) == -1)
+	{
+		fprintf (stderr, "Unable to set times on file %s: %s\n", dest, strerror (errno));
+		return B_FALSE;
+	}
+
+	return B_TRUE;
+}
+
+/*
+ * Copy a file to a new destination
+ */
+boolean_t
 copy_file (const char *path, const char *dest, const struct stat *statptr)
 {
 	int in_fd, out_fd;
 	struct stat in_stat;
-	off_t offset = 0;
+	off_t offset = 0, start;
+	ssize_t len, n;
 
 	/*
 	 * Stat the file if the caller hasn't
@@ -68,171 +224,676 @@ copy_file (const char *path, const char *dest, const struct stat *statptr)
 		return B_FALSE;
 	}
 
-	if ((out_fd = creat (dest, in_stat.st_mode)) == -1)
+	if ((out_fd = create_file (dest, &in_stat)) == -1)
 	{
-		if (errno == EEXIST)
+		(void) close (in_fd);
+		return B_FALSE;
+	}
+
+	/*
+	 * Copy contents over a window at a time.  Only whole windows are
+	 * waited for; smaller pieces are left to write back by themselves.
+	 * Each window goes a chunk at a time so the copy streams see the
+	 * bytes as they're written.
+	 */
+	while (offset < in_stat.st_size)
+	{
+		start = offset;
+		len = in_stat.st_size - offset;
+
+		if (len > COPY_WINDOW)
+			len = COPY_WINDOW;
+
+		while (offset < start + len)
 		{
-			if (unlink (dest) == -1)
+			n = start + len - offset;
+
+			if ((n = sendfile (out_fd, in_fd, &offset, n > COPY_CHUNK ? COPY_CHUNK : n)) == -1)
 			{
-				fprintf (stderr, "Unable to remove file %s: %s\n", dest, strerror (errno));
+				if (errno == EINTR)
+					continue;
+
+				fprintf (stderr, "Unable to copy file %s: %s\n", path, strerror (errno));
 				(void) close (in_fd);
+				(void) close (out_fd);
+				return B_FALSE;
+			}
+
+			if (n == 0)
+				break;
+
+			streams_wrote (n);
+		}
+
+		/*
+		 * The file got shorter
+		 */
+		if ((len = offset - start) == 0)
+			break;
+
+		copy_drop (in_fd, start, len, B_FALSE);
+		copy_drop (out_fd, start, len, len == COPY_WINDOW ? B_TRUE : B_FALSE);
+	}
+
+	if (copy_times (out_fd, dest, &in_stat) == B_FALSE)
+	{
+		(void) close (in_fd);
+		(void) close (out_fd);
+		return B_FALSE;
+	}
+
+	(void) close (in_fd);
+	(void) close (out_fd);
+	return B_TRUE;
+}
+
+/*
+ * Copy a file out of a mapped ISO image, writing straight from its
+ * extent a window at a time
+ */
+static boolean_t
+copy_extent (iso_t *iso, const char *dest, const struct stat *statptr)
+{
+	int fd;
+	const unsigned char *data = iso_data (iso, statptr);
+	off_t offset = 0, start;
+	ssize_t len, n;
+
+	if ((fd = create_file (dest, statptr)) == -1)
+		return B_FALSE;
+
+	iso_advise (iso, statptr, 0, statptr->st_size, MADV_WILLNEED);
+
+	while (offset < statptr->st_size)
+	{
+		start = offset;
+		len = statptr->st_size - offset;
+
+		if (len > COPY_WINDOW)
+			len = COPY_WINDOW;
+
+		while (offset < start + len)
+		{
+			n = start + len - offset;
+
+			if ((n = write (fd, data + offset, n > COPY_CHUNK ? COPY_CHUNK : n)) == -1)
+			{
+				if (errno == EINTR)
+					continue;
+
+				fprintf (stderr, "Unable to write file %s: %s\n", dest, strerror (errno));
+				(void) close (fd);
 				return B_FALSE;
 			}
 
-			if ((out_fd = creat (dest, in_stat.st_mode)) == -1)
+			offset += n;
+			streams_wrote (n);
+		}
+
+		if (copy_drop_cache == B_TRUE)
+		{
+			iso_advise (iso, statptr, start, len, MADV_DONTNEED);
+			copy_drop (iso->i_fd, (off_t) statptr->st_ino * iso->i_blksize + start, len, B_FALSE);
+		}
+
+		copy_drop (fd, start, len, len == COPY_WINDOW ? B_TRUE : B_FALSE);
+	}
+
+	if (copy_times (fd, dest, statptr) == B_FALSE)
+	{
+		(void) close (fd);
+		return B_FALSE;
+	}
+
+	(void) close (fd);
+	return B_TRUE;
+}
+
+/*
+ * Point a symlink at target, replacing an existing one
+ */
+static boolean_t
+make_symlink (const char *target, const char *path, int destfd, const char *dest)
+{
+	if (symlinkat (target, destfd, dest) == -1)
+	{
+		/*
+		 * If the symlink exists recreat it
+		 */
+		if (errno == EEXIST)
+		{
+			if (unlinkat (destfd, dest, 0) == -1)
 			{
-				fprintf (stderr, "Unable to recreate file %s: %s\n", dest, strerror (errno));
-				(void) close (in_fd);
+				fprintf (stderr, "Unable to remove symlink %s: %s\n", dest, strerror (errno));
+				return B_FALSE;
+			}
+
+			if (symlinkat (target, destfd, dest) == -1)
+			{
+				fprintf (stderr, "Unable to recreate symlink %s: %s\n", dest, strerror (errno));
 				return B_FALSE;
 			}
 		}
 		else
 		{
-			fprintf (stderr, "Unable to create file %s: %s\n", dest, strerror (errno));
-			(void) close (in_fd);
+			fprintf (stderr, "Unable to replicate symlink %s: %s\n", path, strerror (errno));
 			return B_FALSE;
 		}
 	}
 
-	/*
-	 * Copy ownership
-	 */
-	if (chown (dest, in_stat.st_uid, in_stat.st_gid) == -1)
+	return B_TRUE;
+}
+
+/*
+ * Replicate a symlink.  Both paths may be relative to a directory fd or
+ * AT_FDCWD.  An existing link is replaced.
+ */
+boolean_t
+copy_symlink (int srcfd, const char *path, int destfd, const char *dest)
+{
+	ssize_t len;
+	char target[PATH_MAX];
+
+	if ((len = readlinkat (srcfd, path, target, PATH_MAX - 1)) == -1)
 	{
-		fprintf (stderr, "Unable to chown file %s: %s\n", dest, strerror (errno));
-		(void) close (in_fd);
-		(void) close (out_fd);
+		fprintf (stderr, "Unable to read symlink %s: %s\n", path, strerror (errno));
 		return B_FALSE;
 	}
 
-	/*
-	 * Copy contents over
-	 */
-	if (sendfile (out_fd, in_fd, &offset, in_stat.st_size) == -1)
+	target[len] = '\0';
+
+	return make_symlink (target, path, destfd, dest);
+}
+
+/*
+ * Files we replace with generated ones
+ */
+static void
+write_bootenv (FILE *fp)
+{
+	fprintf (fp, "#\n");
+	fprintf (fp, "# Copyright 2005 Sun Microsystems, Inc.  All rights reserved.\n");
+	fprintf (fp, "# Use is subject to license terms.\n");
+	fprintf (fp, "#\n");
+	fprintf (fp, "#	bootenv.rc -- boot \"environment variables\"\n");
+	fprintf (fp, "#\n");
+	fprintf (fp, "#setprop kbd-type German\n");
+	fprintf (fp, "setprop kbd-type US-English\n");
+	fprintf (fp, "setprop ata-dma-enabled 1\n");
+	fprintf (fp, "setprop atapi-cd-dma-enabled 1\n");
+	fprintf (fp, "setprop ttyb-rts-dtr-off false\n");
+	fprintf (fp, "setprop ttyb-ignore-cd true\n");
+	fprintf (fp, "setprop ttya-rts-dtr-off false\n");
+	fprintf (fp, "setprop ttya-ignore-cd true\n");
+	fprintf (fp, "setprop ttyb-mode 9600,8,n,1,-\n");
+	fprintf (fp, "setprop ttya-mode 9600,8,n,1,-\n");
+	fprintf (fp, "setprop lba-access-ok 1\n");
+}
+
+static void
+write_vfstab (FILE *fp)
+{
+	fprintf (fp, "#device		device		mount		FS	fsck	mount	mount\n");
+	fprintf (fp, "#to mount	to fsck		point		type	pass	at boot	options\n");
+	fprintf (fp, "#\n");
+	fprintf (fp, "/devices	-		/devices	devfs	-	no	-\n");
+	fprintf (fp, "/proc		-		/proc		proc	-	no	-\n");
+	fprintf (fp, "ctfs		-		/system/contract ctfs	-	no	-\n");
+	fprintf (fp, "objfs		-		/system/object	objfs	-	no	-\n");
+	fprintf (fp, "sharefs		-		/etc/dfs/sharetab	sharefs	-	no	-\n");
+	fprintf (fp, "fd		-		/dev/fd		fd	-	no	-\n");
+	fprintf (fp, "swap		-		/tmp		tmpfs	-	yes	-\n");
+}
+
+static struct overlay
+{
+	char *o_path;
+	void (*o_write) (FILE *fp);
+} overlays[] =
+{
+	{ "/boot/solaris/bootenv.rc",	write_bootenv },
+	{ "/etc/vfstab",		write_vfstab }
+};
+
+#define NUM_OVERLAYS	(sizeof (overlays) / sizeof (overlays[0]))
+
+/*
+ * Return the nth generated file, or NULL when there are no more
+ */
+char *
+overlay_path (int n)
+{
+	if (n < 0 || n >= NUM_OVERLAYS)
+		return NULL;
+
+	return overlays[n].o_path;
+}
+
+/*
+ * Write the contents of the nth generated file
+ */
+void
+overlay_write (int n, FILE *fp)
+{
+	overlays[n].o_write (fp);
+}
+
+/*
+ * Write all of the generated files.  This runs alongside copy_files so
+ * parent directories may not exist yet; copy_files fixes their modes
+ * when it gets to them.
+ */
+boolean_t
+write_overlays (char *mnt)
+{
+	int i;
+	char *p, dest[PATH_MAX];
+	FILE *fp;
+
+	for (i = 0; i < NUM_OVERLAYS; i++)
 	{
-		fprintf (stderr, "Unable to copy file %s: %s\n", path, strerror (errno));
-		(void) close (in_fd);
-		(void) close (out_fd);
-		return B_FALSE;
+		(void) snprintf (dest, PATH_MAX, "%s%s", mnt, overlays[i].o_path);
+
+		for (p = dest + strlen (mnt) + 1; (p = strchr (p, '/')) != NULL; p++)
+		{
+			*p = '\0';
+
+			if (mkdir (dest, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == -1
+			    && errno != EEXIST)
+			{
+				fprintf (stderr, "Unable to create directory %s: %s\n", dest, strerror (errno));
+				return B_FALSE;
+			}
+
+			*p = '/';
+		}
+
+		if ((fp = fopen (dest, "w+")) == NULL)
+		{
+			fprintf (stderr, "Unable to open %s: %s\n", dest, strerror (errno));
+			return B_FALSE;
+		}
+
+		overlays[i].o_write (fp);
+
+		if (fclose (fp) == EOF)
+		{
+			fprintf (stderr, "Unable to write %s: %s\n", dest, strerror (errno));
+			return B_FALSE;
+		}
+
+		bootarch_copied (overlays[i].o_path);
 	}
 
-	(void) close (in_fd);
-	(void) close (out_fd);
 	return B_TRUE;
 }
 
-#define BOOTRCPATH	"/boot/solaris/bootenv.rc"
-#define BOOTRCLEN	24
-#define MENULSTPATH	"/boot/grub/menu.lst"
-#define MENULSTLEN	19
-#define VFSTABPATH	"/etc/vfstab"
-#define VFSTABLEN	11
 #define DOTCDROMPATH	"/.cdrom"
 #define DOTCDROMLEN	7
 
 /*
- * Install a file/directory/symlink.  Called by copy_files
+ * Where copy_files is copying from and to.  nftw gives us no way to
+ * pass these to process_path.
  */
-static int
-process_path (const char *path, const struct stat *statptr, int fileflag, struct FTW *pftw)
+static char copy_base[PATH_MAX];
+static char **copy_mnt;
+static boolean_t *copy_ok;
+static int copy_nmnt;
+static fanout_t *copy_fanout;
+static iso_t *copy_iso;
+static boolean_t copy_streams;
+static manifest_t *copy_manifest;
+static copy_pass_t copy_pass;
+static int copy_nboot;
+
+/*
+ * Create a directory on one root and copy its permissions
+ */
+static boolean_t
+copy_dir (const char *dest, const struct stat *statptr, int level)
 {
-	int read;
-	char base[PATH_MAX], dest[PATH_MAX], target[PATH_MAX];
+	if (mkdir (dest, statptr->st_mode) == -1)
+	{
+		/*
+		 * If the directory exists just copy permissions as it might be a mountpoint
+		 */
+		if (errno == EEXIST)
+		{
+			/*
+			 * But not on the parent directory/root mountpoint
+			 */
+			if (level == 0)
+				return B_TRUE;
 
-	/*
-	 * Work out where we're copying to... again
-	 */
-	if (realpath (cdrom_path, base) == NULL)
+			if (chmod (dest, statptr->st_mode) == -1)
+			{
+				fprintf (stderr, "Unable to chmod directory %s: %s\n", dest, strerror (errno));
+				return B_FALSE;
+			}
+		}
+		else
+		{
+			fprintf (stderr, "Unable to create directory %s: %s\n", dest, strerror (errno));
+			return B_FALSE;
+		}
+	}
+
+	if (chown (dest, statptr->st_uid, statptr->st_gid) == -1)
 	{
-		perror ("Unable to resolve cdrom path");
-		return 1;
+		fprintf (stderr, "Unable to chown directory %s: %s\n", dest, strerror (errno));
+		return B_FALSE;
 	}
 
+	return B_TRUE;
+}
+
+/*
+ * Write a piece of a file out in COPY_CHUNK sized calls
+ */
+static boolean_t
+write_piece (int fd, const char *dest, const char *buf, ssize_t len)
+{
+	ssize_t n;
+
+	while (len > 0)
+	{
+		if ((n = write (fd, buf, len > COPY_CHUNK ? COPY_CHUNK : len)) == -1)
+		{
+			if (errno == EINTR)
+				continue;
+
+			fprintf (stderr, "Unable to write file %s: %s\n", dest, strerror (errno));
+			return B_FALSE;
+		}
+
+		buf += n;
+		len -= n;
+		streams_wrote (n);
+	}
+
+	return B_TRUE;
+}
+
+/*
+ * Copy a file out of the image with pread for copy_pread_image.  Each
+ * piece is read once, hashed and written to every root still going.
+ * Only a failed read returns B_FALSE.
+ */
+static boolean_t
+copy_read_extent (const char *rel, const struct stat *statptr, unsigned char *hash)
+{
+	int i, *fd;
+	char dest[PATH_MAX], *buf;
+	off_t base = (off_t) statptr->st_ino * copy_iso->i_blksize, offset = 0, window = 0;
+	ssize_t len, n;
+	boolean_t ret = B_TRUE;
+	SHA1_CTX ctx;
+
+	if ((fd = malloc (copy_nmnt * sizeof (int))) == NULL)
+	{
+		fprintf (stderr, "Error: out of memory\n");
+		return B_FALSE;
+	}
+
+	for (i = 0; i < copy_nmnt; i++)
+	{
+		(void) sprintf (dest, "%s/%s", copy_mnt[i], rel);
+
+		if (copy_root_ok (&copy_ok[i]) == B_FALSE)
+			fd[i] = -1;
+		else if ((fd[i] = create_file (dest, statptr)) == -1)
+			copy_root_failed (&copy_ok[i]);
+	}
+
+	buf = bufpool_get ();
+	SHA1Init (&ctx);
+
+	while (offset < statptr->st_size)
+	{
+		len = statptr->st_size - offset;
+
+		if (len > BUFPOOL_BUFSIZE)
+			len = BUFPOOL_BUFSIZE;
+
+		if ((n = pread (copy_iso->i_fd, buf, len, base + offset)) <= 0)
+		{
+			if (n == -1 && errno == EINTR)
+				continue;
+
+			fprintf (stderr, "Unable to read %s from %s: %s\n", rel, copy_iso->i_path,
+			    n == 0 ? "Image is truncated" : strerror (errno));
+			ret = B_FALSE;
+			break;
+		}
+
+		SHA1Update (&ctx, buf, n);
+
+		for (i = 0; i < copy_nmnt; i++)
+		{
+			(void) sprintf (dest, "%s/%s", copy_mnt[i], rel);
+
+			if (fd[i] != -1 && write_piece (fd[i], dest, buf, n) == B_FALSE)
+			{
+				(void) close (fd[i]);
+				fd[i] = -1;
+				copy_root_failed (&copy_ok[i]);
+			}
+		}
+
+		offset += n;
+		copy_drop (copy_iso->i_fd, base + offset - n, n, B_FALSE);
+
+		/*
+		 * Written pages are dropped a window at a time, as for
+		 * copy_extent
+		 */
+		if (offset - window >= COPY_WINDOW || offset == statptr->st_size)
+		{
+			for (i = 0; i < copy_nmnt; i++)
+				if (fd[i] != -1)
+					copy_drop (fd[i], window, offset - window,
+					    offset - window >= COPY_WINDOW ? B_TRUE : B_FALSE);
+
+			window = offset;
+		}
+	}
+
+	bufpool_put (buf);
+	SHA1Final (hash, &ctx);
+
+	for (i = 0; i < copy_nmnt; i++)
+	{
+		if (fd[i] == -1)
+			continue;
+
+		(void) sprintf (dest, "%s/%s", copy_mnt[i], rel);
+
+		if (ret == B_FALSE || copy_times (fd[i], dest, statptr) == B_FALSE)
+			copy_root_failed (&copy_ok[i]);
+
+		(void) close (fd[i]);
+	}
+
+	free (fd);
+	return ret;
+}
+
+/*
+ * Copy one file to the roots.  An image is already in memory, so each
+ * root is written straight from the mapping, or from one read of each
+ * piece with copy_pread_image; otherwise there's only the one root.
+ * Called by process_path or by the copy streams, so it may be running
+ * in several threads at once.
+ */
+static boolean_t
+copy_one (const char *path, const char *rel, const struct stat *statptr)
+{
+	int i;
+	char dest[PATH_MAX];
+	unsigned char hash[MANIFEST_HASHLEN];
+	boolean_t trace = trace_sample (), hashed;
+	double span = trace_start ();
+	SHA1_CTX ctx;
+
+	if (copy_iso != NULL && copy_image_pread == B_TRUE)
+	{
+		if (copy_read_extent (rel, statptr, hash) == B_FALSE)
+			return B_FALSE;
+
+		hashed = B_TRUE;
+
+		if (trace == B_TRUE)
+			trace_end ("copy", rel, span);
+	}
+	else if (copy_iso != NULL)
+	{
+		/*
+		 * Hashing first brings the extent in before the roots are
+		 * written from it, rather than after it may have been dropped
+		 */
+		SHA1Init (&ctx);
+		SHA1Update (&ctx, iso_data (copy_iso, statptr), statptr->st_size);
+		SHA1Final (hash, &ctx);
+		hashed = B_TRUE;
+
+		for (i = 0; i < copy_nmnt; i++)
+		{
+			(void) sprintf (dest, "%s/%s", copy_mnt[i], rel);
+
+			if (copy_root_ok (&copy_ok[i]) == B_TRUE && copy_extent (copy_iso, dest, statptr) == B_FALSE)
+				copy_root_failed (&copy_ok[i]);
+		}
+
+		if (trace == B_TRUE)
+			trace_end ("copy", rel, span);
+	}
+	else
+	{
+		(void) sprintf (dest, "%s/%s", copy_mnt[0], rel);
+
+		if (copy_file (path, dest, statptr) == B_FALSE)
+		{
+			fprintf (stderr, "Unable to copy %s\n", path);
+			copy_root_failed (&copy_ok[0]);
+			return B_FALSE;
+		}
+
+		if (trace == B_TRUE)
+			trace_end ("copy", dest, span);
+
+		/*
+		 * sendfile kept the data out of our hands, and reading it
+		 * back would double the copy's reads, so only the size and
+		 * mtime are recorded
+		 */
+		hashed = B_FALSE;
+	}
+
+	/*
+	 * The manifest records what the file was like so that an upgrade
+	 * can tell whether it has been edited since.  A hash is added when
+	 * the data passed through our hands anyway.
+	 */
+	if (hashed == B_TRUE && manifest_hashed (copy_manifest, rel, hash) == B_FALSE)
+		return B_FALSE;
+
+	progress_bytes (statptr->st_size);
+	progress_file ();
+
+	/*
+	 * Let the boot archive builder know it's there
+	 */
+	bootarch_copied (rel);
+
+	return B_TRUE;
+}
+
+/*
+ * Install a file/directory/symlink on every root still going.  Called
+ * by copy_files.  Only a failure on the source side stops the walk.
+ */
+static int
+process_path (const char *path, const struct stat *statptr, int fileflag, struct FTW *pftw)
+{
+	int i;
+	const char *rel = path + strlen (copy_base);
+	char dest[PATH_MAX];
+	unsigned char hash[MANIFEST_HASHLEN];
+
 	switch (fileflag)
 	{
 		case FTW_F:
 
-			(void) sprintf (dest, "%s/%s", temp_mount, path + strlen (base));
+			/*
+			 * Generated files are written by write_overlays
+			 */
+			for (i = 0; i < NUM_OVERLAYS; i++)
+				if (strcmp (rel, overlays[i].o_path) == 0)
+					return 0;
 
 			/*
-			 * Replace /boot/solaris/bootenv.rc with a generated one
+			 * The first pass sees every file, so it counts what
+			 * the progress report has to get through
 			 */
-			if (strncmp (path + strlen (path) - BOOTRCLEN, BOOTRCPATH, BOOTRCLEN) == 0)
-			{
-				FILE *fp;
+			if (copy_pass == COPY_BOOT && bootarch_skip (rel) == B_FALSE)
+				progress_count (statptr->st_size);
 
-				if ((fp = fopen (dest, "w+")) == NULL)
-				{
-					perror ("Unable to open bootenv.rc");
-					return 1;
-				}
-
-				fprintf (fp, "#\n");
-				fprintf (fp, "# Copyright 2005 Sun Microsystems, Inc.  All rights reserved.\n");
-				fprintf (fp, "# Use is subject to license terms.\n");
-				fprintf (fp, "#\n");
-				fprintf (fp, "#	bootenv.rc -- boot \"environment variables\"\n");
-				fprintf (fp, "#\n");
-				fprintf (fp, "#setprop kbd-type German\n");
-				fprintf (fp, "setprop kbd-type US-English\n");
-				fprintf (fp, "setprop ata-dma-enabled 1\n");
-				fprintf (fp, "setprop atapi-cd-dma-enabled 1\n");
-				fprintf (fp, "setprop ttyb-rts-dtr-off false\n");
-				fprintf (fp, "setprop ttyb-ignore-cd true\n");
-				fprintf (fp, "setprop ttya-rts-dtr-off false\n");
-				fprintf (fp, "setprop ttya-ignore-cd true\n");
-				fprintf (fp, "setprop ttyb-mode 9600,8,n,1,-\n");
-				fprintf (fp, "setprop ttya-mode 9600,8,n,1,-\n");
-				fprintf (fp, "setprop lba-access-ok 1\n");
-
-				(void) fclose (fp);
-			}
 			/*
-			 * Replace /etc/vfstab with a generated one
+			 * Boot-critical files go in the first pass and
+			 * everything else in the second
 			 */
-			else if (strncmp (path + strlen (path) - VFSTABLEN, VFSTABPATH, VFSTABLEN) == 0)
-			{
-				FILE *fp;
+			if (bootlist_match (rel) != (copy_pass == COPY_BOOT ? B_TRUE : B_FALSE))
+				return 0;
+
+			if (manifest_add (copy_manifest, rel, statptr) == B_FALSE)
+				return 1;
+
+			/*
+			 * Boot archives being built by bootarch are left alone
+			 */
+			if (bootarch_skip (rel) == B_TRUE)
+				return 0;
 
-				if ((fp = fopen (dest, "w+")) == NULL)
-				{
-					perror ("Unable to open vfstab");
+			if (copy_pass == COPY_BOOT)
+				copy_nboot++;
+
+			/*
+			 * Several roots share one read of the file
+			 */
+			if (copy_fanout != NULL)
+			{
+				if (fanout_file (copy_fanout, path, rel, statptr, hash) == B_FALSE ||
+				    manifest_hashed (copy_manifest, rel, hash) == B_FALSE)
 					return 1;
-				}
-
-				fprintf (fp, "#device		device		mount		FS	fsck	mount	mount\n");
-				fprintf (fp, "#to mount	to fsck		point		type	pass	at boot	options\n");
-				fprintf (fp, "#\n");
-				fprintf (fp, "/devices	-		/devices	devfs	-	no	-\n");
-				fprintf (fp, "/proc		-		/proc		proc	-	no	-\n");
-				fprintf (fp, "ctfs		-		/system/contract ctfs	-	no	-\n");
-				fprintf (fp, "objfs		-		/system/object	objfs	-	no	-\n");
-				fprintf (fp, "sharefs		-		/etc/dfs/sharetab	sharefs	-	no	-\n");
-				fprintf (fp, "fd		-		/dev/fd		fd	-	no	-\n");
-				fprintf (fp, "swap		-		/tmp		tmpfs	-	yes	-\n");
-
-				(void) fclose (fp);
+
+				break;
 			}
-			else
+
+			/*
+			 * Hand the file to the copy streams, or copy it here
+			 * if they couldn't be started
+			 */
+			if (copy_streams == B_TRUE)
 			{
-				/*
-				 * Copy file to new destination
-				 */
-				if (copy_file (path, dest, statptr) == B_FALSE)
-				{
-					fprintf (stderr, "Unable to copy %s\n", path);
+				if (streams_submit (path, rel, statptr) == B_FALSE)
 					return 1;
-				}
+
+				break;
 			}
 
+			if (copy_one (path, rel, statptr) == B_FALSE)
+				return 1;
+
 			break;
 
 		case FTW_D:
 
 			/*
-			 * Create new directory and copy permissions
+			 * Directories and symlinks are all made in the first
+			 * pass
 			 */
-			(void) sprintf (dest, "%s/%s", temp_mount, path + strlen (base));
+			if (copy_pass == COPY_REST)
+				return 0;
 
 			/*
 			 * Don't bother copying the /.cdrom dir as it confuses the
@@ -242,79 +903,41 @@ process_path (const char *path, const struct stat *statptr, int fileflag, struct
 			    && pftw->level == 1)
 				return 0;
 
-			if (mkdir (dest, statptr->st_mode) == -1)
-			{
-				/*
-				 * If the directory exists just copy permissions as it might be a mountpoint
-				 */
-				if (errno == EEXIST)
-				{
-					/*
-					 * But not on the parent directory/root mountpoint
-					 */
-					if (pftw->level == 0)
-						return 0;
-
-					if (chmod (dest, statptr->st_mode) == -1)
-					{
-						fprintf (stderr, "Unable to chmod directory %s: %s\n", dest, strerror (errno));
-						return 1;
-					}
-				}
-				else
-				{
-					fprintf (stderr, "Unable to create directory %s: %s\n", dest, strerror (errno));
-					return 1;
-				}
-			}
+			if (pftw->level > 0 && manifest_add (copy_manifest, rel, NULL) == B_FALSE)
+				return 1;
 
-			if (chown (dest, statptr->st_uid, statptr->st_gid) == -1)
+			/*
+			 * Create new directory and copy permissions
+			 */
+			for (i = 0; i < copy_nmnt; i++)
 			{
-				fprintf (stderr, "Unable to chown directory %s: %s\n", dest, strerror (errno));
-				return 1;
+				(void) sprintf (dest, "%s/%s", copy_mnt[i], rel);
+
+				if (copy_root_ok (&copy_ok[i]) == B_TRUE && copy_dir (dest, statptr, pftw->level) == B_FALSE)
+					copy_root_failed (&copy_ok[i]);
 			}
 
 			break;
 
 		case FTW_SL:
 
+			if (copy_pass == COPY_REST)
+				return 0;
+
+			if (manifest_add (copy_manifest, rel, NULL) == B_FALSE)
+				return 1;
+
 			/*
 			 * Replicate symlink
 			 */
-			(void) sprintf (dest, "%s/%s", temp_mount, path + strlen (base));
-
-			if ((read = readlink (path, target, PATH_MAX)) == -1)
+			for (i = 0; i < copy_nmnt; i++)
 			{
-				fprintf (stderr, "Unable to read symlink %s: %s\n", path, strerror (errno));
-				return 1;
-			}
+				(void) sprintf (dest, "%s/%s", copy_mnt[i], rel);
 
-			target[read] = '\0';
-
-			if (symlink(target, dest) == -1)
-			{
-				/*
-				 * If the symlink exists recreat it
-				 */
-				if (errno == EEXIST)
-				{
-					if (unlink (dest) == -1)
-					{
-						fprintf (stderr, "Unable to remove symlink %s: %s\n", dest, strerror (errno));
-						return 1;
-					}
-
-					if (symlink (target, dest) == -1)
-					{
-						fprintf (stderr, "Unable to recreate symlink %s: %s\n", dest, strerror (errno));
-						return 1;
-					}
-				}
-				else
-				{
-					fprintf (stderr, "Unable to replicate symlink %s: %s\n", path, strerror (errno));
-					return 1;
-				}
+				if (copy_root_ok (&copy_ok[i]) == B_TRUE && (copy_iso != NULL ?
+				    make_symlink (copy_iso->i_link, path, AT_FDCWD, dest) :
+				    copy_symlink (AT_FDCWD, path, AT_FDCWD, dest)) == B_FALSE)
+					copy_root_failed (&copy_ok[i]);
 			}
 
 			break;
@@ -330,36 +953,176 @@ process_path (const char *path, const struct stat *statptr, int fileflag, struct
 }
 
 /*
- * Copy livecd files to new root fs
+ * Set up for copying src to the roots
  */
-boolean_t
-copy_files (void)
+static boolean_t
+copy_start (char *src, char **mnt, boolean_t *ok, int nmnt)
 {
-	char path[PATH_MAX];
+	int i;
 
-	if (realpath(cdrom_path, path) == NULL)
+	if (realpath (src, copy_base) == NULL)
 	{
 		perror ("Error: Unable to resolve cdrom path");
+		bootarch_copy_done ();
 		return B_FALSE;
 	}
 
-	if (nftw(path, &process_path, 0, FTW_PHYS) != 0)
+	copy_mnt = mnt;
+	copy_ok = ok;
+	copy_nmnt = nmnt;
+	copy_fanout = NULL;
+	copy_iso = NULL;
+
+	for (i = 0; i < nmnt; i++)
+		ok[i] = B_TRUE;
+
+	if ((copy_manifest = manifest_alloc ()) == NULL)
 	{
-		fprintf (stderr, "Error: Unable to traverse directory: %s\n", path);
+		bootarch_copy_done ();
 		return B_FALSE;
 	}
 
+	if (iso_image (copy_base) == B_TRUE && (copy_iso = iso_open (copy_base)) == NULL)
+	{
+		manifest_free (copy_manifest);
+		bootarch_copy_done ();
+		return B_FALSE;
+	}
+
+	if (bootlist_expand (copy_base, copy_iso) == B_FALSE)
+	{
+		if (copy_iso != NULL)
+			iso_close (copy_iso);
+
+		manifest_free (copy_manifest);
+		bootarch_copy_done ();
+		return B_FALSE;
+	}
+
+	copy_streams = copy_iso != NULL || nmnt == 1 ? streams_init (copy_one) : B_FALSE;
+
 	return B_TRUE;
 }
 
+/*
+ * Finish off the copy and leave each root that got everything a
+ * manifest
+ */
+static void
+copy_finish (void)
+{
+	int i;
+
+	if (copy_streams == B_TRUE && streams_fini () == B_FALSE)
+		copy_ok[0] = B_FALSE;
+
+	if (copy_iso != NULL)
+		iso_close (copy_iso);
+
+	bootarch_copy_done ();
+	manifest_sort (copy_manifest);
+
+	for (i = 0; i < copy_nmnt; i++)
+		if (copy_ok[i] == B_TRUE && manifest_write (copy_manifest, copy_mnt[i]) == B_FALSE)
+			copy_ok[i] = B_FALSE;
+
+	manifest_free (copy_manifest);
+}
+
+/*
+ * Copy livecd files to each new root fs, in two passes.  COPY_BOOT
+ * makes every directory and symlink, copies the files on the boot list
+ * and flushes them, after which the roots can be booted.  COPY_REST
+ * copies everything else, using the same mnt and ok, and leaves each
+ * root a manifest of what was copied.
+ *
+ * With more than one root each file is read once and fanned out to all
+ * of them, otherwise files are copied by several streams at once.  src
+ * may also be an ISO image, which is walked and copied from without
+ * mounting it.  ok[i] says whether mnt[i] got everything so far;
+ * returns B_FALSE if none did, in which case there's no second pass.
+ */
+boolean_t
+copy_files (char *src, char **mnt, boolean_t *ok, int nmnt, copy_pass_t pass)
+{
+	int i;
+	boolean_t ret = B_FALSE;
+	struct timespec start, end;
+
+	(void) clock_gettime (CLOCK_MONOTONIC, &start);
+
+	if (pass == COPY_BOOT && copy_start (src, mnt, ok, nmnt) == B_FALSE)
+		return B_FALSE;
+
+	copy_pass = pass;
+	copy_nboot = 0;
+
+	if (copy_iso == NULL && nmnt > 1 && (copy_fanout = fanout_init (mnt, ok, nmnt)) == NULL)
+	{
+		for (i = 0; i < nmnt; i++)
+			copy_root_failed (&ok[i]);
+	}
+	else if ((copy_iso != NULL ? iso_walk (copy_iso, &process_path) : nftw (copy_base, &process_path, 0, FTW_PHYS)) != 0)
+	{
+		fprintf (stderr, "Error: Unable to traverse directory: %s\n", copy_base);
+
+		for (i = 0; i < nmnt; i++)
+			copy_root_failed (&ok[i]);
+	}
+
+	/*
+	 * The fanout's writers are done once it's finished
+	 */
+	if (copy_fanout != NULL)
+	{
+		fanout_fini (copy_fanout);
+		copy_fanout = NULL;
+	}
+
+	if (pass == COPY_BOOT)
+	{
+		if (copy_streams == B_TRUE && streams_drain () == B_FALSE)
+			copy_root_failed (&ok[0]);
+
+		sync ();
+	}
+
+	/*
+	 * The rest pass's streams may still be copying
+	 */
+	for (i = 0; i < nmnt; i++)
+		if (copy_root_ok (&ok[i]) == B_TRUE)
+			ret = B_TRUE;
+
+	if (pass == COPY_REST || ret == B_FALSE)
+	{
+		copy_finish ();
+
+		for (i = 0, ret = B_FALSE; i < nmnt; i++)
+			if (ok[i] == B_TRUE)
+				ret = B_TRUE;
+	}
+	else
+	{
+		progress_totals ();
+
+		(void) clock_gettime (CLOCK_MONOTONIC, &end);
+		printf ("Bootable: %d boot-critical files copied and flushed in %.2fs\n", copy_nboot,
+		    (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+	}
+
+	return ret;
+}
+
 #define ROOT_USER	0
 #define STAFF_GROUP	10
 
 /*
- * Copy grub files to rpool
+ * Copy grub files to rpool.  The files come from the livecd rather than
+ * the new root so this doesn't have to wait for copy_files.
  */
 boolean_t
-copy_grub (char *mnt, char *rpool)
+copy_grub (char *src, char *mnt, char *rpool)
 {
 	FILE *fp;
 	char dest[PATH_MAX], path[PATH_MAX];
@@ -409,7 +1172,7 @@ copy_grub (char *mnt, char *rpool)
 	/*
 	 * Copy /boot/grub/capability
 	 */
-	(void) sprintf (path, "%s/boot/grub/capability", mnt);
+	(void) sprintf (path, "%s/boot/grub/capability", src);
 	(void) sprintf (dest, "%s/%s/boot/grub/capability", mnt, rpool);
 
 	if (copy_file (path, dest, NULL) == B_FALSE)
@@ -500,7 +1263,7 @@ copy_grub (char *mnt, char *rpool)
 	/*
 	 * Copy /boot/grub/splash.xpm.gz
 	 */
-	(void) sprintf (path, "%s/boot/grub/splash.xpm.gz", mnt);
+	(void) sprintf (path, "%s/boot/grub/splash.xpm.gz", src);
 	(void) sprintf (dest, "%s/%s/boot/grub/splash.xpm.gz", mnt, rpool);
 
 	if (copy_file (path, dest, NULL) == B_FALSE)
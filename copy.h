@@ -22,5 +22,41 @@
  * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
  */
 
-boolean_t copy_files (void);
-boolean_t copy_grub (char *mnt, char *rpool);
+/*
+ * Copied pages can be dropped from the page cache a window at a time so
+ * that the copy doesn't push the live system out of memory.  By default
+ * that happens when less than 1/COPY_LOWMEM_SHARE of memory is free.
+ * Only Linux can drop them; elsewhere they're always kept.
+ */
+typedef enum
+{
+	CACHE_AUTO,
+	CACHE_KEEP,
+	CACHE_DROP
+} cache_mode_t;
+
+/*
+ * copy_files runs in two passes, boot-critical files first
+ */
+typedef enum
+{
+	COPY_BOOT,
+	COPY_REST
+} copy_pass_t;
+
+#define COPY_WINDOW		(8 * 1024 * 1024)
+#define COPY_CHUNK		(1024 * 1024)	/* most written by one call */
+#define COPY_LOWMEM_SHARE	4
+
+void copy_cache_mode (cache_mode_t mode);
+void copy_pread_image (boolean_t pread);
+boolean_t copy_root_ok (boolean_t *ok);
+void copy_root_failed (boolean_t *ok);
+void copy_drop (int fd, off_t offset, off_t len, boolean_t wait);
+boolean_t copy_file (const char *path, const char *dest, const struct stat *statptr);
+boolean_t copy_symlink (int srcfd, const char *path, int destfd, const char *dest);
+char *overlay_path (int n);
+void overlay_write (int n, FILE *fp);
+boolean_t write_overlays (char *mnt);
+boolean_t copy_files (char *src, char **mnt, boolean_t *ok, int nmnt, copy_pass_t pass);
+boolean_t copy_grub (char *src, char *mnt, char *rpool);
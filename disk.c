@@ -28,13 +28,95 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
 #include <libzfs.h>
 #include <libnvpair.h>
+#ifdef HAVE_LIBZFS_CORE
+#include <libzfs_core.h>
+#endif
 #include <parted/parted.h>
 #include <sys/dkio.h>
 #include <sys/vtoc.h>
+#include <sys/efi_partition.h>
 
 #include "disk.h"
+#include "trace.h"
+
+/*
+ * Gather size, geometry, label and zpool membership of a disk.  Safe to
+ * call from several threads at once, as long as no two of them share a
+ * libzfs handle, which isn't thread safe.
+ */
+boolean_t
+probe_disk (libzfs_handle_t *libzfs_handle, char *disk, disk_info_t *info)
+{
+	int fd, ret;
+	char *poolname, path[PATH_MAX];
+	pool_state_t poolstate;
+	boolean_t inuse = B_FALSE;
+	double span;
+	struct dk_minfo minfo;
+	struct dk_geom geo;
+	struct extvtoc vtoc;
+
+	(void) strcpy (info->di_label, "none");
+	info->di_pool[0] = '\0';
+
+#ifdef sparc
+	(void) sprintf (path, "%ss2", disk);
+#else
+	(void) sprintf (path, "%sp0", disk);
+#endif
+
+	if ((fd = open (path, O_RDONLY | O_NDELAY)) == -1)
+		return B_FALSE;
+
+	if (ioctl (fd, DKIOCGMEDIAINFO, &minfo) == -1)
+	{
+		(void) close (fd);
+		return B_FALSE;
+	}
+
+	info->di_size = (uint64_t) minfo.dki_lbsize * minfo.dki_capacity;
+
+	if (ioctl (fd, DKIOCGGEOM, &geo) == 0)
+	{
+		info->di_ncyl = geo.dkg_ncyl;
+		info->di_nhead = geo.dkg_nhead;
+		info->di_nsect = geo.dkg_nsect;
+	}
+
+	/*
+	 * read_extvtoc refuses to read EFI labels but tells us it found one
+	 */
+	if ((ret = read_extvtoc (fd, &vtoc)) >= 0)
+		(void) strcpy (info->di_label, "vtoc");
+	else if (ret == VT_ENOTSUP)
+		(void) strcpy (info->di_label, "efi");
+
+	(void) close (fd);
+
+	(void) sprintf (path, "%ss0", disk);
+
+	if ((fd = open (path, O_RDONLY | O_NDELAY)) == -1)
+		return B_TRUE;
+
+	span = trace_start ();
+	ret = zpool_in_use (libzfs_handle, fd, &poolstate, &poolname, &inuse);
+	trace_end ("libzfs", "zpool_in_use", span);
+
+	if (ret == 0 && inuse == B_TRUE)
+	{
+		(void) strncpy (info->di_pool, poolname, ZPOOL_MAXNAMELEN - 1);
+		info->di_pool[ZPOOL_MAXNAMELEN - 1] = '\0';
+		free (poolname);
+	}
+
+	(void) close (fd);
+	return B_TRUE;
+}
 
 /*
  * Determine if a disk is in use already
@@ -42,10 +124,11 @@
 boolean_t
 disk_in_use (libzfs_handle_t *libzfs_handle, char *disk)
 {
-	int fd;
+	int fd, ret;
 	char *poolname, path[PATH_MAX];
 	pool_state_t poolstate;
 	boolean_t inuse = B_FALSE;
+	double span;
 
 	(void) sprintf (path, "%ss0", disk);
 
@@ -67,7 +150,11 @@ disk_in_use (libzfs_handle_t *libzfs_handle, char *disk)
 	/*
 	 * Check to see if the disk is already part of a zpool.
 	 */
-	if (zpool_in_use(libzfs_handle, fd, &poolstate, &poolname, &inuse) == -1)
+	span = trace_start ();
+	ret = zpool_in_use (libzfs_handle, fd, &poolstate, &poolname, &inuse);
+	trace_end ("libzfs", "zpool_in_use", span);
+
+	if (ret == -1)
 	{
 		fprintf (stderr, "Error: Unable to determine if disk is in a zpool\n");
 		(void) close (fd);
@@ -85,12 +172,165 @@ disk_in_use (libzfs_handle_t *libzfs_handle, char *disk)
 	return B_FALSE;
 }
 
+/*
+ * Work out an aligned layout for the disk from its logical and physical
+ * block sizes.  Everything starts on a LAYOUT_ALIGN boundary so that no
+ * ZFS block straddles a physical sector on 4K and flash devices.
+ *
+ * Disks that an MBR can't describe get an EFI label, as does any disk
+ * when efi is set.
+ */
+boolean_t
+get_root_layout (char *disk, boolean_t efi, root_layout_t *layout)
+{
+	int fd;
+	char path[PATH_MAX];
+	struct dk_minfo_ext minfo;
+
+#ifdef sparc
+	(void) sprintf (path, "%ss2", disk);
+#else
+	(void) sprintf (path, "%sp0", disk);
+#endif
+
+	if ((fd = open (path, O_RDONLY | O_NDELAY)) == -1)
+	{
+		fprintf (stderr, "Error: Unable to open %s: %s\n", path, strerror (errno));
+		return B_FALSE;
+	}
+
+	if (ioctl (fd, DKIOCGMEDIAINFOEXT, &minfo) == -1)
+	{
+		struct dk_minfo old_minfo;
+
+		/*
+		 * Older drivers don't know about physical block sizes
+		 */
+		if (ioctl (fd, DKIOCGMEDIAINFO, &old_minfo) == -1)
+		{
+			perror ("Error: Unable to read disk media info");
+			(void) close (fd);
+			return B_FALSE;
+		}
+
+		minfo.dki_lbsize = old_minfo.dki_lbsize;
+		minfo.dki_capacity = old_minfo.dki_capacity;
+		minfo.dki_pbsize = old_minfo.dki_lbsize;
+	}
+
+	(void) close (fd);
+
+	layout->rl_lbsize = minfo.dki_lbsize;
+	layout->rl_pbsize = minfo.dki_pbsize;
+	layout->rl_nblocks = minfo.dki_capacity;
+
+	if (layout->rl_pbsize < layout->rl_lbsize)
+		layout->rl_pbsize = layout->rl_lbsize;
+
+	if (layout->rl_pbsize > LAYOUT_ALIGN)
+		layout->rl_align = layout->rl_pbsize / layout->rl_lbsize;
+	else
+		layout->rl_align = LAYOUT_ALIGN / layout->rl_lbsize;
+
+	for (layout->rl_ashift = 9; (1ULL << layout->rl_ashift) < layout->rl_pbsize; layout->rl_ashift++)
+		;
+
+	layout->rl_efi = efi;
+
+	if (layout->rl_nblocks >= LAYOUT_MBR_MAX)
+		layout->rl_efi = B_TRUE;
+
+	if (layout->rl_efi == B_TRUE)
+	{
+		/*
+		 * The GPT and its backup take the ends of the disk, the boot
+		 * slice and root slice go in between followed by the
+		 * reserved slice that ZFS expects on EFI labelled disks.
+		 */
+		layout->rl_part_start = 0;
+		layout->rl_part_size = layout->rl_nblocks;
+
+		layout->rl_boot_slice = EFI_BOOT_SLICE;
+		layout->rl_boot_start = layout->rl_align;
+		layout->rl_boot_size = layout->rl_align;
+
+		layout->rl_root_start = layout->rl_boot_start + layout->rl_boot_size;
+
+		if (layout->rl_nblocks <= layout->rl_root_start + layout->rl_align + EFI_MIN_RESV_SIZE
+		    + layout->rl_align)
+		{
+			fprintf (stderr, "Error: Disk is too small\n");
+			return B_FALSE;
+		}
+
+		layout->rl_root_size = layout->rl_nblocks - layout->rl_align - EFI_MIN_RESV_SIZE
+		    - layout->rl_root_start;
+		layout->rl_root_size -= layout->rl_root_size % layout->rl_align;
+
+		return B_TRUE;
+	}
+
+	/*
+	 * The MBR lives in the first aligned chunk, SPARC has no fdisk table
+	 */
+#ifdef sparc
+	layout->rl_part_start = 0;
+#else
+	layout->rl_part_start = layout->rl_align;
+#endif
+	layout->rl_part_size = layout->rl_nblocks - layout->rl_part_start;
+	layout->rl_part_size -= layout->rl_part_size % layout->rl_align;
+
+	/*
+	 * The boot slice holds stage2 and takes the first aligned chunk
+	 */
+	layout->rl_boot_slice = VTOC_BOOT_SLICE;
+	layout->rl_boot_start = 0;
+	layout->rl_boot_size = layout->rl_align;
+
+	layout->rl_root_start = layout->rl_boot_start + layout->rl_boot_size;
+
+	if (layout->rl_part_size <= layout->rl_root_start + layout->rl_align)
+	{
+		fprintf (stderr, "Error: Disk is too small\n");
+		return B_FALSE;
+	}
+
+	layout->rl_root_size = layout->rl_part_size - layout->rl_root_start;
+
+	return B_TRUE;
+}
+
+/*
+ * Show where everything will go before we write it
+ */
+void
+print_root_layout (root_layout_t *layout)
+{
+	uint64_t part_start = layout->rl_part_start * layout->rl_lbsize;
+	uint64_t root_start = part_start + layout->rl_root_start * layout->rl_lbsize;
+
+	printf ("Disk layout (%s):\n", layout->rl_efi == B_TRUE ? "EFI" : "fdisk + VTOC");
+	printf ("\tlogical block size:  %llu bytes\n", (unsigned long long) layout->rl_lbsize);
+	printf ("\tphysical block size: %llu bytes\n", (unsigned long long) layout->rl_pbsize);
+	printf ("\talignment:           %llu blocks\n", (unsigned long long) layout->rl_align);
+	printf ("\tpartition:           start %llu, size %llu blocks%s\n",
+	    (unsigned long long) layout->rl_part_start, (unsigned long long) layout->rl_part_size,
+	    part_start % layout->rl_pbsize == 0 ? "" : " (MISALIGNED)");
+	printf ("\tboot slice (s%d):     start %llu, size %llu blocks\n", layout->rl_boot_slice,
+	    (unsigned long long) layout->rl_boot_start, (unsigned long long) layout->rl_boot_size);
+	printf ("\troot slice (s%d):     start %llu, size %llu blocks%s\n",
+	    ROOT_SLICE, (unsigned long long) layout->rl_root_start, (unsigned long long) layout->rl_root_size,
+	    root_start % layout->rl_pbsize == 0 ? "" : " (MISALIGNED)");
+	printf ("\tashift:              %d\n", layout->rl_ashift);
+}
+
 /*
  * Create a single "Solaris2" boot partition
  * FIXME: Remove dependency on GNU libparted
  */
 boolean_t
-create_root_partition (char *disk)
+create_root_partition (char *disk, root_layout_t *layout)
 {
 	char path[PATH_MAX];
 	PedDevice *pdev;
@@ -99,6 +339,12 @@ create_root_partition (char *disk)
 	PedPartition *ppart;
 	const PedFileSystemType *pfs_type;
 
+	/*
+	 * efi_write() puts down its own protective MBR
+	 */
+	if (layout->rl_efi == B_TRUE)
+		return B_TRUE;
+
 #ifdef sparc
 	(void) sprintf (path, "%ss2", disk);
 #else
@@ -129,7 +375,8 @@ create_root_partition (char *disk)
 		return B_FALSE;
 	}
 
-	if ((ppart = ped_partition_new (pdisk, PED_PARTITION_NORMAL, pfs_type, 0, pdev->length - 1)) == NULL)
+	if ((ppart = ped_partition_new (pdisk, PED_PARTITION_NORMAL, pfs_type, layout->rl_part_start,
+	    layout->rl_part_start + layout->rl_part_size - 1)) == NULL)
 	{
 		fprintf (stderr, "Error: Unable to get partition handle\n");
 		return B_FALSE;
@@ -141,7 +388,10 @@ create_root_partition (char *disk)
 		return B_FALSE;
 	}
 
-	if (ped_disk_add_partition (pdisk, ppart, ped_device_get_constraint (pdev)) == 0)
+	/*
+	 * Don't let libparted round the partition back onto a cylinder boundary
+	 */
+	if (ped_disk_add_partition (pdisk, ppart, ped_constraint_exact (&ppart->geom)) == 0)
 	{
 		fprintf (stderr, "Error: Unable to add parition to disk\n");
 		return B_FALSE;
@@ -156,18 +406,83 @@ create_root_partition (char *disk)
 	return B_TRUE;
 }
 
+/*
+ * Write an EFI label with boot, root and reserved slices
+ */
+static boolean_t
+create_root_efi (int fd, root_layout_t *layout)
+{
+	int i;
+	uint64_t last;
+	struct dk_gpt *vtoc;
+
+	if (efi_alloc_and_init (fd, EFI_NUMPAR, &vtoc) != 0)
+	{
+		fprintf (stderr, "Error: Unable to create EFI label\n");
+		return B_FALSE;
+	}
+
+	/*
+	 * Now that libefi has told us where the backup GPT goes make sure
+	 * the root and reserved slices fit in front of it
+	 */
+	last = vtoc->efi_last_u_lba + 1 - EFI_MIN_RESV_SIZE;
+
+	if (layout->rl_root_start + layout->rl_root_size > last)
+	{
+		layout->rl_root_size = last - layout->rl_root_start;
+		layout->rl_root_size -= layout->rl_root_size % layout->rl_align;
+	}
+
+	for (i = 0; i < vtoc->efi_nparts; i++)
+	{
+		switch (i)
+		{
+			case ROOT_SLICE:
+				vtoc->efi_parts[i].p_tag = V_USR;
+				vtoc->efi_parts[i].p_start = layout->rl_root_start;
+				vtoc->efi_parts[i].p_size = layout->rl_root_size;
+				break;
+			case EFI_BOOT_SLICE:
+				vtoc->efi_parts[i].p_tag = V_BOOT;
+				vtoc->efi_parts[i].p_start = layout->rl_boot_start;
+				vtoc->efi_parts[i].p_size = layout->rl_boot_size;
+				break;
+			case EFI_RESV_SLICE:
+				vtoc->efi_parts[i].p_tag = V_RESERVED;
+				vtoc->efi_parts[i].p_start = layout->rl_root_start + layout->rl_root_size;
+				vtoc->efi_parts[i].p_size = EFI_MIN_RESV_SIZE;
+				break;
+			default:
+				vtoc->efi_parts[i].p_tag = V_UNASSIGNED;
+				vtoc->efi_parts[i].p_start = 0;
+				vtoc->efi_parts[i].p_size = 0;
+				break;
+		}
+	}
+
+	if (efi_write (fd, vtoc) != 0)
+	{
+		fprintf (stderr, "Error: Unable to write EFI label to disk\n");
+		efi_free (vtoc);
+		return B_FALSE;
+	}
+
+	efi_free (vtoc);
+	return B_TRUE;
+}
+
 /*
  * Create the slices needed for a ZFS root filesystem
  */
 boolean_t
-create_root_vtoc (char *disk)
+create_root_vtoc (char *disk, root_layout_t *layout)
 {
 	int i, fd;
 	char path[PATH_MAX];
 	struct extvtoc vtoc;
 	struct dk_geom geo;
-	uint16_t cylinder_size;
-	uint32_t disk_size;
+	uint64_t disk_size;
 
 #ifdef sparc
 	(void) sprintf (path, "%ss2", disk);
@@ -181,6 +496,14 @@ create_root_vtoc (char *disk)
 		return B_FALSE;
 	}
 
+	if (layout->rl_efi == B_TRUE)
+	{
+		boolean_t ret = create_root_efi (fd, layout);
+
+		(void) close (fd);
+		return ret;
+	}
+
 	if (ioctl (fd, DKIOCGGEOM, &geo) == -1)
 	{
 		perror ("Error: Unable to read disk geometry");
@@ -188,8 +511,20 @@ create_root_vtoc (char *disk)
 		return B_FALSE;
 	}
 
-	cylinder_size = geo.dkg_nhead * geo.dkg_nsect;
-	disk_size = geo.dkg_ncyl * geo.dkg_nhead * geo.dkg_nsect;
+	/*
+	 * The driver may hide a few alternate cylinders from us so make
+	 * sure the root slice still ends inside the usable space
+	 */
+	disk_size = (uint64_t) geo.dkg_ncyl * geo.dkg_nhead * geo.dkg_nsect;
+
+	if (disk_size > layout->rl_part_size)
+		disk_size = layout->rl_part_size;
+
+	if (layout->rl_root_start + layout->rl_root_size > disk_size)
+	{
+		layout->rl_root_size = disk_size - layout->rl_root_start;
+		layout->rl_root_size -= layout->rl_root_size % layout->rl_align;
+	}
 
 	if (!read_extvtoc (fd, &vtoc))
 	{
@@ -202,11 +537,11 @@ create_root_vtoc (char *disk)
 	{
 		switch (i)
 		{
-			case 0:
+			case ROOT_SLICE:
 				vtoc.v_part[i].p_tag = V_ROOT;
 				vtoc.v_part[i].p_flag = 0;
-				vtoc.v_part[i].p_start = cylinder_size;
-				vtoc.v_part[i].p_size = disk_size - cylinder_size;
+				vtoc.v_part[i].p_start = layout->rl_root_start;
+				vtoc.v_part[i].p_size = layout->rl_root_size;
 				break;
 			case 2:
 				vtoc.v_part[i].p_tag = V_BACKUP;
@@ -214,11 +549,11 @@ create_root_vtoc (char *disk)
 				vtoc.v_part[i].p_start = 0;
 				vtoc.v_part[i].p_size = disk_size;
 				break;
-			case 8:
+			case VTOC_BOOT_SLICE:
 				vtoc.v_part[i].p_tag = V_BOOT;
 				vtoc.v_part[i].p_flag = V_UNMNT;
-				vtoc.v_part[i].p_start = 0;
-				vtoc.v_part[i].p_size = cylinder_size;
+				vtoc.v_part[i].p_start = layout->rl_boot_start;
+				vtoc.v_part[i].p_size = layout->rl_boot_size;
 				break;
 			default:
 				vtoc.v_part[i].p_tag = V_UNASSIGNED;
@@ -240,16 +575,104 @@ create_root_vtoc (char *disk)
 	return B_TRUE;
 }
 
-#define ROOT_NAME "schillix"
+/*
+ * Discard the root slice in DISCARD_EXTENT sized pieces, handing the
+ * driver DISCARD_BATCH of them per ioctl
+ */
+#define DISCARD_EXTENT	(1ULL << 30)
+#define DISCARD_BATCH	64
+
+/*
+ * Tell the device that everything on the new root slice is garbage so
+ * that the pool's first writes don't pay for garbage collecting the
+ * previous owner's data.  Devices which can't discard are skipped.
+ */
+boolean_t
+discard_root_slice (char *disk, root_layout_t *layout)
+{
+	int fd;
+	char path[PATH_MAX];
+	uint64_t offset = 0, length, size;
+	double elapsed;
+	dkioc_free_list_t *dfl;
+	struct timespec start, end;
+
+	size = layout->rl_root_size * layout->rl_lbsize;
+
+	(void) sprintf (path, "%ss%d", disk, ROOT_SLICE);
+
+	if ((fd = open (path, O_RDWR)) == -1)
+	{
+		perror ("Error: Unable to open root slice for discard");
+		return B_FALSE;
+	}
+
+	if ((dfl = calloc (1, DFL_SZ (DISCARD_BATCH))) == NULL)
+	{
+		fprintf (stderr, "Error: out of memory\n");
+		(void) close (fd);
+		return B_FALSE;
+	}
+
+	(void) clock_gettime (CLOCK_MONOTONIC, &start);
+
+	while (offset < size)
+	{
+		dfl->dfl_flags = DF_WAIT_SYNC;
+		dfl->dfl_offset = 0;
+		dfl->dfl_num_exts = 0;
+
+		while (offset < size && dfl->dfl_num_exts < DISCARD_BATCH)
+		{
+			length = size - offset;
+
+			if (length > DISCARD_EXTENT)
+				length = DISCARD_EXTENT;
+
+			dfl->dfl_exts[dfl->dfl_num_exts].dfle_start = offset;
+			dfl->dfl_exts[dfl->dfl_num_exts].dfle_length = length;
+			dfl->dfl_num_exts++;
+			offset += length;
+		}
+
+		if (ioctl (fd, DKIOCFREE, dfl) == -1)
+		{
+			if (errno == ENOTSUP || errno == ENOTTY)
+			{
+				puts ("Device does not support discard, skipping");
+				free (dfl);
+				(void) close (fd);
+				return B_TRUE;
+			}
+
+			perror ("Error: Unable to discard root slice");
+			free (dfl);
+			(void) close (fd);
+			return B_FALSE;
+		}
+	}
+
+	(void) clock_gettime (CLOCK_MONOTONIC, &end);
+
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf ("Discarded %.1f GB in %.2fs\n", size / (1024.0 * 1024 * 1024), elapsed);
+
+	free (dfl);
+	(void) close (fd);
+	return B_TRUE;
+}
 
 /*
  * Create root ZFS pool on first slice (s0)
  */
 boolean_t
-create_root_pool (libzfs_handle_t *libzfs_handle, char *disk, char *rpool, char *mnt)
+create_root_pool (libzfs_handle_t *libzfs_handle, char *disk, char *rpool, char *mnt, root_layout_t *layout,
+    pool_layout_t *pl)
 {
 	char path[PATH_MAX];
 	nvlist_t *vdev, *nvroot, *props, *fsprops;
+	int ret;
+	double span;
 #ifdef ZPOOL_CREATE_ALTROOT_BUG
 	zfs_handle_t *zfs_handle;
 #endif
@@ -279,6 +702,16 @@ create_root_pool (libzfs_handle_t *libzfs_handle, char *disk, char *rpool, char
 		return B_FALSE;
 	}
 
+	/*
+	 * Match the pool's block size to the physical block size
+	 */
+	if (nvlist_add_uint64(vdev, ZPOOL_CONFIG_ASHIFT, layout->rl_ashift) != 0)
+	{
+		fprintf (stderr, "Error: Unable to set vdev ashift\n");
+		(void) nvlist_free (vdev);
+		return B_FALSE;
+	}
+
 	/*
 	 * Create the nvroot which is the list of all vdevs
 	 * TODO: Add support for mirrored pools?
@@ -298,9 +731,11 @@ create_root_pool (libzfs_handle_t *libzfs_handle, char *disk, char *rpool, char
 		return B_FALSE;
 	}
 
-	if (nvlist_add_nvlist_array(nvroot, ZPOOL_CONFIG_CHILDREN, &vdev, 1) != 0)
+	/*
+	 * Along with any log, cache and special vdevs
+	 */
+	if (add_pool_vdevs (nvroot, vdev, pl, layout->rl_ashift) == B_FALSE)
 	{
-		fprintf (stderr, "Error: Unable to add vdev to list\n");
 		(void) nvlist_free (vdev);
 		(void) nvlist_free (nvroot);
 		return B_FALSE;
@@ -347,7 +782,11 @@ create_root_pool (libzfs_handle_t *libzfs_handle, char *disk, char *rpool, char
 		return B_FALSE;
 	}
 
-	if (zpool_create (libzfs_handle, rpool, nvroot, props, fsprops) == -1)
+	span = trace_start ();
+	ret = zpool_create (libzfs_handle, rpool, nvroot, props, fsprops);
+	trace_end ("libzfs", "zpool_create", span);
+
+	if (ret == -1)
 	{
 		fprintf (stderr, "Error: Unable to create rpool\n");
 		(void) nvlist_free (vdev);
@@ -371,7 +810,11 @@ create_root_pool (libzfs_handle_t *libzfs_handle, char *disk, char *rpool, char
 		return B_FALSE;
 	}
 
-	if (zfs_prop_set (zfs_handle, zfs_prop_to_name (ZFS_PROP_MOUNTPOINT), path) == -1)
+	span = trace_start ();
+	ret = zfs_prop_set (zfs_handle, zfs_prop_to_name (ZFS_PROP_MOUNTPOINT), path);
+	trace_end ("libzfs", "zfs_prop_set", span);
+
+	if (ret == -1)
 	{
 		fprintf (stderr, "Error: Unable to set root mountpoint\n");
 		(void) nvlist_free (vdev);
@@ -396,6 +839,8 @@ boolean_t
 export_root_pool (libzfs_handle_t *libzfs_handle, char *rpool)
 {
 	zpool_handle_t *zpool_handle;
+	int ret;
+	double span;
 
 	if ((zpool_handle = zpool_open (libzfs_handle, rpool)) == NULL)
 	{
@@ -403,7 +848,11 @@ export_root_pool (libzfs_handle_t *libzfs_handle, char *rpool)
 		return B_FALSE;
 	}
 
-	if (zpool_export (zpool_handle, B_FALSE) == -1)
+	span = trace_start ();
+	ret = zpool_export (zpool_handle, B_FALSE);
+	trace_end ("libzfs", "zpool_export", span);
+
+	if (ret == -1)
 	{
 		fprintf (stderr, "Error: Unable to unmount rpool\n");
 		return B_FALSE;
@@ -413,114 +862,405 @@ export_root_pool (libzfs_handle_t *libzfs_handle, char *rpool)
 }
 
 /*
- * Create root ZFS filesystem on first slice (s0)
+ * The dataset hierarchy, parents first.  A NULL mountpoint is inherited.
  */
-boolean_t
-create_root_datasets (libzfs_handle_t *libzfs_handle, char *rpool)
+static struct root_dataset
 {
-	char path[PATH_MAX];
-	nvlist_t *fsprops;
+	char *rd_name;
+	char *rd_mountpoint;
+} root_datasets[] =
+{
+	{ "ROOT",			ZFS_MOUNTPOINT_LEGACY },
+	{ "ROOT/" ROOT_NAME,		"/" },
+	{ "export",			"/export" },
+	{ "export/home",		NULL },
+	{ "export/home/schillix",	NULL }
+};
 
-	/*
-	 * Create the /ROOT dataset which holds all of the different roots
-	 */
-	if (nvlist_alloc (&fsprops, NV_UNIQUE_NAME, 0) != 0)
+#define NUM_ROOT_DATASETS	(sizeof (root_datasets) / sizeof (root_datasets[0]))
+
+/*
+ * A dataset waiting to be created.  Datasets at the same depth don't
+ * depend on each other.
+ */
+typedef struct dataset
+{
+	char ds_name[ZFS_MAXNAMELEN];
+	char ds_path[ZFS_MAXNAMELEN];
+	int ds_depth;
+	nvlist_t *ds_props;
+	boolean_t ds_created;
+	int ds_error;
+} dataset_t;
+
+/*
+ * Fill in a dataset with its mountpoint and anything from the profile
+ */
+static boolean_t
+init_dataset (dataset_t *ds, char *rpool, char *name, char *mountpoint, profile_t *profile)
+{
+	char *p;
+	dataset_profile_t *dp;
+
+	(void) memset (ds, 0, sizeof (dataset_t));
+
+	if (snprintf (ds->ds_path, ZFS_MAXNAMELEN, "%s/%s", rpool, name) >= ZFS_MAXNAMELEN)
 	{
-		fprintf (stderr, "Error: Unable to allocate fsprop list\n");
-		(void) nvlist_free (fsprops);
+		fprintf (stderr, "Error: Dataset name too long: %s\n", name);
 		return B_FALSE;
 	}
 
-	if (nvlist_add_string (fsprops, zfs_prop_to_name (ZFS_PROP_MOUNTPOINT), ZFS_MOUNTPOINT_LEGACY) != 0)
+	(void) strcpy (ds->ds_name, name);
+
+	for (p = name; *p != '\0'; p++)
+		if (*p == '/')
+			ds->ds_depth++;
+
+	if (nvlist_alloc (&ds->ds_props, NV_UNIQUE_NAME, 0) != 0)
 	{
-		fprintf (stderr, "Error: Unable to set root mountpoint\n");
-		(void) nvlist_free (fsprops);
+		fprintf (stderr, "Error: Unable to allocate fsprop list\n");
 		return B_FALSE;
 	}
 
-	(void) sprintf (path, "%s/ROOT", rpool);
-
-	if (zfs_create (libzfs_handle, path, ZFS_TYPE_DATASET, fsprops) != 0)
+	if (mountpoint != NULL && nvlist_add_string (ds->ds_props,
+	    zfs_prop_to_name (ZFS_PROP_MOUNTPOINT), mountpoint) != 0)
 	{
-		fprintf (stderr, "Error: Unable to create root datatset\n");
-		(void) nvlist_free (fsprops);
+		fprintf (stderr, "Error: Unable to set %s mountpoint\n", name);
 		return B_FALSE;
 	}
 
-	/*
-	 * Create the actual root filesystem /ROOT/schillix
-	 */
-	if (nvlist_add_string (fsprops, zfs_prop_to_name (ZFS_PROP_MOUNTPOINT), "/") != 0)
+	if ((dp = find_profile (profile, name)) != NULL
+	    && nvlist_merge (ds->ds_props, dp->dp_props, 0) != 0)
 	{
-		fprintf (stderr, "Error: Unable to set fsroot mountpoint\n");
-		(void) nvlist_free (fsprops);
+		fprintf (stderr, "Error: Unable to apply profile to %s\n", name);
 		return B_FALSE;
 	}
 
-	(void) sprintf (path, "%s/ROOT/" ROOT_NAME, rpool);
+	return B_TRUE;
+}
+
+/*
+ * List the datasets to create, parents before children: the standard
+ * hierarchy followed by anything extra in the profile
+ */
+static dataset_t *
+list_datasets (char *rpool, profile_t *profile, int *count)
+{
+	int i, j, n = 0, max;
+	dataset_t *list, tmp;
+
+	max = NUM_ROOT_DATASETS + (profile == NULL ? 0 : profile->pr_ndatasets);
 
-	if (zfs_create (libzfs_handle, path, ZFS_TYPE_DATASET, fsprops) != 0)
+	if ((list = calloc (max, sizeof (dataset_t))) == NULL)
 	{
-		fprintf (stderr, "Error: Unable to create rootfs datatset\n");
-		(void) nvlist_free (fsprops);
-		return B_FALSE;
+		fprintf (stderr, "Error: out of memory\n");
+		return NULL;
+	}
+
+	for (i = 0; i < NUM_ROOT_DATASETS; i++)
+	{
+		if (init_dataset (&list[n++], rpool, root_datasets[i].rd_name,
+		    root_datasets[i].rd_mountpoint, profile) == B_FALSE)
+			goto fail;
+	}
+
+	for (i = 0; profile != NULL && i < profile->pr_ndatasets; i++)
+	{
+		for (j = 0; j < NUM_ROOT_DATASETS; j++)
+			if (strcmp (profile->pr_datasets[i].dp_name, root_datasets[j].rd_name) == 0)
+				break;
+
+		if (j < NUM_ROOT_DATASETS)
+			continue;
+
+		if (init_dataset (&list[n++], rpool, profile->pr_datasets[i].dp_name, NULL,
+		    profile) == B_FALSE)
+			goto fail;
 	}
 
 	/*
-	 * Store user data on a seperate globally accessible dataset
+	 * Extra datasets might be listed before their parents
 	 */
-	if (nvlist_add_string (fsprops, zfs_prop_to_name (ZFS_PROP_MOUNTPOINT), "/export") != 0)
+	for (i = 1; i < n; i++)
 	{
-		fprintf (stderr, "Error: Unable to set export mountpoint\n");
-		(void) nvlist_free (fsprops);
-		return B_FALSE;
+		for (j = i; j > 0 && list[j - 1].ds_depth > list[j].ds_depth; j--)
+		{
+			tmp = list[j];
+			list[j] = list[j - 1];
+			list[j - 1] = tmp;
+		}
 	}
 
-	(void) sprintf (path, "%s/export", rpool);
+	*count = n;
+	return list;
 
-	if (zfs_create (libzfs_handle, path, ZFS_TYPE_DATASET, fsprops) != 0)
+fail:
+	for (i = 0; i < n; i++)
+		(void) nvlist_free (list[i].ds_props);
+	free (list);
+	return NULL;
+}
+
+/*
+ * Destroy whatever was created, children first, so that a failure
+ * doesn't leave half a hierarchy behind
+ */
+static void
+destroy_datasets (libzfs_handle_t *libzfs_handle, dataset_t *list, int count)
+{
+	int i;
+	zfs_handle_t *zfs_handle;
+	double span;
+
+	for (i = count - 1; i >= 0; i--)
 	{
-		fprintf (stderr, "Error: Unable to create export dataset\n");
-		(void) nvlist_free (fsprops);
-		return B_FALSE;
+		if (list[i].ds_created == B_FALSE)
+			continue;
+
+		if ((zfs_handle = zfs_open (libzfs_handle, list[i].ds_path, ZFS_TYPE_FILESYSTEM)) == NULL)
+			continue;
+
+		span = trace_start ();
+		(void) zfs_destroy (zfs_handle, B_FALSE);
+		trace_end ("libzfs", "zfs_destroy", span);
+		zfs_close (zfs_handle);
 	}
+}
+
+static void
+free_datasets (dataset_t *list, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		(void) nvlist_free (list[i].ds_props);
+
+	free (list);
+}
+
+#ifdef HAVE_LIBZFS_CORE
+static void *
+create_thread (void *arg)
+{
+	dataset_t *ds = arg;
+	double span = trace_start ();
+
+	ds->ds_error = lzc_create (ds->ds_path, LZC_DATSET_TYPE_ZFS, ds->ds_props);
+	trace_end ("libzfs", "lzc_create", span);
+	return NULL;
+}
+
+/*
+ * Create the root datasets with libzfs_core.  Every dataset at the same
+ * depth is created at once so that their sync tasks share a transaction
+ * group, and bootfs is set alongside the level below the boot dataset.
+ * For the standard hierarchy that's three syncs rather than six.
+ */
+static boolean_t
+create_datasets (libzfs_handle_t *libzfs_handle, char *rpool, dataset_t *list, int count)
+{
+	int i, first, last;
+	boolean_t ret = B_TRUE, bootfs = B_FALSE;
+	pthread_t *tids;
+	boolean_t *started;
 
-	if (nvlist_add_string (fsprops, zfs_prop_to_name (ZFS_PROP_MOUNTPOINT), "/export/home") != 0)
+	if (libzfs_core_init () != 0)
 	{
-		fprintf (stderr, "Error: Unable to set home mountpoint\n");
-		(void) nvlist_free (fsprops);
+		fprintf (stderr, "Error: Unable to initialise libzfs_core\n");
 		return B_FALSE;
 	}
 
-	(void) sprintf (path, "%s/export/home", rpool);
+	tids = calloc (count, sizeof (pthread_t));
+	started = calloc (count, sizeof (boolean_t));
 
-	if (zfs_create(libzfs_handle, path, ZFS_TYPE_DATASET, NULL) != 0)
+	if (tids == NULL || started == NULL)
 	{
-		fprintf (stderr, "Error: Unable to create home dataset\n");
-		(void) nvlist_free (fsprops);
+		fprintf (stderr, "Error: out of memory\n");
+		free (tids);
+		free (started);
+		libzfs_core_fini ();
 		return B_FALSE;
 	}
 
-	if (nvlist_add_string (fsprops, zfs_prop_to_name (ZFS_PROP_MOUNTPOINT), "/export/home/schillix") != 0)
+	for (first = 0; first < count && ret == B_TRUE; first = last)
 	{
-		fprintf (stderr, "Error: Unable to set schillix mountpoint\n");
-		(void) nvlist_free (fsprops);
-		return B_FALSE;
+		for (last = first; last < count && list[last].ds_depth == list[first].ds_depth; last++)
+		{
+			if (pthread_create (&tids[last], NULL, create_thread, &list[last]) != 0)
+			{
+				/*
+				 * Just do it ourselves
+				 */
+				(void) create_thread (&list[last]);
+				started[last] = B_FALSE;
+			}
+			else
+				started[last] = B_TRUE;
+		}
+
+		/*
+		 * ROOT/schillix was created by an earlier level
+		 */
+		if (bootfs == B_FALSE && list[first].ds_depth > 1)
+		{
+			if (set_root_bootfs (libzfs_handle, rpool) == B_FALSE)
+				ret = B_FALSE;
+
+			bootfs = B_TRUE;
+		}
+
+		for (i = first; i < last; i++)
+		{
+			if (started[i] == B_TRUE)
+				(void) pthread_join (tids[i], NULL);
+
+			if (list[i].ds_error == 0)
+				list[i].ds_created = B_TRUE;
+			else
+			{
+				fprintf (stderr, "Error: Unable to create %s dataset: %s\n",
+				    list[i].ds_name, strerror (list[i].ds_error));
+				ret = B_FALSE;
+			}
+		}
 	}
 
-	(void) sprintf (path, "%s/export/home/schillix", rpool);
+	if (ret == B_TRUE && bootfs == B_FALSE)
+		ret = set_root_bootfs (libzfs_handle, rpool);
+
+	free (tids);
+	free (started);
+	libzfs_core_fini ();
 
-	if (zfs_create(libzfs_handle, path, ZFS_TYPE_DATASET, NULL) != 0)
+	return ret;
+}
+#else
+/*
+ * Create the root datasets one after another then set bootfs
+ */
+static boolean_t
+create_datasets (libzfs_handle_t *libzfs_handle, char *rpool, dataset_t *list, int count)
+{
+	int i, ret;
+	double span;
+
+	for (i = 0; i < count; i++)
 	{
-		fprintf (stderr, "Error: Unable to create schillix dataset\n");
-		(void) nvlist_free (fsprops);
+		span = trace_start ();
+		ret = zfs_create (libzfs_handle, list[i].ds_path, ZFS_TYPE_DATASET, list[i].ds_props);
+		trace_end ("libzfs", "zfs_create", span);
+
+		if (ret != 0)
+		{
+			fprintf (stderr, "Error: Unable to create %s dataset\n", list[i].ds_name);
+			return B_FALSE;
+		}
+
+		list[i].ds_created = B_TRUE;
+	}
+
+	return set_root_bootfs (libzfs_handle, rpool);
+}
+#endif
+
+/*
+ * Create the root datasets, with properties from the profile if one was
+ * given, and set bootfs.  Either everything is created or nothing is.
+ */
+boolean_t
+create_root_datasets (libzfs_handle_t *libzfs_handle, char *rpool, profile_t *profile)
+{
+	int count;
+	dataset_t *list;
+
+	if ((list = list_datasets (rpool, profile, &count)) == NULL)
+		return B_FALSE;
+
+	if (create_datasets (libzfs_handle, rpool, list, count) == B_FALSE)
+	{
+		destroy_datasets (libzfs_handle, list, count);
+		free_datasets (list, count);
 		return B_FALSE;
 	}
 
-	(void) nvlist_free (fsprops);
+	free_datasets (list, count);
 	return B_TRUE;
 }
 
+/*
+ * Snapshot every root dataset as it was installed, so the pool can be
+ * reset to it later.  With libzfs_core the snapshots are taken together
+ * in a single transaction group.
+ */
+boolean_t
+snapshot_root_datasets (libzfs_handle_t *libzfs_handle, char *rpool, profile_t *profile)
+{
+	int i, count, ret = 0;
+	char snap[ZFS_MAXNAMELEN];
+	dataset_t *list;
+	double span;
+#ifdef HAVE_LIBZFS_CORE
+	nvlist_t *snaps, *errlist = NULL;
+#endif
+
+	if ((list = list_datasets (rpool, profile, &count)) == NULL)
+		return B_FALSE;
+
+#ifdef HAVE_LIBZFS_CORE
+	if (nvlist_alloc (&snaps, NV_UNIQUE_NAME, 0) != 0)
+	{
+		fprintf (stderr, "Error: Unable to allocate snapshot list\n");
+		free_datasets (list, count);
+		return B_FALSE;
+	}
+
+	for (i = 0; i < count && ret == 0; i++)
+	{
+		if (snprintf (snap, ZFS_MAXNAMELEN, "%s@" INSTALLED_SNAP, list[i].ds_path) >= ZFS_MAXNAMELEN)
+			ret = ENAMETOOLONG;
+		else
+			ret = nvlist_add_boolean (snaps, snap);
+	}
+
+	if (ret == 0 && (ret = libzfs_core_init ()) == 0)
+	{
+		span = trace_start ();
+		ret = lzc_snapshot (snaps, NULL, &errlist);
+		trace_end ("libzfs", "lzc_snapshot", span);
+
+		libzfs_core_fini ();
+	}
+
+	if (ret != 0)
+		fprintf (stderr, "Error: Unable to snapshot %s datasets: %s\n", rpool, strerror (ret));
+
+	if (errlist != NULL)
+		nvlist_free (errlist);
+
+	nvlist_free (snaps);
+#else
+	for (i = 0; i < count && ret == 0; i++)
+	{
+		if (snprintf (snap, ZFS_MAXNAMELEN, "%s@" INSTALLED_SNAP, list[i].ds_path) >= ZFS_MAXNAMELEN)
+		{
+			fprintf (stderr, "Error: Snapshot name too long for %s\n", list[i].ds_path);
+			ret = -1;
+			break;
+		}
+
+		span = trace_start ();
+		ret = zfs_snapshot (libzfs_handle, snap, B_FALSE, NULL);
+		trace_end ("libzfs", "zfs_snapshot", span);
+
+		if (ret != 0)
+			fprintf (stderr, "Error: Unable to snapshot %s\n", list[i].ds_path);
+	}
+#endif
+
+	free_datasets (list, count);
+	return ret == 0 ? B_TRUE : B_FALSE;
+}
+
 /*
  * Set bootfs property on rpool
  */
@@ -529,6 +1269,8 @@ set_root_bootfs (libzfs_handle_t *libzfs_handle, char *rpool)
 {
 	char path[PATH_MAX];
 	zpool_handle_t *zpool_handle;
+	int ret;
+	double span;
 
 	if ((zpool_handle = zpool_open (libzfs_handle, rpool)) == NULL)
 	{
@@ -539,7 +1281,11 @@ set_root_bootfs (libzfs_handle_t *libzfs_handle, char *rpool)
 
 	(void) sprintf (path, "%s/ROOT/" ROOT_NAME, rpool);
 
-	if (zpool_set_prop (zpool_handle, "bootfs", path) == -1)
+	span = trace_start ();
+	ret = zpool_set_prop (zpool_handle, "bootfs", path);
+	trace_end ("libzfs", "zpool_set_prop", span);
+
+	if (ret == -1)
 	{
 		fprintf (stderr, "Error: Unable to set rpool bootfs\n");
 		zpool_close (zpool_handle);
@@ -557,6 +1303,8 @@ boolean_t
 mount_root_datasets (libzfs_handle_t *libzfs_handle, char *rpool)
 {
 	zpool_handle_t *zpool_handle;
+	int ret;
+	double span;
 
 	if ((zpool_handle = zpool_open (libzfs_handle, rpool)) == NULL)
 	{
@@ -565,7 +1313,11 @@ mount_root_datasets (libzfs_handle_t *libzfs_handle, char *rpool)
 		return B_FALSE;
 	}
 
-	if (zpool_enable_datasets (zpool_handle, NULL, 0) == -1)
+	span = trace_start ();
+	ret = zpool_enable_datasets (zpool_handle, NULL, 0);
+	trace_end ("libzfs", "zpool_enable_datasets", span);
+
+	if (ret == -1)
 	{
 		fprintf (stderr, "Error: Unable to mount rpool\n");
 		zpool_close (zpool_handle);
@@ -583,6 +1335,8 @@ boolean_t
 unmount_root_datasets (libzfs_handle_t *libzfs_handle, char *rpool)
 {
 	zpool_handle_t *zpool_handle;
+	int ret;
+	double span;
 
 	if ((zpool_handle = zpool_open (libzfs_handle, rpool)) == NULL)
 	{
@@ -591,7 +1345,11 @@ unmount_root_datasets (libzfs_handle_t *libzfs_handle, char *rpool)
 		return B_FALSE;
 	}
 
-	if (zpool_disable_datasets (zpool_handle, B_TRUE) == -1)
+	span = trace_start ();
+	ret = zpool_disable_datasets (zpool_handle, B_TRUE);
+	trace_end ("libzfs", "zpool_disable_datasets", span);
+
+	if (ret == -1)
 	{
 		fprintf (stderr, "Error: Unable to unmount rpool\n");
 		zpool_close (zpool_handle);
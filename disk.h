@@ -22,14 +22,88 @@
  * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
  */
 
+#include <limits.h>
 #include <libzfs.h>
 
+#include "pool.h"
+#include "profile.h"
+
+/*
+ * Results of probing a single disk
+ */
+typedef enum disk_state
+{
+	DISK_PENDING,
+	DISK_OK,
+	DISK_ERROR,
+	DISK_TIMEOUT
+} disk_state_t;
+
+typedef struct disk_info
+{
+	char di_name[PATH_MAX];		/* cXtXdX name */
+	disk_state_t di_state;
+	uint64_t di_size;		/* size in bytes */
+	uint16_t di_ncyl;		/* geometry */
+	uint16_t di_nhead;
+	uint16_t di_nsect;
+	char di_label[8];		/* vtoc, efi or none */
+	char di_pool[ZPOOL_MAXNAMELEN];	/* pool using s0, if any */
+} disk_info_t;
+
+/*
+ * Where everything goes on the disk.  All offsets and sizes are in
+ * logical blocks; slice offsets are relative to the start of the
+ * fdisk partition, which is the whole disk for EFI labels.
+ */
+#define LAYOUT_ALIGN	(1024 * 1024)
+#define LAYOUT_MBR_MAX	(1ULL << 32)
+
+#define ROOT_SLICE	0
+#define VTOC_BOOT_SLICE	8
+#define EFI_BOOT_SLICE	1
+#define EFI_RESV_SLICE	8
+
+typedef struct root_layout
+{
+	uint64_t rl_lbsize;		/* logical block size */
+	uint64_t rl_pbsize;		/* physical block size */
+	uint64_t rl_nblocks;		/* size of the whole disk */
+	uint64_t rl_align;		/* alignment of everything */
+	boolean_t rl_efi;		/* EFI/GPT label instead of fdisk + VTOC */
+	uint64_t rl_part_start;		/* fdisk partition */
+	uint64_t rl_part_size;
+	int rl_boot_slice;		/* boot slice, s8 or s1 for EFI */
+	uint64_t rl_boot_start;
+	uint64_t rl_boot_size;
+	uint64_t rl_root_start;		/* root slice, s0 */
+	uint64_t rl_root_size;
+	int rl_ashift;
+} root_layout_t;
+
+/*
+ * The boot environment under <rpool>/ROOT that an install creates
+ */
+#define ROOT_NAME	"schillix"
+
+/*
+ * Every root dataset is snapshotted at the end of an install, for
+ * resetting back to
+ */
+#define INSTALLED_SNAP	"installed"
+
+boolean_t get_root_layout (char *disk, boolean_t efi, root_layout_t *layout);
+void print_root_layout (root_layout_t *layout);
+boolean_t probe_disk (libzfs_handle_t *libzfs_handle, char *disk, disk_info_t *info);
 boolean_t disk_in_use(libzfs_handle_t *libzfs_handle, char *disk);
-boolean_t create_root_partition (char *disk);
-boolean_t create_root_vtoc (char *disk);
-boolean_t create_root_pool (libzfs_handle_t *libzfs_handle, char *disk, char *pool, char *mnt);
+boolean_t create_root_partition (char *disk, root_layout_t *layout);
+boolean_t create_root_vtoc (char *disk, root_layout_t *layout);
+boolean_t discard_root_slice (char *disk, root_layout_t *layout);
+boolean_t create_root_pool (libzfs_handle_t *libzfs_handle, char *disk, char *pool, char *mnt, root_layout_t *layout,
+    pool_layout_t *pl);
 boolean_t export_root_pool (libzfs_handle_t *libzfs_handle, char *pool);
-boolean_t create_root_datasets (libzfs_handle_t *libzfs_handle, char *pool);
+boolean_t create_root_datasets (libzfs_handle_t *libzfs_handle, char *pool, profile_t *profile);
+boolean_t snapshot_root_datasets (libzfs_handle_t *libzfs_handle, char *pool, profile_t *profile);
 boolean_t set_root_bootfs (libzfs_handle_t *libzfs_handle, char *pool);
 boolean_t mount_root_datasets (libzfs_handle_t *libzfs_handle, char *pool);
 boolean_t unmount_root_datasets (libzfs_handle_t *libzfs_handle, char *pool);
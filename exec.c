@@ -0,0 +1,174 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "exec.h"
+#include "trace.h"
+
+extern char **environ;
+
+/*
+ * Read everything a command wrote to its output file
+ */
+static char *
+read_output (int fd)
+{
+	char *buf;
+	ssize_t len, got = 0;
+	struct stat st;
+
+	if (fstat (fd, &st) == -1)
+		return NULL;
+
+	if ((buf = malloc (st.st_size + 1)) == NULL)
+		return NULL;
+
+	while (got < st.st_size)
+	{
+		if ((len = pread (fd, buf + got, st.st_size - got, got)) <= 0)
+			break;
+
+		got += len;
+	}
+
+	buf[got] = '\0';
+	return buf;
+}
+
+/*
+ * Run a command directly, without a shell, and wait for it.  Its stdout
+ * and stderr go to an anonymous temporary file rather than a pipe so
+ * that several commands can run at once without anyone having to drain
+ * them.  If output isn't NULL it's set to what the command printed and
+ * must be freed by the caller, otherwise the output is printed on
+ * failure.
+ */
+boolean_t
+exec_cmd (char *const argv[], char **output, double *elapsed)
+{
+	int fd, status, err;
+	char tmp[] = "/tmp/schillix-install.XXXXXX", *out;
+	pid_t pid;
+	posix_spawn_file_actions_t actions;
+	struct timespec start, end;
+	double span;
+
+	if (output != NULL)
+		*output = NULL;
+
+	/*
+	 * Finish steps spawn commands from several threads at once, so
+	 * the file mustn't leak into the others' children
+	 */
+	if ((fd = mkostemp (tmp, O_CLOEXEC)) == -1)
+	{
+		fprintf (stderr, "Error: Unable to create output file for %s: %s\n", argv[0], strerror (errno));
+		return B_FALSE;
+	}
+
+	(void) unlink (tmp);
+
+	if ((err = posix_spawn_file_actions_init (&actions)) != 0)
+	{
+		fprintf (stderr, "Error: Unable to spawn %s: %s\n", argv[0], strerror (err));
+		(void) close (fd);
+		return B_FALSE;
+	}
+
+	if ((err = posix_spawn_file_actions_addopen (&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0)) != 0
+	    || (err = posix_spawn_file_actions_adddup2 (&actions, fd, STDOUT_FILENO)) != 0
+	    || (err = posix_spawn_file_actions_adddup2 (&actions, fd, STDERR_FILENO)) != 0
+	    || (err = posix_spawn_file_actions_addclose (&actions, fd)) != 0)
+	{
+		fprintf (stderr, "Error: Unable to spawn %s: %s\n", argv[0], strerror (err));
+		(void) posix_spawn_file_actions_destroy (&actions);
+		(void) close (fd);
+		return B_FALSE;
+	}
+
+	(void) clock_gettime (CLOCK_MONOTONIC, &start);
+	span = trace_start ();
+
+	if ((err = posix_spawn (&pid, argv[0], &actions, NULL, argv, environ)) != 0)
+	{
+		fprintf (stderr, "Error: Unable to spawn %s: %s\n", argv[0], strerror (err));
+		(void) posix_spawn_file_actions_destroy (&actions);
+		(void) close (fd);
+		return B_FALSE;
+	}
+
+	(void) posix_spawn_file_actions_destroy (&actions);
+
+	while (waitpid (pid, &status, 0) == -1)
+	{
+		if (errno != EINTR)
+		{
+			fprintf (stderr, "Error: Unable to wait for %s: %s\n", argv[0], strerror (errno));
+			(void) close (fd);
+			return B_FALSE;
+		}
+	}
+
+	(void) clock_gettime (CLOCK_MONOTONIC, &end);
+	trace_end ("exec", strrchr (argv[0], '/') == NULL ? argv[0] : strrchr (argv[0], '/') + 1, span);
+
+	if (elapsed != NULL)
+		*elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	out = read_output (fd);
+	(void) close (fd);
+
+	if (!WIFEXITED (status) || WEXITSTATUS (status) != 0)
+	{
+		if (out != NULL && out[0] != '\0')
+			fprintf (stderr, "%s", out);
+
+		if (WIFEXITED (status))
+			fprintf (stderr, "Error: %s exited with status %d\n", argv[0], WEXITSTATUS (status));
+		else
+			fprintf (stderr, "Error: %s was killed by signal %d\n", argv[0], WTERMSIG (status));
+
+		free (out);
+		return B_FALSE;
+	}
+
+	if (output != NULL)
+		*output = out;
+	else
+		free (out);
+
+	return B_TRUE;
+}
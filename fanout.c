@@ -0,0 +1,416 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sha1.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <libzfs.h>
+
+#include "fanout.h"
+#include "copy.h"
+#include "bufpool.h"
+#include "trace.h"
+#include "progress.h"
+
+/*
+ * One buffer of the ring.  The first buffer of a file also carries its
+ * name and attributes, the last one says to close it.
+ */
+typedef struct slot
+{
+	char s_path[PATH_MAX];	/* relative path, empty unless opening */
+	mode_t s_mode;
+	uid_t s_uid;
+	gid_t s_gid;
+	struct timespec s_times[2];	/* access and modification */
+	boolean_t s_close;
+	boolean_t s_trace;	/* record a span for this file */
+	boolean_t s_stop;	/* no more files */
+	char *s_buf;		/* from the buffer pool, NULL if empty */
+	size_t s_len;
+	int s_pending;		/* writers yet to consume it */
+} slot_t;
+
+typedef struct writer
+{
+	fanout_t *w_fanout;
+	char *w_mnt;
+	boolean_t *w_ok;
+	int w_fd;
+	char w_dest[PATH_MAX];
+	off_t w_off;		/* written so far */
+	off_t w_dropped;	/* dropped from the page cache so far */
+	struct timespec w_times[2];	/* set once the file is written */
+	boolean_t w_trace;
+	double w_span;
+	uint64_t w_next;	/* next slot sequence number */
+	pthread_t w_tid;
+} writer_t;
+
+struct fanout
+{
+	pthread_mutex_t f_lock;
+	pthread_cond_t f_posted;	/* a slot was filled */
+	pthread_cond_t f_freed;		/* a slot was consumed by everyone */
+	uint64_t f_head;		/* sequence number of the next slot */
+	slot_t f_slots[FANOUT_SLOTS];
+	int f_nwriters;
+	writer_t *f_writers;
+};
+
+/*
+ * Open a file on one root, replacing anything already there
+ */
+static boolean_t
+writer_open (writer_t *w, slot_t *s)
+{
+	if (snprintf (w->w_dest, PATH_MAX, "%s/%s", w->w_mnt, s->s_path) >= PATH_MAX)
+	{
+		fprintf (stderr, "Unable to create file %s/%s: %s\n", w->w_mnt, s->s_path, strerror (ENAMETOOLONG));
+		return B_FALSE;
+	}
+
+	if ((w->w_trace = s->s_trace) == B_TRUE)
+		w->w_span = trace_start ();
+
+	w->w_off = w->w_dropped = 0;
+	w->w_times[0] = s->s_times[0];
+	w->w_times[1] = s->s_times[1];
+
+	if ((w->w_fd = open (w->w_dest, O_WRONLY | O_CREAT | O_TRUNC, s->s_mode)) == -1)
+	{
+		fprintf (stderr, "Unable to create file %s: %s\n", w->w_dest, strerror (errno));
+		return B_FALSE;
+	}
+
+	if (fchown (w->w_fd, s->s_uid, s->s_gid) == -1)
+	{
+		fprintf (stderr, "Unable to chown file %s: %s\n", w->w_dest, strerror (errno));
+		return B_FALSE;
+	}
+
+	return B_TRUE;
+}
+
+static boolean_t
+writer_write (writer_t *w, slot_t *s)
+{
+	size_t off;
+	ssize_t ret;
+
+	for (off = 0; off < s->s_len; off += ret)
+	{
+		if ((ret = write (w->w_fd, s->s_buf + off, s->s_len - off)) == -1)
+		{
+			if (errno == EINTR)
+			{
+				ret = 0;
+				continue;
+			}
+
+			fprintf (stderr, "Unable to write file %s: %s\n", w->w_dest, strerror (errno));
+			return B_FALSE;
+		}
+	}
+
+	w->w_off += s->s_len;
+
+	/*
+	 * Write back and drop each whole window
+	 */
+	if (w->w_off - w->w_dropped >= COPY_WINDOW)
+	{
+		copy_drop (w->w_fd, w->w_dropped, w->w_off - w->w_dropped, B_TRUE);
+		w->w_dropped = w->w_off;
+	}
+
+	return B_TRUE;
+}
+
+/*
+ * Write every slot to one root.  A root that fails stops writing but
+ * keeps consuming slots so the others aren't held up.
+ */
+static void *
+writer_thread (void *arg)
+{
+	writer_t *w = arg;
+	fanout_t *fo = w->w_fanout;
+	slot_t *s;
+	boolean_t stop = B_FALSE;
+
+	while (stop == B_FALSE)
+	{
+		(void) pthread_mutex_lock (&fo->f_lock);
+
+		while (w->w_next == fo->f_head)
+			(void) pthread_cond_wait (&fo->f_posted, &fo->f_lock);
+
+		(void) pthread_mutex_unlock (&fo->f_lock);
+
+		s = &fo->f_slots[w->w_next % FANOUT_SLOTS];
+		stop = s->s_stop;
+
+		if (stop == B_FALSE && copy_root_ok (w->w_ok) == B_TRUE)
+		{
+			if (s->s_path[0] != '\0' && writer_open (w, s) == B_FALSE)
+				copy_root_failed (w->w_ok);
+			else if (writer_write (w, s) == B_FALSE)
+				copy_root_failed (w->w_ok);
+		}
+
+		if (s->s_close == B_TRUE && w->w_fd != -1)
+		{
+			copy_drop (w->w_fd, w->w_dropped, w->w_off - w->w_dropped, B_FALSE);
+
+			if (copy_root_ok (w->w_ok) == B_TRUE && futimens (w->w_fd, w->w_times) == -1)
+			{
+				fprintf (stderr, "Unable to set times on file %s: %s\n", w->w_dest, strerror (errno));
+				copy_root_failed (w->w_ok);
+			}
+
+			if (close (w->w_fd) == -1 && copy_root_ok (w->w_ok) == B_TRUE)
+			{
+				fprintf (stderr, "Unable to write file %s: %s\n", w->w_dest, strerror (errno));
+				copy_root_failed (w->w_ok);
+			}
+
+			w->w_fd = -1;
+
+			if (w->w_trace == B_TRUE)
+				trace_end ("copy", w->w_dest, w->w_span);
+		}
+
+		(void) pthread_mutex_lock (&fo->f_lock);
+		w->w_next++;
+
+		if (--s->s_pending == 0)
+		{
+			if (s->s_buf != NULL)
+				bufpool_put (s->s_buf);
+
+			s->s_buf = NULL;
+			(void) pthread_cond_broadcast (&fo->f_freed);
+		}
+
+		(void) pthread_mutex_unlock (&fo->f_lock);
+	}
+
+	return NULL;
+}
+
+/*
+ * Wait until the next slot has been written everywhere
+ */
+static slot_t *
+next_slot (fanout_t *fo)
+{
+	slot_t *s = &fo->f_slots[fo->f_head % FANOUT_SLOTS];
+
+	(void) pthread_mutex_lock (&fo->f_lock);
+
+	while (s->s_pending != 0)
+		(void) pthread_cond_wait (&fo->f_freed, &fo->f_lock);
+
+	(void) pthread_mutex_unlock (&fo->f_lock);
+
+	s->s_path[0] = '\0';
+	s->s_close = B_FALSE;
+	s->s_trace = B_FALSE;
+	s->s_stop = B_FALSE;
+	s->s_buf = NULL;
+	s->s_len = 0;
+
+	return s;
+}
+
+/*
+ * Hand a filled slot to the writers
+ */
+static void
+post_slot (fanout_t *fo, slot_t *s)
+{
+	(void) pthread_mutex_lock (&fo->f_lock);
+	s->s_pending = fo->f_nwriters;
+	fo->f_head++;
+	(void) pthread_cond_broadcast (&fo->f_posted);
+	(void) pthread_mutex_unlock (&fo->f_lock);
+}
+
+/*
+ * Start a writer for each root.  ok[i] is cleared if anything fails
+ * on mnt[i].
+ */
+fanout_t *
+fanout_init (char **mnt, boolean_t *ok, int nmnt)
+{
+	int i;
+	fanout_t *fo;
+
+	if ((fo = calloc (1, sizeof (fanout_t))) == NULL ||
+	    (fo->f_writers = calloc (nmnt, sizeof (writer_t))) == NULL)
+	{
+		fprintf (stderr, "Error: out of memory\n");
+		free (fo);
+		return NULL;
+	}
+
+	(void) pthread_mutex_init (&fo->f_lock, NULL);
+	(void) pthread_cond_init (&fo->f_posted, NULL);
+	(void) pthread_cond_init (&fo->f_freed, NULL);
+
+	for (i = 0; i < nmnt; i++)
+	{
+		fo->f_writers[i].w_fanout = fo;
+		fo->f_writers[i].w_mnt = mnt[i];
+		fo->f_writers[i].w_ok = &ok[i];
+		fo->f_writers[i].w_fd = -1;
+
+		if (pthread_create (&fo->f_writers[i].w_tid, NULL, writer_thread, &fo->f_writers[i]) != 0)
+		{
+			fprintf (stderr, "Error: Unable to start writer for %s\n", mnt[i]);
+			fanout_fini (fo);
+			return NULL;
+		}
+
+		fo->f_nwriters++;
+	}
+
+	return fo;
+}
+
+/*
+ * Read a file once and queue it for every root, rel being its path
+ * relative to the roots.  The file's SHA1 is left in hash.
+ */
+boolean_t
+fanout_file (fanout_t *fo, const char *path, const char *rel, const struct stat *statptr, unsigned char *hash)
+{
+	int fd;
+	ssize_t len;
+	off_t offset = 0;
+	slot_t *s;
+	boolean_t first = B_TRUE, ret = B_TRUE, trace = trace_sample ();
+	double span = trace_start ();
+	SHA1_CTX ctx;
+
+	if ((fd = open (path, O_RDONLY)) == -1)
+	{
+		fprintf (stderr, "Unable to open file %s: %s\n", path, strerror (errno));
+		return B_FALSE;
+	}
+
+	SHA1Init (&ctx);
+
+	do
+	{
+		s = next_slot (fo);
+
+		if (first == B_TRUE)
+		{
+			(void) snprintf (s->s_path, PATH_MAX, "%s", rel);
+			s->s_mode = statptr->st_mode;
+			s->s_uid = statptr->st_uid;
+			s->s_gid = statptr->st_gid;
+			s->s_times[0] = statptr->st_atim;
+			s->s_times[1] = statptr->st_mtim;
+			s->s_trace = trace;
+			first = B_FALSE;
+		}
+
+		/*
+		 * Waits here once the writers hold the whole budget
+		 */
+		s->s_buf = bufpool_get ();
+
+		while ((len = read (fd, s->s_buf, BUFPOOL_BUFSIZE)) == -1 && errno == EINTR)
+			;
+
+		if (len == -1)
+		{
+			fprintf (stderr, "Unable to read file %s: %s\n", path, strerror (errno));
+			ret = B_FALSE;
+			len = 0;
+		}
+
+		/*
+		 * The closing slot needn't hold on to memory
+		 */
+		if (len == 0)
+		{
+			bufpool_put (s->s_buf);
+			s->s_buf = NULL;
+		}
+
+		SHA1Update (&ctx, s->s_buf, len);
+		copy_drop (fd, offset, len, B_FALSE);
+		offset += len;
+
+		s->s_len = len;
+		s->s_close = len == 0 ? B_TRUE : B_FALSE;
+		post_slot (fo, s);
+		progress_bytes (len);
+	}
+	while (len > 0);
+
+	SHA1Final (hash, &ctx);
+	(void) close (fd);
+	progress_file ();
+
+	if (trace == B_TRUE)
+		trace_end ("read", path, span);
+
+	return ret;
+}
+
+/*
+ * Wait for the writers to catch up and free everything
+ */
+void
+fanout_fini (fanout_t *fo)
+{
+	int i;
+	slot_t *s;
+
+	if (fo->f_nwriters > 0)
+	{
+		s = next_slot (fo);
+		s->s_stop = B_TRUE;
+		post_slot (fo, s);
+
+		for (i = 0; i < fo->f_nwriters; i++)
+			(void) pthread_join (fo->f_writers[i].w_tid, NULL);
+	}
+
+	free (fo->f_writers);
+	free (fo);
+}
@@ -0,0 +1,40 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+
+/*
+ * Copy files to several roots at once, reading each file only once.
+ * Each root gets its own writer thread working through a shared ring of
+ * buffers, so the slowest root can fall at most FANOUT_SLOTS buffers
+ * behind before the reader waits for it.  The buffers come from the
+ * buffer pool, so the reader may wait for the budget sooner.
+ */
+#define FANOUT_SLOTS	16
+
+typedef struct fanout fanout_t;
+
+fanout_t *fanout_init (char **mnt, boolean_t *ok, int nmnt);
+boolean_t fanout_file (fanout_t *fo, const char *path, const char *rel, const struct stat *statptr,
+    unsigned char *hash);
+void fanout_fini (fanout_t *fo);
@@ -0,0 +1,582 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <pthread.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <libzfs.h>
+
+#include "disk.h"
+#include "config.h"
+#include "copy.h"
+#include "bootarch.h"
+#include "sched.h"
+#include "install.h"
+#include "iso.h"
+
+extern char cdrom_path[PATH_MAX];
+
+/*
+ * The phases each target goes through before the copy...
+ */
+enum
+{
+	PRE_PARTITION,
+	PRE_VTOC,
+	PRE_DISCARD,
+	PRE_POOL,
+	PRE_DATASETS,
+	PRE_MOUNT,
+	PRE_COPY_GRUB,
+	PRE_GRUB,
+	PRE_COUNT
+};
+
+/*
+ * ...the phases shared by all targets...
+ */
+enum
+{
+	SHARED_BOOTARCH,
+	SHARED_COPY_BOOT,
+	SHARED_COPY,
+	SHARED_COUNT
+};
+
+/*
+ * ...and the phases after it
+ */
+enum
+{
+	POST_OVERLAYS,
+	POST_BOOTABLE,
+	POST_COPIED,
+	POST_DEVFS,
+	POST_BOOTADM,
+	POST_SNAPSHOT,
+	POST_UNMOUNT,
+	POST_EXPORT,
+	POST_COUNT
+};
+
+/*
+ * Where each phase sits in the steps array, the pre phases first
+ */
+#define PRE(i, p)	((i) * PRE_COUNT + (p))
+#define SHARED(n, s)	((n) * PRE_COUNT + (s))
+#define POST(n, i, p)	((n) * PRE_COUNT + SHARED_COUNT + (i) * POST_COUNT + (p))
+#define NUM_STEPS(n)	((n) * (PRE_COUNT + POST_COUNT) + SHARED_COUNT)
+
+#define STEP_NAMELEN	64
+
+typedef struct install_job
+{
+	target_t *ij_targets;
+	int ij_ntargets;
+	char *ij_mnt[MAX_TARGETS];	/* the targets being copied to */
+	boolean_t ij_ok[MAX_TARGETS];
+	int ij_ncopy;
+} install_job_t;
+
+/*
+ * libzfs isn't thread safe so only one target uses it at a time
+ */
+static pthread_mutex_t libzfs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static boolean_t
+phase_partition (void *arg)
+{
+	target_t *t = arg;
+
+	printf ("Reformatting %s...\n", t->t_disk);
+
+	return create_root_partition (t->t_disk, t->t_layout);
+}
+
+static boolean_t
+phase_vtoc (void *arg)
+{
+	target_t *t = arg;
+
+	return create_root_vtoc (t->t_disk, t->t_layout);
+}
+
+static boolean_t
+phase_discard (void *arg)
+{
+	target_t *t = arg;
+
+	if (t->t_discard == B_FALSE)
+		return B_TRUE;
+
+	return discard_root_slice (t->t_disk, t->t_layout);
+}
+
+static boolean_t
+phase_pool (void *arg)
+{
+	target_t *t = arg;
+	boolean_t ret;
+
+	printf ("Creating new filesystem %s...\n", t->t_rpool);
+
+	(void) pthread_mutex_lock (&libzfs_lock);
+	ret = create_root_pool (t->t_libzfs, t->t_disk, t->t_rpool, t->t_mnt, t->t_layout, t->t_pool_layout);
+	(void) pthread_mutex_unlock (&libzfs_lock);
+
+	return ret;
+}
+
+static boolean_t
+phase_datasets (void *arg)
+{
+	target_t *t = arg;
+	boolean_t ret;
+
+	(void) pthread_mutex_lock (&libzfs_lock);
+	ret = create_root_datasets (t->t_libzfs, t->t_rpool, t->t_profile);
+	(void) pthread_mutex_unlock (&libzfs_lock);
+
+	return ret;
+}
+
+static boolean_t
+phase_mount (void *arg)
+{
+	target_t *t = arg;
+
+	printf ("Mounting %s on %s...\n", t->t_rpool, t->t_mnt);
+
+	(void) pthread_mutex_lock (&libzfs_lock);
+	t->t_mounted = mount_root_datasets (t->t_libzfs, t->t_rpool);
+	(void) pthread_mutex_unlock (&libzfs_lock);
+
+	return t->t_mounted;
+}
+
+static boolean_t
+phase_copy_grub (void *arg)
+{
+	target_t *t = arg;
+
+	return copy_grub (t->t_src, t->t_mnt, t->t_rpool);
+}
+
+/*
+ * The stage files come from the livecd so the boot blocks can go on as
+ * soon as the disk is labelled.  An image can't be read by path, so
+ * then they come from the new root once the copy has put them there.
+ */
+static boolean_t
+phase_grub (void *arg)
+{
+	target_t *t = arg;
+
+	return config_grub (t->t_src, t->t_disk, t->t_layout);
+}
+
+/*
+ * Start building the boot archives before anything they contain is
+ * written, so they can be built alongside the copy.  The builder only
+ * follows one root and reads the livecd by path, so with several
+ * targets or an image bootadm builds them.
+ */
+static boolean_t
+phase_bootarch (void *arg)
+{
+	install_job_t *ij = arg;
+	target_t *t = &ij->ij_targets[0];
+
+	if (ij->ij_ntargets == 1 && t->t_mounted == B_TRUE && iso_image (cdrom_path) == B_FALSE)
+		(void) bootarch_init (cdrom_path, t->t_mnt, t->t_force_archive);
+
+	return B_TRUE;
+}
+
+/*
+ * Copy what the system needs to boot to every target that got this far
+ */
+static boolean_t
+phase_copy_boot (void *arg)
+{
+	install_job_t *ij = arg;
+	target_t *t;
+	boolean_t ret;
+	int i, n;
+
+	for (i = 0, ij->ij_ncopy = 0; i < ij->ij_ntargets; i++)
+		if (ij->ij_targets[i].t_mounted == B_TRUE)
+			ij->ij_mnt[ij->ij_ncopy++] = ij->ij_targets[i].t_mnt;
+
+	if (ij->ij_ncopy == 0)
+		return B_FALSE;
+
+	puts ("Copying files...");
+
+	ret = copy_files (cdrom_path, ij->ij_mnt, ij->ij_ok, ij->ij_ncopy, COPY_BOOT);
+
+	for (i = 0, n = 0; i < ij->ij_ntargets; i++)
+	{
+		t = &ij->ij_targets[i];
+
+		if (t->t_mounted == B_TRUE)
+			t->t_bootable = ij->ij_ok[n++];
+	}
+
+	return ret;
+}
+
+/*
+ * Then copy the rest to the same targets
+ */
+static boolean_t
+phase_copy (void *arg)
+{
+	install_job_t *ij = arg;
+	target_t *t;
+	boolean_t ret;
+	int i, n;
+
+	ret = copy_files (cdrom_path, ij->ij_mnt, ij->ij_ok, ij->ij_ncopy, COPY_REST);
+
+	for (i = 0, n = 0; i < ij->ij_ntargets; i++)
+	{
+		t = &ij->ij_targets[i];
+
+		if (t->t_mounted == B_TRUE)
+			t->t_copied = ij->ij_ok[n++];
+	}
+
+	return ret;
+}
+
+static boolean_t
+phase_overlays (void *arg)
+{
+	target_t *t = arg;
+
+	return write_overlays (t->t_mnt);
+}
+
+/*
+ * Whether this target got everything it needs to boot
+ */
+static boolean_t
+phase_bootable (void *arg)
+{
+	target_t *t = arg;
+
+	if (t->t_bootable == B_FALSE)
+		fprintf (stderr, "Error: Copy to %s failed\n", t->t_mnt);
+
+	return t->t_bootable;
+}
+
+/*
+ * Whether the shared copy worked for this target
+ */
+static boolean_t
+phase_copied (void *arg)
+{
+	target_t *t = arg;
+
+	if (t->t_copied == B_FALSE)
+		fprintf (stderr, "Error: Copy to %s failed\n", t->t_mnt);
+
+	return t->t_copied;
+}
+
+static boolean_t
+phase_devfs (void *arg)
+{
+	target_t *t = arg;
+
+	return config_devfs (t->t_mnt);
+}
+
+static boolean_t
+phase_bootadm (void *arg)
+{
+	target_t *t = arg;
+
+	return config_bootadm (t->t_mnt);
+}
+
+/*
+ * Keep the finished install to reset back to
+ */
+static boolean_t
+phase_snapshot (void *arg)
+{
+	target_t *t = arg;
+	boolean_t ret;
+
+	(void) pthread_mutex_lock (&libzfs_lock);
+	ret = snapshot_root_datasets (t->t_libzfs, t->t_rpool, t->t_profile);
+	(void) pthread_mutex_unlock (&libzfs_lock);
+
+	return ret;
+}
+
+static boolean_t
+phase_unmount (void *arg)
+{
+	target_t *t = arg;
+	boolean_t ret;
+
+	if (t->t_unmount == B_FALSE)
+		return B_TRUE;
+
+	printf ("Unmounting %s...\n", t->t_rpool);
+
+	(void) pthread_mutex_lock (&libzfs_lock);
+	ret = unmount_root_datasets (t->t_libzfs, t->t_rpool);
+	(void) pthread_mutex_unlock (&libzfs_lock);
+
+	return ret;
+}
+
+static boolean_t
+phase_export (void *arg)
+{
+	target_t *t = arg;
+	boolean_t ret;
+
+	if (t->t_unmount == B_FALSE)
+		return B_TRUE;
+
+	(void) pthread_mutex_lock (&libzfs_lock);
+	ret = export_root_pool (t->t_libzfs, t->t_rpool);
+	(void) pthread_mutex_unlock (&libzfs_lock);
+
+	return ret;
+}
+
+/*
+ * Fill in one step
+ */
+static void
+add_step (sched_step_t *ss, char *name, char *disk, boolean_t (*func) (void *), void *arg, int ndeps, ...)
+{
+	va_list ap;
+	int i;
+
+	if (disk == NULL)
+		(void) snprintf (ss->ss_name, STEP_NAMELEN, "%s", name);
+	else
+		(void) snprintf (ss->ss_name, STEP_NAMELEN, "%s:%s", disk, name);
+
+	ss->ss_func = func;
+	ss->ss_arg = arg;
+	ss->ss_ndeps = ndeps;
+	ss->ss_always = B_FALSE;
+
+	va_start (ap, ndeps);
+
+	for (i = 0; i < ndeps; i++)
+		ss->ss_deps[i] = va_arg (ap, int);
+
+	va_end (ap);
+}
+
+/*
+ * Did every phase for target i finish?
+ */
+static boolean_t
+target_done (sched_step_t *steps, int n, int i)
+{
+	int p;
+
+	for (p = 0; p < PRE_COUNT; p++)
+		if (steps[PRE (i, p)].ss_state != SCHED_DONE)
+			return B_FALSE;
+
+	for (p = 0; p < POST_COUNT; p++)
+		if (steps[POST (n, i, p)].ss_state != SCHED_DONE)
+			return B_FALSE;
+
+	return B_TRUE;
+}
+
+/*
+ * Install onto every target, each phase starting as soon as the ones it
+ * needs are done.  The targets are independent apart from sharing one
+ * read of the livecd: if a phase fails whatever depends on it is
+ * cancelled, and if that target's pool was created it is unmounted and
+ * exported again.  Returns B_FALSE unless every target was installed.
+ */
+boolean_t
+install (target_t *targets, int ntargets)
+{
+	int i, nsteps = NUM_STEPS (ntargets);
+	char *disk, *names;
+	boolean_t ret = B_TRUE, from_iso = iso_image (cdrom_path);
+	sched_step_t *steps;
+	target_t *t;
+	install_job_t ij;
+
+	if ((steps = calloc (nsteps, sizeof (sched_step_t))) == NULL ||
+	    (names = calloc (nsteps, STEP_NAMELEN)) == NULL)
+	{
+		fprintf (stderr, "Error: out of memory\n");
+		free (steps);
+		return B_FALSE;
+	}
+
+	for (i = 0; i < nsteps; i++)
+		steps[i].ss_name = names + i * STEP_NAMELEN;
+
+	ij.ij_targets = targets;
+	ij.ij_ntargets = ntargets;
+
+	for (i = 0; i < ntargets; i++)
+	{
+		t = &targets[i];
+		t->t_src = from_iso == B_TRUE ? t->t_mnt : cdrom_path;
+		t->t_mounted = B_FALSE;
+		t->t_bootable = B_FALSE;
+		t->t_copied = B_FALSE;
+
+		/*
+		 * Only name the disk when there's more than one
+		 */
+		if (ntargets == 1)
+			disk = NULL;
+		else if ((disk = strrchr (t->t_disk, '/')) != NULL)
+			disk++;
+		else
+			disk = t->t_disk;
+
+		add_step (&steps[PRE (i, PRE_PARTITION)], "partition", disk, phase_partition, t, 0);
+		add_step (&steps[PRE (i, PRE_VTOC)], "vtoc", disk, phase_vtoc, t, 1, PRE (i, PRE_PARTITION));
+		add_step (&steps[PRE (i, PRE_DISCARD)], "discard", disk, phase_discard, t, 1, PRE (i, PRE_VTOC));
+		add_step (&steps[PRE (i, PRE_POOL)], "pool", disk, phase_pool, t, 1, PRE (i, PRE_DISCARD));
+		add_step (&steps[PRE (i, PRE_DATASETS)], "datasets", disk, phase_datasets, t, 1, PRE (i, PRE_POOL));
+		add_step (&steps[PRE (i, PRE_MOUNT)], "mount", disk, phase_mount, t, 1, PRE (i, PRE_DATASETS));
+
+		/*
+		 * An image can't be read by installgrub, so grub's files come
+		 * from the copy on the new root instead
+		 */
+		if (from_iso == B_FALSE)
+		{
+			add_step (&steps[PRE (i, PRE_COPY_GRUB)], "copy-grub", disk, phase_copy_grub, t, 1, PRE (i, PRE_MOUNT));
+			add_step (&steps[PRE (i, PRE_GRUB)], "grub", disk, phase_grub, t, 1, PRE (i, PRE_VTOC));
+		}
+		else
+		{
+			add_step (&steps[PRE (i, PRE_COPY_GRUB)], "copy-grub", disk, phase_copy_grub, t, 2,
+			    PRE (i, PRE_MOUNT), POST (ntargets, i, POST_COPIED));
+			add_step (&steps[PRE (i, PRE_GRUB)], "grub", disk, phase_grub, t, 2,
+			    PRE (i, PRE_VTOC), POST (ntargets, i, POST_COPIED));
+		}
+
+		add_step (&steps[POST (ntargets, i, POST_OVERLAYS)], "overlays", disk, phase_overlays, t, 2,
+		    PRE (i, PRE_MOUNT), SHARED (ntargets, SHARED_BOOTARCH));
+		add_step (&steps[POST (ntargets, i, POST_BOOTABLE)], "bootable", disk, phase_bootable, t, 2,
+		    PRE (i, PRE_MOUNT), SHARED (ntargets, SHARED_COPY_BOOT));
+		add_step (&steps[POST (ntargets, i, POST_COPIED)], "copied", disk, phase_copied, t, 2,
+		    POST (ntargets, i, POST_BOOTABLE), SHARED (ntargets, SHARED_COPY));
+
+		/*
+		 * devfs and bootadm only need what's on the boot list, which
+		 * always has the boot archive's contents and the libraries
+		 * of the commands on it, so they go ahead while the rest is
+		 * still being copied
+		 */
+		add_step (&steps[POST (ntargets, i, POST_DEVFS)], "devfs", disk, phase_devfs, t, 1,
+		    POST (ntargets, i, POST_BOOTABLE));
+		add_step (&steps[POST (ntargets, i, POST_BOOTADM)], "bootadm", disk, phase_bootadm, t, 3,
+		    POST (ntargets, i, POST_OVERLAYS), POST (ntargets, i, POST_BOOTABLE), POST (ntargets, i, POST_DEVFS));
+		add_step (&steps[POST (ntargets, i, POST_SNAPSHOT)], "snapshot", disk, phase_snapshot, t, 2,
+		    POST (ntargets, i, POST_BOOTADM), POST (ntargets, i, POST_COPIED));
+		add_step (&steps[POST (ntargets, i, POST_UNMOUNT)], "unmount", disk, phase_unmount, t, 7,
+		    PRE (i, PRE_COPY_GRUB), PRE (i, PRE_GRUB), POST (ntargets, i, POST_OVERLAYS), POST (ntargets, i, POST_COPIED),
+		    POST (ntargets, i, POST_DEVFS), POST (ntargets, i, POST_BOOTADM), POST (ntargets, i, POST_SNAPSHOT));
+		add_step (&steps[POST (ntargets, i, POST_EXPORT)], "export", disk, phase_export, t, 1,
+		    POST (ntargets, i, POST_UNMOUNT));
+	}
+
+	/*
+	 * The shared phases wait for every target to be mounted, or to
+	 * have given up trying
+	 */
+	add_step (&steps[SHARED (ntargets, SHARED_BOOTARCH)], "bootarch", NULL, phase_bootarch, &ij, 0);
+	add_step (&steps[SHARED (ntargets, SHARED_COPY_BOOT)], "copy-boot", NULL, phase_copy_boot, &ij, 1,
+	    SHARED (ntargets, SHARED_BOOTARCH));
+	add_step (&steps[SHARED (ntargets, SHARED_COPY)], "copy", NULL, phase_copy, &ij, 1,
+	    SHARED (ntargets, SHARED_COPY_BOOT));
+
+	steps[SHARED (ntargets, SHARED_BOOTARCH)].ss_ndeps = ntargets;
+	steps[SHARED (ntargets, SHARED_BOOTARCH)].ss_always = B_TRUE;
+
+	for (i = 0; i < ntargets; i++)
+		steps[SHARED (ntargets, SHARED_BOOTARCH)].ss_deps[i] = PRE (i, PRE_MOUNT);
+
+	(void) sched_run (steps, nsteps);
+
+	puts ("Install phases:");
+	sched_report (steps, nsteps);
+
+	for (i = 0; i < ntargets; i++)
+	{
+		t = &targets[i];
+
+		if (target_done (steps, ntargets, i) == B_TRUE)
+		{
+			if (ntargets > 1)
+				printf ("Installed %s on %s\n", t->t_rpool, t->t_disk);
+
+			continue;
+		}
+
+		ret = B_FALSE;
+
+		if (ntargets > 1)
+			fprintf (stderr, "Error: Install on %s failed\n", t->t_disk);
+
+		if (t->t_unmount == B_FALSE)
+			continue;
+
+		if (steps[PRE (i, PRE_MOUNT)].ss_state == SCHED_DONE &&
+		    steps[POST (ntargets, i, POST_UNMOUNT)].ss_state != SCHED_DONE)
+		{
+			(void) unmount_root_datasets (t->t_libzfs, t->t_rpool);
+			(void) export_root_pool (t->t_libzfs, t->t_rpool);
+		}
+		else if (steps[PRE (i, PRE_POOL)].ss_state == SCHED_DONE &&
+		    steps[POST (ntargets, i, POST_EXPORT)].ss_state != SCHED_DONE)
+			(void) export_root_pool (t->t_libzfs, t->t_rpool);
+	}
+
+	free (names);
+	free (steps);
+
+	return ret;
+}
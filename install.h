@@ -0,0 +1,52 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+
+/*
+ * Everything needed to install onto one disk.  The shared phases wait
+ * on every target so there can be no more than SCHED_MAXDEPS.
+ */
+#define MAX_TARGETS	8
+
+typedef struct target
+{
+	libzfs_handle_t *t_libzfs;
+	char *t_disk;
+	char *t_rpool;
+	char *t_mnt;
+	root_layout_t *t_layout;
+	pool_layout_t *t_pool_layout;
+	profile_t *t_profile;
+	boolean_t t_discard;
+	boolean_t t_unmount;
+	boolean_t t_force_archive;
+
+	/* Filled in by install */
+	char *t_src;		/* where the grub phases read the livecd */
+	boolean_t t_mounted;
+	boolean_t t_bootable;
+	boolean_t t_copied;
+} target_t;
+
+boolean_t install (target_t *targets, int ntargets);
@@ -0,0 +1,379 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <libzfs.h>
+
+#include "disk.h"
+#include "inventory.h"
+
+#define RDISK_PATH	"/dev/rdsk"
+
+#ifdef sparc
+#define WHOLE_DISK	"s2"
+#else
+#define WHOLE_DISK	"p0"
+#endif
+
+/*
+ * One of these per disk being probed.  Probe threads which outlive their
+ * timeout still reference it, so they are never freed once that happens.
+ */
+typedef struct probe
+{
+	libzfs_handle_t *libzfs_handle;
+	disk_info_t info;
+} probe_t;
+
+static pthread_mutex_t inventory_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t inventory_cv = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t inventory_zfs_lock = PTHREAD_MUTEX_INITIALIZER;
+static int inventory_pending;
+
+/*
+ * Probe a single disk.  Runs in its own thread.
+ */
+static void *
+probe_thread (void *arg)
+{
+	probe_t *probe = arg;
+	libzfs_handle_t *libzfs_handle;
+	disk_info_t info;
+	char disk[PATH_MAX];
+	boolean_t ok;
+
+	(void) pthread_mutex_lock (&inventory_lock);
+	info = probe->info;
+	(void) pthread_mutex_unlock (&inventory_lock);
+
+	/*
+	 * libzfs handles aren't thread safe, so each probe has its own and
+	 * a disk that hangs doesn't hold up the rest.  Without one the
+	 * probes take turns with the shared handle.
+	 */
+	if (snprintf (disk, sizeof (disk), RDISK_PATH "/%s", info.di_name) >= sizeof (disk))
+	{
+		ok = B_FALSE;
+	}
+	else if ((libzfs_handle = libzfs_init ()) != NULL)
+	{
+		ok = probe_disk (libzfs_handle, disk, &info);
+		(void) libzfs_fini (libzfs_handle);
+	}
+	else
+	{
+		(void) pthread_mutex_lock (&inventory_zfs_lock);
+		ok = probe_disk (probe->libzfs_handle, disk, &info);
+		(void) pthread_mutex_unlock (&inventory_zfs_lock);
+	}
+
+	info.di_state = ok == B_TRUE ? DISK_OK : DISK_ERROR;
+
+	/*
+	 * Don't overwrite the result if we were given up on
+	 */
+	(void) pthread_mutex_lock (&inventory_lock);
+
+	if (probe->info.di_state == DISK_PENDING)
+	{
+		probe->info = info;
+		inventory_pending--;
+		(void) pthread_cond_signal (&inventory_cv);
+	}
+
+	(void) pthread_mutex_unlock (&inventory_lock);
+
+	return NULL;
+}
+
+/*
+ * Print a one line summary of a disk
+ */
+void
+print_disk_info (FILE *out, disk_info_t *info)
+{
+	double size = info->di_size;
+	char *unit = "B";
+
+	switch (info->di_state)
+	{
+		case DISK_OK:
+			break;
+		case DISK_TIMEOUT:
+			fprintf (out, "%-24s probe timed out\n", info->di_name);
+			return;
+		default:
+			fprintf (out, "%-24s unable to probe\n", info->di_name);
+			return;
+	}
+
+	if (size >= 1024.0 * 1024 * 1024 * 1024)
+	{
+		size /= 1024.0 * 1024 * 1024 * 1024;
+		unit = "TB";
+	}
+	else if (size >= 1024.0 * 1024 * 1024)
+	{
+		size /= 1024.0 * 1024 * 1024;
+		unit = "GB";
+	}
+	else if (size >= 1024.0 * 1024)
+	{
+		size /= 1024.0 * 1024;
+		unit = "MB";
+	}
+
+	fprintf (out, "%-24s %8.1f %-2s  %5u/%3u/%3u  %-4s  %s\n", info->di_name,
+	    size, unit, info->di_ncyl, info->di_nhead, info->di_nsect, info->di_label,
+	    info->di_pool[0] == '\0' ? "-" : info->di_pool);
+}
+
+/*
+ * Write probe results to the cache file
+ */
+static boolean_t
+write_cache (char *cache, probe_t *probes, int nprobes)
+{
+	int i;
+	char tmp[PATH_MAX];
+	FILE *fp;
+
+	(void) snprintf (tmp, PATH_MAX, "%s.%ld", cache, (long) getpid ());
+
+	if ((fp = fopen (tmp, "w")) == NULL)
+	{
+		fprintf (stderr, "Error: Unable to create %s: %s\n", tmp, strerror (errno));
+		return B_FALSE;
+	}
+
+	fprintf (fp, "# schillix-install disk inventory, %ld\n", (long) time (NULL));
+	fprintf (fp, "# name\tstate\tsize\tncyl\tnhead\tnsect\tlabel\tpool\n");
+
+	for (i = 0; i < nprobes; i++)
+	{
+		disk_info_t *info = &probes[i].info;
+
+		fprintf (fp, "%s\t%d\t%llu\t%u\t%u\t%u\t%s\t%s\n", info->di_name,
+		    info->di_state, (unsigned long long) info->di_size, info->di_ncyl,
+		    info->di_nhead, info->di_nsect, info->di_label,
+		    info->di_pool[0] == '\0' ? "-" : info->di_pool);
+	}
+
+	if (fclose (fp) == EOF || rename (tmp, cache) == -1)
+	{
+		fprintf (stderr, "Error: Unable to write %s: %s\n", cache, strerror (errno));
+		(void) unlink (tmp);
+		return B_FALSE;
+	}
+
+	return B_TRUE;
+}
+
+/*
+ * Probe every disk on the system concurrently, print what we found and
+ * save the results for later runs.  Unresponsive disks are given up on
+ * after INVENTORY_TIMEOUT seconds.
+ */
+boolean_t
+inventory_disks (libzfs_handle_t *libzfs_handle, char *cache)
+{
+	int i, nprobes = 0, maxprobes = 16;
+	size_t len;
+	boolean_t timedout = B_FALSE, ret;
+	probe_t *probes;
+	DIR *dir;
+	struct dirent *dp;
+	struct timespec deadline;
+	pthread_attr_t attr;
+	pthread_t tid;
+
+	if ((dir = opendir (RDISK_PATH)) == NULL)
+	{
+		fprintf (stderr, "Error: Unable to open " RDISK_PATH ": %s\n", strerror (errno));
+		return B_FALSE;
+	}
+
+	if ((probes = malloc (maxprobes * sizeof (probe_t))) == NULL)
+	{
+		fprintf (stderr, "Error: out of memory\n");
+		(void) closedir (dir);
+		return B_FALSE;
+	}
+
+	/*
+	 * Every disk has exactly one whole disk node
+	 */
+	while ((dp = readdir (dir)) != NULL)
+	{
+		len = strlen (dp->d_name);
+
+		if (len <= 2 || strcmp (dp->d_name + len - 2, WHOLE_DISK) != 0)
+			continue;
+
+		if (nprobes == maxprobes)
+		{
+			probe_t *tmp;
+
+			maxprobes *= 2;
+
+			if ((tmp = realloc (probes, maxprobes * sizeof (probe_t))) == NULL)
+			{
+				fprintf (stderr, "Error: out of memory\n");
+				(void) closedir (dir);
+				free (probes);
+				return B_FALSE;
+			}
+
+			probes = tmp;
+		}
+
+		(void) memset (&probes[nprobes], 0, sizeof (probe_t));
+		probes[nprobes].libzfs_handle = libzfs_handle;
+		(void) strncpy (probes[nprobes].info.di_name, dp->d_name, len - 2);
+		probes[nprobes].info.di_state = DISK_PENDING;
+		nprobes++;
+	}
+
+	(void) closedir (dir);
+
+	/*
+	 * Start all of the probes at once, everyone gets the same deadline
+	 */
+	(void) pthread_attr_init (&attr);
+	(void) pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+
+	(void) clock_gettime (CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += INVENTORY_TIMEOUT;
+
+	(void) pthread_mutex_lock (&inventory_lock);
+
+	for (i = 0; i < nprobes; i++)
+	{
+		if (pthread_create (&tid, &attr, probe_thread, &probes[i]) != 0)
+		{
+			probes[i].info.di_state = DISK_ERROR;
+			continue;
+		}
+
+		inventory_pending++;
+	}
+
+	(void) pthread_attr_destroy (&attr);
+
+	while (inventory_pending > 0)
+	{
+		if (pthread_cond_timedwait (&inventory_cv, &inventory_lock, &deadline) == ETIMEDOUT)
+			break;
+	}
+
+	for (i = 0; i < nprobes; i++)
+	{
+		if (probes[i].info.di_state == DISK_PENDING)
+		{
+			probes[i].info.di_state = DISK_TIMEOUT;
+			timedout = B_TRUE;
+		}
+	}
+
+	inventory_pending = 0;
+	(void) pthread_mutex_unlock (&inventory_lock);
+
+	printf ("%-24s %11s  %-13s  %-4s  %s\n", "DISK", "SIZE", "CYL/HD/SEC", "LABEL", "POOL");
+
+	for (i = 0; i < nprobes; i++)
+		print_disk_info (stdout, &probes[i].info);
+
+	ret = write_cache (cache, probes, nprobes);
+
+	/*
+	 * Stuck probe threads still point at the array
+	 */
+	if (timedout == B_FALSE)
+		free (probes);
+
+	return ret;
+}
+
+/*
+ * Find a disk in the cache left by an earlier inventory
+ */
+boolean_t
+inventory_lookup (char *cache, char *disk, disk_info_t *info)
+{
+	int state;
+	unsigned int ncyl, nhead, nsect;
+	unsigned long long size;
+	char *name, line[LINE_MAX], label[8], pool[ZPOOL_MAXNAMELEN];
+	FILE *fp;
+
+	/*
+	 * Accept /dev/rdsk/cXtXdX as well as plain names
+	 */
+	if ((name = strrchr (disk, '/')) != NULL)
+		name++;
+	else
+		name = disk;
+
+	if ((fp = fopen (cache, "r")) == NULL)
+		return B_FALSE;
+
+	while (fgets (line, sizeof (line), fp) != NULL)
+	{
+		if (line[0] == '#')
+			continue;
+
+		if (sscanf (line, "%1023s %d %llu %u %u %u %7s %255s", info->di_name, &state,
+		    &size, &ncyl, &nhead, &nsect, label, pool) != 8)
+			continue;
+
+		if (strcmp (info->di_name, name) != 0)
+			continue;
+
+		info->di_state = state;
+		info->di_size = size;
+		info->di_ncyl = ncyl;
+		info->di_nhead = nhead;
+		info->di_nsect = nsect;
+		(void) strcpy (info->di_label, label);
+
+		if (strcmp (pool, "-") == 0)
+			info->di_pool[0] = '\0';
+		else
+			(void) strcpy (info->di_pool, pool);
+
+		(void) fclose (fp);
+		return B_TRUE;
+	}
+
+	(void) fclose (fp);
+	return B_FALSE;
+}
@@ -0,0 +1,717 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <libzfs.h>
+
+#include "iso.h"
+
+#define ISO_SECTOR		2048
+#define ISO_VD_START		16	/* first volume descriptor */
+#define ISO_VD_PRIMARY		1
+#define ISO_VD_END		255
+#define ISO_MAXDEPTH		64
+#define ISO_MAXCONT		32	/* CE areas followed per record */
+
+/*
+ * Directory record layout
+ */
+#define DR_LEN			0
+#define DR_EXTENT		2
+#define DR_SIZE			10
+#define DR_DATE			18
+#define DR_FLAGS		25
+#define DR_NAMELEN		32
+#define DR_NAME			33
+#define DR_MINLEN		34
+
+#define DR_DIRECTORY		0x02
+#define DR_ASSOCIATED		0x04
+#define DR_MULTIEXTENT		0x80
+
+/*
+ * Rock Ridge flags
+ */
+#define NM_CONTINUE		0x01
+#define NM_CURRENT		0x02
+#define NM_PARENT		0x04
+#define SL_CONTINUE		0x01
+#define SL_CURRENT		0x02
+#define SL_PARENT		0x04
+#define SL_ROOT			0x08
+#define TF_CREATE		0x01
+#define TF_MODIFY		0x02
+#define TF_ACCESS		0x04
+#define TF_LONG			0x80
+
+/*
+ * What a directory record says about one entry
+ */
+typedef struct iso_entry
+{
+	struct stat e_stat;
+	char e_name[NAME_MAX + 1];
+	size_t e_namelen;
+	size_t e_linklen;
+	boolean_t e_sep;		/* next symlink component needs a '/' */
+	boolean_t e_relocated;		/* RE: the real entry is a CL elsewhere */
+	uint32_t e_child;		/* CL: where a relocated directory went */
+	uint32_t e_extent;
+	uint32_t e_size;
+} iso_entry_t;
+
+static uint32_t
+le16 (const unsigned char *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static uint32_t
+le32 (const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+/*
+ * A pointer len bytes into the image at block lba plus offset, or NULL
+ * if that runs off the end
+ */
+static const unsigned char *
+iso_ptr (iso_t *iso, uint32_t lba, size_t offset, size_t len)
+{
+	uint64_t start = (uint64_t) lba * iso->i_blksize + offset;
+
+	if (start > iso->i_size || len > iso->i_size - start)
+		return NULL;
+
+	return iso->i_map + start;
+}
+
+static int
+digits (const unsigned char *p, int n)
+{
+	int v = 0;
+
+	while (n-- > 0)
+		v = v * 10 + (*p >= '0' && *p <= '9' ? *p - '0' : 0);
+
+	return v;
+}
+
+/*
+ * Seconds since the epoch of a 7 byte directory record date or a 17
+ * byte volume descriptor style one.  Both end in a signed offset from
+ * GMT in 15 minute units.
+ */
+static time_t
+iso_time (const unsigned char *p, boolean_t longform)
+{
+	int year, mon, day, hour, min, sec, off;
+	long days;
+
+	if (longform == B_TRUE)
+	{
+		year = digits (p, 4);
+		mon = digits (p + 4, 2);
+		day = digits (p + 6, 2);
+		hour = digits (p + 8, 2);
+		min = digits (p + 10, 2);
+		sec = digits (p + 12, 2);
+		off = (signed char) p[16];
+	}
+	else
+	{
+		year = 1900 + p[0];
+		mon = p[1];
+		day = p[2];
+		hour = p[3];
+		min = p[4];
+		sec = p[5];
+		off = (signed char) p[6];
+	}
+
+	if (mon < 1 || mon > 12)
+		return 0;
+
+	/*
+	 * Days since 1970-01-01 in the proleptic Gregorian calendar
+	 */
+	if (mon <= 2)
+		year--;
+
+	days = 365L * year + year / 4 - year / 100 + year / 400 + (153 * ((mon + 9) % 12) + 2) / 5 + day - 1 - 719468;
+
+	return ((days * 24 + hour) * 60 + min) * 60 + sec - off * 15 * 60;
+}
+
+static void
+append_link (iso_t *iso, iso_entry_t *e, const char *s, size_t len)
+{
+	if (e->e_linklen + len >= PATH_MAX)
+		return;
+
+	(void) memcpy (iso->i_link + e->e_linklen, s, len);
+	e->e_linklen += len;
+	iso->i_link[e->e_linklen] = '\0';
+}
+
+/*
+ * Add an SL entry's components to the symlink target
+ */
+static void
+parse_sl (iso_t *iso, iso_entry_t *e, const unsigned char *p, size_t len)
+{
+	size_t i = 5;
+	int flags, clen;
+
+	while (i + 2 <= len && i + 2 + p[i + 1] <= len)
+	{
+		flags = p[i];
+		clen = p[i + 1];
+
+		if (e->e_sep == B_TRUE)
+			append_link (iso, e, "/", 1);
+
+		if (flags & SL_ROOT)
+			append_link (iso, e, "/", 1);
+		else if (flags & SL_CURRENT)
+			append_link (iso, e, ".", 1);
+		else if (flags & SL_PARENT)
+			append_link (iso, e, "..", 2);
+		else
+			append_link (iso, e, (const char *) p + i + 2, clen);
+
+		e->e_sep = (flags & (SL_CONTINUE | SL_ROOT)) ? B_FALSE : B_TRUE;
+		i += 2 + clen;
+	}
+}
+
+/*
+ * Go through a record's System Use area and any continuation areas it
+ * points to, filling in e
+ */
+static boolean_t
+parse_susp (iso_t *iso, iso_entry_t *e, const unsigned char *p, size_t len)
+{
+	const unsigned char *sig;
+	size_t elen, off;
+	int flags, ncont = 0;
+	uint32_t ce_lba = 0, ce_off = 0, ce_len = 0;
+
+	for (;;)
+	{
+		while (len >= 4 && (elen = p[2]) >= 4 && elen <= len)
+		{
+			sig = p;
+
+			if (sig[0] == 'S' && sig[1] == 'T')
+				break;
+
+			if (sig[0] == 'P' && sig[1] == 'X' && elen >= 36)
+			{
+				e->e_stat.st_mode = le32 (p + 4);
+				e->e_stat.st_nlink = le32 (p + 12);
+				e->e_stat.st_uid = le32 (p + 20);
+				e->e_stat.st_gid = le32 (p + 28);
+			}
+			else if (sig[0] == 'N' && sig[1] == 'M' && elen >= 5)
+			{
+				flags = p[4];
+
+				if ((flags & (NM_CURRENT | NM_PARENT)) == 0 && e->e_namelen + elen - 5 <= NAME_MAX)
+				{
+					(void) memcpy (e->e_name + e->e_namelen, p + 5, elen - 5);
+					e->e_namelen += elen - 5;
+					e->e_name[e->e_namelen] = '\0';
+				}
+			}
+			else if (sig[0] == 'S' && sig[1] == 'L' && elen >= 5)
+				parse_sl (iso, e, p, elen);
+			else if (sig[0] == 'T' && sig[1] == 'F' && elen >= 5)
+			{
+				flags = p[4];
+				off = 5;
+
+				if (flags & TF_CREATE)
+					off += flags & TF_LONG ? 17 : 7;
+
+				if ((flags & TF_MODIFY) && off + (flags & TF_LONG ? 17 : 7) <= elen)
+				{
+					e->e_stat.st_mtime = iso_time (p + off, flags & TF_LONG ? B_TRUE : B_FALSE);
+					off += flags & TF_LONG ? 17 : 7;
+				}
+
+				if ((flags & TF_ACCESS) && off + (flags & TF_LONG ? 17 : 7) <= elen)
+					e->e_stat.st_atime = iso_time (p + off, flags & TF_LONG ? B_TRUE : B_FALSE);
+			}
+			else if (sig[0] == 'C' && sig[1] == 'L' && elen >= 12)
+				e->e_child = le32 (p + 4);
+			else if (sig[0] == 'R' && sig[1] == 'E')
+				e->e_relocated = B_TRUE;
+			else if (sig[0] == 'C' && sig[1] == 'E' && elen >= 28)
+			{
+				ce_lba = le32 (p + 4);
+				ce_off = le32 (p + 12);
+				ce_len = le32 (p + 20);
+			}
+
+			p += elen;
+			len -= elen;
+		}
+
+		if (ce_len == 0)
+			return B_TRUE;
+
+		if (++ncont > ISO_MAXCONT || (p = iso_ptr (iso, ce_lba, ce_off, ce_len)) == NULL)
+		{
+			fprintf (stderr, "Error: Bad continuation area in %s\n", iso->i_path);
+			return B_FALSE;
+		}
+
+		len = ce_len;
+		ce_len = 0;
+	}
+}
+
+/*
+ * Read one directory record.  The mode, owner and times come from
+ * Rock Ridge; without it the entry is left read only and owned by root.
+ */
+static boolean_t
+parse_record (iso_t *iso, const unsigned char *rec, iso_entry_t *e)
+{
+	int namelen = rec[DR_NAMELEN], i;
+	size_t susp;
+
+	(void) memset (e, 0, sizeof (iso_entry_t));
+
+	e->e_extent = le32 (rec + DR_EXTENT);
+	e->e_size = le32 (rec + DR_SIZE);
+	e->e_stat.st_mtime = e->e_stat.st_atime = iso_time (rec + DR_DATE, B_FALSE);
+	iso->i_link[0] = '\0';
+
+	susp = DR_NAME + namelen + (namelen % 2 == 0 ? 1 : 0) + iso->i_skip;
+
+	if (susp < rec[DR_LEN] && parse_susp (iso, e, rec + susp, rec[DR_LEN] - susp) == B_FALSE)
+		return B_FALSE;
+
+	if (rec[DR_FLAGS] & DR_MULTIEXTENT)
+	{
+		fprintf (stderr, "Error: Files split across extents aren't supported (%.*s in %s)\n",
+		    namelen, rec + DR_NAME, iso->i_path);
+		return B_FALSE;
+	}
+
+	/*
+	 * Fall back to the ISO name without its version
+	 */
+	if (e->e_namelen == 0)
+	{
+		for (i = 0; i < namelen && i < NAME_MAX && rec[DR_NAME + i] != ';'; i++)
+			e->e_name[i] = rec[DR_NAME + i];
+
+		if (i > 0 && e->e_name[i - 1] == '.')
+			i--;
+
+		e->e_name[i] = '\0';
+		e->e_namelen = i;
+	}
+
+	if (e->e_stat.st_mode == 0)
+		e->e_stat.st_mode = (rec[DR_FLAGS] & DR_DIRECTORY) ? S_IFDIR | 0555 : S_IFREG | 0444;
+
+	if (e->e_child != 0)
+	{
+		/*
+		 * A relocated directory.  Its own "." says how big it is.
+		 */
+		if ((rec = iso_ptr (iso, e->e_child, 0, DR_MINLEN)) == NULL)
+		{
+			fprintf (stderr, "Error: Bad relocated directory in %s\n", iso->i_path);
+			return B_FALSE;
+		}
+
+		e->e_extent = e->e_child;
+		e->e_size = le32 (rec + DR_SIZE);
+		e->e_stat.st_mode = S_IFDIR | (e->e_stat.st_mode & 07777);
+	}
+
+	if (S_ISREG (e->e_stat.st_mode) && iso_ptr (iso, e->e_extent, 0, e->e_size) == NULL)
+	{
+		fprintf (stderr, "Error: %s runs past the end of %s\n", e->e_name, iso->i_path);
+		return B_FALSE;
+	}
+
+	e->e_stat.st_ino = e->e_extent;
+	e->e_stat.st_size = S_ISLNK (e->e_stat.st_mode) ? e->e_linklen : e->e_size;
+	e->e_stat.st_blksize = iso->i_blksize;
+	e->e_stat.st_blocks = (e->e_size + 511) / 512;
+
+	if (e->e_stat.st_nlink == 0)
+		e->e_stat.st_nlink = 1;
+
+	return B_TRUE;
+}
+
+/*
+ * The next entry in a directory after offset *off, leaving out "." and
+ * "..", associated files and relocated directories.  Returns 1 with e
+ * filled in, 0 at the end of the directory or -1 on error.
+ */
+static int
+next_entry (iso_t *iso, uint32_t lba, uint32_t size, uint32_t *off, iso_entry_t *e)
+{
+	const unsigned char *rec;
+
+	while (*off < size)
+	{
+		/*
+		 * Records don't cross sectors; a zero length pads to the next
+		 */
+		if ((rec = iso_ptr (iso, lba, *off, 1)) == NULL)
+			return -1;
+
+		if (rec[DR_LEN] == 0)
+		{
+			*off = (*off / ISO_SECTOR + 1) * ISO_SECTOR;
+			continue;
+		}
+
+		if (rec[DR_LEN] < DR_MINLEN || *off + rec[DR_LEN] > size ||
+		    (rec = iso_ptr (iso, lba, *off, rec[DR_LEN])) == NULL ||
+		    DR_NAME + rec[DR_NAMELEN] > rec[DR_LEN])
+		{
+			fprintf (stderr, "Error: Bad directory record in %s\n", iso->i_path);
+			return -1;
+		}
+
+		*off += rec[DR_LEN];
+
+		/*
+		 * Skip "." and "..", and associated files
+		 */
+		if ((rec[DR_NAMELEN] == 1 && rec[DR_NAME] <= 1) || (rec[DR_FLAGS] & DR_ASSOCIATED))
+			continue;
+
+		if (parse_record (iso, rec, e) == B_FALSE)
+			return -1;
+
+		if (e->e_relocated == B_TRUE || e->e_namelen == 0 || strcmp (e->e_name, ".") == 0 ||
+		    strcmp (e->e_name, "..") == 0 || strchr (e->e_name, '/') != NULL)
+			continue;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Call func for everything in a directory, and everything below each
+ * subdirectory straight after it, as nftw does
+ */
+static int
+walk_dir (iso_t *iso, uint32_t lba, uint32_t size, char *path, int level, iso_func_t func)
+{
+	uint32_t off = 0;
+	size_t len = strlen (path);
+	iso_entry_t e;
+	struct FTW ftw;
+	int ret, next, flag;
+
+	if (level > ISO_MAXDEPTH)
+	{
+		fprintf (stderr, "Error: Directories nested too deeply in %s\n", iso->i_path);
+		return -1;
+	}
+
+	while ((next = next_entry (iso, lba, size, &off, &e)) == 1)
+	{
+		/*
+		 * Device nodes, fifos and sockets are left to devfsadm and
+		 * the services that make them
+		 */
+		if (S_ISDIR (e.e_stat.st_mode))
+			flag = FTW_D;
+		else if (S_ISREG (e.e_stat.st_mode))
+			flag = FTW_F;
+		else if (S_ISLNK (e.e_stat.st_mode))
+			flag = FTW_SL;
+		else
+			continue;
+
+		if (len + 1 + e.e_namelen >= PATH_MAX)
+		{
+			fprintf (stderr, "Error: Path too long in %s\n", iso->i_path);
+			return -1;
+		}
+
+		path[len] = '/';
+		(void) strcpy (path + len + 1, e.e_name);
+
+		ftw.base = len + 1;
+		ftw.level = level + 1;
+
+		if ((ret = func (path, &e.e_stat, flag, &ftw)) != 0)
+			return ret;
+
+		if (flag == FTW_D && (ret = walk_dir (iso, e.e_extent, e.e_size, path, level + 1, func)) != 0)
+			return ret;
+
+		path[len] = '\0';
+	}
+
+	return next;
+}
+
+/*
+ * Whether path is an image rather than a directory
+ */
+boolean_t
+iso_image (const char *path)
+{
+	struct stat st;
+
+	return stat (path, &st) == 0 && S_ISREG (st.st_mode) ? B_TRUE : B_FALSE;
+}
+
+/*
+ * Map an image and check that it's ISO9660 with Rock Ridge
+ */
+iso_t *
+iso_open (const char *path)
+{
+	iso_t *iso;
+	struct stat st;
+	const unsigned char *vd, *rec;
+	uint32_t i;
+
+	if ((iso = calloc (1, sizeof (iso_t))) == NULL)
+	{
+		fprintf (stderr, "Error: out of memory\n");
+		return NULL;
+	}
+
+	if (realpath (path, iso->i_path) == NULL || (iso->i_fd = open (iso->i_path, O_RDONLY)) == -1)
+	{
+		fprintf (stderr, "Error: Unable to open %s: %s\n", path, strerror (errno));
+		free (iso);
+		return NULL;
+	}
+
+	if (fstat (iso->i_fd, &st) == -1 || st.st_size < (ISO_VD_START + 1) * ISO_SECTOR)
+	{
+		fprintf (stderr, "Error: %s is too small to be an ISO image\n", path);
+		(void) close (iso->i_fd);
+		free (iso);
+		return NULL;
+	}
+
+	iso->i_size = st.st_size;
+	iso->i_blksize = ISO_SECTOR;
+
+	if ((iso->i_map = mmap (NULL, iso->i_size, PROT_READ, MAP_SHARED, iso->i_fd, 0)) == MAP_FAILED)
+	{
+		fprintf (stderr, "Error: Unable to map %s: %s\n", path, strerror (errno));
+		(void) close (iso->i_fd);
+		free (iso);
+		return NULL;
+	}
+
+	/*
+	 * Find the primary volume descriptor
+	 */
+	for (i = ISO_VD_START; (vd = iso_ptr (iso, i, 0, ISO_SECTOR)) != NULL; i++)
+		if (memcmp (vd + 1, "CD001", 5) != 0 || vd[0] == ISO_VD_END || vd[0] == ISO_VD_PRIMARY)
+			break;
+
+	if (vd == NULL || memcmp (vd + 1, "CD001", 5) != 0 || vd[0] != ISO_VD_PRIMARY)
+	{
+		fprintf (stderr, "Error: %s is not an ISO9660 image\n", path);
+		iso_close (iso);
+		return NULL;
+	}
+
+	iso->i_blksize = le16 (vd + 128);
+
+	/*
+	 * Rock Ridge starts with an SP entry in the root's "." record,
+	 * which also says how much of every other record to skip
+	 */
+	if (iso->i_blksize < 512 || iso->i_blksize > ISO_SECTOR ||
+	    (rec = iso_ptr (iso, le32 (vd + 156 + DR_EXTENT), 0, DR_MINLEN + 7)) == NULL ||
+	    rec[DR_LEN] < DR_MINLEN + 7 || memcmp (rec + DR_MINLEN, "SP", 2) != 0 ||
+	    rec[DR_MINLEN + 4] != 0xbe || rec[DR_MINLEN + 5] != 0xef)
+	{
+		fprintf (stderr, "Error: %s has no Rock Ridge extensions\n", path);
+		iso_close (iso);
+		return NULL;
+	}
+
+	iso->i_skip = rec[DR_MINLEN + 6];
+
+	return iso;
+}
+
+/*
+ * The root's attributes are in its own "." record, which is the one
+ * record whose SP isn't skipped
+ */
+static boolean_t
+root_entry (iso_t *iso, iso_entry_t *e)
+{
+	const unsigned char *vd, *rec;
+	int skip = iso->i_skip;
+	boolean_t ret;
+
+	vd = iso->i_map + ISO_VD_START * ISO_SECTOR;
+
+	while (vd[0] != ISO_VD_PRIMARY)
+		vd += ISO_SECTOR;
+
+	rec = iso_ptr (iso, le32 (vd + 156 + DR_EXTENT), 0, DR_MINLEN);
+	iso->i_skip = 0;
+	ret = parse_record (iso, rec, e);
+	iso->i_skip = skip;
+
+	e->e_stat.st_mode = S_IFDIR | (e->e_stat.st_mode & 07777);
+
+	return ret;
+}
+
+/*
+ * Walk the image from the root down
+ */
+int
+iso_walk (iso_t *iso, iso_func_t func)
+{
+	char path[PATH_MAX];
+	iso_entry_t e;
+	struct FTW ftw;
+	int ret;
+
+	if (root_entry (iso, &e) == B_FALSE)
+		return -1;
+
+	(void) strcpy (path, iso->i_path);
+
+	ftw.base = strrchr (path, '/') - path + 1;
+	ftw.level = 0;
+
+	if ((ret = func (path, &e.e_stat, FTW_D, &ftw)) != 0)
+		return ret;
+
+	return walk_dir (iso, e.e_extent, e.e_size, path, 0, func);
+}
+
+/*
+ * Find a path below the root of the image without following symlinks,
+ * as lstat would.  A symlink's target is left in i_link.
+ */
+boolean_t
+iso_lookup (iso_t *iso, const char *rel, struct stat *statptr)
+{
+	char name[NAME_MAX + 1];
+	iso_entry_t e;
+	uint32_t lba, size, off;
+	size_t len;
+	int next;
+
+	if (root_entry (iso, &e) == B_FALSE)
+		return B_FALSE;
+
+	for (;;)
+	{
+		while (*rel == '/')
+			rel++;
+
+		if (*rel == '\0')
+			break;
+
+		if (!S_ISDIR (e.e_stat.st_mode) || (len = strcspn (rel, "/")) > NAME_MAX)
+			return B_FALSE;
+
+		(void) memcpy (name, rel, len);
+		name[len] = '\0';
+		rel += len;
+
+		lba = e.e_extent;
+		size = e.e_size;
+		off = 0;
+
+		while ((next = next_entry (iso, lba, size, &off, &e)) == 1)
+			if (strcmp (e.e_name, name) == 0)
+				break;
+
+		if (next != 1)
+			return B_FALSE;
+	}
+
+	*statptr = e.e_stat;
+
+	return B_TRUE;
+}
+
+/*
+ * The mapped contents of a file iso_walk or iso_lookup passed on
+ */
+const unsigned char *
+iso_data (iso_t *iso, const struct stat *statptr)
+{
+	return iso->i_map + (uint64_t) statptr->st_ino * iso->i_blksize;
+}
+
+/*
+ * madvise part of a file's extent, widened to whole pages
+ */
+void
+iso_advise (iso_t *iso, const struct stat *statptr, off_t offset, off_t len, int advice)
+{
+	uint64_t start = (uint64_t) statptr->st_ino * iso->i_blksize + offset;
+	uint64_t pagesize = sysconf (_SC_PAGESIZE);
+	uint64_t end = start + len;
+
+	start -= start % pagesize;
+
+	if (len > 0)
+		(void) madvise ((char *) iso->i_map + start, end - start, advice);
+}
+
+void
+iso_close (iso_t *iso)
+{
+	(void) munmap ((char *) iso->i_map, iso->i_size);
+	(void) close (iso->i_fd);
+	free (iso);
+}
@@ -0,0 +1,51 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+/*
+ * A Rock Ridge ISO9660 image mapped into memory, so the livecd can be
+ * installed from a downloaded image without mounting it.  iso_walk
+ * calls func the way nftw does, with paths under i_path.  A file's
+ * st_ino is the first block of its extent, which iso_data turns back
+ * into the mapped data.
+ */
+typedef struct iso
+{
+	char i_path[PATH_MAX];
+	int i_fd;
+	unsigned char *i_map;
+	size_t i_size;
+	uint32_t i_blksize;
+	int i_skip;			/* SUSP bytes to skip in each record */
+	char i_link[PATH_MAX];		/* target of the symlink last walked */
+} iso_t;
+
+typedef int (*iso_func_t) (const char *path, const struct stat *statptr, int fileflag, struct FTW *pftw);
+
+boolean_t iso_image (const char *path);
+iso_t *iso_open (const char *path);
+int iso_walk (iso_t *iso, iso_func_t func);
+boolean_t iso_lookup (iso_t *iso, const char *rel, struct stat *statptr);
+const unsigned char *iso_data (iso_t *iso, const struct stat *statptr);
+void iso_advise (iso_t *iso, const struct stat *statptr, off_t offset, off_t len, int advice);
+void iso_close (iso_t *iso);
@@ -23,18 +23,34 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include <errno.h>
 #include <limits.h>
 #include <string.h>
 #include <dirent.h>
+#include <sys/stat.h>
+#include <ftw.h>
 #include <libzfs.h>
 
-#include "config.h"
 #include "disk.h"
+#include "config.h"
 #include "copy.h"
+#include "inventory.h"
+#include "install.h"
+#include "upgrade.h"
+#include "reset.h"
+#include "trace.h"
+#include "progress.h"
+#include "bufpool.h"
+#include "iso.h"
+#include "bootlist.h"
+#include "streams.h"
 
 char program_name[] = "schillix-install";
 char temp_mount[PATH_MAX] = DEFAULT_MNT_POINT;
+pool_layout_t pool_layout;
+profile_t profile;
 char cdrom_path[PATH_MAX] = DEFAULT_CDROM_PATH;
 
 /*
@@ -62,13 +78,40 @@ usage (int retval)
 	fprintf (out, "Installer for Schillix\n");
 	fprintf (out, "(c) Copyright 2013 - Andrew Stormont\n");
 	fprintf (out, "\n");
-	fprintf (out, "usage: schillix-install [opts] /path/to/disk or devname\n");
+	fprintf (out, "usage: schillix-install [opts] /path/to/disk or devname...\n");
+	fprintf (out, "       schillix-install -U [-H] [opts]\n");
+	fprintf (out, "       schillix-install -R [opts]\n");
+	fprintf (out, "       schillix-install -i\n");
 	fprintf (out, "\n");
 	fprintf (out, "Where opts is:\n");
 	fprintf (out, "\t-r name or new rpool (default is " DEFAULT_RPOOL_NAME ")\n");
 	fprintf (out, "\t-m temporary mountpoint (default is " DEFAULT_MNT_POINT ")\n");
-	fprintf (out, "\t-c path to livecd contents (default is " DEFAULT_CDROM_PATH ")\n");
+	fprintf (out, "\t   with several disks the rpool and mountpoint are numbered after the first\n");
+	fprintf (out, "\t-c path to livecd contents or a Rock Ridge ISO image of them (default is " DEFAULT_CDROM_PATH ")\n");
+	fprintf (out, "\t-I read files out of an ISO image with pread instead of mapping it\n");
 	fprintf (out, "\t-u don't unmount or export rpool after install\n");
+	fprintf (out, "\t-l \"log dev cache dev special [mirror] dev...\" extra vdevs for rpool\n");
+	fprintf (out, "\t-L file containing extra vdevs for rpool, as for -l\n");
+	fprintf (out, "\t-p file of ZFS properties for each dataset\n");
+	fprintf (out, "\t-T file to write a Chrome/Perfetto trace of the install to\n");
+	fprintf (out, "\t-s n also trace one in every n file copies\n");
+	fprintf (out, "\t-P fd write newline-delimited JSON progress events to fd\n");
+	fprintf (out, "\t-C keep or drop copied files from the page cache (default drops them if memory is low)\n");
+	fprintf (out, "\t   only Linux can drop them; on illumos ZFS caches file data in the ARC, so they're kept\n");
+	fprintf (out, "\t-M size of the copy's buffer pool, e.g. 32M (default is 1/%d of free memory)\n", BUFPOOL_SHARE);
+	fprintf (out, "\t-j n or min:max parallel copy streams (default is %d:%d, adjusted to what copies fastest)\n",
+	    STREAMS_MIN, STREAMS_MAX);
+	fprintf (out, "\t-B file of paths to copy and flush first instead of the built in list\n");
+	fprintf (out, "\t   the boot archive's contents and the libraries of the listed commands are always added\n");
+	fprintf (out, "\t-A always regenerate the boot archive\n");
+	fprintf (out, "\t-t discard (TRIM) the root slice before creating the pool\n");
+	fprintf (out, "\t-E use an EFI label even if the disk is small enough for fdisk\n");
+	fprintf (out, "\t-U upgrade rpool from the livecd into a new boot environment, mounted on the -m mountpoint\n");
+	fprintf (out, "\t   files edited since they were installed are kept, with a changed livecd version as <name>.new\n");
+	fprintf (out, "\t-H with -U, compare files whose size matches but mtime doesn't by hash\n");
+	fprintf (out, "\t   and record the hashes of what's copied for the next upgrade\n");
+	fprintf (out, "\t-R reset rpool, imported with an altroot, to how it was installed\n");
+	fprintf (out, "\t-i probe all disks, print and cache an inventory and exit\n");
 	fprintf (out, "\t-? print this message and exit\n");
 
 	exit (retval);
@@ -77,16 +120,27 @@ usage (int retval)
 int
 main (int argc, char **argv)
 {
-	char c, disk[PATH_MAX] = { '\0' }, rpool[ZPOOL_MAXNAMELEN] = DEFAULT_RPOOL_NAME;
-	int i;
+	char c, disk[MAX_TARGETS][PATH_MAX], rpool[MAX_TARGETS][ZPOOL_MAXNAMELEN] = { DEFAULT_RPOOL_NAME };
+	char mnt[MAX_TARGETS][PATH_MAX];
+	char *profile_path = NULL, *trace_path = NULL, *budget_str = NULL;
+	int i, j, ndisks = 0, sample = 0, progress_fd = -1, min_streams, max_streams;
+	uint64_t budget = 0;
+	cache_mode_t cache_mode = CACHE_AUTO;
+	double span;
 	DIR *dir;
+	iso_t *iso;
 	libzfs_handle_t *libzfs_handle;
-	boolean_t unmount = B_TRUE;
+	disk_info_t info;
+	root_layout_t layout[MAX_TARGETS];
+	target_t target[MAX_TARGETS];
+	boolean_t unmount = B_TRUE, inventory = B_FALSE, efi = B_FALSE;
+	boolean_t discard = B_FALSE, force_archive = B_FALSE, upgrade_mode = B_FALSE, hash = B_FALSE, ret;
+	boolean_t reset_mode = B_FALSE;
 
 	/*
 	 * Parse command line arguments
 	 */
-	while ((c = getopt (argc, argv, "r:m:c:u?")) != -1)
+	while ((c = getopt (argc, argv, "r:m:c:l:L:p:T:s:P:M:C:j:B:uitAEUHRI?")) != -1)
 	{
 		switch (c)
 		{
@@ -100,7 +154,7 @@ main (int argc, char **argv)
 					usage (EXIT_FAILURE);
 				}
 
-				strcpy (rpool, optarg);
+				strcpy (rpool[0], optarg);
 				break;
 
 			case 'm':
@@ -129,6 +183,107 @@ main (int argc, char **argv)
 				strcpy (cdrom_path, optarg);
 				break;
 
+			case 'l':
+				/*
+				 * Add log, cache and special vdevs
+				 */
+				if (parse_pool_layout (optarg, &pool_layout) == B_FALSE)
+					usage (EXIT_FAILURE);
+				break;
+
+			case 'L':
+				/*
+				 * Same but from a file
+				 */
+				if (read_pool_layout (optarg, &pool_layout) == B_FALSE)
+					usage (EXIT_FAILURE);
+				break;
+
+			case 'p':
+				/*
+				 * Read later, it needs libzfs
+				 */
+				profile_path = optarg;
+				break;
+
+			case 'T':
+				/*
+				 * Write a trace of where the time went
+				 */
+				trace_path = optarg;
+				break;
+
+			case 's':
+				/*
+				 * Trace one in every n file copies too
+				 */
+				if ((sample = atoi (optarg)) <= 0)
+				{
+					fprintf (stderr, "Error: -s needs a positive number\n");
+					usage (EXIT_FAILURE);
+				}
+				break;
+
+			case 'P':
+				/*
+				 * Stream progress events to a descriptor
+				 */
+				if ((progress_fd = atoi (optarg)) < 0 || optarg[0] < '0' || optarg[0] > '9')
+				{
+					fprintf (stderr, "Error: -P needs a file descriptor\n");
+					usage (EXIT_FAILURE);
+				}
+				break;
+
+			case 'M':
+				/*
+				 * Limit the memory the copy may hold
+				 */
+				budget_str = optarg;
+				break;
+
+			case 'j':
+				/*
+				 * How many files may be copied at once
+				 */
+				switch (sscanf (optarg, "%d:%d", &min_streams, &max_streams))
+				{
+					case 1:
+						max_streams = min_streams;
+						/* FALLTHROUGH */
+					case 2:
+						if (streams_bounds (min_streams, max_streams) == B_TRUE)
+							break;
+						/* FALLTHROUGH */
+					default:
+						fprintf (stderr, "Error: -j needs n or min:max\n");
+						usage (EXIT_FAILURE);
+				}
+				break;
+
+			case 'B':
+				/*
+				 * Which files go first so the install is bootable early
+				 */
+				if (bootlist_read (optarg) == B_FALSE)
+					usage (EXIT_FAILURE);
+				break;
+
+			case 'C':
+				/*
+				 * Whether the copy leaves its pages cached
+				 */
+				if (strcmp (optarg, "keep") == 0)
+					cache_mode = CACHE_KEEP;
+				else if (strcmp (optarg, "drop") == 0)
+					cache_mode = CACHE_DROP;
+				else
+				{
+					fprintf (stderr, "Error: -C needs keep or drop\n");
+					usage (EXIT_FAILURE);
+				}
+				break;
+
 			case 'u':
 				/*
 				 * Don't unmount or export zpool with done
@@ -136,6 +291,62 @@ main (int argc, char **argv)
 				unmount = B_FALSE;
 				break;
 
+			case 't':
+				/*
+				 * Discard the root slice before use
+				 */
+				discard = B_TRUE;
+				break;
+
+			case 'A':
+				/*
+				 * Don't reuse the livecd's boot archive
+				 */
+				force_archive = B_TRUE;
+				break;
+
+			case 'E':
+				/*
+				 * Force an EFI label
+				 */
+				efi = B_TRUE;
+				break;
+
+			case 'U':
+				/*
+				 * Upgrade an installed pool instead
+				 */
+				upgrade_mode = B_TRUE;
+				break;
+
+			case 'R':
+				/*
+				 * Roll an installed pool back instead
+				 */
+				reset_mode = B_TRUE;
+				break;
+
+			case 'I':
+				/*
+				 * Let stub/slowio.c see reads from an image
+				 */
+				copy_pread_image (B_TRUE);
+				break;
+
+			case 'H':
+				/*
+				 * Hash files the upgrade can't otherwise tell apart
+				 */
+				hash = B_TRUE;
+				break;
+
+			case 'i':
+				/*
+				 * Only list the disks on the system
+				 */
+				inventory = B_TRUE;
+				break;
+
 			case '?':
 				/*
 				 * We get here if an argument is missing or
@@ -156,66 +367,183 @@ main (int argc, char **argv)
 	}
 
 	/*
-	 * Fix any given disk paths
-	 * TODO: Support for creating mirrored rpools!
+	 * Inventory doesn't need a disk or livecd
+	 */
+	if (inventory == B_TRUE)
+	{
+		if (optind != argc)
+		{
+			fprintf (stderr, "Error: -i takes no disk\n");
+			usage (EXIT_FAILURE);
+		}
+
+		if ((libzfs_handle = libzfs_init ()) == NULL)
+		{
+			fprintf (stderr, "Error: Unable to get libzfs handle\n");
+			return EXIT_FAILURE;
+		}
+
+		if (inventory_disks (libzfs_handle, DEFAULT_INVENTORY_CACHE) == B_FALSE)
+			return EXIT_FAILURE;
+
+		(void) libzfs_fini (libzfs_handle);
+		return EXIT_SUCCESS;
+	}
+
+	if (upgrade_mode == B_TRUE && optind != argc)
+	{
+		fprintf (stderr, "Error: -U takes no disk\n");
+		usage (EXIT_FAILURE);
+	}
+
+	if (reset_mode == B_TRUE && (optind != argc || upgrade_mode == B_TRUE))
+	{
+		fprintf (stderr, "Error: -R takes no disk and can't be used with -U\n");
+		usage (EXIT_FAILURE);
+	}
+
+	/*
+	 * A reset needs neither disks nor the livecd
+	 */
+	if (reset_mode == B_TRUE)
+	{
+		if ((libzfs_handle = libzfs_init ()) == NULL)
+		{
+			fprintf (stderr, "Error: Unable to get libzfs handle\n");
+			return EXIT_FAILURE;
+		}
+
+		if (trace_path != NULL && trace_open (trace_path, sample) == B_FALSE)
+			return EXIT_FAILURE;
+
+		ret = reset (libzfs_handle, rpool[0]);
+
+		if (trace_close () == B_FALSE || ret == B_FALSE)
+			return EXIT_FAILURE;
+
+		(void) libzfs_fini (libzfs_handle);
+
+		puts ("Done.");
+
+		return EXIT_SUCCESS;
+	}
+
+	if (hash == B_TRUE && upgrade_mode == B_FALSE)
+	{
+		fprintf (stderr, "Error: -H needs -U\n");
+		usage (EXIT_FAILURE);
+	}
+
+	/*
+	 * Fix any given disk paths.  Each disk gets a pool and mountpoint
+	 * of its own, numbered after the first.
 	 */
 #define DISK_PATH 	"/dev/dsk"
 #define RDISK_PATH	"/dev/rdsk"
 #define DISK_LEN	8
 #define RDISK_LEN	9
 
-	for (i = optind; i < argc; i++)
+	for (i = optind; i < argc; i++, ndisks++)
 	{
-		if (disk[0] == '\0')
+		if (ndisks == MAX_TARGETS)
+		{
+			fprintf (stderr, "Error: No more than %d disks at once\n", MAX_TARGETS);
+			usage (EXIT_FAILURE);
+		}
+
+		/*
+		 * Disk path is too long
+		 */
+		if (strlen (argv[i]) + RDISK_LEN + 1 >= PATH_MAX)
 		{
-			/*
-			 * Disk path is too long
-			 */
-			if (strlen (disk) >= PATH_MAX)
+			fprintf (stderr, "Error: disk path is too long\n");
+			usage (EXIT_FAILURE);
+		}
+		/*
+		 * Path is correct already
+		 */
+		else if (strncmp (RDISK_PATH, argv[i], RDISK_LEN) == 0)
+			strcpy (disk[ndisks], argv[i]);
+		/*
+		 * Replace /dev/dsk with /dev/rdsk
+		 */
+		else if (strncmp (DISK_PATH, argv[i], DISK_LEN) == 0)
+			sprintf (disk[ndisks], RDISK_PATH "/%s", argv[i] + DISK_LEN + 1);
+		/*
+		 * Some other absolute path, such as a disk image
+		 */
+		else if (argv[i][0] == '/')
+			strcpy (disk[ndisks], argv[i]);
+		/*
+		 * Need to append /dev/rdsk
+		 */
+		else
+			sprintf (disk[ndisks], RDISK_PATH "/%s", argv[i]);
+
+		for (j = 0; j < ndisks; j++)
+		{
+			if (strcmp (disk[j], disk[ndisks]) == 0)
 			{
-				fprintf (stderr, "Error: disk path is too long\n");
+				fprintf (stderr, "Error: %s given twice\n", disk[j]);
 				usage (EXIT_FAILURE);
 			}
-			/*
-			 * Path is correct already
-			 */
-			else if (strncmp (RDISK_PATH, argv[i], RDISK_LEN) == 0)
-				strcpy (disk, argv[i]);
-			/*
-			 * Replace /dev/dsk with /dev/rdsk
-			 */
-			else if (strncmp (DISK_PATH, argv[i], DISK_LEN) == 0)
-				sprintf (disk, RDISK_PATH "/%s", argv[i] + DISK_LEN + 1);
-			/*
-			 * Need to append /dev/rdsk
-			 */
-			else
-				sprintf (disk, RDISK_PATH "/%s", argv[i]);
 		}
-		else
+
+		if (ndisks == 0)
 		{
-			fprintf (stderr, "Error: Please specify only one disk\n");
+			strcpy (mnt[0], temp_mount);
+			continue;
+		}
+
+		if (snprintf (rpool[ndisks], ZPOOL_MAXNAMELEN, "%s%d", rpool[0], ndisks) >= ZPOOL_MAXNAMELEN ||
+		    snprintf (mnt[ndisks], PATH_MAX, "%s%d", temp_mount, ndisks) >= PATH_MAX)
+		{
+			fprintf (stderr, "Error: rpool name or mountpoint too long\n");
 			usage (EXIT_FAILURE);
 		}
 	}
 
-	if (disk[0] == '\0')
+	if (ndisks == 0 && upgrade_mode == B_FALSE)
 	{
 		fprintf (stderr, "Error: No disk specified\n");
 		usage (EXIT_FAILURE);
 	}
 
+	/*
+	 * The extra vdevs can only belong to one pool
+	 */
+	if (ndisks > 1 && pool_layout.pl_nvdevs > 0)
+	{
+		fprintf (stderr, "Error: -l and -L need a single disk\n");
+		usage (EXIT_FAILURE);
+	}
+
 	/*
 	 * Ensure that the path to the livecd contents is a directory
-	 * and that it can be opened.
+	 * and that it can be opened, or that it's an ISO image we can
+	 * read.  Upgrades compare against the files themselves so they
+	 * need the directory.
 	 */
-	if ((dir = opendir (cdrom_path)) == NULL)
+	if (iso_image (cdrom_path) == B_TRUE)
+	{
+		if (upgrade_mode == B_TRUE)
+		{
+			fprintf (stderr, "Error: -U needs the livecd contents, not an image\n");
+			usage (EXIT_FAILURE);
+		}
+
+		if ((iso = iso_open (cdrom_path)) == NULL)
+			usage (EXIT_FAILURE);
+
+		iso_close (iso);
+	}
+	else if ((dir = opendir (cdrom_path)) == NULL)
 	{
 		fprintf (stderr, "Error: unable to open %s: %s\n", cdrom_path, strerror (errno));
 		usage (EXIT_FAILURE);
 	}
-
-	(void) closedir (dir);
+	else
+		(void) closedir (dir);
 
 	/*
 	 * Get libzfs handle before outputting anything to stdout/stderr
@@ -227,90 +555,140 @@ main (int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
-	/*
-	 * Warn the user before touching the disk
-	 */
-	printf ("All data on %s will be destroyed.  Continue? [yn] ", disk);
-	while (scanf ("%c", &c) == 0 || (c != 'y' && c != 'n'))
-		printf ("\rContinue? [yn] ");
+	if (trace_path != NULL && trace_open (trace_path, sample) == B_FALSE)
+		return EXIT_FAILURE;
 
-	if (c == 'n')
+	if (budget_str != NULL && (zfs_nicestrtonum (libzfs_handle, budget_str, &budget) != 0 || budget == 0))
 	{
-		fprintf (stderr, "User aborted format\n");
-		return EXIT_FAILURE;
+		fprintf (stderr, "Error: -M needs a size, such as 32M\n");
+		usage (EXIT_FAILURE);
 	}
 
-	if (disk_in_use (libzfs_handle, disk) == B_TRUE)
-		return EXIT_FAILURE;
-
 	/*
-	 * Reformat disk
+	 * Upgrades leave the disks alone
 	 */
-	puts ("Reformatting disk...");
+	if (upgrade_mode == B_TRUE)
+	{
+		if (bufpool_init (budget) == B_FALSE)
+			return EXIT_FAILURE;
 
-	if (create_root_partition (disk) == B_FALSE)
-		return EXIT_FAILURE;
+		copy_cache_mode (cache_mode);
 
-	if (create_root_vtoc (disk) == B_FALSE)
-		return EXIT_FAILURE;
+		if (progress_fd != -1 && progress_open (progress_fd) == B_FALSE)
+			return EXIT_FAILURE;
 
-	/*
-	 * Create new ZFS filesystem
-	 */
-	puts ("Creating new filesystem...");
+		ret = upgrade (libzfs_handle, rpool[0], temp_mount, hash);
 
-	if (create_root_pool (libzfs_handle, disk, rpool, temp_mount) == B_FALSE)
-		return EXIT_FAILURE;
+		progress_close (ret);
+		bufpool_report ();
+		bufpool_fini ();
 
-	if (create_root_datasets (libzfs_handle, rpool) == B_FALSE)
-		return EXIT_FAILURE;
+		if (trace_close () == B_FALSE || ret == B_FALSE)
+			return EXIT_FAILURE;
+
+		(void) libzfs_fini (libzfs_handle);
 
-	if (set_root_bootfs (libzfs_handle, rpool) == B_FALSE)
+		puts ("Done.");
+
+		return EXIT_SUCCESS;
+	}
+
+	span = trace_start ();
+
+	if (profile_path != NULL && read_profile (libzfs_handle, profile_path, &profile) == B_FALSE)
 		return EXIT_FAILURE;
 
+	for (i = 0; i < ndisks; i++)
+	{
+		/*
+		 * Remind the user what's on the disk if we've seen it before
+		 */
+		if (inventory_lookup (DEFAULT_INVENTORY_CACHE, disk[i], &info) == B_TRUE)
+			print_disk_info (stdout, &info);
+
+		/*
+		 * Check the extra vdevs before anything is touched
+		 */
+		if (validate_pool_layout (libzfs_handle, disk[i], &pool_layout) == B_FALSE)
+			return EXIT_FAILURE;
+
+		/*
+		 * Show the user where everything will go
+		 */
+		if (get_root_layout (disk[i], efi, &layout[i]) == B_FALSE)
+			return EXIT_FAILURE;
+
+		print_root_layout (&layout[i]);
+	}
+
+	trace_end ("phase", "layout", span);
+
 	/*
-	 * Mount new filesystem and copy files
+	 * Warn the user before touching the disks
 	 */
-	puts ("Mounting filesystem...");
+	printf ("All data on");
+	for (i = 0; i < ndisks; i++)
+		printf (" %s", disk[i]);
+	printf (" will be destroyed.  Continue? [yn] ");
+
+	while (scanf ("%c", &c) == 0 || (c != 'y' && c != 'n'))
+		printf ("\rContinue? [yn] ");
 
-	if (mount_root_datasets (libzfs_handle, rpool) == B_FALSE)
+	if (c == 'n')
+	{
+		fprintf (stderr, "User aborted format\n");
 		return EXIT_FAILURE;
+	}
 
-	printf ("Copying files...\n");
+	span = trace_start ();
 
-	if (copy_files () == B_FALSE)
-		return EXIT_FAILURE;
+	for (i = 0; i < ndisks; i++)
+		if (disk_in_use (libzfs_handle, disk[i]) == B_TRUE)
+			return EXIT_FAILURE;
 
-	if (copy_grub (temp_mount, rpool) == B_FALSE)
-		return EXIT_FAILURE;
+	trace_end ("phase", "in-use", span);
 
 	/*
-	 * Install grub to mbr, create boot archive, etc
+	 * Partition, copy and configure, overlapping what we can
 	 */
-	puts ("Finishing up...");
+	for (i = 0; i < ndisks; i++)
+	{
+		target[i].t_libzfs = libzfs_handle;
+		target[i].t_disk = disk[i];
+		target[i].t_rpool = rpool[i];
+		target[i].t_mnt = mnt[i];
+		target[i].t_layout = &layout[i];
+		target[i].t_pool_layout = &pool_layout;
+		target[i].t_profile = profile_path == NULL ? NULL : &profile;
+		target[i].t_discard = discard;
+		target[i].t_unmount = unmount;
+		target[i].t_force_archive = force_archive;
+	}
 
-	if (config_grub (temp_mount, disk) == B_FALSE)
+	if (bufpool_init (budget) == B_FALSE)
 		return EXIT_FAILURE;
 
-	if (config_devfs (temp_mount) == B_FALSE)
-		return EXIT_FAILURE;
+	copy_cache_mode (cache_mode);
 
-	if (config_bootadm (temp_mount) == B_FALSE)
+	if (progress_fd != -1 && progress_open (progress_fd) == B_FALSE)
 		return EXIT_FAILURE;
 
-	/*
-	 * Unmount and export new rpool
-	 */
-	if (unmount == B_TRUE)
+	if (install (target, ndisks) == B_FALSE)
 	{
-		puts ("Unmounting filesystem...");
+		progress_close (B_FALSE);
+		(void) trace_close ();
+		streams_report ();
+		bufpool_report ();
+		return EXIT_FAILURE;
+	}
 
-		if (unmount_root_datasets (libzfs_handle, rpool) == B_FALSE)
-			return EXIT_FAILURE;
+	progress_close (B_TRUE);
+	streams_report ();
+	bufpool_report ();
+	bufpool_fini ();
 
-		if (export_root_pool (libzfs_handle, rpool) == B_FALSE)
-			return EXIT_FAILURE;
-	}
+	if (trace_close () == B_FALSE)
+		return EXIT_FAILURE;
 
 	(void) libzfs_fini (libzfs_handle);
 
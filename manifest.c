@@ -0,0 +1,396 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sha1.h>
+#include <sys/stat.h>
+
+#include "manifest.h"
+
+/*
+ * Guards the hashes, which the copy threads hand in
+ */
+static pthread_mutex_t manifest_lock = PTHREAD_MUTEX_INITIALIZER;
+
+manifest_t *
+manifest_alloc (void)
+{
+	manifest_t *m;
+
+	if ((m = calloc (1, sizeof (manifest_t))) == NULL)
+		perror ("Error: Unable to allocate manifest");
+
+	return m;
+}
+
+/*
+ * Make room for one more entry
+ */
+static manifest_entry_t *
+next_entry (manifest_entry_t **entries, int *n, int *max)
+{
+	manifest_entry_t *grown;
+
+	if (*n == *max)
+	{
+		*max = *max == 0 ? 1024 : *max * 2;
+
+		if ((grown = realloc (*entries, *max * sizeof (manifest_entry_t))) == NULL)
+		{
+			perror ("Error: Unable to grow manifest");
+			return NULL;
+		}
+
+		*entries = grown;
+	}
+
+	(void) memset (&(*entries)[*n], 0, sizeof (manifest_entry_t));
+	return &(*entries)[*n];
+}
+
+/*
+ * Paths with a newline in them can't be written out, so they are left
+ * out; an upgrade will never delete them.  Regular files also get their
+ * size and mtime from statptr.
+ */
+boolean_t
+manifest_add (manifest_t *m, const char *path, const struct stat *statptr)
+{
+	manifest_entry_t *me;
+
+	if (strchr (path, '\n') != NULL)
+		return B_TRUE;
+
+	if ((me = next_entry (&m->m_entries, &m->m_nentries, &m->m_max)) == NULL)
+		return B_FALSE;
+
+	if ((me->me_path = strdup (path)) == NULL)
+	{
+		perror ("Error: Unable to grow manifest");
+		return B_FALSE;
+	}
+
+	if (statptr != NULL && S_ISREG (statptr->st_mode))
+	{
+		me->me_file = B_TRUE;
+		me->me_size = statptr->st_size;
+		me->me_mtime = statptr->st_mtim;
+	}
+
+	m->m_nentries++;
+	return B_TRUE;
+}
+
+/*
+ * Note the hash of a copied file.  The copy threads call this while the
+ * walk is still adding paths, so it's kept aside until manifest_sort.
+ */
+boolean_t
+manifest_hashed (manifest_t *m, const char *path, const unsigned char *hash)
+{
+	manifest_entry_t *me;
+	boolean_t ret = B_FALSE;
+
+	(void) pthread_mutex_lock (&manifest_lock);
+
+	if ((me = next_entry (&m->m_hashes, &m->m_nhashes, &m->m_maxhashes)) != NULL)
+	{
+		if ((me->me_path = strdup (path)) == NULL)
+			perror ("Error: Unable to grow manifest");
+		else
+		{
+			(void) memcpy (me->me_hash, hash, MANIFEST_HASHLEN);
+			m->m_nhashes++;
+			ret = B_TRUE;
+		}
+	}
+
+	(void) pthread_mutex_unlock (&manifest_lock);
+	return ret;
+}
+
+/*
+ * SHA1 a whole file, reading it len bytes at a time through buf
+ */
+boolean_t
+manifest_hash (const char *path, unsigned char *hash, char *buf, size_t len)
+{
+	int fd;
+	ssize_t n;
+	SHA1_CTX ctx;
+
+	if ((fd = open (path, O_RDONLY)) == -1)
+	{
+		fprintf (stderr, "Unable to open file %s: %s\n", path, strerror (errno));
+		return B_FALSE;
+	}
+
+	SHA1Init (&ctx);
+
+	while ((n = read (fd, buf, len)) != 0)
+	{
+		if (n == -1)
+		{
+			if (errno == EINTR)
+				continue;
+
+			fprintf (stderr, "Unable to read file %s: %s\n", path, strerror (errno));
+			(void) close (fd);
+			return B_FALSE;
+		}
+
+		SHA1Update (&ctx, buf, n);
+	}
+
+	SHA1Final (hash, &ctx);
+	(void) close (fd);
+	return B_TRUE;
+}
+
+static int
+compare_entries (const void *a, const void *b)
+{
+	return strcmp (((const manifest_entry_t *)a)->me_path, ((const manifest_entry_t *)b)->me_path);
+}
+
+/*
+ * Sort the paths and give each file the hash noted for it
+ */
+void
+manifest_sort (manifest_t *m)
+{
+	int i;
+	manifest_entry_t *me;
+
+	qsort (m->m_entries, m->m_nentries, sizeof (manifest_entry_t), compare_entries);
+
+	for (i = 0; i < m->m_nhashes; i++)
+	{
+		if ((me = manifest_find (m, m->m_hashes[i].me_path)) != NULL && me->me_file == B_TRUE)
+		{
+			(void) memcpy (me->me_hash, m->m_hashes[i].me_hash, MANIFEST_HASHLEN);
+			me->me_hashed = B_TRUE;
+		}
+
+		free (m->m_hashes[i].me_path);
+	}
+
+	free (m->m_hashes);
+	m->m_hashes = NULL;
+	m->m_nhashes = m->m_maxhashes = 0;
+}
+
+/*
+ * The manifest must be sorted
+ */
+manifest_entry_t *
+manifest_find (manifest_t *m, const char *path)
+{
+	manifest_entry_t key;
+
+	key.me_path = (char *) path;
+
+	return bsearch (&key, m->m_entries, m->m_nentries, sizeof (manifest_entry_t), compare_entries);
+}
+
+/*
+ * Write the manifest into a root, making its directory if need be
+ */
+boolean_t
+manifest_write (manifest_t *m, char *mnt)
+{
+	int i, j;
+	char *p, dest[PATH_MAX];
+	manifest_entry_t *me;
+	FILE *fp;
+
+	(void) snprintf (dest, PATH_MAX, "%s%s", mnt, MANIFEST_PATH);
+
+	for (p = dest + strlen (mnt) + 1; (p = strchr (p, '/')) != NULL; p++)
+	{
+		*p = '\0';
+
+		if (mkdir (dest, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == -1 && errno != EEXIST)
+		{
+			fprintf (stderr, "Error: Unable to create directory %s: %s\n", dest, strerror (errno));
+			return B_FALSE;
+		}
+
+		*p = '/';
+	}
+
+	if ((fp = fopen (dest, "w")) == NULL)
+	{
+		fprintf (stderr, "Error: Unable to open %s: %s\n", dest, strerror (errno));
+		return B_FALSE;
+	}
+
+	for (i = 0; i < m->m_nentries; i++)
+	{
+		me = &m->m_entries[i];
+
+		if (me->me_file == B_TRUE)
+		{
+			fprintf (fp, "%lld %ld.%09ld ", (long long) me->me_size, (long) me->me_mtime.tv_sec,
+			    (long) me->me_mtime.tv_nsec);
+
+			if (me->me_hashed == B_FALSE)
+				fprintf (fp, "- ");
+			else
+			{
+				for (j = 0; j < MANIFEST_HASHLEN; j++)
+					fprintf (fp, "%02x", me->me_hash[j]);
+
+				fprintf (fp, " ");
+			}
+		}
+
+		fprintf (fp, "%s\n", me->me_path);
+	}
+
+	if (fclose (fp) == EOF)
+	{
+		fprintf (stderr, "Error: Unable to write %s: %s\n", dest, strerror (errno));
+		return B_FALSE;
+	}
+
+	return B_TRUE;
+}
+
+/*
+ * Read back one line of a manifest.  Manifests from before files were
+ * recorded hold nothing but paths.
+ */
+static boolean_t
+read_entry (manifest_t *m, char *line)
+{
+	struct stat st;
+	long long size;
+	long sec, nsec;
+	char hex[MANIFEST_HASHLEN * 2 + 1];
+	unsigned int byte;
+	int i, n;
+	manifest_entry_t *me;
+
+	if (line[0] == '/')
+		return manifest_add (m, line, NULL);
+
+	if (sscanf (line, "%lld %ld.%ld %40s %n", &size, &sec, &nsec, hex, &n) != 4 || line[n] != '/')
+	{
+		fprintf (stderr, "Error: Bad manifest line: %s\n", line);
+		return B_FALSE;
+	}
+
+	(void) memset (&st, 0, sizeof (st));
+	st.st_mode = S_IFREG;
+	st.st_size = size;
+	st.st_mtim.tv_sec = sec;
+	st.st_mtim.tv_nsec = nsec;
+
+	if (manifest_add (m, line + n, &st) == B_FALSE)
+		return B_FALSE;
+
+	if (strlen (hex) != MANIFEST_HASHLEN * 2)
+		return B_TRUE;
+
+	me = &m->m_entries[m->m_nentries - 1];
+
+	for (i = 0; i < MANIFEST_HASHLEN; i++)
+	{
+		if (sscanf (hex + i * 2, "%2x", &byte) != 1)
+			return B_TRUE;
+
+		me->me_hash[i] = byte;
+	}
+
+	me->me_hashed = B_TRUE;
+	return B_TRUE;
+}
+
+/*
+ * Read a root's manifest back.  Returns NULL if it has none, which is
+ * the case for roots installed before manifests were kept.
+ */
+manifest_t *
+manifest_read (char *mnt)
+{
+	char path[PATH_MAX], line[PATH_MAX + 128];
+	manifest_t *m;
+	FILE *fp;
+
+	(void) snprintf (path, PATH_MAX, "%s%s", mnt, MANIFEST_PATH);
+
+	if ((fp = fopen (path, "r")) == NULL)
+	{
+		if (errno != ENOENT)
+			fprintf (stderr, "Error: Unable to open %s: %s\n", path, strerror (errno));
+
+		return NULL;
+	}
+
+	if ((m = manifest_alloc ()) == NULL)
+	{
+		(void) fclose (fp);
+		return NULL;
+	}
+
+	while (fgets (line, sizeof (line), fp) != NULL)
+	{
+		line[strcspn (line, "\n")] = '\0';
+
+		if (line[0] != '\0' && read_entry (m, line) == B_FALSE)
+		{
+			manifest_free (m);
+			(void) fclose (fp);
+			return NULL;
+		}
+	}
+
+	(void) fclose (fp);
+	manifest_sort (m);
+	return m;
+}
+
+void
+manifest_free (manifest_t *m)
+{
+	int i;
+
+	for (i = 0; i < m->m_nentries; i++)
+		free (m->m_entries[i].me_path);
+
+	for (i = 0; i < m->m_nhashes; i++)
+		free (m->m_hashes[i].me_path);
+
+	free (m->m_entries);
+	free (m->m_hashes);
+	free (m);
+}
@@ -0,0 +1,64 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+/*
+ * The list of what copy_files put on a root, kept in the root so that
+ * an upgrade can tell files that came from the livecd from ones the
+ * user added, and files it hasn't touched since from ones the user
+ * edited.  One path per line, relative to the root and sorted.  Lines
+ * for regular files start with the size, mtime and SHA1 the file had
+ * when it was copied.
+ */
+#define MANIFEST_PATH	"/var/sadm/schillix/manifest"
+#define MANIFEST_HASHLEN	20
+
+typedef struct manifest_entry
+{
+	char *me_path;
+	boolean_t me_file;	/* a regular file, with the rest filled in */
+	boolean_t me_hashed;
+	off_t me_size;
+	struct timespec me_mtime;
+	unsigned char me_hash[MANIFEST_HASHLEN];
+} manifest_entry_t;
+
+typedef struct manifest
+{
+	manifest_entry_t *m_entries;
+	int m_nentries;
+	int m_max;
+	manifest_entry_t *m_hashes;	/* hashes waiting for manifest_sort */
+	int m_nhashes;
+	int m_maxhashes;
+} manifest_t;
+
+manifest_t *manifest_alloc (void);
+boolean_t manifest_add (manifest_t *m, const char *path, const struct stat *statptr);
+boolean_t manifest_hashed (manifest_t *m, const char *path, const unsigned char *hash);
+boolean_t manifest_hash (const char *path, unsigned char *hash, char *buf, size_t len);
+void manifest_sort (manifest_t *m);
+manifest_entry_t *manifest_find (manifest_t *m, const char *path);
+boolean_t manifest_write (manifest_t *m, char *mnt);
+manifest_t *manifest_read (char *mnt);
+void manifest_free (manifest_t *m);
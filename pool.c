@@ -0,0 +1,460 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <libzfs.h>
+#include <libnvpair.h>
+
+#include "pool.h"
+
+#define DISK_PATH	"/dev/dsk"
+
+static char *class_names[] = { "log", "cache", "special" };
+
+/*
+ * Parse a zpool(1M) style list of log, cache and special vdevs.  Each
+ * class keyword starts a new vdev, log and special vdevs may be mirrors.
+ */
+boolean_t
+parse_pool_layout (char *spec, pool_layout_t *pl)
+{
+	int i;
+	char *tok, *last, *buf;
+	pool_vdev_t *pv = NULL;
+
+	if ((buf = strdup (spec)) == NULL)
+	{
+		fprintf (stderr, "Error: out of memory\n");
+		return B_FALSE;
+	}
+
+	for (tok = strtok_r (buf, " \t\n", &last); tok != NULL; tok = strtok_r (NULL, " \t\n", &last))
+	{
+		/*
+		 * Class keywords start a new vdev
+		 */
+		for (i = 0; i < sizeof (class_names) / sizeof (class_names[0]); i++)
+			if (strcmp (tok, class_names[i]) == 0)
+				break;
+
+		if (i < sizeof (class_names) / sizeof (class_names[0]))
+		{
+			if (pl->pl_nvdevs == POOL_MAXVDEVS)
+			{
+				fprintf (stderr, "Error: Too many vdevs in pool layout\n");
+				free (buf);
+				return B_FALSE;
+			}
+
+			pv = &pl->pl_vdevs[pl->pl_nvdevs++];
+			(void) memset (pv, 0, sizeof (pool_vdev_t));
+			pv->pv_class = i;
+			continue;
+		}
+
+		if (pv == NULL)
+		{
+			fprintf (stderr, "Error: Expected log, cache or special before %s\n", tok);
+			free (buf);
+			return B_FALSE;
+		}
+
+		if (strcmp (tok, "mirror") == 0)
+		{
+			if (pv->pv_ndevs != 0 || pv->pv_mirror == B_TRUE)
+			{
+				fprintf (stderr, "Error: mirror must directly follow %s\n",
+				    class_names[pv->pv_class]);
+				free (buf);
+				return B_FALSE;
+			}
+
+			pv->pv_mirror = B_TRUE;
+			continue;
+		}
+
+		if (pv->pv_ndevs == POOL_MAXDEVS)
+		{
+			fprintf (stderr, "Error: Too many devices in %s vdev\n", class_names[pv->pv_class]);
+			free (buf);
+			return B_FALSE;
+		}
+
+		/*
+		 * Devices can be given as cXtXdXsX or a full path
+		 */
+		if (tok[0] == '/')
+		{
+			if (strlen (tok) >= PATH_MAX)
+			{
+				fprintf (stderr, "Error: vdev path too long\n");
+				free (buf);
+				return B_FALSE;
+			}
+
+			(void) strcpy (pv->pv_devs[pv->pv_ndevs++], tok);
+		}
+		else
+		{
+			if (strlen (tok) >= PATH_MAX - sizeof (DISK_PATH))
+			{
+				fprintf (stderr, "Error: vdev path too long\n");
+				free (buf);
+				return B_FALSE;
+			}
+
+			(void) sprintf (pv->pv_devs[pv->pv_ndevs++], DISK_PATH "/%s", tok);
+		}
+	}
+
+	free (buf);
+	return B_TRUE;
+}
+
+/*
+ * Read a pool layout from a file, # starts a comment.  The lines are
+ * joined into one spec, so a vdev's devices can go on the lines after
+ * its class keyword.
+ */
+boolean_t
+read_pool_layout (char *file, pool_layout_t *pl)
+{
+	char *p, *spec = NULL, line[LINE_MAX];
+	size_t len = 0, n;
+	boolean_t ret;
+	FILE *fp;
+
+	if ((fp = fopen (file, "r")) == NULL)
+	{
+		fprintf (stderr, "Error: Unable to open %s: %s\n", file, strerror (errno));
+		return B_FALSE;
+	}
+
+	while (fgets (line, sizeof (line), fp) != NULL)
+	{
+		if ((p = strchr (line, '#')) != NULL)
+			*p = '\0';
+
+		n = strlen (line);
+
+		if ((p = realloc (spec, len + n + 2)) == NULL)
+		{
+			fprintf (stderr, "Error: out of memory\n");
+			free (spec);
+			(void) fclose (fp);
+			return B_FALSE;
+		}
+
+		spec = p;
+		(void) memcpy (spec + len, line, n);
+		len += n;
+		spec[len++] = ' ';
+		spec[len] = '\0';
+	}
+
+	(void) fclose (fp);
+
+	if (spec == NULL)
+		return B_TRUE;
+
+	ret = parse_pool_layout (spec, pl);
+	free (spec);
+	return ret;
+}
+
+/*
+ * Make sure every device in the layout exists, isn't used twice, isn't
+ * on the root disk and isn't part of another pool.  Called before the
+ * root disk is touched.
+ */
+boolean_t
+validate_pool_layout (libzfs_handle_t *libzfs_handle, char *disk, pool_layout_t *pl)
+{
+	int i, j, k, l, fd;
+	size_t len;
+	char *root, *name, *poolname;
+	pool_state_t poolstate;
+	boolean_t inuse;
+	pool_vdev_t *pv;
+	struct stat st;
+
+	if ((root = strrchr (disk, '/')) != NULL)
+		root++;
+	else
+		root = disk;
+
+	len = strlen (root);
+
+	for (i = 0; i < pl->pl_nvdevs; i++)
+	{
+		pv = &pl->pl_vdevs[i];
+
+		if (pv->pv_ndevs == 0)
+		{
+			fprintf (stderr, "Error: %s vdev has no devices\n", class_names[pv->pv_class]);
+			return B_FALSE;
+		}
+
+		if (pv->pv_mirror == B_TRUE && pv->pv_class == VDEV_CLASS_CACHE)
+		{
+			fprintf (stderr, "Error: cache devices can't be mirrored\n");
+			return B_FALSE;
+		}
+
+		if (pv->pv_mirror == B_TRUE && pv->pv_ndevs < 2)
+		{
+			fprintf (stderr, "Error: %s mirror needs at least two devices\n",
+			    class_names[pv->pv_class]);
+			return B_FALSE;
+		}
+
+		if (pv->pv_mirror == B_FALSE && pv->pv_ndevs > 1 && pv->pv_class != VDEV_CLASS_CACHE)
+		{
+			fprintf (stderr, "Error: %s vdev has more than one device, did you mean mirror?\n",
+			    class_names[pv->pv_class]);
+			return B_FALSE;
+		}
+
+		for (j = 0; j < pv->pv_ndevs; j++)
+		{
+			if (stat (pv->pv_devs[j], &st) == -1)
+			{
+				fprintf (stderr, "Error: Unable to stat %s: %s\n", pv->pv_devs[j], strerror (errno));
+				return B_FALSE;
+			}
+
+			if (!S_ISBLK (st.st_mode) && !S_ISCHR (st.st_mode))
+			{
+				fprintf (stderr, "Error: %s is not a device\n", pv->pv_devs[j]);
+				return B_FALSE;
+			}
+
+			/*
+			 * The root disk is reformatted so none of its slices can be used
+			 */
+			name = strrchr (pv->pv_devs[j], '/') + 1;
+
+			if (strncmp (name, root, len) == 0 && (name[len] == 's' || name[len] == 'p'))
+			{
+				fprintf (stderr, "Error: %s is on the root disk\n", pv->pv_devs[j]);
+				return B_FALSE;
+			}
+
+			/*
+			 * Each device can only be used once
+			 */
+			for (k = 0; k <= i; k++)
+			{
+				for (l = 0; l < pl->pl_vdevs[k].pv_ndevs; l++)
+				{
+					if (k == i && l == j)
+						break;
+
+					if (strcmp (pl->pl_vdevs[k].pv_devs[l], pv->pv_devs[j]) == 0)
+					{
+						fprintf (stderr, "Error: %s is used more than once\n", pv->pv_devs[j]);
+						return B_FALSE;
+					}
+				}
+			}
+
+			if ((fd = open (pv->pv_devs[j], O_RDONLY | O_NDELAY)) == -1)
+			{
+				fprintf (stderr, "Error: Unable to open %s: %s\n", pv->pv_devs[j], strerror (errno));
+				return B_FALSE;
+			}
+
+			inuse = B_FALSE;
+
+			if (zpool_in_use (libzfs_handle, fd, &poolstate, &poolname, &inuse) == -1)
+			{
+				fprintf (stderr, "Error: Unable to determine if %s is in a zpool\n", pv->pv_devs[j]);
+				(void) close (fd);
+				return B_FALSE;
+			}
+
+			(void) close (fd);
+
+			if (inuse == B_TRUE)
+			{
+				fprintf (stderr, "Error: %s is already part of pool: %s\n", pv->pv_devs[j], poolname);
+				return B_FALSE;
+			}
+		}
+	}
+
+	return B_TRUE;
+}
+
+/*
+ * Create a leaf vdev for a single device
+ */
+static nvlist_t *
+make_leaf_vdev (char *path, int ashift)
+{
+	nvlist_t *vdev;
+
+	if (nvlist_alloc (&vdev, NV_UNIQUE_NAME, 0) != 0)
+		return NULL;
+
+	if (nvlist_add_string (vdev, ZPOOL_CONFIG_PATH, path) != 0
+	    || nvlist_add_string (vdev, ZPOOL_CONFIG_TYPE, VDEV_TYPE_DISK) != 0
+	    || nvlist_add_uint64 (vdev, ZPOOL_CONFIG_ASHIFT, ashift) != 0)
+	{
+		(void) nvlist_free (vdev);
+		return NULL;
+	}
+
+	return vdev;
+}
+
+/*
+ * Create a top level vdev, either a single disk or a mirror
+ */
+static nvlist_t *
+make_top_vdev (pool_vdev_t *pv, int ashift)
+{
+	int i;
+	nvlist_t *vdev, *children[POOL_MAXDEVS];
+
+	if (pv->pv_mirror == B_FALSE)
+		return make_leaf_vdev (pv->pv_devs[0], ashift);
+
+	for (i = 0; i < pv->pv_ndevs; i++)
+	{
+		if ((children[i] = make_leaf_vdev (pv->pv_devs[i], ashift)) == NULL)
+		{
+			while (--i >= 0)
+				(void) nvlist_free (children[i]);
+			return NULL;
+		}
+	}
+
+	if (nvlist_alloc (&vdev, NV_UNIQUE_NAME, 0) != 0)
+		vdev = NULL;
+	else if (nvlist_add_string (vdev, ZPOOL_CONFIG_TYPE, VDEV_TYPE_MIRROR) != 0
+	    || nvlist_add_nvlist_array (vdev, ZPOOL_CONFIG_CHILDREN, children, pv->pv_ndevs) != 0)
+	{
+		(void) nvlist_free (vdev);
+		vdev = NULL;
+	}
+
+	for (i = 0; i < pv->pv_ndevs; i++)
+		(void) nvlist_free (children[i]);
+
+	return vdev;
+}
+
+/*
+ * Add the root disk and every vdev in the layout to nvroot.  Logs and
+ * special vdevs are marked children of the root, cache devices go in
+ * their own list.
+ */
+boolean_t
+add_pool_vdevs (nvlist_t *nvroot, nvlist_t *rootvdev, pool_layout_t *pl, int ashift)
+{
+	int i, j, nchildren = 0, ncache = 0;
+	nvlist_t *children[POOL_MAXVDEVS + 1], *cache[POOL_MAXVDEVS * POOL_MAXDEVS];
+	pool_vdev_t *pv;
+	boolean_t ret = B_FALSE;
+
+	children[nchildren++] = rootvdev;
+
+	for (i = 0; pl != NULL && i < pl->pl_nvdevs; i++)
+	{
+		pv = &pl->pl_vdevs[i];
+
+		if (pv->pv_class == VDEV_CLASS_CACHE)
+		{
+			for (j = 0; j < pv->pv_ndevs; j++)
+			{
+				if ((cache[ncache] = make_leaf_vdev (pv->pv_devs[j], ashift)) == NULL)
+				{
+					fprintf (stderr, "Error: Unable to create cache vdev\n");
+					goto out;
+				}
+
+				ncache++;
+			}
+
+			continue;
+		}
+
+		if ((children[nchildren] = make_top_vdev (pv, ashift)) == NULL)
+		{
+			fprintf (stderr, "Error: Unable to create %s vdev\n", class_names[pv->pv_class]);
+			goto out;
+		}
+
+		nchildren++;
+
+		if (pv->pv_class == VDEV_CLASS_LOG)
+		{
+			if (nvlist_add_uint64 (children[nchildren - 1], ZPOOL_CONFIG_IS_LOG, 1) != 0)
+			{
+				fprintf (stderr, "Error: Unable to mark log vdev\n");
+				goto out;
+			}
+		}
+		else if (nvlist_add_string (children[nchildren - 1], ZPOOL_CONFIG_ALLOCATION_BIAS,
+		    VDEV_ALLOC_BIAS_SPECIAL) != 0)
+		{
+			fprintf (stderr, "Error: Unable to mark special vdev\n");
+			goto out;
+		}
+	}
+
+	if (nvlist_add_nvlist_array (nvroot, ZPOOL_CONFIG_CHILDREN, children, nchildren) != 0)
+	{
+		fprintf (stderr, "Error: Unable to add vdevs to list\n");
+		goto out;
+	}
+
+	if (ncache > 0 && nvlist_add_nvlist_array (nvroot, ZPOOL_CONFIG_L2CACHE, cache, ncache) != 0)
+	{
+		fprintf (stderr, "Error: Unable to add cache vdevs to list\n");
+		goto out;
+	}
+
+	ret = B_TRUE;
+
+out:
+	/*
+	 * The root vdev belongs to the caller
+	 */
+	for (i = 1; i < nchildren; i++)
+		(void) nvlist_free (children[i]);
+
+	for (i = 0; i < ncache; i++)
+		(void) nvlist_free (cache[i]);
+
+	return ret;
+}
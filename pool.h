@@ -0,0 +1,57 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+/*
+ * Extra vdevs for the root pool, described zpool(1M) style:
+ *
+ *	log c1t0d0s0 cache c2t0d0s0 special mirror c3t0d0s0 c4t0d0s0
+ */
+#define POOL_MAXVDEVS	16
+#define POOL_MAXDEVS	8
+
+typedef enum vdev_class
+{
+	VDEV_CLASS_LOG,
+	VDEV_CLASS_CACHE,
+	VDEV_CLASS_SPECIAL
+} vdev_class_t;
+
+typedef struct pool_vdev
+{
+	vdev_class_t pv_class;
+	boolean_t pv_mirror;
+	int pv_ndevs;
+	char pv_devs[POOL_MAXDEVS][PATH_MAX];
+} pool_vdev_t;
+
+typedef struct pool_layout
+{
+	int pl_nvdevs;
+	pool_vdev_t pl_vdevs[POOL_MAXVDEVS];
+} pool_layout_t;
+
+boolean_t parse_pool_layout (char *spec, pool_layout_t *pl);
+boolean_t read_pool_layout (char *file, pool_layout_t *pl);
+boolean_t validate_pool_layout (libzfs_handle_t *libzfs_handle, char *disk, pool_layout_t *pl);
+boolean_t add_pool_vdevs (nvlist_t *nvroot, nvlist_t *rootvdev, pool_layout_t *pl, int ashift);
@@ -0,0 +1,188 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <libzfs.h>
+#include <libnvpair.h>
+
+#include "profile.h"
+
+/*
+ * Find the profile for a dataset, if there is one
+ */
+dataset_profile_t *
+find_profile (profile_t *profile, char *name)
+{
+	int i;
+
+	if (profile == NULL)
+		return NULL;
+
+	for (i = 0; i < profile->pr_ndatasets; i++)
+		if (strcmp (profile->pr_datasets[i].dp_name, name) == 0)
+			return &profile->pr_datasets[i];
+
+	return NULL;
+}
+
+/*
+ * Convert a property to the type the kernel wants.  libzfs_core passes
+ * property lists straight through so "lz4" and "8k" have to become
+ * numbers here.
+ */
+static boolean_t
+add_profile_prop (libzfs_handle_t *libzfs_handle, nvlist_t *props, char *name, char *value)
+{
+	zfs_prop_t prop;
+	uint64_t number;
+
+	if ((prop = zfs_name_to_prop (name)) == ZPROP_INVAL || zfs_prop_readonly (prop))
+	{
+		fprintf (stderr, "Error: %s is not a settable property\n", name);
+		return B_FALSE;
+	}
+
+	switch (zfs_prop_get_type (prop))
+	{
+		case PROP_TYPE_STRING:
+			if (nvlist_add_string (props, name, value) != 0)
+				return B_FALSE;
+			break;
+
+		case PROP_TYPE_NUMBER:
+			if (zfs_nicestrtonum (libzfs_handle, value, &number) != 0)
+			{
+				fprintf (stderr, "Error: Bad value for %s: %s\n", name, value);
+				return B_FALSE;
+			}
+
+			if (nvlist_add_uint64 (props, name, number) != 0)
+				return B_FALSE;
+			break;
+
+		case PROP_TYPE_INDEX:
+			if (zfs_prop_string_to_index (prop, value, &number) != 0)
+			{
+				fprintf (stderr, "Error: Bad value for %s: %s\n", name, value);
+				return B_FALSE;
+			}
+
+			if (nvlist_add_uint64 (props, name, number) != 0)
+				return B_FALSE;
+			break;
+
+		default:
+			return B_FALSE;
+	}
+
+	return B_TRUE;
+}
+
+/*
+ * Read and check a property profile
+ */
+boolean_t
+read_profile (libzfs_handle_t *libzfs_handle, char *file, profile_t *profile)
+{
+	int lineno = 0;
+	char *p, *tok, *last, *value, line[LINE_MAX];
+	dataset_profile_t *dp;
+	FILE *fp;
+
+	if ((fp = fopen (file, "r")) == NULL)
+	{
+		fprintf (stderr, "Error: Unable to open %s: %s\n", file, strerror (errno));
+		return B_FALSE;
+	}
+
+	while (fgets (line, sizeof (line), fp) != NULL)
+	{
+		lineno++;
+
+		if ((p = strchr (line, '#')) != NULL)
+			*p = '\0';
+
+		if ((tok = strtok_r (line, " \t\n", &last)) == NULL)
+			continue;
+
+		if (strlen (tok) >= ZFS_MAXNAMELEN || tok[0] == '/')
+		{
+			fprintf (stderr, "Error: %s:%d: bad dataset name %s\n", file, lineno, tok);
+			(void) fclose (fp);
+			return B_FALSE;
+		}
+
+		/*
+		 * A dataset can be split over several lines
+		 */
+		if ((dp = find_profile (profile, tok)) == NULL)
+		{
+			if (profile->pr_ndatasets == PROFILE_MAXDATASETS)
+			{
+				fprintf (stderr, "Error: %s:%d: too many datasets\n", file, lineno);
+				(void) fclose (fp);
+				return B_FALSE;
+			}
+
+			dp = &profile->pr_datasets[profile->pr_ndatasets];
+
+			if (nvlist_alloc (&dp->dp_props, NV_UNIQUE_NAME, 0) != 0)
+			{
+				fprintf (stderr, "Error: out of memory\n");
+				(void) fclose (fp);
+				return B_FALSE;
+			}
+
+			(void) strcpy (dp->dp_name, tok);
+			profile->pr_ndatasets++;
+		}
+
+		while ((tok = strtok_r (NULL, " \t\n", &last)) != NULL)
+		{
+			if ((value = strchr (tok, '=')) == NULL)
+			{
+				fprintf (stderr, "Error: %s:%d: expected property=value, got %s\n",
+				    file, lineno, tok);
+				(void) fclose (fp);
+				return B_FALSE;
+			}
+
+			*value++ = '\0';
+
+			if (add_profile_prop (libzfs_handle, dp->dp_props, tok, value) == B_FALSE)
+			{
+				fprintf (stderr, "Error: %s:%d: unable to use %s\n", file, lineno, tok);
+				(void) fclose (fp);
+				return B_FALSE;
+			}
+		}
+	}
+
+	(void) fclose (fp);
+	return B_TRUE;
+}
@@ -0,0 +1,50 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+/*
+ * ZFS properties to apply to datasets as they are created, read from a
+ * profile file of the form:
+ *
+ *	# dataset	property=value ...
+ *	ROOT/schillix	compression=lz4 atime=off
+ *
+ * Dataset names are relative to the root pool.  Datasets the installer
+ * doesn't create itself are created as well.
+ */
+#define PROFILE_MAXDATASETS	32
+
+typedef struct dataset_profile
+{
+	char dp_name[ZFS_MAXNAMELEN];
+	nvlist_t *dp_props;
+} dataset_profile_t;
+
+typedef struct profile
+{
+	int pr_ndatasets;
+	dataset_profile_t pr_datasets[PROFILE_MAXDATASETS];
+} profile_t;
+
+boolean_t read_profile (libzfs_handle_t *libzfs_handle, char *file, profile_t *profile);
+dataset_profile_t *find_profile (profile_t *profile, char *name);
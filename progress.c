@@ -0,0 +1,269 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <libzfs.h>
+
+#include "progress.h"
+
+/*
+ * Weight of the newest sample in the smoothed rate
+ */
+#define PROGRESS_ALPHA	0.2
+
+static boolean_t progress_enabled = B_FALSE;
+static int progress_fd;
+static struct timespec progress_epoch;
+
+/*
+ * Updated from the copy with atomics
+ */
+static uint64_t progress_done_bytes;
+static uint64_t progress_done_files;
+static const char *progress_current;
+
+/*
+ * Counted by the copy's first pass, and only read by the reporter once
+ * progress_totals says they're complete
+ */
+static uint64_t progress_total_bytes;
+static uint64_t progress_total_files;
+static boolean_t progress_counted = B_FALSE;
+
+static pthread_t progress_tid;
+static pthread_mutex_t progress_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t progress_cv = PTHREAD_COND_INITIALIZER;
+static boolean_t progress_stop;
+
+static double
+progress_time (void)
+{
+	struct timespec now;
+
+	(void) clock_gettime (CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - progress_epoch.tv_sec) + (now.tv_nsec - progress_epoch.tv_nsec) / 1e9;
+}
+
+/*
+ * Write one event.  Events are small enough for a single write to keep
+ * lines from different threads whole.
+ */
+static void
+progress_emit (const char *fmt, ...)
+{
+	char buf[1024];
+	va_list ap;
+	int len;
+
+	va_start (ap, fmt);
+	len = vsnprintf (buf, sizeof (buf) - 1, fmt, ap);
+	va_end (ap);
+
+	if (len < 0 || len >= sizeof (buf) - 1)
+		return;
+
+	buf[len++] = '\n';
+	(void) write (progress_fd, buf, len);
+}
+
+/*
+ * Sample the counters every PROGRESS_INTERVAL until told to stop
+ */
+static void *
+progress_thread (void *arg)
+{
+	uint64_t bytes, files, last_bytes = 0;
+	double now, last = 0, rate, smoothed = 0;
+	char eta[32], files_total[32], bytes_total[32];
+	const char *phase;
+	struct timespec deadline;
+
+	(void) pthread_mutex_lock (&progress_lock);
+
+	while (progress_stop == B_FALSE)
+	{
+		(void) clock_gettime (CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += PROGRESS_INTERVAL;
+
+		if (pthread_cond_timedwait (&progress_cv, &progress_lock, &deadline) == 0)
+			continue;
+
+		now = progress_time ();
+		bytes = __sync_add_and_fetch (&progress_done_bytes, 0);
+		files = __sync_add_and_fetch (&progress_done_files, 0);
+		phase = progress_current;
+
+		rate = (bytes - last_bytes) / (now - last);
+		smoothed = last == 0 ? rate : PROGRESS_ALPHA * rate + (1 - PROGRESS_ALPHA) * smoothed;
+		last = now;
+		last_bytes = bytes;
+
+		if (progress_counted == B_TRUE)
+		{
+			(void) snprintf (files_total, sizeof (files_total), "%llu", (unsigned long long) progress_total_files);
+			(void) snprintf (bytes_total, sizeof (bytes_total), "%llu", (unsigned long long) progress_total_bytes);
+		}
+		else
+		{
+			(void) strcpy (files_total, "null");
+			(void) strcpy (bytes_total, "null");
+		}
+
+		if (progress_counted == B_TRUE && smoothed > 0 && bytes <= progress_total_bytes)
+			(void) snprintf (eta, sizeof (eta), "%.0f", (progress_total_bytes - bytes) / smoothed);
+		else
+			(void) strcpy (eta, "null");
+
+		progress_emit ("{\"event\":\"progress\",\"time\":%.3f,\"phase\":\"%s\","
+		    "\"files\":%llu,\"files_total\":%s,\"bytes\":%llu,\"bytes_total\":%s,"
+		    "\"rate\":%.0f,\"smoothed_rate\":%.0f,\"eta\":%s}",
+		    now, phase == NULL ? "" : phase, (unsigned long long) files, files_total,
+		    (unsigned long long) bytes, bytes_total, rate, smoothed, eta);
+	}
+
+	(void) pthread_mutex_unlock (&progress_lock);
+
+	return NULL;
+}
+
+/*
+ * Start reporting to fd
+ */
+boolean_t
+progress_open (int fd)
+{
+	if (fcntl (fd, F_GETFD) == -1)
+	{
+		fprintf (stderr, "Error: Bad progress descriptor %d: %s\n", fd, strerror (errno));
+		return B_FALSE;
+	}
+
+	progress_fd = fd;
+	(void) clock_gettime (CLOCK_MONOTONIC, &progress_epoch);
+
+	if (pthread_create (&progress_tid, NULL, progress_thread, NULL) != 0)
+	{
+		fprintf (stderr, "Error: Unable to start progress reporter\n");
+		return B_FALSE;
+	}
+
+	progress_enabled = B_TRUE;
+	return B_TRUE;
+}
+
+/*
+ * A phase started or finished.  The last one started is reported as
+ * the current phase.
+ */
+void
+progress_phase (const char *name, const char *state)
+{
+	if (progress_enabled == B_FALSE)
+		return;
+
+	if (strcmp (state, "start") == 0)
+		progress_current = name;
+
+	progress_emit ("{\"event\":\"phase\",\"time\":%.3f,\"phase\":\"%s\",\"state\":\"%s\"}",
+	    progress_time (), name, state);
+}
+
+/*
+ * A file the copy will get to.  Only called from the walk, before
+ * progress_totals.
+ */
+void
+progress_count (uint64_t bytes)
+{
+	if (progress_enabled == B_TRUE)
+	{
+		progress_total_files++;
+		progress_total_bytes += bytes;
+	}
+}
+
+/*
+ * Everything to be copied has been counted
+ */
+void
+progress_totals (void)
+{
+	if (progress_enabled == B_FALSE)
+		return;
+
+	(void) pthread_mutex_lock (&progress_lock);
+	progress_counted = B_TRUE;
+	(void) pthread_mutex_unlock (&progress_lock);
+
+	progress_emit ("{\"event\":\"totals\",\"time\":%.3f,\"files_total\":%llu,\"bytes_total\":%llu}",
+	    progress_time (), (unsigned long long) progress_total_files,
+	    (unsigned long long) progress_total_bytes);
+}
+
+void
+progress_bytes (uint64_t bytes)
+{
+	if (progress_enabled == B_TRUE)
+		(void) __sync_add_and_fetch (&progress_done_bytes, bytes);
+}
+
+void
+progress_file (void)
+{
+	if (progress_enabled == B_TRUE)
+		(void) __sync_add_and_fetch (&progress_done_files, 1);
+}
+
+/*
+ * Stop the reporter and say how it went
+ */
+void
+progress_close (boolean_t ok)
+{
+	if (progress_enabled == B_FALSE)
+		return;
+
+	(void) pthread_mutex_lock (&progress_lock);
+	progress_stop = B_TRUE;
+	(void) pthread_cond_signal (&progress_cv);
+	(void) pthread_mutex_unlock (&progress_lock);
+
+	(void) pthread_join (progress_tid, NULL);
+
+	progress_emit ("{\"event\":\"end\",\"time\":%.3f,\"files\":%llu,\"bytes\":%llu,\"ok\":%s}",
+	    progress_time (), (unsigned long long) progress_done_files,
+	    (unsigned long long) progress_done_bytes, ok == B_TRUE ? "true" : "false");
+
+	progress_enabled = B_FALSE;
+}
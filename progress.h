@@ -0,0 +1,40 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+
+/*
+ * Newline-delimited JSON progress events written to a file descriptor.
+ * The copy only bumps counters; a reporter thread samples them.  The
+ * totals come from the copy's first pass, which walks everything, so
+ * until it's done, and during an upgrade, they're null.
+ */
+#define PROGRESS_INTERVAL	1	/* seconds between progress events */
+
+boolean_t progress_open (int fd);
+void progress_phase (const char *name, const char *state);
+void progress_count (uint64_t bytes);
+void progress_totals (void);
+void progress_bytes (uint64_t bytes);
+void progress_file (void);
+void progress_close (boolean_t ok);
@@ -0,0 +1,371 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <libzfs.h>
+
+#include "disk.h"
+#include "trace.h"
+#include "reset.h"
+
+/*
+ * Every filesystem in the pool, parents before children
+ */
+typedef struct reset_list
+{
+	libzfs_handle_t *rl_libzfs;
+	char (*rl_names)[ZFS_MAXNAMELEN];
+	boolean_t *rl_installed;	/* has an @installed snapshot */
+	boolean_t *rl_destroyed;
+	int rl_count;
+	int rl_max;
+} reset_list_t;
+
+static int
+list_filesystem (zfs_handle_t *zfs_handle, void *data)
+{
+	reset_list_t *rl = data;
+	char snap[ZFS_MAXNAMELEN], (*names)[ZFS_MAXNAMELEN];
+	boolean_t *installed, *destroyed;
+	int n, ret;
+
+	if (rl->rl_count == rl->rl_max)
+	{
+		n = rl->rl_max == 0 ? 32 : rl->rl_max * 2;
+
+		if ((names = realloc (rl->rl_names, n * ZFS_MAXNAMELEN)) != NULL)
+			rl->rl_names = names;
+
+		if ((installed = realloc (rl->rl_installed, n * sizeof (boolean_t))) != NULL)
+			rl->rl_installed = installed;
+
+		if ((destroyed = realloc (rl->rl_destroyed, n * sizeof (boolean_t))) != NULL)
+			rl->rl_destroyed = destroyed;
+
+		if (names == NULL || installed == NULL || destroyed == NULL)
+		{
+			fprintf (stderr, "Error: out of memory\n");
+			zfs_close (zfs_handle);
+			return -1;
+		}
+
+		rl->rl_max = n;
+	}
+
+	n = rl->rl_count++;
+	(void) snprintf (rl->rl_names[n], ZFS_MAXNAMELEN, "%s", zfs_get_name (zfs_handle));
+	(void) snprintf (snap, ZFS_MAXNAMELEN, "%s@" INSTALLED_SNAP, rl->rl_names[n]);
+
+	rl->rl_installed[n] = zfs_dataset_exists (rl->rl_libzfs, snap, ZFS_TYPE_SNAPSHOT);
+	rl->rl_destroyed[n] = B_FALSE;
+
+	ret = zfs_iter_filesystems (zfs_handle, list_filesystem, rl);
+	zfs_close (zfs_handle);
+
+	return ret;
+}
+
+static int
+destroy_snapshot (zfs_handle_t *zfs_handle, void *data)
+{
+	int ret = zfs_destroy (zfs_handle, B_FALSE);
+
+	zfs_close (zfs_handle);
+	return ret;
+}
+
+/*
+ * Destroy a filesystem made since the install, snapshots first.  This
+ * fails while clones of its snapshots are still around.
+ */
+static boolean_t
+destroy_filesystem (libzfs_handle_t *libzfs_handle, char *name)
+{
+	zfs_handle_t *zfs_handle;
+	int ret;
+
+	if ((zfs_handle = zfs_open (libzfs_handle, name, ZFS_TYPE_FILESYSTEM)) == NULL)
+		return B_FALSE;
+
+	(void) zfs_unmount (zfs_handle, NULL, 0);
+
+	if ((ret = zfs_iter_snapshots (zfs_handle, B_FALSE, destroy_snapshot, NULL)) == 0)
+		ret = zfs_destroy (zfs_handle, B_FALSE);
+
+	zfs_close (zfs_handle);
+	return ret == 0 ? B_TRUE : B_FALSE;
+}
+
+/*
+ * Destroy everything without an @installed snapshot, bar the pool's own
+ * dataset.  Children go before parents and clones have to go before
+ * their origins, so keep going round while that gets anywhere.
+ */
+static boolean_t
+destroy_new (reset_list_t *rl, int *count)
+{
+	int i, left;
+	boolean_t progress = B_TRUE;
+
+	*count = 0;
+
+	while (progress == B_TRUE)
+	{
+		progress = B_FALSE;
+		left = 0;
+
+		for (i = rl->rl_count - 1; i > 0; i--)
+		{
+			if (rl->rl_installed[i] == B_TRUE || rl->rl_destroyed[i] == B_TRUE)
+				continue;
+
+			if (destroy_filesystem (rl->rl_libzfs, rl->rl_names[i]) == B_TRUE)
+			{
+				rl->rl_destroyed[i] = B_TRUE;
+				progress = B_TRUE;
+				(*count)++;
+			}
+			else
+				left++;
+		}
+	}
+
+	for (i = rl->rl_count - 1; left > 0 && i > 0; i--)
+		if (rl->rl_installed[i] == B_FALSE && rl->rl_destroyed[i] == B_FALSE)
+			fprintf (stderr, "Error: Unable to destroy %s\n", rl->rl_names[i]);
+
+	return left == 0 ? B_TRUE : B_FALSE;
+}
+
+/*
+ * Roll back everything with an @installed snapshot.  Any later
+ * snapshots go with it.
+ */
+static boolean_t
+rollback_installed (reset_list_t *rl, int *count)
+{
+	char snap[ZFS_MAXNAMELEN];
+	zfs_handle_t *zfs_handle, *snap_handle;
+	int i, ret;
+
+	*count = 0;
+
+	for (i = 0; i < rl->rl_count; i++)
+	{
+		if (rl->rl_installed[i] == B_FALSE)
+			continue;
+
+		(void) snprintf (snap, ZFS_MAXNAMELEN, "%s@" INSTALLED_SNAP, rl->rl_names[i]);
+
+		if ((zfs_handle = zfs_open (rl->rl_libzfs, rl->rl_names[i], ZFS_TYPE_FILESYSTEM)) == NULL)
+		{
+			fprintf (stderr, "Error: Unable to open %s\n", rl->rl_names[i]);
+			return B_FALSE;
+		}
+
+		if ((snap_handle = zfs_open (rl->rl_libzfs, snap, ZFS_TYPE_SNAPSHOT)) == NULL)
+		{
+			fprintf (stderr, "Error: Unable to open %s\n", snap);
+			zfs_close (zfs_handle);
+			return B_FALSE;
+		}
+
+		ret = zfs_rollback (zfs_handle, snap_handle, B_FALSE);
+
+		zfs_close (snap_handle);
+		zfs_close (zfs_handle);
+
+		if (ret != 0)
+		{
+			fprintf (stderr, "Error: Unable to roll back %s\n", rl->rl_names[i]);
+			return B_FALSE;
+		}
+
+		(*count)++;
+	}
+
+	return B_TRUE;
+}
+
+/*
+ * Properties aren't part of a snapshot, so put back the ones an
+ * upgrade changes.  Returns how many needed it, or -1.
+ */
+static int
+restore_boot_env (libzfs_handle_t *libzfs_handle, char *rpool)
+{
+	char bootfs[ZFS_MAXNAMELEN], root[ZFS_MAXNAMELEN];
+	zpool_handle_t *zpool_handle;
+	zfs_handle_t *zfs_handle;
+	int ret, count = 0;
+
+	(void) snprintf (root, ZFS_MAXNAMELEN, "%s/ROOT/" ROOT_NAME, rpool);
+
+	if ((zpool_handle = zpool_open (libzfs_handle, rpool)) == NULL)
+	{
+		fprintf (stderr, "Error: Unable to open rpool\n");
+		return -1;
+	}
+
+	ret = zpool_get_prop (zpool_handle, ZPOOL_PROP_BOOTFS, bootfs, ZFS_MAXNAMELEN, NULL);
+	zpool_close (zpool_handle);
+
+	if (ret != 0 || strcmp (bootfs, root) != 0)
+	{
+		if (set_root_bootfs (libzfs_handle, rpool) == B_FALSE)
+			return -1;
+
+		count++;
+	}
+
+	if ((zfs_handle = zfs_open (libzfs_handle, root, ZFS_TYPE_FILESYSTEM)) == NULL)
+	{
+		fprintf (stderr, "Error: Unable to open %s\n", root);
+		return -1;
+	}
+
+	if (zfs_prop_get_int (zfs_handle, ZFS_PROP_CANMOUNT) != ZFS_CANMOUNT_ON)
+	{
+		if (zfs_prop_set (zfs_handle, zfs_prop_to_name (ZFS_PROP_CANMOUNT), "on") != 0)
+		{
+			fprintf (stderr, "Error: Unable to set %s canmount\n", root);
+			zfs_close (zfs_handle);
+			return -1;
+		}
+
+		count++;
+	}
+
+	zfs_close (zfs_handle);
+	return count;
+}
+
+/*
+ * The pool must be imported with an altroot, so the running system is
+ * never rolled back underneath itself
+ */
+static boolean_t
+check_pool (libzfs_handle_t *libzfs_handle, char *rpool)
+{
+	char altroot[PATH_MAX], snap[ZFS_MAXNAMELEN];
+	zpool_handle_t *zpool_handle;
+	int ret;
+
+	if ((zpool_handle = zpool_open (libzfs_handle, rpool)) == NULL)
+	{
+		fprintf (stderr, "Error: Unable to open %s, is it imported?\n", rpool);
+		return B_FALSE;
+	}
+
+	ret = zpool_get_prop (zpool_handle, ZPOOL_PROP_ALTROOT, altroot, PATH_MAX, NULL);
+	zpool_close (zpool_handle);
+
+	if (ret != 0 || strcmp (altroot, "-") == 0)
+	{
+		fprintf (stderr, "Error: %s must be imported with an altroot to be reset\n", rpool);
+		return B_FALSE;
+	}
+
+	(void) snprintf (snap, ZFS_MAXNAMELEN, "%s/ROOT/" ROOT_NAME "@" INSTALLED_SNAP, rpool);
+
+	if (zfs_dataset_exists (libzfs_handle, snap, ZFS_TYPE_SNAPSHOT) == B_FALSE)
+	{
+		fprintf (stderr, "Error: %s has no %s snapshot to reset to\n", rpool, snap);
+		return B_FALSE;
+	}
+
+	return B_TRUE;
+}
+
+boolean_t
+reset (libzfs_handle_t *libzfs_handle, char *rpool)
+{
+	reset_list_t rl;
+	zfs_handle_t *zfs_handle;
+	int destroyed = 0, rolled = 0, restored = 0;
+	boolean_t ret = B_FALSE;
+	struct timespec start, end;
+	double span;
+
+	if (check_pool (libzfs_handle, rpool) == B_FALSE)
+		return B_FALSE;
+
+	(void) memset (&rl, 0, sizeof (rl));
+	rl.rl_libzfs = libzfs_handle;
+	(void) clock_gettime (CLOCK_MONOTONIC, &start);
+	span = trace_start ();
+
+	if ((zfs_handle = zfs_open (libzfs_handle, rpool, ZFS_TYPE_FILESYSTEM)) == NULL)
+	{
+		fprintf (stderr, "Error: Unable to open %s\n", rpool);
+		return B_FALSE;
+	}
+
+	if (list_filesystem (zfs_handle, &rl) != 0)
+		goto out;
+
+	trace_end ("phase", "list", span);
+
+	printf ("Resetting %s...\n", rpool);
+
+	/*
+	 * bootfs first, so an upgraded boot environment isn't in use when
+	 * it's destroyed
+	 */
+	span = trace_start ();
+	restored = restore_boot_env (libzfs_handle, rpool);
+	trace_end ("phase", "restore", span);
+
+	if (restored == -1)
+		goto out;
+
+	span = trace_start ();
+	ret = destroy_new (&rl, &destroyed);
+	trace_end ("phase", "destroy", span);
+
+	if (ret == B_FALSE)
+		goto out;
+
+	span = trace_start ();
+	ret = rollback_installed (&rl, &rolled);
+	trace_end ("phase", "rollback", span);
+
+	(void) clock_gettime (CLOCK_MONOTONIC, &end);
+
+	if (ret == B_TRUE)
+		printf ("Reset %s in %.2fs: %d datasets rolled back, %d destroyed, %d properties restored\n",
+		    rpool, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9,
+		    rolled, destroyed, restored);
+
+out:
+	free (rl.rl_names);
+	free (rl.rl_installed);
+	free (rl.rl_destroyed);
+
+	return ret;
+}
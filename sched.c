@@ -0,0 +1,292 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "sched.h"
+#include "trace.h"
+#include "progress.h"
+
+typedef struct sched
+{
+	pthread_mutex_t sc_lock;
+	pthread_cond_t sc_cv;
+	sched_step_t *sc_steps;
+	int sc_running;
+	struct timespec sc_epoch;
+} sched_t;
+
+typedef struct sched_arg
+{
+	sched_t *sa_sched;
+	sched_step_t *sa_step;
+} sched_arg_t;
+
+/*
+ * Seconds since the schedule started
+ */
+static double
+sched_time (sched_t *sc)
+{
+	struct timespec now;
+
+	(void) clock_gettime (CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - sc->sc_epoch.tv_sec) + (now.tv_nsec - sc->sc_epoch.tv_nsec) / 1e9;
+}
+
+/*
+ * Run one step and tell the scheduler when it's done
+ */
+static void *
+sched_thread (void *arg)
+{
+	sched_arg_t *sa = arg;
+	sched_t *sc = sa->sa_sched;
+	sched_step_t *ss = sa->sa_step;
+	boolean_t ret;
+	double start = trace_start ();
+
+	progress_phase (ss->ss_name, "start");
+	ret = ss->ss_func (ss->ss_arg);
+	progress_phase (ss->ss_name, ret == B_TRUE ? "done" : "failed");
+	trace_end ("phase", ss->ss_name, start);
+
+	(void) pthread_mutex_lock (&sc->sc_lock);
+	ss->ss_end = sched_time (sc);
+	ss->ss_state = ret == B_TRUE ? SCHED_DONE : SCHED_FAILED;
+	sc->sc_running--;
+	(void) pthread_cond_signal (&sc->sc_cv);
+	(void) pthread_mutex_unlock (&sc->sc_lock);
+
+	free (sa);
+	return NULL;
+}
+
+/*
+ * Work out whether a step can start: SCHED_DONE if everything it
+ * depends on is done, SCHED_CANCELLED if anything it depends on failed
+ * or was cancelled, otherwise SCHED_WAITING.  Steps marked ss_always
+ * only wait for their dependencies to finish one way or another.
+ */
+static sched_state_t
+sched_ready (sched_step_t *steps, sched_step_t *ss)
+{
+	int i;
+	sched_state_t state = SCHED_DONE;
+
+	for (i = 0; i < ss->ss_ndeps; i++)
+	{
+		switch (steps[ss->ss_deps[i]].ss_state)
+		{
+			case SCHED_DONE:
+				break;
+			case SCHED_FAILED:
+			case SCHED_CANCELLED:
+				if (ss->ss_always == B_TRUE)
+					break;
+				return SCHED_CANCELLED;
+			default:
+				state = SCHED_WAITING;
+				break;
+		}
+	}
+
+	return state;
+}
+
+/*
+ * Run every step on its own thread as soon as the steps it depends on
+ * have finished.  If a step fails everything depending on it is
+ * cancelled, but steps already running are left to finish.  Each pass
+ * over the array is repeated until nothing changes, so a step can
+ * depend on one after it and still be started or cancelled in time.
+ */
+boolean_t
+sched_run (sched_step_t *steps, int nsteps)
+{
+	int i;
+	boolean_t ret = B_TRUE, changed;
+	sched_t sc;
+	sched_arg_t *sa;
+	pthread_attr_t attr;
+	pthread_t tid;
+
+	(void) pthread_mutex_init (&sc.sc_lock, NULL);
+	(void) pthread_cond_init (&sc.sc_cv, NULL);
+	(void) pthread_attr_init (&attr);
+	(void) pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+	(void) clock_gettime (CLOCK_MONOTONIC, &sc.sc_epoch);
+	sc.sc_steps = steps;
+	sc.sc_running = 0;
+
+	for (i = 0; i < nsteps; i++)
+		steps[i].ss_state = SCHED_WAITING;
+
+	(void) pthread_mutex_lock (&sc.sc_lock);
+
+	for (;;)
+	{
+		for (i = 0, changed = B_FALSE; i < nsteps; i++)
+		{
+			if (steps[i].ss_state != SCHED_WAITING)
+				continue;
+
+			switch (sched_ready (steps, &steps[i]))
+			{
+				case SCHED_CANCELLED:
+					steps[i].ss_state = SCHED_CANCELLED;
+					changed = B_TRUE;
+					continue;
+				case SCHED_WAITING:
+					continue;
+				default:
+					break;
+			}
+
+			changed = B_TRUE;
+
+			steps[i].ss_start = sched_time (&sc);
+			steps[i].ss_state = SCHED_RUNNING;
+
+			if ((sa = malloc (sizeof (sched_arg_t))) == NULL)
+			{
+				fprintf (stderr, "Error: out of memory\n");
+				steps[i].ss_state = SCHED_FAILED;
+				continue;
+			}
+
+			sa->sa_sched = &sc;
+			sa->sa_step = &steps[i];
+
+			if (pthread_create (&tid, &attr, sched_thread, sa) != 0)
+			{
+				fprintf (stderr, "Error: Unable to start %s\n", steps[i].ss_name);
+				steps[i].ss_state = SCHED_FAILED;
+				free (sa);
+				continue;
+			}
+
+			sc.sc_running++;
+		}
+
+		/*
+		 * A change may have settled a step earlier in the array
+		 */
+		if (changed == B_TRUE)
+			continue;
+
+		if (sc.sc_running == 0)
+			break;
+
+		(void) pthread_cond_wait (&sc.sc_cv, &sc.sc_lock);
+	}
+
+	(void) pthread_mutex_unlock (&sc.sc_lock);
+
+	for (i = 0; i < nsteps; i++)
+	{
+		if (steps[i].ss_state == SCHED_CANCELLED)
+			fprintf (stderr, "Cancelled %s\n", steps[i].ss_name);
+
+		if (steps[i].ss_state != SCHED_DONE)
+			ret = B_FALSE;
+	}
+
+	(void) pthread_attr_destroy (&attr);
+	(void) pthread_cond_destroy (&sc.sc_cv);
+	(void) pthread_mutex_destroy (&sc.sc_lock);
+
+	return ret;
+}
+
+/*
+ * Print how long each step took, followed by the critical path: the
+ * chain of steps, each waiting on the last, that decided the total time
+ */
+void
+sched_report (sched_step_t *steps, int nsteps)
+{
+	int i, j, last = -1, npath = 0, *path;
+	double end;
+
+	for (i = 0; i < nsteps; i++)
+	{
+		switch (steps[i].ss_state)
+		{
+			case SCHED_DONE:
+			case SCHED_FAILED:
+				printf ("\t%-20s %7.2fs%s\n", steps[i].ss_name, steps[i].ss_end - steps[i].ss_start,
+				    steps[i].ss_state == SCHED_FAILED ? " (failed)" : "");
+
+				if (last == -1 || steps[i].ss_end > steps[last].ss_end)
+					last = i;
+				break;
+			case SCHED_CANCELLED:
+				printf ("\t%-20s cancelled\n", steps[i].ss_name);
+				break;
+			default:
+				break;
+		}
+	}
+
+	if (last == -1 || (path = malloc (nsteps * sizeof (int))) == NULL)
+		return;
+
+	/*
+	 * Walk back from the last step to finish through whichever of its
+	 * dependencies finished last
+	 */
+	for (i = last; i != -1; )
+	{
+		path[npath++] = i;
+		last = -1;
+		end = 0;
+
+		for (j = 0; j < steps[i].ss_ndeps; j++)
+		{
+			if (steps[steps[i].ss_deps[j]].ss_end >= end)
+			{
+				end = steps[steps[i].ss_deps[j]].ss_end;
+				last = steps[i].ss_deps[j];
+			}
+		}
+
+		i = last;
+	}
+
+	printf ("Critical path (%.2fs):\n", steps[path[0]].ss_end);
+
+	while (--npath >= 0)
+	{
+		i = path[npath];
+		printf ("\t%-20s %7.2fs - %7.2fs\n", steps[i].ss_name, steps[i].ss_start, steps[i].ss_end);
+	}
+
+	free (path);
+}
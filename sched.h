@@ -0,0 +1,55 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+/*
+ * A step which can run as soon as the steps it depends on have finished
+ */
+#define SCHED_MAXDEPS	8
+
+typedef enum sched_state
+{
+	SCHED_WAITING,
+	SCHED_RUNNING,
+	SCHED_DONE,
+	SCHED_FAILED,
+	SCHED_CANCELLED
+} sched_state_t;
+
+typedef struct sched_step
+{
+	char *ss_name;
+	boolean_t (*ss_func) (void *arg);
+	void *ss_arg;
+	int ss_ndeps;
+	int ss_deps[SCHED_MAXDEPS];	/* indices of steps we wait for */
+	boolean_t ss_always;		/* run even if a dependency failed */
+
+	/* Filled in by sched_run */
+	sched_state_t ss_state;
+	double ss_start;
+	double ss_end;
+} sched_step_t;
+
+boolean_t sched_run (sched_step_t *steps, int nsteps);
+void sched_report (sched_step_t *steps, int nsteps);
@@ -0,0 +1,448 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <libzfs.h>
+
+#include "streams.h"
+#include "trace.h"
+
+typedef struct streams_job
+{
+	char *sj_path;
+	size_t sj_rel;			/* offset of the relative path */
+	struct stat sj_stat;
+} streams_job_t;
+
+typedef struct streams_change
+{
+	double sc_time;			/* seconds into the copy */
+	int sc_level;
+	double sc_rate;			/* bytes/s of the window that led to it */
+} streams_change_t;
+
+static int streams_min = STREAMS_MIN;
+static int streams_max = STREAMS_MAX;
+
+static streams_func_t streams_func;
+static pthread_t streams_tids[STREAMS_LIMIT];
+static pthread_t streams_controller;
+static int streams_nthreads;
+
+/*
+ * The queue, and what the threads are up to, under streams_lock
+ */
+static streams_job_t streams_queue[STREAMS_QUEUE];
+static int streams_head;
+static int streams_count;
+static int streams_busy;
+static int streams_level;
+static boolean_t streams_starved;	/* a thread had nothing to do this window */
+static boolean_t streams_failed;
+static boolean_t streams_stop;
+static uint64_t streams_bytes;		/* only touched with atomics */
+
+static pthread_mutex_t streams_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t streams_work_cv = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t streams_space_cv = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t streams_tick_cv = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t streams_idle_cv = PTHREAD_COND_INITIALIZER;
+
+static streams_change_t streams_history[STREAMS_HISTORY];
+static int streams_nchanges;
+static int streams_settled;
+static double streams_start;
+
+static double
+now (void)
+{
+	struct timespec ts;
+
+	(void) clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Limit how many streams the controller may use.  Equal bounds fix
+ * the number.
+ */
+boolean_t
+streams_bounds (int min, int max)
+{
+	if (min < 1 || max < min || max > STREAMS_LIMIT)
+	{
+		fprintf (stderr, "Error: copy streams must be between 1 and %d\n", STREAMS_LIMIT);
+		return B_FALSE;
+	}
+
+	streams_min = min;
+	streams_max = max;
+
+	return B_TRUE;
+}
+
+static void *
+streams_thread (void *arg)
+{
+	streams_job_t job;
+	boolean_t ok;
+
+	(void) pthread_mutex_lock (&streams_lock);
+
+	for (;;)
+	{
+		while (streams_count == 0 || streams_busy >= streams_level)
+		{
+			/*
+			 * Pass the wakeup on so every thread gets to leave
+			 */
+			if (streams_count == 0 && streams_stop == B_TRUE)
+			{
+				(void) pthread_cond_signal (&streams_work_cv);
+				(void) pthread_mutex_unlock (&streams_lock);
+				return NULL;
+			}
+
+			if (streams_count == 0 && streams_busy < streams_level)
+				streams_starved = B_TRUE;
+
+			(void) pthread_cond_wait (&streams_work_cv, &streams_lock);
+		}
+
+		job = streams_queue[streams_head];
+		streams_head = (streams_head + 1) % STREAMS_QUEUE;
+		streams_count--;
+		streams_busy++;
+		(void) pthread_cond_signal (&streams_space_cv);
+
+		/*
+		 * Once a copy has failed the rest are thrown away
+		 */
+		if (streams_failed == B_FALSE)
+		{
+			(void) pthread_mutex_unlock (&streams_lock);
+			ok = streams_func (job.sj_path, job.sj_path + job.sj_rel, &job.sj_stat);
+			(void) pthread_mutex_lock (&streams_lock);
+
+			if (ok == B_FALSE)
+			{
+				streams_failed = B_TRUE;
+				(void) pthread_cond_broadcast (&streams_space_cv);
+			}
+		}
+
+		free (job.sj_path);
+
+		if (--streams_busy == 0 && streams_count == 0)
+			(void) pthread_cond_broadcast (&streams_idle_cv);
+
+		/*
+		 * A thread held back by the level may go now
+		 */
+		(void) pthread_cond_signal (&streams_work_cv);
+	}
+}
+
+/*
+ * Count bytes as they're written, so that a big file shows up in the
+ * windows it's copied in rather than all at once when it's done.  Every
+ * copy thread calls this for each chunk, so it stays off streams_lock.
+ */
+void
+streams_wrote (uint64_t bytes)
+{
+	(void) __sync_add_and_fetch (&streams_bytes, bytes);
+}
+
+/*
+ * Trace how long the current level lasted
+ */
+static void
+trace_level (double *span)
+{
+	char name[32];
+
+	(void) snprintf (name, sizeof (name), "%d streams", streams_level);
+	trace_end ("streams", name, *span);
+	*span = trace_start ();
+}
+
+static void
+set_level (int level, double rate, double *span)
+{
+	if (level == streams_level)
+		return;
+
+	trace_level (span);
+	streams_level = level;
+	(void) pthread_cond_broadcast (&streams_work_cv);
+
+	if (streams_nchanges < STREAMS_HISTORY)
+	{
+		streams_history[streams_nchanges].sc_time = now () - streams_start;
+		streams_history[streams_nchanges].sc_level = level;
+		streams_history[streams_nchanges].sc_rate = rate;
+		streams_nchanges++;
+	}
+}
+
+/*
+ * Hill-climb: keep stepping the same way while throughput improves and
+ * turn round when it drops.  When it hardly changes fewer streams are
+ * as good, so step down.  Each level is measured over STREAMS_SAMPLES
+ * windows so that one slow window doesn't turn the climb round.  A
+ * window in which a thread went without work says nothing about the
+ * level, so the measurement starts again after it.
+ */
+static void *
+controller_thread (void *arg)
+{
+	struct timespec deadline;
+	uint64_t bytes, last_bytes = 0;
+	double t, last = now (), rate, last_rate = -1, span = trace_start ();
+	int dir = 1, level, nwindows = 0;
+
+	(void) pthread_mutex_lock (&streams_lock);
+
+	while (streams_stop == B_FALSE)
+	{
+		(void) clock_gettime (CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += STREAMS_WINDOW * 1000000L;
+		deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+		deadline.tv_nsec %= 1000000000L;
+
+		if (pthread_cond_timedwait (&streams_tick_cv, &streams_lock, &deadline) == 0)
+			continue;
+
+		if (streams_starved == B_TRUE)
+		{
+			streams_starved = B_FALSE;
+			last = now ();
+			last_bytes = __sync_add_and_fetch (&streams_bytes, 0);
+			last_rate = -1;
+			nwindows = 0;
+			continue;
+		}
+
+		if (++nwindows < STREAMS_SAMPLES)
+			continue;
+
+		t = now ();
+		bytes = __sync_add_and_fetch (&streams_bytes, 0);
+		rate = (bytes - last_bytes) / (t - last);
+		last = t;
+		last_bytes = bytes;
+		nwindows = 0;
+
+		if (last_rate >= 0)
+		{
+			if (rate < last_rate * (1 - STREAMS_TOLERANCE))
+				dir = -dir;
+			else if (rate <= last_rate * (1 + STREAMS_TOLERANCE))
+				dir = -1;
+		}
+
+		last_rate = rate;
+
+		if ((level = streams_level + dir) < streams_min || level > streams_max)
+		{
+			dir = -dir;
+			level = streams_level + dir;
+		}
+
+		if (level >= streams_min && level <= streams_max)
+			set_level (level, rate, &span);
+	}
+
+	trace_level (&span);
+	(void) pthread_mutex_unlock (&streams_lock);
+
+	return NULL;
+}
+
+/*
+ * Start the threads and the controller.  Returns B_FALSE if they can't
+ * be started, in which case the caller copies by itself.
+ */
+boolean_t
+streams_init (streams_func_t func)
+{
+	int i;
+
+	streams_func = func;
+	streams_head = streams_count = streams_busy = 0;
+	streams_level = streams_min > STREAMS_START ? streams_min :
+	    streams_max < STREAMS_START ? streams_max : STREAMS_START;
+	streams_starved = streams_failed = streams_stop = B_FALSE;
+	streams_bytes = 0;
+	streams_nchanges = 0;
+	streams_start = now ();
+
+	for (streams_nthreads = 0; streams_nthreads < streams_max; streams_nthreads++)
+		if (pthread_create (&streams_tids[streams_nthreads], NULL, streams_thread, NULL) != 0)
+			break;
+
+	if (streams_nthreads < streams_max ||
+	    (streams_min < streams_max && pthread_create (&streams_controller, NULL, controller_thread, NULL) != 0))
+	{
+		fprintf (stderr, "Warning: Unable to start copy streams, copying one file at a time\n");
+		(void) pthread_mutex_lock (&streams_lock);
+		streams_stop = B_TRUE;
+		(void) pthread_cond_broadcast (&streams_work_cv);
+		(void) pthread_mutex_unlock (&streams_lock);
+
+		for (i = 0; i < streams_nthreads; i++)
+			(void) pthread_join (streams_tids[i], NULL);
+
+		streams_nthreads = 0;
+		return B_FALSE;
+	}
+
+	return B_TRUE;
+}
+
+/*
+ * Queue a file for copying, waiting for room.  Returns B_FALSE once a
+ * copy has failed.
+ */
+boolean_t
+streams_submit (const char *path, const char *rel, const struct stat *statptr)
+{
+	streams_job_t *job;
+	char *copy;
+
+	if ((copy = strdup (path)) == NULL)
+	{
+		fprintf (stderr, "Error: out of memory\n");
+		return B_FALSE;
+	}
+
+	(void) pthread_mutex_lock (&streams_lock);
+
+	while (streams_count == STREAMS_QUEUE && streams_failed == B_FALSE)
+		(void) pthread_cond_wait (&streams_space_cv, &streams_lock);
+
+	if (streams_failed == B_TRUE)
+	{
+		(void) pthread_mutex_unlock (&streams_lock);
+		free (copy);
+		return B_FALSE;
+	}
+
+	job = &streams_queue[(streams_head + streams_count) % STREAMS_QUEUE];
+	job->sj_path = copy;
+	job->sj_rel = rel - path;
+	job->sj_stat = *statptr;
+	streams_count++;
+
+	(void) pthread_cond_signal (&streams_work_cv);
+	(void) pthread_mutex_unlock (&streams_lock);
+
+	return B_TRUE;
+}
+
+/*
+ * Wait for everything queued so far to be copied.  Returns B_FALSE if
+ * any copy failed.
+ */
+boolean_t
+streams_drain (void)
+{
+	(void) pthread_mutex_lock (&streams_lock);
+
+	while (streams_count > 0 || streams_busy > 0)
+		(void) pthread_cond_wait (&streams_idle_cv, &streams_lock);
+
+	(void) pthread_mutex_unlock (&streams_lock);
+
+	return streams_failed == B_TRUE ? B_FALSE : B_TRUE;
+}
+
+/*
+ * Wait for the queue to empty and stop everything.  Returns B_FALSE if
+ * any copy failed.
+ */
+boolean_t
+streams_fini (void)
+{
+	int i;
+
+	(void) pthread_mutex_lock (&streams_lock);
+
+	/*
+	 * The controller carries on until the queue has been copied
+	 */
+	while (streams_count > 0 || streams_busy > 0)
+		(void) pthread_cond_wait (&streams_idle_cv, &streams_lock);
+
+	streams_stop = B_TRUE;
+	streams_settled = streams_level;
+	(void) pthread_cond_broadcast (&streams_work_cv);
+	(void) pthread_cond_signal (&streams_tick_cv);
+	(void) pthread_mutex_unlock (&streams_lock);
+
+	for (i = 0; i < streams_nthreads; i++)
+		(void) pthread_join (streams_tids[i], NULL);
+
+	if (streams_min < streams_max)
+		(void) pthread_join (streams_controller, NULL);
+
+	return streams_failed == B_TRUE ? B_FALSE : B_TRUE;
+}
+
+/*
+ * Say where the level went
+ */
+void
+streams_report (void)
+{
+	int i;
+	streams_change_t *sc;
+
+	if (streams_nthreads == 0)
+		return;
+
+	if (streams_nchanges == 0)
+	{
+		printf ("Copy streams: %d-%d, stayed at %d\n", streams_min, streams_max, streams_settled);
+		return;
+	}
+
+	printf ("Copy streams: %d-%d, settled on %d after %d changes\n", streams_min, streams_max,
+	    streams_settled, streams_nchanges);
+
+	for (i = 0; i < streams_nchanges; i++)
+	{
+		sc = &streams_history[i];
+		printf ("\t%7.2fs  %2d streams  (%.1f MB/s)\n", sc->sc_time, sc->sc_level, sc->sc_rate / (1024 * 1024));
+	}
+
+	if (streams_nchanges == STREAMS_HISTORY)
+		printf ("\t...\n");
+}
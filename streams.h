@@ -0,0 +1,52 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+/*
+ * Parallel copy streams.  Files handed to streams_submit are copied by
+ * a pool of threads, no more of which than the current level may be
+ * busy at once.  The throughput over every STREAMS_SAMPLES windows of
+ * STREAMS_WINDOW is compared with that of the ones before, counting
+ * bytes as streams_wrote is told of them, and the level climbs towards
+ * whichever number of streams copies fastest, between the bounds from
+ * streams_bounds.
+ */
+#define STREAMS_LIMIT		64
+#define STREAMS_MIN		1
+#define STREAMS_MAX		16
+#define STREAMS_START		4
+#define STREAMS_WINDOW		250	/* milliseconds */
+#define STREAMS_SAMPLES		3	/* windows measured at each level */
+#define STREAMS_TOLERANCE	0.05	/* smaller changes in throughput are noise */
+#define STREAMS_QUEUE		256
+#define STREAMS_HISTORY		256
+
+typedef boolean_t (*streams_func_t) (const char *path, const char *rel, const struct stat *statptr);
+
+boolean_t streams_bounds (int min, int max);
+boolean_t streams_init (streams_func_t func);
+boolean_t streams_submit (const char *path, const char *rel, const struct stat *statptr);
+void streams_wrote (uint64_t bytes);
+boolean_t streams_drain (void);
+boolean_t streams_fini (void);
+void streams_report (void);
@@ -0,0 +1,490 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+/*
+ * Stand-in backend: disk ioctls plus libadm's VTOC and libefi's GPT
+ * routines, all working on an image file or a Linux block device.
+ * Sectors are always 512 bytes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <linux/falloc.h>
+#endif
+#include <zlib.h>
+#include <sys/dkio.h>
+#include <sys/vtoc.h>
+#include <sys/efi_partition.h>
+
+#define	SECTOR_SIZE	512
+#define	MBR_TABLE	446
+#define	MBR_ENTRY	16
+#define	MBR_SOLARIS	0xbf
+#define	MBR_PROTECTIVE	0xee
+
+#define	DK_LABEL_LOC	1	/* VTOC sector in the fdisk partition */
+#define	P0_PARTITION	16	/* what read_extvtoc reports for p0 */
+
+#define	GPT_SIGNATURE	"EFI PART"
+#define	GPT_REVISION	0x00010000
+#define	GPT_HEADER_SIZE	92
+#define	GPT_ENTRIES	128
+#define	GPT_ENTRY_SIZE	128
+#define	GPT_ARRAY_SECTORS	(GPT_ENTRIES * GPT_ENTRY_SIZE / SECTOR_SIZE)
+
+/*
+ * The size of an image file or block device in sectors, along with the
+ * physical sector size
+ */
+static int
+media_info (int fd, uint64_t *nblocks, unsigned int *pbsize)
+{
+	struct stat st;
+
+	if (fstat (fd, &st) == -1)
+		return -1;
+
+	*pbsize = SECTOR_SIZE;
+
+#ifdef BLKGETSIZE64
+	if (S_ISBLK (st.st_mode))
+	{
+		uint64_t size;
+		int phys;
+
+		if ((ioctl) (fd, BLKGETSIZE64, &size) == -1)
+			return -1;
+
+		if ((ioctl) (fd, BLKPBSZGET, &phys) == 0 && phys > SECTOR_SIZE)
+			*pbsize = phys;
+
+		*nblocks = size / SECTOR_SIZE;
+		return 0;
+	}
+#endif
+
+	if (!S_ISREG (st.st_mode))
+	{
+		errno = ENOTTY;
+		return -1;
+	}
+
+	*nblocks = st.st_size / SECTOR_SIZE;
+	return 0;
+}
+
+/*
+ * Discard extents by punching holes in the image
+ */
+static int
+free_extents (int fd, dkioc_free_list_t *dfl)
+{
+#ifdef FALLOC_FL_PUNCH_HOLE
+	uint64_t i;
+
+	for (i = 0; i < dfl->dfl_num_exts; i++)
+	{
+		if (fallocate (fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		    dfl->dfl_offset + dfl->dfl_exts[i].dfle_start, dfl->dfl_exts[i].dfle_length) == -1)
+		{
+			if (errno == EOPNOTSUPP)
+				errno = ENOTSUP;
+
+			return -1;
+		}
+	}
+
+	return 0;
+#else
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+int
+stub_ioctl (int fd, unsigned long request, void *arg)
+{
+	uint64_t nblocks, ncyl;
+	unsigned int pbsize;
+
+	switch (request)
+	{
+		case DKIOCGMEDIAINFO:
+		case DKIOCGMEDIAINFOEXT:
+		{
+			struct dk_minfo_ext *minfo = arg;
+
+			if (media_info (fd, &nblocks, &pbsize) == -1)
+				return -1;
+
+			minfo->dki_media_type = 0;
+			minfo->dki_lbsize = SECTOR_SIZE;
+			minfo->dki_capacity = nblocks;
+
+			if (request == DKIOCGMEDIAINFOEXT)
+				minfo->dki_pbsize = pbsize;
+
+			return 0;
+		}
+		case DKIOCGGEOM:
+		{
+			struct dk_geom *geo = arg;
+
+			if (media_info (fd, &nblocks, &pbsize) == -1)
+				return -1;
+
+			/*
+			 * The usual fake geometry, capped at what fits
+			 */
+			ncyl = nblocks / (255 * 63);
+
+			if (ncyl > 65535)
+				ncyl = 65535;
+
+			(void) memset (geo, 0, sizeof (struct dk_geom));
+			geo->dkg_ncyl = geo->dkg_pcyl = ncyl;
+			geo->dkg_nhead = 255;
+			geo->dkg_nsect = 63;
+			geo->dkg_intrlv = 1;
+			geo->dkg_rpm = 7200;
+
+			return 0;
+		}
+		case DKIOCFREE:
+			return free_extents (fd, arg);
+		case DKIOCFLUSHWRITECACHE:
+			return fdatasync (fd);
+		default:
+			return (ioctl) (fd, request, arg);
+	}
+}
+
+static uint32_t
+get_le32 (const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void
+put_le16 (unsigned char *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void
+put_le32 (unsigned char *p, uint32_t v)
+{
+	put_le16 (p, v);
+	put_le16 (p + 2, v >> 16);
+}
+
+static void
+put_le64 (unsigned char *p, uint64_t v)
+{
+	put_le32 (p, v);
+	put_le32 (p + 4, v >> 32);
+}
+
+/*
+ * Find the Solaris fdisk partition
+ */
+static int
+solaris_partition (int fd, uint64_t *start, uint64_t *size)
+{
+	int i;
+	unsigned char mbr[SECTOR_SIZE], *entry;
+
+	if (pread (fd, mbr, SECTOR_SIZE, 0) != SECTOR_SIZE)
+		return VT_EIO;
+
+	if (mbr[510] != 0x55 || mbr[511] != 0xaa)
+		return VT_EINVAL;
+
+	for (i = 0; i < 4; i++)
+	{
+		entry = mbr + MBR_TABLE + i * MBR_ENTRY;
+
+		if (entry[4] == MBR_PROTECTIVE)
+			return VT_ENOTSUP;
+
+		if (entry[4] == MBR_SOLARIS)
+		{
+			*start = get_le32 (entry + 8);
+			*size = get_le32 (entry + 12);
+			return 0;
+		}
+	}
+
+	return VT_EINVAL;
+}
+
+/*
+ * The label is kept in its in-memory form, which takes a couple of
+ * sectors; GRUB's stage2 doesn't start until sector 50.
+ */
+#define	VTOC_SECTORS	((sizeof (struct extvtoc) + SECTOR_SIZE - 1) / SECTOR_SIZE)
+
+int
+read_extvtoc (int fd, struct extvtoc *vtoc)
+{
+	int ret;
+	uint64_t start, size;
+	unsigned char buf[VTOC_SECTORS * SECTOR_SIZE];
+
+	if ((ret = solaris_partition (fd, &start, &size)) != 0)
+		return ret;
+
+	if (pread (fd, buf, sizeof (buf), (start + DK_LABEL_LOC) * SECTOR_SIZE) != sizeof (buf))
+		return VT_EIO;
+
+	(void) memcpy (vtoc, buf, sizeof (struct extvtoc));
+
+	/*
+	 * Like the disk driver, make up a label for a partition without one
+	 */
+	if (vtoc->v_sanity != VTOC_SANE)
+	{
+		(void) memset (vtoc, 0, sizeof (struct extvtoc));
+		vtoc->v_sanity = VTOC_SANE;
+		vtoc->v_version = V_VERSION;
+		vtoc->v_sectorsz = SECTOR_SIZE;
+		vtoc->v_nparts = V_NUMPAR;
+		vtoc->v_part[2].p_tag = V_BACKUP;
+		vtoc->v_part[2].p_flag = V_UNMNT;
+		vtoc->v_part[2].p_size = size;
+	}
+
+	return P0_PARTITION;
+}
+
+int
+write_extvtoc (int fd, struct extvtoc *vtoc)
+{
+	int ret;
+	uint64_t start, size;
+	unsigned char buf[VTOC_SECTORS * SECTOR_SIZE];
+
+	if ((ret = solaris_partition (fd, &start, &size)) != 0)
+		return ret;
+
+	if (vtoc->v_sanity != VTOC_SANE || vtoc->v_nparts > V_NUMPAR)
+		return VT_EINVAL;
+
+	(void) memset (buf, 0, sizeof (buf));
+	(void) memcpy (buf, vtoc, sizeof (struct extvtoc));
+
+	if (pwrite (fd, buf, sizeof (buf), (start + DK_LABEL_LOC) * SECTOR_SIZE) != sizeof (buf))
+		return VT_EIO;
+
+	return P0_PARTITION;
+}
+
+/*
+ * Partition type GUIDs, in the same order as the fields of a uuid
+ */
+static const struct
+{
+	unsigned short tag;
+	uint32_t time_low;
+	uint16_t time_mid;
+	uint16_t time_hi;
+	unsigned char rest[8];
+} efi_types[] =
+{
+	{ V_BOOT, 0x6a82cb45, 0x1dd2, 0x11b2, { 0x99, 0xa6, 0x08, 0x00, 0x20, 0x73, 0x66, 0x31 } },
+	{ V_ROOT, 0x6a85cf4d, 0x1dd2, 0x11b2, { 0x99, 0xa6, 0x08, 0x00, 0x20, 0x73, 0x66, 0x31 } },
+	{ V_USR, 0x6a898cc3, 0x1dd2, 0x11b2, { 0x99, 0xa6, 0x08, 0x00, 0x20, 0x73, 0x66, 0x31 } },
+	{ V_RESERVED, 0x6a945a3b, 0x1dd2, 0x11b2, { 0x99, 0xa6, 0x08, 0x00, 0x20, 0x73, 0x66, 0x31 } }
+};
+
+static void
+put_type_guid (unsigned char *p, unsigned short tag)
+{
+	int i;
+
+	for (i = 0; i < sizeof (efi_types) / sizeof (efi_types[0]); i++)
+	{
+		if (efi_types[i].tag == tag)
+		{
+			put_le32 (p, efi_types[i].time_low);
+			put_le16 (p + 4, efi_types[i].time_mid);
+			put_le16 (p + 6, efi_types[i].time_hi);
+			(void) memcpy (p + 8, efi_types[i].rest, 8);
+			return;
+		}
+	}
+}
+
+/*
+ * A random (version 4) GUID
+ */
+static void
+put_random_guid (unsigned char *p)
+{
+	int i;
+
+	for (i = 0; i < 16; i++)
+		p[i] = random ();
+
+	p[7] = (p[7] & 0x0f) | 0x40;
+	p[8] = (p[8] & 0x3f) | 0x80;
+}
+
+int
+efi_alloc_and_init (int fd, uint32_t nparts, struct dk_gpt **vtoc)
+{
+	uint64_t nblocks;
+	unsigned int pbsize;
+	struct dk_gpt *gpt;
+
+	if (media_info (fd, &nblocks, &pbsize) == -1)
+		return -1;
+
+	if (nparts == 0 || nparts > GPT_ENTRIES || nblocks < 2 * (GPT_ARRAY_SECTORS + 2))
+		return -1;
+
+	if ((gpt = calloc (1, sizeof (struct dk_gpt) + (nparts - 1) * sizeof (struct dk_part))) == NULL)
+		return -1;
+
+	gpt->efi_version = GPT_REVISION;
+	gpt->efi_nparts = nparts;
+	gpt->efi_part_size = GPT_ENTRY_SIZE;
+	gpt->efi_lbasize = SECTOR_SIZE;
+	gpt->efi_last_lba = nblocks - 1;
+	gpt->efi_first_u_lba = GPT_ARRAY_SECTORS + 2;
+	gpt->efi_last_u_lba = nblocks - GPT_ARRAY_SECTORS - 2;
+	gpt->efi_altern_lba = nblocks - 1;
+
+	*vtoc = gpt;
+	return 0;
+}
+
+void
+efi_free (struct dk_gpt *vtoc)
+{
+	free (vtoc);
+}
+
+/*
+ * Write one copy of the GPT header
+ */
+static int
+write_gpt_header (int fd, struct dk_gpt *vtoc, unsigned char *guid, uint64_t lba, uint64_t alt_lba,
+    uint64_t array_lba, uint32_t array_crc)
+{
+	unsigned char hdr[SECTOR_SIZE];
+
+	(void) memset (hdr, 0, SECTOR_SIZE);
+	(void) memcpy (hdr, GPT_SIGNATURE, 8);
+	put_le32 (hdr + 8, GPT_REVISION);
+	put_le32 (hdr + 12, GPT_HEADER_SIZE);
+	put_le64 (hdr + 24, lba);
+	put_le64 (hdr + 32, alt_lba);
+	put_le64 (hdr + 40, vtoc->efi_first_u_lba);
+	put_le64 (hdr + 48, vtoc->efi_last_u_lba);
+	(void) memcpy (hdr + 56, guid, 16);
+	put_le64 (hdr + 72, array_lba);
+	put_le32 (hdr + 80, GPT_ENTRIES);
+	put_le32 (hdr + 84, GPT_ENTRY_SIZE);
+	put_le32 (hdr + 88, array_crc);
+	put_le32 (hdr + 16, crc32 (0, hdr, GPT_HEADER_SIZE));
+
+	if (pwrite (fd, hdr, SECTOR_SIZE, lba * SECTOR_SIZE) != SECTOR_SIZE)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Write the protective MBR, both GPTs and their partition arrays
+ */
+int
+efi_write (int fd, struct dk_gpt *vtoc)
+{
+	int i;
+	uint32_t crc;
+	uint64_t nblocks = vtoc->efi_last_lba + 1;
+	unsigned char mbr[SECTOR_SIZE], array[GPT_ENTRIES * GPT_ENTRY_SIZE], guid[16], *entry;
+	struct dk_part *part;
+
+	(void) memset (array, 0, sizeof (array));
+
+	for (i = 0; i < vtoc->efi_nparts; i++)
+	{
+		part = &vtoc->efi_parts[i];
+
+		if (part->p_tag == V_UNASSIGNED)
+			continue;
+
+		if (part->p_start < vtoc->efi_first_u_lba || part->p_size == 0
+		    || part->p_start + part->p_size - 1 > vtoc->efi_last_u_lba)
+			return VT_EINVAL;
+
+		entry = array + i * GPT_ENTRY_SIZE;
+		put_type_guid (entry, part->p_tag);
+		put_random_guid (entry + 16);
+		put_le64 (entry + 32, part->p_start);
+		put_le64 (entry + 40, part->p_start + part->p_size - 1);
+	}
+
+	crc = crc32 (0, array, sizeof (array));
+	put_random_guid (guid);
+
+	if (pwrite (fd, array, sizeof (array), 2 * SECTOR_SIZE) != sizeof (array)
+	    || pwrite (fd, array, sizeof (array), (nblocks - 1 - GPT_ARRAY_SECTORS) * SECTOR_SIZE) != sizeof (array))
+		return VT_EIO;
+
+	if (write_gpt_header (fd, vtoc, guid, 1, nblocks - 1, 2, crc) == -1
+	    || write_gpt_header (fd, vtoc, guid, nblocks - 1, 1, nblocks - 1 - GPT_ARRAY_SECTORS, crc) == -1)
+		return VT_EIO;
+
+	/*
+	 * A single partition covering the disk, keeping any boot code
+	 */
+	if (pread (fd, mbr, SECTOR_SIZE, 0) != SECTOR_SIZE)
+		return VT_EIO;
+
+	(void) memset (mbr + MBR_TABLE, 0, SECTOR_SIZE - MBR_TABLE);
+	entry = mbr + MBR_TABLE;
+	entry[2] = 0x02;
+	entry[4] = MBR_PROTECTIVE;
+	entry[5] = entry[6] = entry[7] = 0xff;
+	put_le32 (entry + 8, 1);
+	put_le32 (entry + 12, nblocks - 1 > 0xffffffffULL ? 0xffffffff : nblocks - 1);
+	mbr[510] = 0x55;
+	mbr[511] = 0xaa;
+
+	if (pwrite (fd, mbr, SECTOR_SIZE, 0) != SECTOR_SIZE || fsync (fd) == -1)
+		return VT_EIO;
+
+	return 0;
+}
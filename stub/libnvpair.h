@@ -0,0 +1,71 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+/*
+ * Stand-in backend: the parts of libnvpair the installer uses
+ */
+#ifndef _LIBNVPAIR_H
+#define	_LIBNVPAIR_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef enum data_type
+{
+	DATA_TYPE_UNKNOWN,
+	DATA_TYPE_BOOLEAN,
+	DATA_TYPE_STRING,
+	DATA_TYPE_UINT64,
+	DATA_TYPE_UINT64_ARRAY,
+	DATA_TYPE_NVLIST_ARRAY
+} data_type_t;
+
+typedef struct nvpair nvpair_t;
+typedef struct nvlist nvlist_t;
+
+#define	NV_UNIQUE_NAME	0x1
+#define	NV_ENCODE_XDR	1
+
+int nvlist_alloc (nvlist_t **nvlp, uint_t flag, int kmflag);
+void nvlist_free (nvlist_t *nvl);
+int nvlist_dup (nvlist_t *nvl, nvlist_t **nvlp, int kmflag);
+int nvlist_merge (nvlist_t *dst, nvlist_t *src, int flag);
+int nvlist_add_boolean (nvlist_t *nvl, const char *name);
+int nvlist_add_string (nvlist_t *nvl, const char *name, const char *val);
+int nvlist_add_uint64 (nvlist_t *nvl, const char *name, uint64_t val);
+int nvlist_add_uint64_array (nvlist_t *nvl, const char *name, uint64_t *val, uint_t nelem);
+int nvlist_add_nvlist_array (nvlist_t *nvl, const char *name, nvlist_t **val, uint_t nelem);
+int nvlist_lookup_string (nvlist_t *nvl, const char *name, char **val);
+int nvlist_lookup_uint64 (nvlist_t *nvl, const char *name, uint64_t *val);
+int nvlist_lookup_nvlist_array (nvlist_t *nvl, const char *name, nvlist_t ***val, uint_t *nelem);
+int nvlist_pack (nvlist_t *nvl, char **bufp, size_t *buflen, int encoding, int kmflag);
+nvpair_t *nvlist_next_nvpair (nvlist_t *nvl, nvpair_t *nvp);
+char *nvpair_name (nvpair_t *nvp);
+data_type_t nvpair_type (nvpair_t *nvp);
+int nvpair_value_string (nvpair_t *nvp, char **val);
+int nvpair_value_uint64 (nvpair_t *nvp, uint64_t *val);
+
+#endif
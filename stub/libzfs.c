@@ -0,0 +1,1228 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+/*
+ * Stand-in backend: pool and dataset bookkeeping for libzfs and
+ * libzfs_core.  "Mounting" makes the mountpoint directory.  Snapshots
+ * of mounted datasets are hard links to their files under .zfs, and
+ * clones and rollbacks link them back.  If
+ * STUB_ZFS_STATE names a file the bookkeeping is kept there between
+ * runs, so an upgrade can find the pool an earlier install left.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <libzfs.h>
+#include <libzfs_core.h>
+
+typedef struct stub_dataset
+{
+	char sd_name[ZFS_MAXNAMELEN];
+	char sd_mountpoint[PATH_MAX];	/* empty if inherited */
+	boolean_t sd_mounted;
+	boolean_t sd_noauto;		/* canmount=noauto or off */
+	struct stub_dataset *sd_next;
+} stub_dataset_t;
+
+typedef struct stub_pool
+{
+	char sp_name[ZPOOL_MAXNAMELEN];
+	char sp_altroot[PATH_MAX];
+	char sp_bootfs[ZFS_MAXNAMELEN];
+	stub_dataset_t *sp_datasets;	/* parents before children */
+	struct stub_pool *sp_next;
+} stub_pool_t;
+
+struct libzfs_handle
+{
+	int lh_refs;
+};
+
+struct zpool_handle
+{
+	char zph_name[ZPOOL_MAXNAMELEN];
+};
+
+struct zfs_handle
+{
+	char zh_name[ZFS_MAXNAMELEN];
+};
+
+/*
+ * libzfs_core has no handle, so neither does the state
+ */
+static stub_pool_t *stub_pools;
+static boolean_t stub_loaded = B_FALSE;
+static pthread_mutex_t stub_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Read back the state file, one tab separated line per pool and per
+ * dataset, datasets following their pool
+ */
+static void
+stub_load (void)
+{
+	FILE *fp;
+	char *file, line[3 * PATH_MAX], *p, *field[5];
+	stub_pool_t *sp = NULL, **ptail = &stub_pools;
+	stub_dataset_t *sd, **dtail = NULL;
+	int i;
+
+	(void) pthread_mutex_lock (&stub_lock);
+
+	if (stub_loaded == B_TRUE || (file = getenv ("STUB_ZFS_STATE")) == NULL
+	    || (fp = fopen (file, "r")) == NULL)
+	{
+		stub_loaded = B_TRUE;
+		(void) pthread_mutex_unlock (&stub_lock);
+		return;
+	}
+
+	stub_loaded = B_TRUE;
+
+	while (fgets (line, sizeof (line), fp) != NULL)
+	{
+		line[strcspn (line, "\n")] = '\0';
+
+		for (i = 0, p = line; i < 5; i++)
+			field[i] = p != NULL ? strsep (&p, "\t") : "";
+
+		if (strcmp (field[0], "pool") == 0 && (sp = calloc (1, sizeof (stub_pool_t))) != NULL)
+		{
+			(void) snprintf (sp->sp_name, ZPOOL_MAXNAMELEN, "%s", field[1]);
+			(void) snprintf (sp->sp_altroot, PATH_MAX, "%s", field[2]);
+			(void) snprintf (sp->sp_bootfs, ZFS_MAXNAMELEN, "%s", field[3]);
+			*ptail = sp;
+			ptail = &sp->sp_next;
+			dtail = &sp->sp_datasets;
+		}
+		else if (strcmp (field[0], "dataset") == 0 && dtail != NULL
+		    && (sd = calloc (1, sizeof (stub_dataset_t))) != NULL)
+		{
+			(void) snprintf (sd->sd_name, ZFS_MAXNAMELEN, "%s", field[1]);
+			sd->sd_mounted = atoi (field[2]) ? B_TRUE : B_FALSE;
+			sd->sd_noauto = atoi (field[3]) ? B_TRUE : B_FALSE;
+			(void) snprintf (sd->sd_mountpoint, PATH_MAX, "%s", field[4]);
+			*dtail = sd;
+			dtail = &sd->sd_next;
+		}
+	}
+
+	(void) fclose (fp);
+	(void) pthread_mutex_unlock (&stub_lock);
+}
+
+/*
+ * Write the state file after every change; called with stub_lock held
+ */
+static void
+stub_save (void)
+{
+	FILE *fp;
+	char *file, tmp[PATH_MAX];
+	stub_pool_t *sp;
+	stub_dataset_t *sd;
+
+	if ((file = getenv ("STUB_ZFS_STATE")) == NULL)
+		return;
+
+	(void) snprintf (tmp, PATH_MAX, "%s.tmp", file);
+
+	if ((fp = fopen (tmp, "w")) == NULL)
+	{
+		fprintf (stderr, "stub: unable to write %s: %s\n", tmp, strerror (errno));
+		return;
+	}
+
+	for (sp = stub_pools; sp != NULL; sp = sp->sp_next)
+	{
+		fprintf (fp, "pool\t%s\t%s\t%s\n", sp->sp_name, sp->sp_altroot, sp->sp_bootfs);
+
+		for (sd = sp->sp_datasets; sd != NULL; sd = sd->sd_next)
+			fprintf (fp, "dataset\t%s\t%d\t%d\t%s\n", sd->sd_name, sd->sd_mounted,
+			    sd->sd_noauto, sd->sd_mountpoint);
+	}
+
+	if (fclose (fp) != 0 || rename (tmp, file) == -1)
+		fprintf (stderr, "stub: unable to write %s: %s\n", file, strerror (errno));
+}
+
+libzfs_handle_t *
+libzfs_init (void)
+{
+	stub_load ();
+	return calloc (1, sizeof (libzfs_handle_t));
+}
+
+void
+libzfs_fini (libzfs_handle_t *hdl)
+{
+	free (hdl);
+}
+
+int
+libzfs_core_init (void)
+{
+	stub_load ();
+	return 0;
+}
+
+void
+libzfs_core_fini (void)
+{
+}
+
+/*
+ * mkdir -p
+ */
+static int
+make_dirs (char *path)
+{
+	char *p;
+
+	for (p = path + 1; (p = strchr (p, '/')) != NULL; p++)
+	{
+		*p = '\0';
+
+		if (mkdir (path, 0755) == -1 && errno != EEXIST)
+			return -1;
+
+		*p = '/';
+	}
+
+	if (mkdir (path, 0755) == -1 && errno != EEXIST)
+		return -1;
+
+	return 0;
+}
+
+static stub_pool_t *
+find_pool (const char *name)
+{
+	stub_pool_t *sp;
+	size_t len = strcspn (name, "/@");
+
+	for (sp = stub_pools; sp != NULL; sp = sp->sp_next)
+		if (strlen (sp->sp_name) == len && strncmp (sp->sp_name, name, len) == 0)
+			return sp;
+
+	return NULL;
+}
+
+static stub_dataset_t *
+find_dataset (const char *name)
+{
+	stub_pool_t *sp;
+	stub_dataset_t *sd;
+
+	if ((sp = find_pool (name)) == NULL)
+		return NULL;
+
+	for (sd = sp->sp_datasets; sd != NULL; sd = sd->sd_next)
+		if (strcmp (sd->sd_name, name) == 0)
+			return sd;
+
+	return NULL;
+}
+
+/*
+ * Work out where a dataset is mounted, relative to the altroot
+ */
+static void
+get_mountpoint (stub_pool_t *sp, const char *name, char *buf)
+{
+	stub_dataset_t *sd;
+	char parent[ZFS_MAXNAMELEN], *slash;
+
+	if ((sd = find_dataset (name)) != NULL && sd->sd_mountpoint[0] != '\0')
+	{
+		(void) strcpy (buf, sd->sd_mountpoint);
+		return;
+	}
+
+	(void) strcpy (parent, name);
+
+	if ((slash = strrchr (parent, '/')) == NULL)
+	{
+		(void) snprintf (buf, PATH_MAX, "/%s", name);
+		return;
+	}
+
+	*slash = '\0';
+	get_mountpoint (sp, parent, buf);
+
+	if (strcmp (buf, ZFS_MOUNTPOINT_LEGACY) == 0 || strcmp (buf, ZFS_MOUNTPOINT_NONE) == 0)
+		return;
+
+	if (strcmp (buf, "/") == 0)
+		buf[0] = '\0';
+
+	(void) strcat (buf, "/");
+	(void) strcat (buf, slash + 1);
+}
+
+/*
+ * Where a dataset's mountpoint is on this machine, or B_FALSE if it
+ * doesn't get mounted or the path won't fit
+ */
+static boolean_t
+host_path (stub_pool_t *sp, const char *name, char *buf)
+{
+	char mountpoint[PATH_MAX];
+
+	get_mountpoint (sp, name, mountpoint);
+
+	if (mountpoint[0] != '/')
+		return B_FALSE;
+
+	return snprintf (buf, PATH_MAX, "%s%s", sp->sp_altroot,
+	    strcmp (mountpoint, "/") == 0 && sp->sp_altroot[0] != '\0' ? "" : mountpoint) < PATH_MAX ? B_TRUE : B_FALSE;
+}
+
+/*
+ * Add a dataset whose parent already exists
+ */
+static int
+add_dataset (const char *name, nvlist_t *props)
+{
+	stub_pool_t *sp;
+	stub_dataset_t *sd, **tail;
+	char parent[ZFS_MAXNAMELEN], *mountpoint, *canmount, *slash;
+
+	if (strlen (name) >= ZFS_MAXNAMELEN)
+		return ENAMETOOLONG;
+
+	(void) pthread_mutex_lock (&stub_lock);
+
+	if ((sp = find_pool (name)) == NULL)
+	{
+		(void) pthread_mutex_unlock (&stub_lock);
+		return ENOENT;
+	}
+
+	if (find_dataset (name) != NULL)
+	{
+		(void) pthread_mutex_unlock (&stub_lock);
+		return EEXIST;
+	}
+
+	(void) strcpy (parent, name);
+
+	if ((slash = strchr (parent, '@')) != NULL || (slash = strrchr (parent, '/')) != NULL)
+	{
+		*slash = '\0';
+
+		if (find_dataset (parent) == NULL)
+		{
+			(void) pthread_mutex_unlock (&stub_lock);
+			return ENOENT;
+		}
+	}
+
+	if ((sd = calloc (1, sizeof (stub_dataset_t))) == NULL)
+	{
+		(void) pthread_mutex_unlock (&stub_lock);
+		return ENOMEM;
+	}
+
+	(void) strcpy (sd->sd_name, name);
+
+	if (nvlist_lookup_string (props, zfs_prop_to_name (ZFS_PROP_MOUNTPOINT), &mountpoint) == 0)
+		(void) snprintf (sd->sd_mountpoint, PATH_MAX, "%s", mountpoint);
+
+	if (nvlist_lookup_string (props, zfs_prop_to_name (ZFS_PROP_CANMOUNT), &canmount) == 0)
+		sd->sd_noauto = strcmp (canmount, "on") != 0 ? B_TRUE : B_FALSE;
+
+	for (tail = &sp->sp_datasets; *tail != NULL; tail = &(*tail)->sd_next)
+		;
+
+	*tail = sd;
+	stub_save ();
+
+	(void) pthread_mutex_unlock (&stub_lock);
+	return 0;
+}
+
+/*
+ * Whether a directory is where some dataset other than skip is mounted
+ */
+static boolean_t
+is_mountpoint (stub_pool_t *sp, const char *path, const char *skip)
+{
+	stub_dataset_t *sd;
+	char mountpoint[PATH_MAX];
+
+	for (sd = sp->sp_datasets; sd != NULL; sd = sd->sd_next)
+		if (strcmp (sd->sd_name, skip) != 0 && strchr (sd->sd_name, '@') == NULL &&
+		    host_path (sp, sd->sd_name, mountpoint) == B_TRUE && strcmp (mountpoint, path) == 0)
+			return B_TRUE;
+
+	return B_FALSE;
+}
+
+/*
+ * Hard link one dataset's tree into another, leaving out the datasets
+ * mounted inside it.  Like the blocks of a real clone the files are
+ * shared, so they must be replaced rather than rewritten in place.
+ */
+static int
+link_tree (stub_pool_t *sp, const char *origin, const char *src, const char *dst)
+{
+	DIR *dir;
+	struct dirent *de;
+	struct stat st;
+	char from[PATH_MAX], to[PATH_MAX];
+	int ret = 0;
+
+	if ((dir = opendir (src)) == NULL)
+		return -1;
+
+	while (ret == 0 && (de = readdir (dir)) != NULL)
+	{
+		if (strcmp (de->d_name, ".") == 0 || strcmp (de->d_name, "..") == 0 ||
+		    strcmp (de->d_name, ".zfs") == 0)
+			continue;
+
+		(void) snprintf (from, PATH_MAX, "%s/%s", src, de->d_name);
+		(void) snprintf (to, PATH_MAX, "%s/%s", dst, de->d_name);
+
+		if (lstat (from, &st) == -1)
+			ret = -1;
+		else if (!S_ISDIR (st.st_mode))
+			ret = link (from, to) == -1 && errno != EEXIST ? -1 : 0;
+		else if (is_mountpoint (sp, from, origin) == B_TRUE)
+			continue;
+		else if ((mkdir (to, st.st_mode & 07777) == -1 && errno != EEXIST) ||
+		    lchown (to, st.st_uid, st.st_gid) == -1)
+			ret = -1;
+		else
+			ret = link_tree (sp, origin, from, to);
+	}
+
+	(void) closedir (dir);
+	return ret;
+}
+
+/*
+ * Empty a dataset's directory, but for .zfs and the datasets mounted
+ * inside it
+ */
+static int
+clear_tree (stub_pool_t *sp, const char *name, const char *path)
+{
+	DIR *dir;
+	struct dirent *de;
+	struct stat st;
+	char child[PATH_MAX];
+	int ret = 0;
+
+	if ((dir = opendir (path)) == NULL)
+		return -1;
+
+	while (ret == 0 && (de = readdir (dir)) != NULL)
+	{
+		if (strcmp (de->d_name, ".") == 0 || strcmp (de->d_name, "..") == 0 ||
+		    strcmp (de->d_name, ".zfs") == 0)
+			continue;
+
+		(void) snprintf (child, PATH_MAX, "%s/%s", path, de->d_name);
+
+		if (lstat (child, &st) == -1)
+			ret = -1;
+		else if (!S_ISDIR (st.st_mode))
+			ret = unlink (child);
+		else if (is_mountpoint (sp, child, name) == B_TRUE)
+			continue;
+		else if ((ret = clear_tree (sp, name, child)) == 0 && rmdir (child) == -1 &&
+		    errno != ENOTEMPTY && errno != EEXIST)
+			ret = -1;
+	}
+
+	(void) closedir (dir);
+	return ret;
+}
+
+/*
+ * Where a snapshot's files are kept, as seen through .zfs
+ */
+static boolean_t
+snapshot_path (stub_pool_t *sp, const char *name, char *buf)
+{
+	char fs[ZFS_MAXNAMELEN], mountpoint[PATH_MAX], *at;
+
+	(void) strcpy (fs, name);
+
+	if ((at = strchr (fs, '@')) == NULL)
+		return B_FALSE;
+
+	*at = '\0';
+
+	if (host_path (sp, fs, mountpoint) == B_FALSE)
+		return B_FALSE;
+
+	return snprintf (buf, PATH_MAX, "%s/.zfs/snapshot/%s", mountpoint, at + 1) < PATH_MAX ? B_TRUE : B_FALSE;
+}
+
+/*
+ * Forget a snapshot and its files; called with stub_lock held
+ */
+static void
+drop_snapshot (stub_pool_t *sp, stub_dataset_t **prev)
+{
+	stub_dataset_t *sd = *prev;
+	char path[PATH_MAX];
+
+	if (snapshot_path (sp, sd->sd_name, path) == B_TRUE && clear_tree (sp, "", path) == 0)
+		(void) rmdir (path);
+
+	*prev = sd->sd_next;
+	free (sd);
+}
+
+int
+zpool_in_use (libzfs_handle_t *hdl, int fd, pool_state_t *state, char **name, boolean_t *inuse)
+{
+	*inuse = B_FALSE;
+	return 0;
+}
+
+int
+zpool_create (libzfs_handle_t *hdl, const char *pool, nvlist_t *nvroot, nvlist_t *props, nvlist_t *fsprops)
+{
+	stub_pool_t *sp;
+	nvlist_t **child;
+	uint_t nchild;
+	char *altroot;
+
+	if (nvlist_lookup_nvlist_array (nvroot, ZPOOL_CONFIG_CHILDREN, &child, &nchild) != 0 || nchild == 0)
+	{
+		fprintf (stderr, "stub: pool %s has no vdevs\n", pool);
+		return -1;
+	}
+
+	(void) pthread_mutex_lock (&stub_lock);
+
+	if (find_pool (pool) != NULL || strlen (pool) >= ZPOOL_MAXNAMELEN
+	    || (sp = calloc (1, sizeof (stub_pool_t))) == NULL)
+	{
+		(void) pthread_mutex_unlock (&stub_lock);
+		return -1;
+	}
+
+	(void) strcpy (sp->sp_name, pool);
+
+	if (nvlist_lookup_string (props, zpool_prop_to_name (ZPOOL_PROP_ALTROOT), &altroot) == 0)
+		(void) snprintf (sp->sp_altroot, PATH_MAX, "%s", altroot);
+
+	sp->sp_next = stub_pools;
+	stub_pools = sp;
+
+	(void) pthread_mutex_unlock (&stub_lock);
+
+	if (add_dataset (pool, fsprops) != 0)
+		return -1;
+
+	return 0;
+}
+
+zpool_handle_t *
+zpool_open (libzfs_handle_t *hdl, const char *pool)
+{
+	zpool_handle_t *zhp;
+
+	(void) pthread_mutex_lock (&stub_lock);
+
+	if (find_pool (pool) == NULL || (zhp = calloc (1, sizeof (zpool_handle_t))) == NULL)
+	{
+		(void) pthread_mutex_unlock (&stub_lock);
+		return NULL;
+	}
+
+	(void) pthread_mutex_unlock (&stub_lock);
+
+	(void) snprintf (zhp->zph_name, ZPOOL_MAXNAMELEN, "%s", pool);
+	return zhp;
+}
+
+void
+zpool_close (zpool_handle_t *zhp)
+{
+	free (zhp);
+}
+
+int
+zpool_export (zpool_handle_t *zhp, boolean_t force)
+{
+	stub_pool_t *sp, **prev;
+	stub_dataset_t *sd, *next;
+
+	(void) pthread_mutex_lock (&stub_lock);
+
+	for (prev = &stub_pools; (sp = *prev) != NULL; prev = &sp->sp_next)
+		if (strcmp (sp->sp_name, zhp->zph_name) == 0)
+			break;
+
+	if (sp == NULL)
+	{
+		(void) pthread_mutex_unlock (&stub_lock);
+		return -1;
+	}
+
+	*prev = sp->sp_next;
+	stub_save ();
+	(void) pthread_mutex_unlock (&stub_lock);
+
+	for (sd = sp->sp_datasets; sd != NULL; sd = next)
+	{
+		next = sd->sd_next;
+		free (sd);
+	}
+
+	free (sp);
+	return 0;
+}
+
+int
+zpool_set_prop (zpool_handle_t *zhp, const char *propname, const char *propval)
+{
+	stub_pool_t *sp;
+	int ret = -1;
+
+	(void) pthread_mutex_lock (&stub_lock);
+
+	if (strcmp (propname, zpool_prop_to_name (ZPOOL_PROP_BOOTFS)) == 0
+	    && (sp = find_pool (zhp->zph_name)) != NULL && find_dataset (propval) != NULL)
+	{
+		(void) snprintf (sp->sp_bootfs, ZFS_MAXNAMELEN, "%s", propval);
+		stub_save ();
+		ret = 0;
+	}
+
+	(void) pthread_mutex_unlock (&stub_lock);
+	return ret;
+}
+
+/*
+ * Unset properties read back as "-", as they do from zpool get
+ */
+int
+zpool_get_prop (zpool_handle_t *zhp, zpool_prop_t prop, char *buf, size_t len, zprop_source_t *srctype)
+{
+	stub_pool_t *sp;
+	const char *value;
+
+	(void) pthread_mutex_lock (&stub_lock);
+
+	if ((sp = find_pool (zhp->zph_name)) == NULL)
+	{
+		(void) pthread_mutex_unlock (&stub_lock);
+		return -1;
+	}
+
+	value = prop == ZPOOL_PROP_ALTROOT ? sp->sp_altroot : sp->sp_bootfs;
+	(void) snprintf (buf, len, "%s", value[0] != '\0' ? value : "-");
+
+	if (srctype != NULL)
+		*srctype = value[0] != '\0' ? ZPROP_SRC_LOCAL : ZPROP_SRC_DEFAULT;
+
+	(void) pthread_mutex_unlock (&stub_lock);
+	return 0;
+}
+
+int
+zpool_enable_datasets (zpool_handle_t *zhp, const char *mntopts, int flags)
+{
+	stub_pool_t *sp;
+	stub_dataset_t *sd;
+	char path[PATH_MAX];
+	int ret = 0;
+
+	(void) pthread_mutex_lock (&stub_lock);
+
+	if ((sp = find_pool (zhp->zph_name)) == NULL)
+	{
+		(void) pthread_mutex_unlock (&stub_lock);
+		return -1;
+	}
+
+	for (sd = sp->sp_datasets; sd != NULL; sd = sd->sd_next)
+	{
+		if (strchr (sd->sd_name, '@') != NULL || sd->sd_noauto == B_TRUE
+		    || host_path (sp, sd->sd_name, path) == B_FALSE)
+			continue;
+
+		if (make_dirs (path) == -1)
+		{
+			fprintf (stderr, "stub: unable to mount %s on %s: %s\n", sd->sd_name, path, strerror (errno));
+			ret = -1;
+			break;
+		}
+
+		sd->sd_mounted = B_TRUE;
+	}
+
+	stub_save ();
+	(void) pthread_mutex_unlock (&stub_lock);
+	return ret;
+}
+
+int
+zpool_disable_datasets (zpool_handle_t *zhp, boolean_t force)
+{
+	stub_pool_t *sp;
+	stub_dataset_t *sd;
+
+	(void) pthread_mutex_lock (&stub_lock);
+
+	if ((sp = find_pool (zhp->zph_name)) == NULL)
+	{
+		(void) pthread_mutex_unlock (&stub_lock);
+		return -1;
+	}
+
+	for (sd = sp->sp_datasets; sd != NULL; sd = sd->sd_next)
+		sd->sd_mounted = B_FALSE;
+
+	stub_save ();
+	(void) pthread_mutex_unlock (&stub_lock);
+	return 0;
+}
+
+zfs_handle_t *
+zfs_open (libzfs_handle_t *hdl, const char *path, int types)
+{
+	zfs_handle_t *zhp;
+
+	(void) pthread_mutex_lock (&stub_lock);
+
+	if (find_dataset (path) == NULL || (zhp = calloc (1, sizeof (zfs_handle_t))) == NULL)
+	{
+		(void) pthread_mutex_unlock (&stub_lock);
+		return NULL;
+	}
+
+	(void) pthread_mutex_unlock (&stub_lock);
+
+	(void) snprintf (zhp->zh_name, ZFS_MAXNAMELEN, "%s", path);
+	return zhp;
+}
+
+zfs_handle_t *
+zfs_path_to_zhandle (libzfs_handle_t *hdl, char *path, zfs_type_t type)
+{
+	return zfs_open (hdl, path, type);
+}
+
+void
+zfs_close (zfs_handle_t *zhp)
+{
+	free (zhp);
+}
+
+int
+zfs_create (libzfs_handle_t *hdl, const char *path, zfs_type_t type, nvlist_t *props)
+{
+	return add_dataset (path, props) == 0 ? 0 : -1;
+}
+
+int
+lzc_create (const char *fsname, enum lzc_dataset_type type, nvlist_t *props)
+{
+	return add_dataset (fsname, props);
+}
+
+int
+zfs_destroy (zfs_handle_t *zhp, boolean_t defer)
+{
+	stub_pool_t *sp;
+	stub_dataset_t *sd, **prev;
+	char path[PATH_MAX];
+
+	(void) pthread_mutex_lock (&stub_lock);
+
+	if ((sp = find_pool (zhp->zh_name)) == NULL)
+	{
+		(void) pthread_mutex_unlock (&stub_lock);
+		return -1;
+	}
+
+	for (prev = &sp->sp_datasets; (sd = *prev) != NULL; prev = &sd->sd_next)
+		if (strcmp (sd->sd_name, zhp->zh_name) == 0)
+			break;
+
+	if (sd == NULL)
+	{
+		(void) pthread_mutex_unlock (&stub_lock);
+		return -1;
+	}
+
+	if (strchr (sd->sd_name, '@') != NULL)
+		drop_snapshot (sp, prev);
+	else
+	{
+		if (sd->sd_mounted == B_TRUE && host_path (sp, sd->sd_name, path) == B_TRUE)
+			(void) rmdir (path);
+
+		*prev = sd->sd_next;
+		free (sd);
+	}
+
+	stub_save ();
+
+	(void) pthread_mutex_unlock (&stub_lock);
+	return 0;
+}
+
+int
+zfs_prop_set (zfs_handle_t *zhp, const char *propname, const char *propval)
+{
+	stub_dataset_t *sd;
+	int ret = 0;
+
+	(void) pthread_mutex_lock (&stub_lock);
+
+	if ((sd = find_dataset (zhp->zh_name)) == NULL)
+		ret = -1;
+	else if (strcmp (propname, zfs_prop_to_name (ZFS_PROP_MOUNTPOINT)) == 0)
+		(void) snprintf (sd->sd_mountpoint, PATH_MAX, "%s", propval);
+	else if (strcmp (propname, zfs_prop_to_name (ZFS_PROP_CANMOUNT)) == 0)
+		sd->sd_noauto = strcmp (propval, "on") != 0 ? B_TRUE : B_FALSE;
+
+	if (ret == 0)
+		stub_save ();
+
+	(void) pthread_mutex_unlock (&stub_lock);
+	return ret;
+}
+
+boolean_t
+zfs_dataset_exists (libzfs_handle_t *hdl, const char *path, zfs_type_t types)
+{
+	boolean_t exists;
+
+	(void) pthread_mutex_lock (&stub_lock);
+	exists = find_dataset (path) != NULL ? B_TRUE : B_FALSE;
+	(void) pthread_mutex_unlock (&stub_lock);
+
+	return exists;
+}
+
+/*
+ * Take a snapshot, linking the files of a mounted dataset into it
+ */
+static int
+take_snapshot (const char *name)
+{
+	stub_pool_t *sp;
+	stub_dataset_t *sd;
+	char fs[ZFS_MAXNAMELEN], src[PATH_MAX], dst[PATH_MAX];
+	int ret = 0;
+
+	(void) snprintf (fs, ZFS_MAXNAMELEN, "%.*s", (int) strcspn (name, "@"), name);
+
+	if (strchr (name, '@') == NULL || add_dataset (name, NULL) != 0)
+		return -1;
+
+	(void) pthread_mutex_lock (&stub_lock);
+
+	if ((sp = find_pool (fs)) != NULL && (sd = find_dataset (fs)) != NULL && sd->sd_mounted == B_TRUE &&
+	    host_path (sp, fs, src) == B_TRUE && snapshot_path (sp, name, dst) == B_TRUE)
+	{
+		if (make_dirs (dst) == -1 || link_tree (sp, fs, src, dst) == -1)
+		{
+			fprintf (stderr, "stub: unable to snapshot %s into %s: %s\n", src, dst, strerror (errno));
+			ret = -1;
+		}
+	}
+
+	(void) pthread_mutex_unlock (&stub_lock);
+	return ret;
+}
+
+int
+zfs_snapshot (libzfs_handle_t *hdl, const char *path, boolean_t recursive, nvlist_t *props)
+{
+	return take_snapshot (path) == 0 ? 0 : -1;
+}
+
+/*
+ * Not atomic, but nothing else is going on
+ */
+int
+lzc_snapshot (nvlist_t *snaps, nvlist_t *props, nvlist_t **errlist)
+{
+	nvpair_t *nvp;
+	int ret;
+
+	*errlist = NULL;
+
+	for (nvp = nvlist_next_nvpair (snaps, NULL); nvp != NULL; nvp = nvlist_next_nvpair (snaps, nvp))
+		if ((ret = take_snapshot (nvpair_name (nvp))) != 0)
+			return ret == -1 ? EINVAL : ret;
+
+	return 0;
+}
+
+/*
+ * Put a dataset's files back as they were in the snapshot, which must
+ * be its latest unless later ones can go too
+ */
+int
+zfs_rollback (zfs_handle_t *zhp, zfs_handle_t *snap, boolean_t force)
+{
+	stub_pool_t *sp;
+	stub_dataset_t *sd, **prev;
+	char src[PATH_MAX], dst[PATH_MAX], prefix[ZFS_MAXNAMELEN];
+	boolean_t later = B_FALSE;
+	int ret = 0;
+
+	if (snprintf (prefix, ZFS_MAXNAMELEN, "%s@", zhp->zh_name) >= ZFS_MAXNAMELEN)
+		return -1;
+
+	(void) pthread_mutex_lock (&stub_lock);
+
+	if ((sp = find_pool (zhp->zh_name)) == NULL || find_dataset (snap->zh_name) == NULL)
+	{
+		(void) pthread_mutex_unlock (&stub_lock);
+		return -1;
+	}
+
+	if (snapshot_path (sp, snap->zh_name, src) == B_TRUE && access (src, F_OK) == 0 &&
+	    host_path (sp, zhp->zh_name, dst) == B_TRUE)
+	{
+		if (clear_tree (sp, zhp->zh_name, dst) == -1 || link_tree (sp, zhp->zh_name, src, dst) == -1)
+		{
+			fprintf (stderr, "stub: unable to roll %s back to %s: %s\n", dst, src, strerror (errno));
+			ret = -1;
+		}
+	}
+
+	/*
+	 * libzfs destroys the snapshots after the one rolled back to
+	 */
+	for (prev = &sp->sp_datasets; ret == 0 && (sd = *prev) != NULL; )
+	{
+		if (later == B_TRUE && strncmp (sd->sd_name, prefix, strlen (prefix)) == 0)
+		{
+			drop_snapshot (sp, prev);
+			continue;
+		}
+
+		if (strcmp (sd->sd_name, snap->zh_name) == 0)
+			later = B_TRUE;
+
+		prev = &sd->sd_next;
+	}
+
+	stub_save ();
+	(void) pthread_mutex_unlock (&stub_lock);
+	return ret;
+}
+
+/*
+ * Call func on each child filesystem, or each snapshot, which it must
+ * close.  The names are gathered first so func can change things.
+ */
+static int
+iter_children (zfs_handle_t *zhp, char sep, zfs_iter_f func, void *data)
+{
+	stub_pool_t *sp;
+	stub_dataset_t *sd;
+	char (*names)[ZFS_MAXNAMELEN] = NULL;
+	size_t len = strlen (zhp->zh_name);
+	int i, n = 0, ret = 0;
+	zfs_handle_t *child;
+
+	(void) pthread_mutex_lock (&stub_lock);
+
+	if ((sp = find_pool (zhp->zh_name)) != NULL)
+	{
+		for (sd = sp->sp_datasets; sd != NULL; sd = sd->sd_next)
+			n++;
+
+		names = calloc (n, ZFS_MAXNAMELEN);
+		n = 0;
+
+		for (sd = sp->sp_datasets; names != NULL && sd != NULL; sd = sd->sd_next)
+			if (strncmp (sd->sd_name, zhp->zh_name, len) == 0 && sd->sd_name[len] == sep &&
+			    strpbrk (sd->sd_name + len + 1, "/@") == NULL)
+				(void) strcpy (names[n++], sd->sd_name);
+	}
+
+	(void) pthread_mutex_unlock (&stub_lock);
+
+	for (i = 0; i < n && ret == 0; i++)
+		if ((child = zfs_open (NULL, names[i], ZFS_TYPE_DATASET)) != NULL)
+			ret = func (child, data);
+
+	free (names);
+	return ret;
+}
+
+int
+zfs_iter_filesystems (zfs_handle_t *zhp, zfs_iter_f func, void *data)
+{
+	return iter_children (zhp, '/', func, data);
+}
+
+int
+zfs_iter_snapshots (zfs_handle_t *zhp, boolean_t simple, zfs_iter_f func, void *data)
+{
+	return iter_children (zhp, '@', func, data);
+}
+
+/*
+ * Only canmount is kept
+ */
+uint64_t
+zfs_prop_get_int (zfs_handle_t *zhp, zfs_prop_t prop)
+{
+	stub_dataset_t *sd;
+	uint64_t value = 0;
+
+	(void) pthread_mutex_lock (&stub_lock);
+
+	if (prop == ZFS_PROP_CANMOUNT && (sd = find_dataset (zhp->zh_name)) != NULL)
+		value = sd->sd_noauto == B_TRUE ? ZFS_CANMOUNT_NOAUTO : ZFS_CANMOUNT_ON;
+
+	(void) pthread_mutex_unlock (&stub_lock);
+	return value;
+}
+
+const char *
+zfs_get_name (const zfs_handle_t *zhp)
+{
+	return zhp->zh_name;
+}
+
+/*
+ * A clone starts out as links to the snapshot's files, or to the
+ * origin's if the snapshot didn't keep any
+ */
+int
+zfs_clone (zfs_handle_t *zhp, const char *target, nvlist_t *props)
+{
+	stub_pool_t *sp;
+	char origin[ZFS_MAXNAMELEN], src[PATH_MAX], dst[PATH_MAX], *at;
+	int ret = 0;
+
+	(void) strcpy (origin, zhp->zh_name);
+
+	if ((at = strchr (origin, '@')) == NULL || add_dataset (target, props) != 0)
+		return -1;
+
+	*at = '\0';
+
+	(void) pthread_mutex_lock (&stub_lock);
+
+	if ((sp = find_pool (origin)) != NULL && (snapshot_path (sp, zhp->zh_name, src) == B_FALSE ||
+	    access (src, F_OK) != 0))
+		(void) host_path (sp, origin, src);
+
+	if (sp != NULL && host_path (sp, target, dst) == B_TRUE && access (src, F_OK) == 0)
+	{
+		if (make_dirs (dst) == -1 || link_tree (sp, origin, src, dst) == -1)
+		{
+			fprintf (stderr, "stub: unable to clone %s into %s: %s\n", src, dst, strerror (errno));
+			ret = -1;
+		}
+	}
+
+	(void) pthread_mutex_unlock (&stub_lock);
+	return ret;
+}
+
+int
+zfs_mount (zfs_handle_t *zhp, const char *options, int flags)
+{
+	stub_pool_t *sp;
+	stub_dataset_t *sd;
+	char path[PATH_MAX];
+	int ret = -1;
+
+	(void) pthread_mutex_lock (&stub_lock);
+
+	if ((sp = find_pool (zhp->zh_name)) != NULL && (sd = find_dataset (zhp->zh_name)) != NULL
+	    && host_path (sp, sd->sd_name, path) == B_TRUE && make_dirs (path) == 0)
+	{
+		sd->sd_mounted = B_TRUE;
+		stub_save ();
+		ret = 0;
+	}
+
+	(void) pthread_mutex_unlock (&stub_lock);
+	return ret;
+}
+
+int
+zfs_unmount (zfs_handle_t *zhp, const char *mountpoint, int flags)
+{
+	stub_dataset_t *sd;
+	int ret = -1;
+
+	(void) pthread_mutex_lock (&stub_lock);
+
+	if ((sd = find_dataset (zhp->zh_name)) != NULL)
+	{
+		sd->sd_mounted = B_FALSE;
+		stub_save ();
+		ret = 0;
+	}
+
+	(void) pthread_mutex_unlock (&stub_lock);
+	return ret;
+}
+
+static const char *zpool_props[ZPOOL_NUM_PROPS] = { "altroot", "bootfs" };
+
+const char *
+zpool_prop_to_name (zpool_prop_t prop)
+{
+	return zpool_props[prop];
+}
+
+/*
+ * The dataset properties profiles are likely to use.  Index values
+ * only have to be distinct, nothing reads them back.
+ */
+static struct
+{
+	const char *p_name;
+	zprop_type_t p_type;
+	boolean_t p_readonly;
+	const char *p_values[8];
+} zfs_props[ZFS_NUM_PROPS] =
+{
+	[ZFS_PROP_MOUNTPOINT] = { "mountpoint", PROP_TYPE_STRING },
+	[ZFS_PROP_CANMOUNT] = { "canmount", PROP_TYPE_INDEX, B_FALSE, { "off", "on", "noauto" } },
+	[ZFS_PROP_COMPRESSION] = { "compression", PROP_TYPE_INDEX, B_FALSE,
+	    { "inherit", "on", "off", "lzjb", "gzip", "zle", "lz4" } },
+	[ZFS_PROP_ATIME] = { "atime", PROP_TYPE_INDEX, B_FALSE, { "off", "on" } },
+	[ZFS_PROP_RECORDSIZE] = { "recordsize", PROP_TYPE_NUMBER },
+	[ZFS_PROP_PRIMARYCACHE] = { "primarycache", PROP_TYPE_INDEX, B_FALSE, { "none", "metadata", "all" } },
+	[ZFS_PROP_SECONDARYCACHE] = { "secondarycache", PROP_TYPE_INDEX, B_FALSE, { "none", "metadata", "all" } },
+	[ZFS_PROP_LOGBIAS] = { "logbias", PROP_TYPE_INDEX, B_FALSE, { "latency", "throughput" } },
+	[ZFS_PROP_SYNC] = { "sync", PROP_TYPE_INDEX, B_FALSE, { "standard", "always", "disabled" } },
+	[ZFS_PROP_CHECKSUM] = { "checksum", PROP_TYPE_INDEX, B_FALSE,
+	    { "inherit", "on", "off", "fletcher2", "fletcher4", "sha256", "sha512", "skein" } },
+	[ZFS_PROP_DEDUP] = { "dedup", PROP_TYPE_INDEX, B_FALSE, { "off", "on", "verify" } },
+	[ZFS_PROP_COPIES] = { "copies", PROP_TYPE_INDEX, B_FALSE, { "0", "1", "2", "3" } },
+	[ZFS_PROP_EXEC] = { "exec", PROP_TYPE_INDEX, B_FALSE, { "off", "on" } },
+	[ZFS_PROP_SETUID] = { "setuid", PROP_TYPE_INDEX, B_FALSE, { "off", "on" } },
+	[ZFS_PROP_READONLY] = { "readonly", PROP_TYPE_INDEX, B_FALSE, { "off", "on" } },
+	[ZFS_PROP_QUOTA] = { "quota", PROP_TYPE_NUMBER },
+	[ZFS_PROP_RESERVATION] = { "reservation", PROP_TYPE_NUMBER },
+	[ZFS_PROP_USED] = { "used", PROP_TYPE_NUMBER, B_TRUE }
+};
+
+const char *
+zfs_prop_to_name (zfs_prop_t prop)
+{
+	return zfs_props[prop].p_name;
+}
+
+zfs_prop_t
+zfs_name_to_prop (const char *name)
+{
+	int i;
+
+	for (i = 0; i < ZFS_NUM_PROPS; i++)
+		if (strcmp (zfs_props[i].p_name, name) == 0)
+			return i;
+
+	return ZPROP_INVAL;
+}
+
+zprop_type_t
+zfs_prop_get_type (zfs_prop_t prop)
+{
+	return zfs_props[prop].p_type;
+}
+
+boolean_t
+zfs_prop_readonly (zfs_prop_t prop)
+{
+	return zfs_props[prop].p_readonly;
+}
+
+int
+zfs_prop_string_to_index (zfs_prop_t prop, const char *string, uint64_t *index)
+{
+	int i;
+
+	for (i = 0; i < 8 && zfs_props[prop].p_values[i] != NULL; i++)
+	{
+		if (strcmp (zfs_props[prop].p_values[i], string) == 0)
+		{
+			*index = i;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Numbers with an optional K, M, G, T, P or E suffix
+ */
+int
+zfs_nicestrtonum (libzfs_handle_t *hdl, const char *value, uint64_t *num)
+{
+	char *end;
+	const char *suffixes = "KMGTPE", *s;
+	unsigned long long n;
+
+	errno = 0;
+	n = strtoull (value, &end, 10);
+
+	if (errno != 0 || end == value)
+		return -1;
+
+	if (*end != '\0')
+	{
+		if ((s = strchr (suffixes, toupper (*end))) == NULL)
+			return -1;
+
+		n <<= 10 * (s - suffixes + 1);
+		end++;
+
+		if (*end == 'b' || *end == 'B')
+			end++;
+
+		if (*end != '\0')
+			return -1;
+	}
+
+	*num = n;
+	return 0;
+}
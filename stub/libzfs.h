@@ -0,0 +1,177 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+/*
+ * Stand-in backend: the parts of libzfs the installer uses.  Pools and
+ * datasets only exist for the life of the process, unless STUB_ZFS_STATE
+ * names a file to keep them in; a dataset is a plain directory under the
+ * pool's altroot once it's mounted.
+ */
+#ifndef _LIBZFS_H
+#define	_LIBZFS_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <libnvpair.h>
+
+typedef struct libzfs_handle libzfs_handle_t;
+typedef struct zpool_handle zpool_handle_t;
+typedef struct zfs_handle zfs_handle_t;
+typedef int (*zfs_iter_f) (zfs_handle_t *zhp, void *data);
+
+#define	ZPOOL_MAXNAMELEN	256
+#define	ZFS_MAXNAMELEN		256
+#define	ZFS_MOUNTPOINT_LEGACY	"legacy"
+#define	ZFS_MOUNTPOINT_NONE	"none"
+
+typedef enum pool_state
+{
+	POOL_STATE_ACTIVE,
+	POOL_STATE_EXPORTED,
+	POOL_STATE_DESTROYED,
+	POOL_STATE_SPARE,
+	POOL_STATE_L2CACHE,
+	POOL_STATE_UNINITIALIZED,
+	POOL_STATE_UNAVAIL,
+	POOL_STATE_POTENTIALLY_ACTIVE
+} pool_state_t;
+
+typedef enum
+{
+	ZFS_TYPE_FILESYSTEM = 0x1,
+	ZFS_TYPE_SNAPSHOT = 0x2,
+	ZFS_TYPE_VOLUME = 0x4,
+	ZFS_TYPE_POOL = 0x8,
+	ZFS_TYPE_DATASET = ZFS_TYPE_FILESYSTEM | ZFS_TYPE_SNAPSHOT | ZFS_TYPE_VOLUME
+} zfs_type_t;
+
+typedef enum
+{
+	ZPOOL_PROP_INVAL = -1,
+	ZPOOL_PROP_ALTROOT,
+	ZPOOL_PROP_BOOTFS,
+	ZPOOL_NUM_PROPS
+} zpool_prop_t;
+
+typedef enum
+{
+	ZPROP_INVAL = -1,
+	ZFS_PROP_MOUNTPOINT,
+	ZFS_PROP_CANMOUNT,
+	ZFS_PROP_COMPRESSION,
+	ZFS_PROP_ATIME,
+	ZFS_PROP_RECORDSIZE,
+	ZFS_PROP_PRIMARYCACHE,
+	ZFS_PROP_SECONDARYCACHE,
+	ZFS_PROP_LOGBIAS,
+	ZFS_PROP_SYNC,
+	ZFS_PROP_CHECKSUM,
+	ZFS_PROP_DEDUP,
+	ZFS_PROP_COPIES,
+	ZFS_PROP_EXEC,
+	ZFS_PROP_SETUID,
+	ZFS_PROP_READONLY,
+	ZFS_PROP_QUOTA,
+	ZFS_PROP_RESERVATION,
+	ZFS_PROP_USED,
+	ZFS_NUM_PROPS
+} zfs_prop_t;
+
+typedef enum
+{
+	ZFS_CANMOUNT_OFF = 0,
+	ZFS_CANMOUNT_ON = 1,
+	ZFS_CANMOUNT_NOAUTO = 2
+} zfs_canmount_type_t;
+
+typedef enum
+{
+	ZPROP_SRC_NONE = 0x1,
+	ZPROP_SRC_DEFAULT = 0x2,
+	ZPROP_SRC_TEMPORARY = 0x4,
+	ZPROP_SRC_LOCAL = 0x8,
+	ZPROP_SRC_INHERITED = 0x10,
+	ZPROP_SRC_RECEIVED = 0x20
+} zprop_source_t;
+
+typedef enum
+{
+	PROP_TYPE_NUMBER,
+	PROP_TYPE_STRING,
+	PROP_TYPE_INDEX
+} zprop_type_t;
+
+#define	ZPOOL_CONFIG_TYPE		"type"
+#define	ZPOOL_CONFIG_PATH		"path"
+#define	ZPOOL_CONFIG_CHILDREN		"children"
+#define	ZPOOL_CONFIG_L2CACHE		"l2cache"
+#define	ZPOOL_CONFIG_IS_LOG		"is_log"
+#define	ZPOOL_CONFIG_ASHIFT		"ashift"
+#define	ZPOOL_CONFIG_ALLOCATION_BIAS	"alloc_bias"
+#define	ZPOOL_CONFIG_WHOLE_DISK		"whole_disk"
+
+#define	VDEV_TYPE_ROOT			"root"
+#define	VDEV_TYPE_MIRROR		"mirror"
+#define	VDEV_TYPE_DISK			"disk"
+#define	VDEV_ALLOC_BIAS_SPECIAL		"special"
+
+libzfs_handle_t *libzfs_init (void);
+void libzfs_fini (libzfs_handle_t *hdl);
+
+int zpool_in_use (libzfs_handle_t *hdl, int fd, pool_state_t *state, char **name, boolean_t *inuse);
+int zpool_create (libzfs_handle_t *hdl, const char *pool, nvlist_t *nvroot, nvlist_t *props, nvlist_t *fsprops);
+zpool_handle_t *zpool_open (libzfs_handle_t *hdl, const char *pool);
+void zpool_close (zpool_handle_t *zhp);
+int zpool_export (zpool_handle_t *zhp, boolean_t force);
+int zpool_set_prop (zpool_handle_t *zhp, const char *propname, const char *propval);
+int zpool_enable_datasets (zpool_handle_t *zhp, const char *mntopts, int flags);
+int zpool_disable_datasets (zpool_handle_t *zhp, boolean_t force);
+int zpool_get_prop (zpool_handle_t *zhp, zpool_prop_t prop, char *buf, size_t len, zprop_source_t *srctype);
+const char *zpool_prop_to_name (zpool_prop_t prop);
+
+zfs_handle_t *zfs_open (libzfs_handle_t *hdl, const char *path, int types);
+zfs_handle_t *zfs_path_to_zhandle (libzfs_handle_t *hdl, char *path, zfs_type_t type);
+void zfs_close (zfs_handle_t *zhp);
+int zfs_create (libzfs_handle_t *hdl, const char *path, zfs_type_t type, nvlist_t *props);
+int zfs_destroy (zfs_handle_t *zhp, boolean_t defer);
+int zfs_prop_set (zfs_handle_t *zhp, const char *propname, const char *propval);
+boolean_t zfs_dataset_exists (libzfs_handle_t *hdl, const char *path, zfs_type_t types);
+int zfs_snapshot (libzfs_handle_t *hdl, const char *path, boolean_t recursive, nvlist_t *props);
+int zfs_clone (zfs_handle_t *zhp, const char *target, nvlist_t *props);
+int zfs_mount (zfs_handle_t *zhp, const char *options, int flags);
+int zfs_unmount (zfs_handle_t *zhp, const char *mountpoint, int flags);
+int zfs_rollback (zfs_handle_t *zhp, zfs_handle_t *snap, boolean_t force);
+int zfs_iter_filesystems (zfs_handle_t *zhp, zfs_iter_f func, void *data);
+int zfs_iter_snapshots (zfs_handle_t *zhp, boolean_t simple, zfs_iter_f func, void *data);
+uint64_t zfs_prop_get_int (zfs_handle_t *zhp, zfs_prop_t prop);
+const char *zfs_get_name (const zfs_handle_t *zhp);
+
+const char *zfs_prop_to_name (zfs_prop_t prop);
+zfs_prop_t zfs_name_to_prop (const char *name);
+zprop_type_t zfs_prop_get_type (zfs_prop_t prop);
+boolean_t zfs_prop_readonly (zfs_prop_t prop);
+int zfs_prop_string_to_index (zfs_prop_t prop, const char *string, uint64_t *index);
+int zfs_nicestrtonum (libzfs_handle_t *hdl, const char *value, uint64_t *num);
+
+#endif
@@ -0,0 +1,396 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+/*
+ * Stand-in backend: a list of name/value pairs, enough of libnvpair for
+ * building vdev trees and property lists
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <libnvpair.h>
+
+struct nvpair
+{
+	char *nvp_name;
+	data_type_t nvp_type;
+	char *nvp_string;
+	uint64_t nvp_uint64;
+	uint64_t *nvp_uint64s;
+	nvlist_t **nvp_array;
+	uint_t nvp_nelem;
+	struct nvpair *nvp_next;
+};
+
+struct nvlist
+{
+	uint_t nvl_flag;
+	nvpair_t *nvl_head;
+	nvpair_t *nvl_tail;
+};
+
+int
+nvlist_alloc (nvlist_t **nvlp, uint_t flag, int kmflag)
+{
+	if ((*nvlp = calloc (1, sizeof (nvlist_t))) == NULL)
+		return ENOMEM;
+
+	(*nvlp)->nvl_flag = flag;
+	return 0;
+}
+
+static void
+free_pair (nvpair_t *nvp)
+{
+	uint_t i;
+
+	for (i = 0; nvp->nvp_array != NULL && i < nvp->nvp_nelem; i++)
+		nvlist_free (nvp->nvp_array[i]);
+
+	free (nvp->nvp_array);
+	free (nvp->nvp_uint64s);
+	free (nvp->nvp_string);
+	free (nvp->nvp_name);
+	free (nvp);
+}
+
+void
+nvlist_free (nvlist_t *nvl)
+{
+	nvpair_t *nvp, *next;
+
+	if (nvl == NULL)
+		return;
+
+	for (nvp = nvl->nvl_head; nvp != NULL; nvp = next)
+	{
+		next = nvp->nvp_next;
+		free_pair (nvp);
+	}
+
+	free (nvl);
+}
+
+/*
+ * Append a new pair, replacing any of the same name if names are unique
+ */
+static nvpair_t *
+add_pair (nvlist_t *nvl, const char *name, data_type_t type)
+{
+	nvpair_t *nvp, **prev;
+
+	if (nvl == NULL || name == NULL)
+		return NULL;
+
+	if (nvl->nvl_flag & NV_UNIQUE_NAME)
+	{
+		for (prev = &nvl->nvl_head; *prev != NULL; prev = &(*prev)->nvp_next)
+		{
+			if (strcmp ((*prev)->nvp_name, name) == 0)
+			{
+				nvp = *prev;
+				*prev = nvp->nvp_next;
+				free_pair (nvp);
+				break;
+			}
+		}
+
+		for (nvl->nvl_tail = nvl->nvl_head; nvl->nvl_tail != NULL && nvl->nvl_tail->nvp_next != NULL; )
+			nvl->nvl_tail = nvl->nvl_tail->nvp_next;
+	}
+
+	if ((nvp = calloc (1, sizeof (nvpair_t))) == NULL)
+		return NULL;
+
+	if ((nvp->nvp_name = strdup (name)) == NULL)
+	{
+		free (nvp);
+		return NULL;
+	}
+
+	nvp->nvp_type = type;
+
+	if (nvl->nvl_tail == NULL)
+		nvl->nvl_head = nvp;
+	else
+		nvl->nvl_tail->nvp_next = nvp;
+
+	nvl->nvl_tail = nvp;
+	return nvp;
+}
+
+int
+nvlist_add_boolean (nvlist_t *nvl, const char *name)
+{
+	return add_pair (nvl, name, DATA_TYPE_BOOLEAN) == NULL ? ENOMEM : 0;
+}
+
+int
+nvlist_add_string (nvlist_t *nvl, const char *name, const char *val)
+{
+	nvpair_t *nvp;
+
+	if ((nvp = add_pair (nvl, name, DATA_TYPE_STRING)) == NULL)
+		return ENOMEM;
+
+	if ((nvp->nvp_string = strdup (val)) == NULL)
+		return ENOMEM;
+
+	return 0;
+}
+
+int
+nvlist_add_uint64 (nvlist_t *nvl, const char *name, uint64_t val)
+{
+	nvpair_t *nvp;
+
+	if ((nvp = add_pair (nvl, name, DATA_TYPE_UINT64)) == NULL)
+		return ENOMEM;
+
+	nvp->nvp_uint64 = val;
+	return 0;
+}
+
+int
+nvlist_add_uint64_array (nvlist_t *nvl, const char *name, uint64_t *val, uint_t nelem)
+{
+	nvpair_t *nvp;
+
+	if ((nvp = add_pair (nvl, name, DATA_TYPE_UINT64_ARRAY)) == NULL)
+		return ENOMEM;
+
+	if ((nvp->nvp_uint64s = calloc (nelem, sizeof (uint64_t))) == NULL)
+		return ENOMEM;
+
+	(void) memcpy (nvp->nvp_uint64s, val, nelem * sizeof (uint64_t));
+	nvp->nvp_nelem = nelem;
+	return 0;
+}
+
+int
+nvlist_add_nvlist_array (nvlist_t *nvl, const char *name, nvlist_t **val, uint_t nelem)
+{
+	nvpair_t *nvp;
+	uint_t i;
+
+	if ((nvp = add_pair (nvl, name, DATA_TYPE_NVLIST_ARRAY)) == NULL)
+		return ENOMEM;
+
+	if ((nvp->nvp_array = calloc (nelem, sizeof (nvlist_t *))) == NULL)
+		return ENOMEM;
+
+	for (i = 0; i < nelem; i++, nvp->nvp_nelem++)
+		if (nvlist_dup (val[i], &nvp->nvp_array[i], 0) != 0)
+			return ENOMEM;
+
+	return 0;
+}
+
+/*
+ * Copy every pair of src into dst
+ */
+int
+nvlist_merge (nvlist_t *dst, nvlist_t *src, int flag)
+{
+	nvpair_t *nvp;
+	int err = 0;
+
+	if (dst == NULL || src == NULL)
+		return EINVAL;
+
+	for (nvp = src->nvl_head; nvp != NULL && err == 0; nvp = nvp->nvp_next)
+	{
+		switch (nvp->nvp_type)
+		{
+			case DATA_TYPE_STRING:
+				err = nvlist_add_string (dst, nvp->nvp_name, nvp->nvp_string);
+				break;
+			case DATA_TYPE_UINT64:
+				err = nvlist_add_uint64 (dst, nvp->nvp_name, nvp->nvp_uint64);
+				break;
+			case DATA_TYPE_UINT64_ARRAY:
+				err = nvlist_add_uint64_array (dst, nvp->nvp_name, nvp->nvp_uint64s, nvp->nvp_nelem);
+				break;
+			case DATA_TYPE_NVLIST_ARRAY:
+				err = nvlist_add_nvlist_array (dst, nvp->nvp_name, nvp->nvp_array, nvp->nvp_nelem);
+				break;
+			default:
+				err = EINVAL;
+				break;
+		}
+	}
+
+	return err;
+}
+
+int
+nvlist_dup (nvlist_t *nvl, nvlist_t **nvlp, int kmflag)
+{
+	int err;
+
+	if ((err = nvlist_alloc (nvlp, nvl->nvl_flag, kmflag)) != 0)
+		return err;
+
+	if ((err = nvlist_merge (*nvlp, nvl, 0)) != 0)
+	{
+		nvlist_free (*nvlp);
+		*nvlp = NULL;
+	}
+
+	return err;
+}
+
+static nvpair_t *
+find_pair (nvlist_t *nvl, const char *name, data_type_t type)
+{
+	nvpair_t *nvp;
+
+	if (nvl == NULL)
+		return NULL;
+
+	for (nvp = nvl->nvl_head; nvp != NULL; nvp = nvp->nvp_next)
+		if (nvp->nvp_type == type && strcmp (nvp->nvp_name, name) == 0)
+			return nvp;
+
+	return NULL;
+}
+
+int
+nvlist_lookup_string (nvlist_t *nvl, const char *name, char **val)
+{
+	nvpair_t *nvp;
+
+	if ((nvp = find_pair (nvl, name, DATA_TYPE_STRING)) == NULL)
+		return ENOENT;
+
+	*val = nvp->nvp_string;
+	return 0;
+}
+
+int
+nvlist_lookup_uint64 (nvlist_t *nvl, const char *name, uint64_t *val)
+{
+	nvpair_t *nvp;
+
+	if ((nvp = find_pair (nvl, name, DATA_TYPE_UINT64)) == NULL)
+		return ENOENT;
+
+	*val = nvp->nvp_uint64;
+	return 0;
+}
+
+int
+nvlist_lookup_nvlist_array (nvlist_t *nvl, const char *name, nvlist_t ***val, uint_t *nelem)
+{
+	nvpair_t *nvp;
+
+	if ((nvp = find_pair (nvl, name, DATA_TYPE_NVLIST_ARRAY)) == NULL)
+		return ENOENT;
+
+	*val = nvp->nvp_array;
+	*nelem = nvp->nvp_nelem;
+	return 0;
+}
+
+nvpair_t *
+nvlist_next_nvpair (nvlist_t *nvl, nvpair_t *nvp)
+{
+	if (nvl == NULL)
+		return NULL;
+
+	return nvp == NULL ? nvl->nvl_head : nvp->nvp_next;
+}
+
+char *
+nvpair_name (nvpair_t *nvp)
+{
+	return nvp->nvp_name;
+}
+
+data_type_t
+nvpair_type (nvpair_t *nvp)
+{
+	return nvp->nvp_type;
+}
+
+int
+nvpair_value_string (nvpair_t *nvp, char **val)
+{
+	if (nvp->nvp_type != DATA_TYPE_STRING)
+		return EINVAL;
+
+	*val = nvp->nvp_string;
+	return 0;
+}
+
+int
+nvpair_value_uint64 (nvpair_t *nvp, uint64_t *val)
+{
+	if (nvp->nvp_type != DATA_TYPE_UINT64)
+		return EINVAL;
+
+	*val = nvp->nvp_uint64;
+	return 0;
+}
+
+/*
+ * Not XDR: one "name value..." line per pair, which is as much as
+ * anything reading it back here needs
+ */
+int
+nvlist_pack (nvlist_t *nvl, char **bufp, size_t *buflen, int encoding, int kmflag)
+{
+	nvpair_t *nvp;
+	uint_t i;
+	FILE *fp;
+
+	if ((fp = open_memstream (bufp, buflen)) == NULL)
+		return ENOMEM;
+
+	for (nvp = nvl->nvl_head; nvp != NULL; nvp = nvp->nvp_next)
+	{
+		fprintf (fp, "%s", nvp->nvp_name);
+
+		switch (nvp->nvp_type)
+		{
+			case DATA_TYPE_STRING:
+				fprintf (fp, " %s", nvp->nvp_string);
+				break;
+			case DATA_TYPE_UINT64:
+				fprintf (fp, " %llu", (unsigned long long) nvp->nvp_uint64);
+				break;
+			case DATA_TYPE_UINT64_ARRAY:
+				for (i = 0; i < nvp->nvp_nelem; i++)
+					fprintf (fp, " %llu", (unsigned long long) nvp->nvp_uint64s[i]);
+				break;
+			default:
+				break;
+		}
+
+		fprintf (fp, "\n");
+	}
+
+	return fclose (fp) == 0 ? 0 : ENOMEM;
+}
@@ -0,0 +1,276 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+/*
+ * Stand-in backend: writes an msdos partition table the way libparted
+ * would, leaving the boot code in front of it alone.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+#include <parted/parted.h>
+
+#define	SECTOR_SIZE	512
+#define	MBR_TABLE	446
+#define	MBR_ENTRY	16
+#define	MBR_ACTIVE	0x80
+
+static const PedDiskType msdos_type = { "msdos" };
+
+static const PedFileSystemType fs_types[] =
+{
+	{ "solaris", 0xbf },
+	{ "linux-swap", 0x82 },
+	{ "ext2", 0x83 },
+	{ "fat32", 0x0c }
+};
+
+/*
+ * The size of an image file or block device in bytes
+ */
+static off_t
+device_size (int fd)
+{
+	struct stat st;
+
+	if (fstat (fd, &st) == -1)
+		return -1;
+
+#ifdef BLKGETSIZE64
+	if (S_ISBLK (st.st_mode))
+	{
+		uint64_t size;
+
+		if (ioctl (fd, BLKGETSIZE64, &size) == -1)
+			return -1;
+
+		return size;
+	}
+#endif
+
+	return st.st_size;
+}
+
+PedDevice *
+ped_device_get (const char *path)
+{
+	int fd;
+	off_t size;
+	PedDevice *dev;
+
+	if ((fd = open (path, O_RDONLY)) == -1)
+		return NULL;
+
+	size = device_size (fd);
+	(void) close (fd);
+
+	if (size < SECTOR_SIZE || (dev = calloc (1, sizeof (PedDevice))) == NULL)
+		return NULL;
+
+	if ((dev->path = strdup (path)) == NULL)
+	{
+		free (dev);
+		return NULL;
+	}
+
+	dev->sector_size = SECTOR_SIZE;
+	dev->phys_sector_size = SECTOR_SIZE;
+	dev->length = size / SECTOR_SIZE;
+
+	return dev;
+}
+
+void
+ped_device_destroy (PedDevice *dev)
+{
+	free (dev->path);
+	free (dev);
+}
+
+const PedDiskType *
+ped_disk_type_get (const char *name)
+{
+	return strcmp (name, msdos_type.name) == 0 ? &msdos_type : NULL;
+}
+
+PedDisk *
+ped_disk_new_fresh (PedDevice *dev, const PedDiskType *type)
+{
+	PedDisk *disk;
+
+	if ((disk = calloc (1, sizeof (PedDisk))) == NULL)
+		return NULL;
+
+	disk->dev = dev;
+	disk->type = type;
+
+	return disk;
+}
+
+void
+ped_disk_destroy (PedDisk *disk)
+{
+	int i;
+
+	for (i = 0; i < disk->nparts; i++)
+		free (disk->parts[i]);
+
+	free (disk);
+}
+
+const PedFileSystemType *
+ped_file_system_type_get (const char *name)
+{
+	int i;
+
+	for (i = 0; i < sizeof (fs_types) / sizeof (fs_types[0]); i++)
+		if (strcmp (fs_types[i].name, name) == 0)
+			return &fs_types[i];
+
+	return NULL;
+}
+
+PedPartition *
+ped_partition_new (const PedDisk *disk, PedPartitionType type, const PedFileSystemType *fs_type,
+    PedSector start, PedSector end)
+{
+	PedPartition *part;
+
+	if (start < 1 || end < start || end >= disk->dev->length)
+		return NULL;
+
+	if ((part = calloc (1, sizeof (PedPartition))) == NULL)
+		return NULL;
+
+	part->disk = (PedDisk *) disk;
+	part->geom.start = start;
+	part->geom.end = end;
+	part->geom.length = end - start + 1;
+	part->type = type;
+	part->fs_type = fs_type;
+
+	return part;
+}
+
+int
+ped_partition_set_flag (PedPartition *part, PedPartitionFlag flag, int state)
+{
+	if (flag != PED_PARTITION_BOOT)
+		return 0;
+
+	part->boot = state;
+	return 1;
+}
+
+/*
+ * Every partition already sits exactly where it was asked to
+ */
+PedConstraint *
+ped_constraint_exact (const PedGeometry *geom)
+{
+	static PedConstraint constraint;
+
+	constraint.start_range = *geom;
+	return &constraint;
+}
+
+int
+ped_disk_add_partition (PedDisk *disk, PedPartition *part, const PedConstraint *constraint)
+{
+	int i;
+
+	if (disk->nparts == PED_MAX_PARTITIONS)
+		return 0;
+
+	for (i = 0; i < disk->nparts; i++)
+		if (part->geom.start <= disk->parts[i]->geom.end && disk->parts[i]->geom.start <= part->geom.end)
+			return 0;
+
+	disk->parts[disk->nparts++] = part;
+	return 1;
+}
+
+static void
+put_le32 (unsigned char *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+/*
+ * Partitions are written LBA only, with the CHS fields maxed out
+ */
+int
+ped_disk_commit_to_dev (PedDisk *disk)
+{
+	int i, fd;
+	unsigned char mbr[SECTOR_SIZE], *entry;
+	PedPartition *part;
+
+	if ((fd = open (disk->dev->path, O_RDWR)) == -1)
+		return 0;
+
+	if (pread (fd, mbr, SECTOR_SIZE, 0) != SECTOR_SIZE)
+	{
+		(void) close (fd);
+		return 0;
+	}
+
+	(void) memset (mbr + MBR_TABLE, 0, SECTOR_SIZE - MBR_TABLE);
+
+	for (i = 0; i < disk->nparts; i++)
+	{
+		part = disk->parts[i];
+		entry = mbr + MBR_TABLE + i * MBR_ENTRY;
+
+		entry[0] = part->boot ? MBR_ACTIVE : 0;
+		entry[1] = entry[5] = 0xfe;
+		entry[2] = entry[3] = entry[6] = entry[7] = 0xff;
+		entry[4] = part->fs_type->id;
+		put_le32 (entry + 8, part->geom.start);
+		put_le32 (entry + 12, part->geom.length);
+	}
+
+	mbr[510] = 0x55;
+	mbr[511] = 0xaa;
+
+	if (pwrite (fd, mbr, SECTOR_SIZE, 0) != SECTOR_SIZE || fsync (fd) == -1)
+	{
+		(void) close (fd);
+		return 0;
+	}
+
+	(void) close (fd);
+	return 1;
+}
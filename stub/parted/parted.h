@@ -0,0 +1,111 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+/*
+ * Stand-in backend: the parts of libparted the installer uses.  Only
+ * msdos labels are supported.
+ */
+#ifndef _PARTED_H
+#define	_PARTED_H
+
+#include <stdint.h>
+
+typedef long long PedSector;
+
+typedef struct _PedDevice
+{
+	char *path;
+	long long sector_size;
+	long long phys_sector_size;
+	PedSector length;
+} PedDevice;
+
+typedef struct _PedDiskType
+{
+	const char *name;
+} PedDiskType;
+
+typedef struct _PedFileSystemType
+{
+	const char *name;
+	uint8_t id;		/* MBR partition type */
+} PedFileSystemType;
+
+typedef struct _PedGeometry
+{
+	PedSector start;
+	PedSector length;
+	PedSector end;
+} PedGeometry;
+
+typedef struct _PedConstraint
+{
+	PedGeometry start_range;
+} PedConstraint;
+
+typedef enum
+{
+	PED_PARTITION_NORMAL = 0x00
+} PedPartitionType;
+
+typedef enum
+{
+	PED_PARTITION_BOOT = 1
+} PedPartitionFlag;
+
+typedef struct _PedDisk PedDisk;
+
+typedef struct _PedPartition
+{
+	PedDisk *disk;
+	PedGeometry geom;
+	PedPartitionType type;
+	const PedFileSystemType *fs_type;
+	int boot;
+} PedPartition;
+
+#define	PED_MAX_PARTITIONS	4
+
+struct _PedDisk
+{
+	PedDevice *dev;
+	const PedDiskType *type;
+	PedPartition *parts[PED_MAX_PARTITIONS];
+	int nparts;
+};
+
+PedDevice *ped_device_get (const char *path);
+void ped_device_destroy (PedDevice *dev);
+const PedDiskType *ped_disk_type_get (const char *name);
+PedDisk *ped_disk_new_fresh (PedDevice *dev, const PedDiskType *type);
+void ped_disk_destroy (PedDisk *disk);
+const PedFileSystemType *ped_file_system_type_get (const char *name);
+PedPartition *ped_partition_new (const PedDisk *disk, PedPartitionType type,
+    const PedFileSystemType *fs_type, PedSector start, PedSector end);
+int ped_partition_set_flag (PedPartition *part, PedPartitionFlag flag, int state);
+PedConstraint *ped_constraint_exact (const PedGeometry *geom);
+int ped_disk_add_partition (PedDisk *disk, PedPartition *part, const PedConstraint *constraint);
+int ped_disk_commit_to_dev (PedDisk *disk);
+
+#endif
@@ -0,0 +1,148 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+/*
+ * Stand-in backend: libmd's SHA1, straight from FIPS 180-1
+ */
+
+#include <string.h>
+#include <sha1.h>
+
+#define	ROTL(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+static void
+sha1_block (SHA1_CTX *ctx, const uint8_t *block)
+{
+	int i;
+	uint32_t w[80], a, b, c, d, e, f, k, tmp;
+
+	for (i = 0; i < 16; i++)
+		w[i] = (uint32_t) block[i * 4] << 24 | block[i * 4 + 1] << 16 | block[i * 4 + 2] << 8 | block[i * 4 + 3];
+
+	for (i = 16; i < 80; i++)
+		w[i] = ROTL (w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+	a = ctx->state[0];
+	b = ctx->state[1];
+	c = ctx->state[2];
+	d = ctx->state[3];
+	e = ctx->state[4];
+
+	for (i = 0; i < 80; i++)
+	{
+		if (i < 20)
+		{
+			f = (b & c) | (~b & d);
+			k = 0x5a827999;
+		}
+		else if (i < 40)
+		{
+			f = b ^ c ^ d;
+			k = 0x6ed9eba1;
+		}
+		else if (i < 60)
+		{
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8f1bbcdc;
+		}
+		else
+		{
+			f = b ^ c ^ d;
+			k = 0xca62c1d6;
+		}
+
+		tmp = ROTL (a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = ROTL (b, 30);
+		b = a;
+		a = tmp;
+	}
+
+	ctx->state[0] += a;
+	ctx->state[1] += b;
+	ctx->state[2] += c;
+	ctx->state[3] += d;
+	ctx->state[4] += e;
+}
+
+void
+SHA1Init (SHA1_CTX *ctx)
+{
+	ctx->state[0] = 0x67452301;
+	ctx->state[1] = 0xefcdab89;
+	ctx->state[2] = 0x98badcfe;
+	ctx->state[3] = 0x10325476;
+	ctx->state[4] = 0xc3d2e1f0;
+	ctx->count = 0;
+}
+
+void
+SHA1Update (SHA1_CTX *ctx, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	size_t used = ctx->count % 64, n;
+
+	ctx->count += len;
+
+	while (len > 0)
+	{
+		n = 64 - used;
+
+		if (n > len)
+			n = len;
+
+		(void) memcpy (ctx->buf + used, p, n);
+		used += n;
+		p += n;
+		len -= n;
+
+		if (used == 64)
+		{
+			sha1_block (ctx, ctx->buf);
+			used = 0;
+		}
+	}
+}
+
+void
+SHA1Final (void *digest, SHA1_CTX *ctx)
+{
+	int i;
+	uint8_t *out = digest, pad[72];
+	uint64_t bits = ctx->count * 8;
+	size_t padlen;
+
+	padlen = (ctx->count % 64 < 56 ? 56 : 120) - ctx->count % 64;
+	(void) memset (pad, 0, sizeof (pad));
+	pad[0] = 0x80;
+
+	for (i = 0; i < 8; i++)
+		pad[padlen + i] = bits >> (56 - i * 8);
+
+	SHA1Update (ctx, pad, padlen + 8);
+
+	for (i = 0; i < 20; i++)
+		out[i] = ctx->state[i / 4] >> (24 - (i % 4) * 8);
+}
@@ -0,0 +1,45 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+/*
+ * Stand-in backend: libmd's SHA1
+ */
+#ifndef _SHA1_H
+#define	_SHA1_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+typedef struct
+{
+	uint32_t state[5];
+	uint64_t count;		/* bytes */
+	uint8_t buf[64];
+} SHA1_CTX;
+
+void SHA1Init (SHA1_CTX *ctx);
+void SHA1Update (SHA1_CTX *ctx, const void *data, size_t len);
+void SHA1Final (void *digest, SHA1_CTX *ctx);
+
+#endif
@@ -0,0 +1,390 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+/*
+ * Slow media emulation for benchmarking copy strategies on Linux:
+ *
+ *	LD_PRELOAD=stub/slowio.so SLOWIO_PATH=/path/to/livecd schillix-install ...
+ *
+ * Reads of files below SLOWIO_PATH are held up as though they came off
+ * a slower device.  The device has SLOWIO_DEPTH channels (default 1)
+ * that each serve one read at a time.  A read costs SLOWIO_SEEK_US
+ * microseconds unless it carries on where the device's last read left
+ * off, plus its length at SLOWIO_BW bytes a second (K, M and G
+ * suffixes allowed, 0 for no cap).  One read in SLOWIO_STALL_EVERY, at
+ * random, also stalls for SLOWIO_STALL_MS.  SLOWIO_MEDIA=dvd, usb2 or
+ * nvme fills in typical values which the others override.  A summary
+ * goes to stderr at exit.
+ *
+ * Only what the copy uses is covered: open, read, pread and sendfile.
+ * stdio reads inside libc can't be seen.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#define SLOWIO_MAXFD	65536
+#define SLOWIO_MAXDEPTH	64
+
+static struct media
+{
+	const char *m_name;
+	double m_seek_us;
+	double m_bw;
+	int m_depth;
+	int m_stall_every;
+	double m_stall_ms;
+} media[] =
+{
+	{ "dvd",	100000,	11e6,	1,	0,	0 },
+	{ "usb2",	1000,	30e6,	1,	500,	200 },
+	{ "nvme",	20,	2e9,	32,	0,	0 }
+};
+
+#define NUM_MEDIA	(sizeof (media) / sizeof (media[0]))
+
+static ssize_t (*real_read) (int, void *, size_t);
+static ssize_t (*real_pread) (int, void *, size_t, off_t);
+static ssize_t (*real_sendfile) (int, int, off_t *, size_t);
+static int (*real_open) (const char *, int, ...);
+static int (*real_openat) (int, const char *, int, ...);
+static int (*real_close) (int);
+
+static char slow_path[PATH_MAX];
+static size_t slow_len;
+static double slow_seek_us, slow_bw, slow_stall_ms;
+static int slow_depth = 1, slow_stall_every;
+static unsigned int slow_seed = 1;
+
+/*
+ * Which descriptors are slow, where each will read next, and where the
+ * device last read from
+ */
+static pthread_mutex_t slow_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned char slow_fd[SLOWIO_MAXFD];
+static off_t slow_next[SLOWIO_MAXFD];
+static int slow_last_fd = -1;
+static double slow_free_at[SLOWIO_MAXDEPTH];	/* when each channel is next idle */
+
+static unsigned long long slow_reads, slow_bytes, slow_seeks, slow_stalls;
+static double slow_busy_us;
+
+static double
+now_us (void)
+{
+	struct timespec ts;
+
+	(void) clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static double
+env_number (const char *name, double def)
+{
+	char *value, *end;
+	double n;
+
+	if ((value = getenv (name)) == NULL || *value == '\0')
+		return def;
+
+	n = strtod (value, &end);
+
+	switch (*end)
+	{
+		case 'k': case 'K': n *= 1024; break;
+		case 'm': case 'M': n *= 1024 * 1024; break;
+		case 'g': case 'G': n *= 1024 * 1024 * 1024; break;
+	}
+
+	return n;
+}
+
+__attribute__ ((constructor)) static void
+slow_init (void)
+{
+	char *value;
+	struct media *m = NULL;
+	int i;
+
+	real_read = dlsym (RTLD_NEXT, "read");
+	real_pread = dlsym (RTLD_NEXT, "pread");
+	real_sendfile = dlsym (RTLD_NEXT, "sendfile");
+	real_open = dlsym (RTLD_NEXT, "open");
+	real_openat = dlsym (RTLD_NEXT, "openat");
+	real_close = dlsym (RTLD_NEXT, "close");
+
+	if ((value = getenv ("SLOWIO_PATH")) == NULL || realpath (value, slow_path) == NULL)
+		return;
+
+	slow_len = strlen (slow_path);
+
+	if ((value = getenv ("SLOWIO_MEDIA")) != NULL)
+	{
+		for (i = 0; i < NUM_MEDIA; i++)
+			if (strcmp (media[i].m_name, value) == 0)
+				m = &media[i];
+
+		if (m == NULL)
+			fprintf (stderr, "slowio: unknown media %s\n", value);
+	}
+
+	slow_seek_us = env_number ("SLOWIO_SEEK_US", m != NULL ? m->m_seek_us : 0);
+	slow_bw = env_number ("SLOWIO_BW", m != NULL ? m->m_bw : 0);
+	slow_depth = env_number ("SLOWIO_DEPTH", m != NULL ? m->m_depth : 1);
+	slow_stall_every = env_number ("SLOWIO_STALL_EVERY", m != NULL ? m->m_stall_every : 0);
+	slow_stall_ms = env_number ("SLOWIO_STALL_MS", m != NULL ? m->m_stall_ms : 0);
+	slow_seed = env_number ("SLOWIO_SEED", 1);
+
+	if (slow_depth < 1)
+		slow_depth = 1;
+	else if (slow_depth > SLOWIO_MAXDEPTH)
+		slow_depth = SLOWIO_MAXDEPTH;
+}
+
+__attribute__ ((destructor)) static void
+slow_fini (void)
+{
+	if (slow_reads == 0)
+		return;
+
+	fprintf (stderr, "slowio: %llu reads, %.1f MB, %llu seeks, %llu stalls, device busy %.2fs\n",
+	    slow_reads, slow_bytes / (1024.0 * 1024), slow_seeks, slow_stalls, slow_busy_us / 1e6);
+}
+
+/*
+ * Whether a path being opened is below SLOWIO_PATH
+ */
+static int
+is_slow (int dirfd, const char *path)
+{
+	char resolved[PATH_MAX];
+
+	if (slow_len == 0)
+		return 0;
+
+	if (path[0] != '/')
+	{
+		if (dirfd != AT_FDCWD || realpath (path, resolved) == NULL)
+			return 0;
+
+		path = resolved;
+	}
+
+	return strncmp (path, slow_path, slow_len) == 0 && (path[slow_len] == '/' || path[slow_len] == '\0');
+}
+
+static int
+track (int fd, int slow)
+{
+	if (fd >= 0 && fd < SLOWIO_MAXFD)
+	{
+		(void) pthread_mutex_lock (&slow_lock);
+		slow_fd[fd] = slow;
+		slow_next[fd] = 0;
+
+		/* A new file in a reused descriptor is somewhere else on the device */
+		if (fd == slow_last_fd)
+			slow_last_fd = -1;
+
+		(void) pthread_mutex_unlock (&slow_lock);
+	}
+
+	return fd;
+}
+
+/*
+ * Hold the caller up until the device would have finished a read of
+ * len bytes at offset off
+ */
+static void
+charge (int fd, off_t off, size_t len)
+{
+	double cost = 0, start, now = now_us (), done;
+	struct timespec ts;
+	int i, c = 0;
+
+	(void) pthread_mutex_lock (&slow_lock);
+
+	if (fd != slow_last_fd || off != slow_next[fd])
+	{
+		cost += slow_seek_us;
+		slow_seeks++;
+	}
+
+	slow_last_fd = fd;
+	slow_next[fd] = off + len;
+
+	if (slow_bw > 0)
+		cost += len * 1e6 / slow_bw;
+
+	if (slow_stall_every > 0 && rand_r (&slow_seed) % slow_stall_every == 0)
+	{
+		cost += slow_stall_ms * 1e3;
+		slow_stalls++;
+	}
+
+	for (i = 1; i < slow_depth; i++)
+		if (slow_free_at[i] < slow_free_at[c])
+			c = i;
+
+	start = slow_free_at[c] > now ? slow_free_at[c] : now;
+	done = slow_free_at[c] = start + cost;
+
+	slow_reads++;
+	slow_bytes += len;
+	slow_busy_us += cost;
+
+	(void) pthread_mutex_unlock (&slow_lock);
+
+	ts.tv_sec = (time_t) (done / 1e6);
+	ts.tv_nsec = (long) ((done - ts.tv_sec * 1e6) * 1e3);
+
+	while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+static int
+slow (int fd)
+{
+	return fd >= 0 && fd < SLOWIO_MAXFD && slow_fd[fd] != 0;
+}
+
+int
+open (const char *path, int flags, ...)
+{
+	va_list ap;
+	mode_t mode = 0;
+
+	if (flags & (O_CREAT | O_TMPFILE))
+	{
+		va_start (ap, flags);
+		mode = va_arg (ap, mode_t);
+		va_end (ap);
+	}
+
+	return track (real_open (path, flags, mode), is_slow (AT_FDCWD, path));
+}
+
+int
+open64 (const char *path, int flags, ...)
+{
+	va_list ap;
+	mode_t mode = 0;
+
+	if (flags & (O_CREAT | O_TMPFILE))
+	{
+		va_start (ap, flags);
+		mode = va_arg (ap, mode_t);
+		va_end (ap);
+	}
+
+	return track (real_open (path, flags, mode), is_slow (AT_FDCWD, path));
+}
+
+int
+openat (int dirfd, const char *path, int flags, ...)
+{
+	va_list ap;
+	mode_t mode = 0;
+
+	if (flags & (O_CREAT | O_TMPFILE))
+	{
+		va_start (ap, flags);
+		mode = va_arg (ap, mode_t);
+		va_end (ap);
+	}
+
+	return track (real_openat (dirfd, path, flags, mode), is_slow (dirfd, path));
+}
+
+int
+close (int fd)
+{
+	(void) track (fd, 0);
+	return real_close (fd);
+}
+
+ssize_t
+read (int fd, void *buf, size_t count)
+{
+	ssize_t ret;
+	off_t off;
+
+	if (!slow (fd))
+		return real_read (fd, buf, count);
+
+	off = slow_next[fd];
+
+	if ((ret = real_read (fd, buf, count)) > 0)
+		charge (fd, off, ret);
+
+	return ret;
+}
+
+ssize_t
+pread (int fd, void *buf, size_t count, off_t offset)
+{
+	ssize_t ret;
+
+	if ((ret = real_pread (fd, buf, count, offset)) > 0 && slow (fd))
+		charge (fd, offset, ret);
+
+	return ret;
+}
+
+ssize_t
+pread64 (int fd, void *buf, size_t count, off_t offset)
+{
+	return pread (fd, buf, count, offset);
+}
+
+ssize_t
+sendfile (int out_fd, int in_fd, off_t *offset, size_t count)
+{
+	ssize_t ret;
+	off_t off = offset != NULL ? *offset : slow_next[in_fd < SLOWIO_MAXFD && in_fd >= 0 ? in_fd : 0];
+
+	if ((ret = real_sendfile (out_fd, in_fd, offset, count)) > 0 && slow (in_fd))
+		charge (in_fd, off, ret);
+
+	return ret;
+}
+
+ssize_t
+sendfile64 (int out_fd, int in_fd, off_t *offset, size_t count)
+{
+	return sendfile (out_fd, in_fd, offset, count);
+}
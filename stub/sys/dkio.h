@@ -0,0 +1,100 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+/*
+ * Stand-in backend: the disk ioctls the installer uses.  They are
+ * answered from the size of an image file (or a Linux block device),
+ * so ioctl() is routed through stub_ioctl in any file including this.
+ */
+#ifndef _SYS_DKIO_H
+#define	_SYS_DKIO_H
+
+#include <sys/ioctl.h>
+#include <stdint.h>
+
+#define	DKIOC			(0x04 << 8)
+#define	DKIOCGGEOM		(DKIOC|1)
+#define	DKIOCFLUSHWRITECACHE	(DKIOC|34)
+#define	DKIOCGMEDIAINFO		(DKIOC|42)
+#define	DKIOCGMEDIAINFOEXT	(DKIOC|48)
+#define	DKIOCFREE		(DKIOC|50)
+
+struct dk_geom
+{
+	unsigned short dkg_ncyl;
+	unsigned short dkg_acyl;
+	unsigned short dkg_bcyl;
+	unsigned short dkg_nhead;
+	unsigned short dkg_obs1;
+	unsigned short dkg_nsect;
+	unsigned short dkg_intrlv;
+	unsigned short dkg_obs2;
+	unsigned short dkg_obs3;
+	unsigned short dkg_apc;
+	unsigned short dkg_rpm;
+	unsigned short dkg_pcyl;
+	unsigned short dkg_write_reinstruct;
+	unsigned short dkg_read_reinstruct;
+	unsigned short dkg_extra[7];
+};
+
+struct dk_minfo
+{
+	unsigned int dki_media_type;
+	unsigned int dki_lbsize;
+	uint64_t dki_capacity;
+};
+
+struct dk_minfo_ext
+{
+	unsigned int dki_media_type;
+	unsigned int dki_lbsize;
+	uint64_t dki_capacity;
+	unsigned int dki_pbsize;
+};
+
+typedef struct dkioc_free_list_ext
+{
+	uint64_t dfle_start;
+	uint64_t dfle_length;
+} dkioc_free_list_ext_t;
+
+typedef struct dkioc_free_list
+{
+	uint64_t dfl_flags;
+	uint64_t dfl_num_exts;
+	int64_t dfl_offset;
+	uint64_t dfl_pad;
+	dkioc_free_list_ext_t dfl_exts[1];
+} dkioc_free_list_t;
+
+#define	DFL_SZ(num_exts) \
+	(sizeof (dkioc_free_list_t) + ((num_exts) - 1) * sizeof (dkioc_free_list_ext_t))
+#define	DF_WAIT_SYNC	0x00000001
+
+int stub_ioctl (int fd, unsigned long request, void *arg);
+
+#define	ioctl(fd, request, arg)	stub_ioctl ((fd), (request), (arg))
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+/*
+ * Stand-in backend: libefi's GPT routines
+ */
+#ifndef _SYS_EFI_PARTITION_H
+#define	_SYS_EFI_PARTITION_H
+
+#include <stdint.h>
+#include <sys/vtoc.h>
+
+#define	EFI_NUMPAR		9
+#define	EFI_MIN_RESV_SIZE	(16 * 1024)
+#define	EFI_PART_NAME_LEN	36
+
+struct dk_part
+{
+	uint64_t p_start;
+	uint64_t p_size;
+	unsigned char p_guid[16];
+	unsigned short p_tag;
+	unsigned short p_flag;
+	char p_name[EFI_PART_NAME_LEN];
+	unsigned char p_uguid[16];
+	unsigned int p_resv[8];
+};
+
+typedef struct dk_gpt
+{
+	unsigned int efi_version;
+	unsigned int efi_nparts;
+	unsigned int efi_part_size;
+	unsigned int efi_lbasize;
+	uint64_t efi_last_lba;
+	uint64_t efi_first_u_lba;
+	uint64_t efi_last_u_lba;
+	unsigned char efi_disk_uguid[16];
+	unsigned int efi_flags;
+	unsigned int efi_reserved1;
+	uint64_t efi_altern_lba;
+	unsigned int efi_reserved[12];
+	struct dk_part efi_parts[1];
+} dk_gpt_t;
+
+int efi_alloc_and_init (int fd, uint32_t nparts, struct dk_gpt **vtoc);
+int efi_write (int fd, struct dk_gpt *vtoc);
+void efi_free (struct dk_gpt *vtoc);
+
+#endif
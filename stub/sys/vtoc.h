@@ -0,0 +1,81 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+/*
+ * Stand-in backend: libadm's VTOC routines.  The label goes in the
+ * second sector of the Solaris fdisk partition, as on x86.
+ */
+#ifndef _SYS_VTOC_H
+#define	_SYS_VTOC_H
+
+#include <stdint.h>
+
+#define	V_NUMPAR	16
+#define	VTOC_SANE	0x600DDEEE
+#define	V_VERSION	0x01
+
+#define	V_UNASSIGNED	0x00
+#define	V_BOOT		0x01
+#define	V_ROOT		0x02
+#define	V_SWAP		0x03
+#define	V_USR		0x04
+#define	V_BACKUP	0x05
+#define	V_RESERVED	0x0b
+
+#define	V_UNMNT		0x01
+#define	V_RONLY		0x10
+
+#define	VT_ERROR	(-2)
+#define	VT_EIO		(-3)
+#define	VT_EINVAL	(-4)
+#define	VT_ENOTSUP	(-5)
+
+struct extpartition
+{
+	unsigned short p_tag;
+	unsigned short p_flag;
+	unsigned short p_pad[2];
+	uint64_t p_start;
+	uint64_t p_size;
+};
+
+struct extvtoc
+{
+	uint64_t v_bootinfo[3];
+	uint64_t v_sanity;
+	uint64_t v_version;
+	char v_volume[8];
+	unsigned short v_sectorsz;
+	unsigned short v_nparts;
+	unsigned short pad[2];
+	uint64_t v_reserved[10];
+	struct extpartition v_part[V_NUMPAR];
+	uint64_t timestamp[V_NUMPAR];
+	char v_asciilabel[128];
+};
+
+int read_extvtoc (int fd, struct extvtoc *vtoc);
+int write_extvtoc (int fd, struct extvtoc *vtoc);
+
+#endif
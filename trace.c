@@ -0,0 +1,267 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <libzfs.h>
+
+#include "trace.h"
+
+#define TRACE_CHUNK	256
+#define TRACE_NAMELEN	128
+
+typedef struct trace_event
+{
+	const char *te_cat;
+	char te_name[TRACE_NAMELEN];
+	double te_start;	/* microseconds since trace_open */
+	double te_dur;
+} trace_event_t;
+
+typedef struct trace_chunk
+{
+	trace_event_t tc_events[TRACE_CHUNK];
+	int tc_count;
+	struct trace_chunk *tc_next;
+} trace_chunk_t;
+
+/*
+ * Each thread records into its own buffer so recording takes no locks.
+ * Buffers are pushed onto a list the first time a thread records
+ * anything and are only read back by trace_close once every thread is
+ * finished.
+ */
+typedef struct trace_buf
+{
+	int tb_tid;
+	trace_chunk_t *tb_first;
+	trace_chunk_t *tb_last;
+	struct trace_buf *tb_next;
+} trace_buf_t;
+
+static __thread trace_buf_t *trace_buf;
+static trace_buf_t *trace_bufs;
+static int trace_tids;
+static unsigned int trace_files;
+
+static boolean_t trace_enabled = B_FALSE;
+static int trace_every;
+static char trace_path[PATH_MAX];
+static struct timespec trace_epoch;
+
+/*
+ * Start recording, to be written to path by trace_close.  If sample
+ * isn't zero one in every sample file copies gets a span too.
+ */
+boolean_t
+trace_open (char *path, int sample)
+{
+	if (strlen (path) >= PATH_MAX)
+	{
+		fprintf (stderr, "Error: trace path too long\n");
+		return B_FALSE;
+	}
+
+	(void) strcpy (trace_path, path);
+	(void) clock_gettime (CLOCK_MONOTONIC, &trace_epoch);
+	trace_every = sample;
+	trace_enabled = B_TRUE;
+
+	return B_TRUE;
+}
+
+/*
+ * Microseconds since trace_open
+ */
+double
+trace_start (void)
+{
+	struct timespec now;
+
+	if (trace_enabled == B_FALSE)
+		return 0;
+
+	(void) clock_gettime (CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - trace_epoch.tv_sec) * 1e6 + (now.tv_nsec - trace_epoch.tv_nsec) / 1e3;
+}
+
+/*
+ * Get this thread's buffer, adding it to the list if it's new
+ */
+static trace_buf_t *
+get_buf (void)
+{
+	trace_buf_t *tb;
+
+	if (trace_buf != NULL)
+		return trace_buf;
+
+	if ((tb = calloc (1, sizeof (trace_buf_t))) == NULL)
+		return NULL;
+
+	tb->tb_tid = __sync_add_and_fetch (&trace_tids, 1);
+
+	do
+		tb->tb_next = trace_bufs;
+	while (__sync_bool_compare_and_swap (&trace_bufs, tb->tb_next, tb) == 0);
+
+	trace_buf = tb;
+	return tb;
+}
+
+/*
+ * Record a span from start until now
+ */
+void
+trace_end (const char *cat, const char *name, double start)
+{
+	trace_buf_t *tb;
+	trace_chunk_t *tc;
+	trace_event_t *te;
+	double end;
+
+	if (trace_enabled == B_FALSE)
+		return;
+
+	end = trace_start ();
+
+	if ((tb = get_buf ()) == NULL)
+		return;
+
+	if ((tc = tb->tb_last) == NULL || tc->tc_count == TRACE_CHUNK)
+	{
+		if ((tc = malloc (sizeof (trace_chunk_t))) == NULL)
+			return;
+
+		tc->tc_count = 0;
+		tc->tc_next = NULL;
+
+		if (tb->tb_last == NULL)
+			tb->tb_first = tc;
+		else
+			tb->tb_last->tc_next = tc;
+
+		tb->tb_last = tc;
+	}
+
+	te = &tc->tc_events[tc->tc_count++];
+	te->te_cat = cat;
+	(void) snprintf (te->te_name, TRACE_NAMELEN, "%s", name);
+	te->te_start = start;
+	te->te_dur = end - start;
+}
+
+/*
+ * Should this file copy get a span?
+ */
+boolean_t
+trace_sample (void)
+{
+	if (trace_enabled == B_FALSE || trace_every == 0)
+		return B_FALSE;
+
+	return __sync_fetch_and_add (&trace_files, 1) % trace_every == 0 ? B_TRUE : B_FALSE;
+}
+
+/*
+ * Write a string as a JSON string
+ */
+static void
+put_string (FILE *fp, const char *s)
+{
+	fputc ('"', fp);
+
+	for (; *s != '\0'; s++)
+	{
+		if (*s == '"' || *s == '\\')
+			fprintf (fp, "\\%c", *s);
+		else if ((unsigned char) *s < ' ')
+			fprintf (fp, "\\u%04x", *s);
+		else
+			fputc (*s, fp);
+	}
+
+	fputc ('"', fp);
+}
+
+/*
+ * Write everything recorded as a trace-event file.  Every thread that
+ * recorded anything must have finished.
+ */
+boolean_t
+trace_close (void)
+{
+	FILE *fp;
+	trace_buf_t *tb;
+	trace_chunk_t *tc;
+	trace_event_t *te;
+	int i;
+	pid_t pid = getpid ();
+	const char *sep = "";
+
+	if (trace_enabled == B_FALSE)
+		return B_TRUE;
+
+	trace_enabled = B_FALSE;
+
+	if ((fp = fopen (trace_path, "w")) == NULL)
+	{
+		fprintf (stderr, "Error: Unable to create %s: %s\n", trace_path, strerror (errno));
+		return B_FALSE;
+	}
+
+	fprintf (fp, "{\"traceEvents\":[");
+
+	for (tb = trace_bufs; tb != NULL; tb = tb->tb_next)
+	{
+		for (tc = tb->tb_first; tc != NULL; tc = tc->tc_next)
+		{
+			for (i = 0; i < tc->tc_count; i++)
+			{
+				te = &tc->tc_events[i];
+				fprintf (fp, "%s\n{\"name\":", sep);
+				put_string (fp, te->te_name);
+				fprintf (fp, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+				    te->te_cat, te->te_start, te->te_dur, (int) pid, tb->tb_tid);
+				sep = ",";
+			}
+		}
+	}
+
+	fprintf (fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+	if (fclose (fp) == EOF)
+	{
+		fprintf (stderr, "Error: Unable to write %s: %s\n", trace_path, strerror (errno));
+		return B_FALSE;
+	}
+
+	return B_TRUE;
+}
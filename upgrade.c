@@ -0,0 +1,920 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ *
+ * Installer for Schillix
+ * (c) Copyright 2013 - Andrew Stormont <andyjstormont@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <libzfs.h>
+
+#include "disk.h"
+#include "config.h"
+#include "copy.h"
+#include "manifest.h"
+#include "bufpool.h"
+#include "sched.h"
+#include "trace.h"
+#include "progress.h"
+#include "upgrade.h"
+
+extern char cdrom_path[PATH_MAX];
+
+/*
+ * The upgrade runs through the scheduler like an install does, one
+ * phase after another, so it gets the same report, trace and progress
+ */
+enum
+{
+	UP_SNAPSHOT,
+	UP_CLONE,
+	UP_MOUNT,
+	UP_COPY,
+	UP_PRUNE,
+	UP_BOOTADM,
+	UP_UNMOUNT,
+	UP_ACTIVATE,
+	UP_COUNT
+};
+
+#define MAX_BOOT_ENVS	1000
+
+typedef struct upgrade_job
+{
+	libzfs_handle_t *uj_libzfs;
+	char *uj_rpool;
+	char *uj_temp;			/* where the clone is mounted, relative to the altroot */
+	char uj_mnt[PATH_MAX];		/* and where that is on this system */
+	char uj_old[ZFS_MAXNAMELEN];	/* boot environment we come from */
+	char uj_new[ZFS_MAXNAMELEN];
+	char uj_snap[ZFS_MAXNAMELEN];
+	manifest_t *uj_manifest;	/* what the livecd holds */
+	manifest_t *uj_installed;	/* and what the old boot environment was given */
+} upgrade_job_t;
+
+/*
+ * Where the delta copy is copying from and to, and what it found.
+ * nftw gives us no way to pass these to upgrade_path.
+ */
+static char upgrade_base[PATH_MAX];
+static upgrade_job_t *upgrade_job;
+static boolean_t upgrade_hash;
+static uint64_t upgrade_copied, upgrade_bytes, upgrade_unchanged, upgrade_hashed, upgrade_removed, upgrade_kept;
+
+#define DOTCDROMPATH	"/.cdrom"
+
+/*
+ * Work out which boot environment to clone and what to call the new
+ * one: the first free <rpool>/ROOT/schillix-<n>
+ */
+static boolean_t
+find_boot_envs (upgrade_job_t *uj)
+{
+	zpool_handle_t *zpool_handle;
+	char altroot[PATH_MAX], bootfs[ZFS_MAXNAMELEN];
+	int n;
+
+	if ((zpool_handle = zpool_open (uj->uj_libzfs, uj->uj_rpool)) == NULL)
+	{
+		fprintf (stderr, "Error: Unable to open %s, is it imported?\n", uj->uj_rpool);
+		return B_FALSE;
+	}
+
+	if (zpool_get_prop (zpool_handle, ZPOOL_PROP_ALTROOT, altroot, PATH_MAX, NULL) != 0 ||
+	    zpool_get_prop (zpool_handle, ZPOOL_PROP_BOOTFS, bootfs, ZFS_MAXNAMELEN, NULL) != 0)
+	{
+		fprintf (stderr, "Error: Unable to get %s properties\n", uj->uj_rpool);
+		zpool_close (zpool_handle);
+		return B_FALSE;
+	}
+
+	zpool_close (zpool_handle);
+
+	if (strcmp (altroot, "-") == 0)
+		altroot[0] = '\0';
+
+	if (snprintf (uj->uj_mnt, PATH_MAX, "%s%s", altroot, uj->uj_temp) >= PATH_MAX)
+	{
+		fprintf (stderr, "Error: mountpoint path too long\n");
+		return B_FALSE;
+	}
+
+	/*
+	 * Pools from before bootfs was set by the installer
+	 */
+	if (strcmp (bootfs, "-") == 0)
+		(void) snprintf (bootfs, ZFS_MAXNAMELEN, "%s/ROOT/" ROOT_NAME, uj->uj_rpool);
+
+	if (zfs_dataset_exists (uj->uj_libzfs, bootfs, ZFS_TYPE_FILESYSTEM) == B_FALSE)
+	{
+		fprintf (stderr, "Error: %s has no boot environment %s\n", uj->uj_rpool, bootfs);
+		return B_FALSE;
+	}
+
+	(void) strcpy (uj->uj_old, bootfs);
+
+	for (n = 1; n < MAX_BOOT_ENVS; n++)
+	{
+		if (snprintf (uj->uj_new, ZFS_MAXNAMELEN, "%s/ROOT/" ROOT_NAME "-%d", uj->uj_rpool, n)
+		    >= ZFS_MAXNAMELEN ||
+		    snprintf (uj->uj_snap, ZFS_MAXNAMELEN, "%s@" ROOT_NAME "-%d", uj->uj_old, n) >= ZFS_MAXNAMELEN)
+		{
+			fprintf (stderr, "Error: boot environment name too long\n");
+			return B_FALSE;
+		}
+
+		if (zfs_dataset_exists (uj->uj_libzfs, uj->uj_new, ZFS_TYPE_DATASET) == B_FALSE &&
+		    zfs_dataset_exists (uj->uj_libzfs, uj->uj_snap, ZFS_TYPE_DATASET) == B_FALSE)
+			return B_TRUE;
+	}
+
+	fprintf (stderr, "Error: %s has no free boot environment names\n", uj->uj_rpool);
+	return B_FALSE;
+}
+
+static boolean_t
+phase_snapshot (void *arg)
+{
+	upgrade_job_t *uj = arg;
+	double span;
+	int ret;
+
+	printf ("Snapshotting %s...\n", uj->uj_old);
+
+	span = trace_start ();
+	ret = zfs_snapshot (uj->uj_libzfs, uj->uj_snap, B_FALSE, NULL);
+	trace_end ("libzfs", "zfs_snapshot", span);
+
+	if (ret != 0)
+	{
+		fprintf (stderr, "Error: Unable to snapshot %s\n", uj->uj_old);
+		return B_FALSE;
+	}
+
+	return B_TRUE;
+}
+
+/*
+ * The clone is mounted out of the way until it's ready, so this works
+ * on the running system as well as on a pool imported with an altroot
+ */
+static boolean_t
+phase_clone (void *arg)
+{
+	upgrade_job_t *uj = arg;
+	zfs_handle_t *zfs_handle;
+	nvlist_t *props;
+	double span;
+	int ret;
+
+	printf ("Cloning %s into %s...\n", uj->uj_snap, uj->uj_new);
+
+	if (nvlist_alloc (&props, NV_UNIQUE_NAME, 0) != 0)
+	{
+		fprintf (stderr, "Error: Unable to allocate clone properties\n");
+		return B_FALSE;
+	}
+
+	if (nvlist_add_string (props, zfs_prop_to_name (ZFS_PROP_MOUNTPOINT), uj->uj_temp) != 0 ||
+	    nvlist_add_string (props, zfs_prop_to_name (ZFS_PROP_CANMOUNT), "noauto") != 0)
+	{
+		fprintf (stderr, "Error: Unable to set clone properties\n");
+		nvlist_free (props);
+		return B_FALSE;
+	}
+
+	if ((zfs_handle = zfs_open (uj->uj_libzfs, uj->uj_snap, ZFS_TYPE_SNAPSHOT)) == NULL)
+	{
+		fprintf (stderr, "Error: Unable to open %s\n", uj->uj_snap);
+		nvlist_free (props);
+		return B_FALSE;
+	}
+
+	span = trace_start ();
+	ret = zfs_clone (zfs_handle, uj->uj_new, props);
+	trace_end ("libzfs", "zfs_clone", span);
+
+	zfs_close (zfs_handle);
+	nvlist_free (props);
+
+	if (ret != 0)
+	{
+		fprintf (stderr, "Error: Unable to clone %s\n", uj->uj_snap);
+		return B_FALSE;
+	}
+
+	return B_TRUE;
+}
+
+static boolean_t
+phase_mount (void *arg)
+{
+	upgrade_job_t *uj = arg;
+	zfs_handle_t *zfs_handle;
+	double span;
+	int ret;
+
+	printf ("Mounting %s on %s...\n", uj->uj_new, uj->uj_mnt);
+
+	if ((zfs_handle = zfs_open (uj->uj_libzfs, uj->uj_new, ZFS_TYPE_FILESYSTEM)) == NULL)
+	{
+		fprintf (stderr, "Error: Unable to open %s\n", uj->uj_new);
+		return B_FALSE;
+	}
+
+	span = trace_start ();
+	ret = zfs_mount (zfs_handle, NULL, 0);
+	trace_end ("libzfs", "zfs_mount", span);
+
+	zfs_close (zfs_handle);
+
+	if (ret != 0)
+	{
+		fprintf (stderr, "Error: Unable to mount %s\n", uj->uj_new);
+		return B_FALSE;
+	}
+
+	return B_TRUE;
+}
+
+/*
+ * rm -r, for when a directory has become something else
+ */
+static int
+remove_path (const char *path, const struct stat *statptr, int fileflag, struct FTW *pftw)
+{
+	if ((fileflag == FTW_DP ? rmdir (path) : unlink (path)) == -1)
+	{
+		fprintf (stderr, "Unable to remove %s: %s\n", path, strerror (errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Clear the way for a path of a different type
+ */
+static boolean_t
+replace_path (const char *dest, const struct stat *statptr)
+{
+	if (S_ISDIR (statptr->st_mode))
+		return nftw (dest, remove_path, 16, FTW_PHYS | FTW_DEPTH) == 0 ? B_TRUE : B_FALSE;
+
+	if (unlink (dest) == -1)
+	{
+		fprintf (stderr, "Unable to remove %s: %s\n", dest, strerror (errno));
+		return B_FALSE;
+	}
+
+	return B_TRUE;
+}
+
+/*
+ * Whether the clone's copy of a file can be kept.  Matching size and
+ * mtime is enough, as copies keep their mtime.  Failing that, with a
+ * hash asked for, files of the same size are compared and a match gets
+ * the livecd's times so the next upgrade needn't hash it again.
+ */
+static boolean_t
+file_unchanged (const char *path, const struct stat *src, const char *dest, const struct stat *dst)
+{
+	unsigned char old[20], new[20];
+	struct timespec times[2];
+	boolean_t same;
+	char *buf;
+
+	if (S_ISREG (dst->st_mode) == 0 || src->st_size != dst->st_size)
+		return B_FALSE;
+
+	if (src->st_mtim.tv_sec == dst->st_mtim.tv_sec && src->st_mtim.tv_nsec == dst->st_mtim.tv_nsec)
+		return B_TRUE;
+
+	if (upgrade_hash == B_FALSE)
+		return B_FALSE;
+
+	buf = bufpool_get ();
+	same = manifest_hash (path, new, buf, BUFPOOL_BUFSIZE) == B_TRUE &&
+	    manifest_hash (dest, old, buf, BUFPOOL_BUFSIZE) == B_TRUE &&
+	    memcmp (old, new, sizeof (old)) == 0 ? B_TRUE : B_FALSE;
+	bufpool_put (buf);
+
+	if (same == B_FALSE)
+		return B_FALSE;
+
+	times[0] = src->st_atim;
+	times[1] = src->st_mtim;
+	(void) utimensat (AT_FDCWD, dest, times, AT_SYMLINK_NOFOLLOW);
+
+	upgrade_hashed++;
+	return B_TRUE;
+}
+
+/*
+ * Whether the user has changed a path since the livecd put it there,
+ * going by what the old manifest recorded.  Anything it has no record
+ * of is taken to be the user's.
+ */
+static boolean_t
+file_edited (const char *rel, const char *dest, const struct stat *dst)
+{
+	manifest_entry_t *me;
+	unsigned char hash[MANIFEST_HASHLEN];
+	boolean_t same;
+	char *buf;
+
+	if (upgrade_job->uj_installed == NULL || (me = manifest_find (upgrade_job->uj_installed, rel)) == NULL ||
+	    me->me_file == B_FALSE)
+		return B_TRUE;
+
+	if (S_ISREG (dst->st_mode) == 0 || dst->st_size != me->me_size)
+		return B_TRUE;
+
+	if (dst->st_mtim.tv_sec == me->me_mtime.tv_sec && dst->st_mtim.tv_nsec == me->me_mtime.tv_nsec)
+		return B_FALSE;
+
+	if (me->me_hashed == B_FALSE)
+		return B_TRUE;
+
+	buf = bufpool_get ();
+	same = manifest_hash (dest, hash, buf, BUFPOOL_BUFSIZE) == B_TRUE &&
+	    memcmp (hash, me->me_hash, MANIFEST_HASHLEN) == 0 ? B_TRUE : B_FALSE;
+	bufpool_put (buf);
+
+	return same == B_TRUE ? B_FALSE : B_TRUE;
+}
+
+/*
+ * Whether the old manifest recorded this version of a file, with its
+ * hash
+ */
+static boolean_t
+installed_as (const char *rel, const struct stat *src)
+{
+	manifest_entry_t *me;
+
+	return upgrade_job->uj_installed != NULL && (me = manifest_find (upgrade_job->uj_installed, rel)) != NULL &&
+	    me->me_hashed == B_TRUE && me->me_size == src->st_size &&
+	    me->me_mtime.tv_sec == src->st_mtim.tv_sec && me->me_mtime.tv_nsec == src->st_mtim.tv_nsec ?
+	    B_TRUE : B_FALSE;
+}
+
+/*
+ * Record the hash of the livecd's version of a file, found at path.
+ * The old manifest's is reused if it was recorded for the same version.
+ * Otherwise the file is only read back for one with -H; without a hash
+ * the next upgrade goes by size and mtime.
+ */
+static boolean_t
+record_hash (const char *rel, const char *path, const struct stat *src)
+{
+	unsigned char hash[MANIFEST_HASHLEN];
+	boolean_t hashed;
+	char *buf;
+
+	if (installed_as (rel, src) == B_TRUE)
+		return manifest_hashed (upgrade_job->uj_manifest, rel,
+		    manifest_find (upgrade_job->uj_installed, rel)->me_hash);
+
+	if (upgrade_hash == B_FALSE)
+		return B_TRUE;
+
+	buf = bufpool_get ();
+	hashed = manifest_hash (path, hash, buf, BUFPOOL_BUFSIZE);
+	bufpool_put (buf);
+
+	return hashed == B_TRUE ? manifest_hashed (upgrade_job->uj_manifest, rel, hash) : B_TRUE;
+}
+
+/*
+ * Bring the ownership and permissions of a kept path into line
+ */
+static boolean_t
+fix_attrs (const char *dest, const struct stat *src, const struct stat *dst)
+{
+	if ((src->st_uid != dst->st_uid || src->st_gid != dst->st_gid) &&
+	    lchown (dest, src->st_uid, src->st_gid) == -1)
+	{
+		fprintf (stderr, "Unable to chown %s: %s\n", dest, strerror (errno));
+		return B_FALSE;
+	}
+
+	if (S_ISLNK (src->st_mode) == 0 && (src->st_mode & 07777) != (dst->st_mode & 07777) &&
+	    chmod (dest, src->st_mode & 07777) == -1)
+	{
+		fprintf (stderr, "Unable to chmod %s: %s\n", dest, strerror (errno));
+		return B_FALSE;
+	}
+
+	return B_TRUE;
+}
+
+/*
+ * Whether a symlink in the clone already points where the livecd's does
+ */
+static boolean_t
+symlink_unchanged (const char *path, const char *dest, const struct stat *dst)
+{
+	char old[PATH_MAX], new[PATH_MAX];
+	ssize_t oldlen, newlen;
+
+	if (S_ISLNK (dst->st_mode) == 0)
+		return B_FALSE;
+
+	if ((newlen = readlink (path, new, PATH_MAX)) == -1 || (oldlen = readlink (dest, old, PATH_MAX)) == -1)
+		return B_FALSE;
+
+	return oldlen == newlen && memcmp (old, new, newlen) == 0 ? B_TRUE : B_FALSE;
+}
+
+/*
+ * Bring one file/directory/symlink in the clone into line with the
+ * livecd.  Called by phase_copy.  Changed files are unlinked before
+ * they're copied so the old boot environment's blocks stay shared
+ * until the new copy is written.  Files the user has edited are kept,
+ * with the livecd's version next to them as <name>.new if it differs
+ * from the one they started from.
+ */
+static int
+upgrade_path (const char *path, const struct stat *statptr, int fileflag, struct FTW *pftw)
+{
+	int i;
+	const char *rel = path + strlen (upgrade_base);
+	char dest[PATH_MAX], new[PATH_MAX], *overlay;
+	struct stat dst;
+	boolean_t exists, trace;
+	double span;
+
+	if (pftw->level == 1 && strcmp (rel, DOTCDROMPATH) == 0)
+		return 0;
+
+	/*
+	 * Generated files belong to the installed system now
+	 */
+	for (i = 0; (overlay = overlay_path (i)) != NULL; i++)
+		if (strcmp (rel, overlay) == 0)
+			return 0;
+
+	if (pftw->level == 0)
+		return 0;
+
+	if (manifest_add (upgrade_job->uj_manifest, rel, fileflag == FTW_F ? statptr : NULL) == B_FALSE)
+		return 1;
+
+	(void) snprintf (dest, PATH_MAX, "%s%s", upgrade_job->uj_mnt, rel);
+
+	if (lstat (dest, &dst) == 0)
+		exists = B_TRUE;
+	else if (errno == ENOENT)
+		exists = B_FALSE;
+	else
+	{
+		fprintf (stderr, "Unable to stat %s: %s\n", dest, strerror (errno));
+		return 1;
+	}
+
+	switch (fileflag)
+	{
+		case FTW_F:
+
+			progress_bytes (statptr->st_size);
+			progress_file ();
+
+			if (exists == B_TRUE && file_unchanged (path, statptr, dest, &dst) == B_TRUE)
+			{
+				upgrade_unchanged++;
+				return fix_attrs (dest, statptr, &dst) == B_TRUE &&
+				    record_hash (rel, dest, statptr) == B_TRUE ? 0 : 1;
+			}
+
+			if (exists == B_TRUE && file_edited (rel, dest, &dst) == B_TRUE)
+			{
+				upgrade_kept++;
+
+				/*
+				 * Nothing to offer if the livecd's version is the
+				 * one the user started from
+				 */
+				if (installed_as (rel, statptr) == B_TRUE)
+					return record_hash (rel, dest, statptr) == B_TRUE ? 0 : 1;
+
+				if (snprintf (new, PATH_MAX, "%s.new", dest) >= PATH_MAX)
+				{
+					fprintf (stderr, "Unable to copy %s: path too long\n", path);
+					return 1;
+				}
+
+				if (copy_file (path, new, statptr) == B_FALSE)
+				{
+					fprintf (stderr, "Unable to copy %s\n", path);
+					return 1;
+				}
+
+				printf ("Kept %s, the new version is %s.new\n", rel, rel);
+				return record_hash (rel, new, statptr) == B_TRUE ? 0 : 1;
+			}
+
+			if (exists == B_TRUE && replace_path (dest, &dst) == B_FALSE)
+				return 1;
+
+			trace = trace_sample ();
+			span = trace_start ();
+
+			if (copy_file (path, dest, statptr) == B_FALSE)
+			{
+				fprintf (stderr, "Unable to copy %s\n", path);
+				return 1;
+			}
+
+			if (trace == B_TRUE)
+				trace_end ("copy", dest, span);
+
+			upgrade_copied++;
+			upgrade_bytes += statptr->st_size;
+
+			if (record_hash (rel, dest, statptr) == B_FALSE)
+				return 1;
+
+			break;
+
+		case FTW_D:
+
+			if (exists == B_TRUE && S_ISDIR (dst.st_mode))
+				return fix_attrs (dest, statptr, &dst) == B_TRUE ? 0 : 1;
+
+			if (exists == B_TRUE && replace_path (dest, &dst) == B_FALSE)
+				return 1;
+
+			if (mkdir (dest, statptr->st_mode & 07777) == -1 ||
+			    chown (dest, statptr->st_uid, statptr->st_gid) == -1)
+			{
+				fprintf (stderr, "Unable to create directory %s: %s\n", dest, strerror (errno));
+				return 1;
+			}
+
+			break;
+
+		case FTW_SL:
+
+			if (exists == B_TRUE && symlink_unchanged (path, dest, &dst) == B_TRUE)
+			{
+				upgrade_unchanged++;
+				return fix_attrs (dest, statptr, &dst) == B_TRUE ? 0 : 1;
+			}
+
+			if (exists == B_TRUE && replace_path (dest, &dst) == B_FALSE)
+				return 1;
+
+			if (copy_symlink (AT_FDCWD, path, AT_FDCWD, dest) == B_FALSE)
+				return 1;
+
+			upgrade_copied++;
+			break;
+
+		default:
+			/*
+			 * Ignoring an error might result in an unbootable system!
+			 */
+			abort();
+	}
+
+	return 0;
+}
+
+static boolean_t
+phase_copy (void *arg)
+{
+	upgrade_job_t *uj = arg;
+
+	puts ("Copying changed files...");
+
+	if (realpath (cdrom_path, upgrade_base) == NULL)
+	{
+		perror ("Error: Unable to resolve cdrom path");
+		return B_FALSE;
+	}
+
+	upgrade_job = uj;
+	upgrade_copied = upgrade_bytes = upgrade_unchanged = upgrade_hashed = upgrade_kept = 0;
+
+	/*
+	 * Without records nothing can be told apart from the user's edits
+	 */
+	if ((uj->uj_installed = manifest_read (uj->uj_mnt)) == NULL)
+		fprintf (stderr, "Warning: %s has no manifest, changed files will be kept and the new "
+		    "versions written alongside as .new\n", uj->uj_old);
+
+	if (nftw (upgrade_base, upgrade_path, 16, FTW_PHYS) != 0)
+	{
+		fprintf (stderr, "Error: Unable to upgrade %s from %s\n", uj->uj_mnt, upgrade_base);
+		return B_FALSE;
+	}
+
+	manifest_sort (uj->uj_manifest);
+
+	printf ("Copied %llu files (%.1f MB), %llu unchanged", (unsigned long long) upgrade_copied,
+	    upgrade_bytes / (1024.0 * 1024), (unsigned long long) upgrade_unchanged);
+
+	if (upgrade_hash == B_TRUE)
+		printf (", %llu of them by hash", (unsigned long long) upgrade_hashed);
+
+	printf ("\n");
+
+	if (upgrade_kept > 0)
+		printf ("Kept %llu files edited since they were installed\n", (unsigned long long) upgrade_kept);
+
+	return B_TRUE;
+}
+
+/*
+ * Remove what the old livecd put there and the new one doesn't have.
+ * Only paths in the old manifest are touched, so anything the user
+ * added stays, and so do files they've edited and directories they've
+ * put files in.
+ */
+static boolean_t
+phase_prune (void *arg)
+{
+	upgrade_job_t *uj = arg;
+	manifest_t *old = uj->uj_installed;
+	char dest[PATH_MAX];
+	struct stat st;
+	int i;
+
+	if (old == NULL)
+		fprintf (stderr, "Warning: %s has no manifest, files removed from the livecd will be kept\n",
+		    uj->uj_old);
+	else
+	{
+		upgrade_removed = 0;
+
+		/*
+		 * Backwards, so directories are emptied before they're removed
+		 */
+		for (i = old->m_nentries - 1; i >= 0; i--)
+		{
+			if (manifest_find (uj->uj_manifest, old->m_entries[i].me_path) != NULL)
+				continue;
+
+			(void) snprintf (dest, PATH_MAX, "%s%s", uj->uj_mnt, old->m_entries[i].me_path);
+
+			if (lstat (dest, &st) == -1)
+				continue;
+
+			if (old->m_entries[i].me_file == B_TRUE &&
+			    file_edited (old->m_entries[i].me_path, dest, &st) == B_TRUE)
+			{
+				printf ("Kept %s, which is no longer on the livecd\n", old->m_entries[i].me_path);
+				continue;
+			}
+
+			if (S_ISDIR (st.st_mode))
+			{
+				if (rmdir (dest) == -1)
+				{
+					if (errno == EEXIST || errno == ENOTEMPTY)
+						continue;
+
+					fprintf (stderr, "Error: Unable to remove %s: %s\n", dest, strerror (errno));
+					return B_FALSE;
+				}
+			}
+			else if (unlink (dest) == -1)
+			{
+				fprintf (stderr, "Error: Unable to remove %s: %s\n", dest, strerror (errno));
+				return B_FALSE;
+			}
+
+			upgrade_removed++;
+		}
+
+		printf ("Removed %llu files\n", (unsigned long long) upgrade_removed);
+	}
+
+	return manifest_write (uj->uj_manifest, uj->uj_mnt);
+}
+
+static boolean_t
+phase_bootadm (void *arg)
+{
+	upgrade_job_t *uj = arg;
+
+	return config_bootadm (uj->uj_mnt);
+}
+
+static boolean_t
+phase_unmount (void *arg)
+{
+	upgrade_job_t *uj = arg;
+	zfs_handle_t *zfs_handle;
+	double span;
+	int ret;
+
+	printf ("Unmounting %s...\n", uj->uj_new);
+
+	if ((zfs_handle = zfs_open (uj->uj_libzfs, uj->uj_new, ZFS_TYPE_FILESYSTEM)) == NULL)
+	{
+		fprintf (stderr, "Error: Unable to open %s\n", uj->uj_new);
+		return B_FALSE;
+	}
+
+	span = trace_start ();
+	ret = zfs_unmount (zfs_handle, NULL, 0);
+	trace_end ("libzfs", "zfs_unmount", span);
+
+	zfs_close (zfs_handle);
+
+	if (ret != 0)
+	{
+		fprintf (stderr, "Error: Unable to unmount %s\n", uj->uj_new);
+		return B_FALSE;
+	}
+
+	return B_TRUE;
+}
+
+/*
+ * Give the new boot environment the root mountpoint and make it the
+ * one that boots.  The old one stops competing for / at boot.
+ */
+static boolean_t
+phase_activate (void *arg)
+{
+	upgrade_job_t *uj = arg;
+	zfs_handle_t *zfs_handle;
+	zpool_handle_t *zpool_handle;
+	double span;
+	int ret;
+
+	printf ("Activating %s...\n", uj->uj_new);
+
+	if ((zfs_handle = zfs_open (uj->uj_libzfs, uj->uj_new, ZFS_TYPE_FILESYSTEM)) == NULL)
+	{
+		fprintf (stderr, "Error: Unable to open %s\n", uj->uj_new);
+		return B_FALSE;
+	}
+
+	ret = zfs_prop_set (zfs_handle, zfs_prop_to_name (ZFS_PROP_MOUNTPOINT), "/");
+	zfs_close (zfs_handle);
+
+	if (ret != 0)
+	{
+		fprintf (stderr, "Error: Unable to set %s mountpoint\n", uj->uj_new);
+		return B_FALSE;
+	}
+
+	if ((zfs_handle = zfs_open (uj->uj_libzfs, uj->uj_old, ZFS_TYPE_FILESYSTEM)) == NULL)
+	{
+		fprintf (stderr, "Error: Unable to open %s\n", uj->uj_old);
+		return B_FALSE;
+	}
+
+	ret = zfs_prop_set (zfs_handle, zfs_prop_to_name (ZFS_PROP_CANMOUNT), "noauto");
+	zfs_close (zfs_handle);
+
+	if (ret != 0)
+	{
+		fprintf (stderr, "Error: Unable to set %s canmount\n", uj->uj_old);
+		return B_FALSE;
+	}
+
+	if ((zpool_handle = zpool_open (uj->uj_libzfs, uj->uj_rpool)) == NULL)
+	{
+		fprintf (stderr, "Error: Unable to open rpool\n");
+		return B_FALSE;
+	}
+
+	span = trace_start ();
+	ret = zpool_set_prop (zpool_handle, zpool_prop_to_name (ZPOOL_PROP_BOOTFS), uj->uj_new);
+	trace_end ("libzfs", "zpool_set_prop", span);
+
+	zpool_close (zpool_handle);
+
+	if (ret != 0)
+	{
+		fprintf (stderr, "Error: Unable to set rpool bootfs\n");
+		return B_FALSE;
+	}
+
+	return B_TRUE;
+}
+
+/*
+ * Destroy a dataset left behind by a failed upgrade
+ */
+static void
+destroy_dataset (libzfs_handle_t *libzfs_handle, char *name, boolean_t mounted)
+{
+	zfs_handle_t *zfs_handle;
+
+	if ((zfs_handle = zfs_open (libzfs_handle, name, ZFS_TYPE_DATASET)) == NULL)
+		return;
+
+	if (mounted == B_TRUE)
+		(void) zfs_unmount (zfs_handle, NULL, 0);
+
+	if (zfs_destroy (zfs_handle, B_FALSE) != 0)
+		fprintf (stderr, "Error: Unable to destroy %s\n", name);
+
+	zfs_close (zfs_handle);
+}
+
+static void
+add_step (sched_step_t *ss, char *name, boolean_t (*func) (void *), void *arg, int dep)
+{
+	ss->ss_name = name;
+	ss->ss_func = func;
+	ss->ss_arg = arg;
+	ss->ss_ndeps = dep == -1 ? 0 : 1;
+	ss->ss_deps[0] = dep;
+	ss->ss_always = B_FALSE;
+}
+
+/*
+ * Upgrade rpool's boot environment from the livecd.  The clone is
+ * mounted on mnt, under the pool's altroot if it has one.  With hash
+ * set files whose size matches but mtime doesn't are compared by
+ * content before being copied.  Files the user has edited since the
+ * livecd put them there, going by the size, mtime and hash recorded in
+ * the old manifest, are kept; if the livecd's version has changed too it
+ * is written next to them as <name>.new.  If anything fails before the new boot
+ * environment is activated it is destroyed again, along with its
+ * snapshot.
+ */
+boolean_t
+upgrade (libzfs_handle_t *libzfs_handle, char *rpool, char *mnt, boolean_t hash)
+{
+	sched_step_t steps[UP_COUNT];
+	upgrade_job_t uj;
+	boolean_t ret;
+
+	(void) memset (steps, 0, sizeof (steps));
+	(void) memset (&uj, 0, sizeof (uj));
+
+	uj.uj_libzfs = libzfs_handle;
+	uj.uj_rpool = rpool;
+	uj.uj_temp = mnt;
+	upgrade_hash = hash;
+
+	if (find_boot_envs (&uj) == B_FALSE || (uj.uj_manifest = manifest_alloc ()) == NULL)
+		return B_FALSE;
+
+	printf ("Upgrading %s to %s\n", uj.uj_old, uj.uj_new);
+
+	add_step (&steps[UP_SNAPSHOT], "snapshot", phase_snapshot, &uj, -1);
+	add_step (&steps[UP_CLONE], "clone", phase_clone, &uj, UP_SNAPSHOT);
+	add_step (&steps[UP_MOUNT], "mount", phase_mount, &uj, UP_CLONE);
+	add_step (&steps[UP_COPY], "copy", phase_copy, &uj, UP_MOUNT);
+	add_step (&steps[UP_PRUNE], "prune", phase_prune, &uj, UP_COPY);
+	add_step (&steps[UP_BOOTADM], "bootadm", phase_bootadm, &uj, UP_PRUNE);
+	add_step (&steps[UP_UNMOUNT], "unmount", phase_unmount, &uj, UP_BOOTADM);
+	add_step (&steps[UP_ACTIVATE], "activate", phase_activate, &uj, UP_UNMOUNT);
+
+	ret = sched_run (steps, UP_COUNT);
+
+	puts ("Upgrade phases:");
+	sched_report (steps, UP_COUNT);
+
+	if (ret == B_FALSE)
+	{
+		if (steps[UP_CLONE].ss_state == SCHED_DONE)
+			destroy_dataset (libzfs_handle, uj.uj_new,
+			    steps[UP_MOUNT].ss_state == SCHED_DONE && steps[UP_UNMOUNT].ss_state != SCHED_DONE);
+
+		if (steps[UP_SNAPSHOT].ss_state == SCHED_DONE)
+			destroy_dataset (libzfs_handle, uj.uj_snap, B_FALSE);
+	}
+
+	manifest_free (uj.uj_manifest);
+
+	if (uj.uj_installed != NULL)
+		manifest_free (uj.uj_installed);
+
+	return ret;
+}